@@ -15,6 +15,7 @@
 #cmakedefine HAVE_SYS_TIMERFD_H 1
 #cmakedefine HAVE_GNU_LIB_NAMES_H 1
 #cmakedefine HAVE_RPC_RPC_H 1
+#cmakedefine HAVE_SYS_RANDOM_H 1
 
 /**************************** STRUCTS ****************************/
 
@@ -44,6 +45,16 @@
 #cmakedefine HAVE_GETPROGNAME 1
 #cmakedefine HAVE_GETEXECNAME 1
 #cmakedefine HAVE_PLEDGE 1
+/* Since glibc 2.25, without it the uuids are read from /dev/urandom */
+#cmakedefine HAVE_GETRANDOM 1
+/* Since glibc 2.34 */
+#cmakedefine HAVE_CLOSE_RANGE 1
+#cmakedefine HAVE_CLOSEFROM 1
+#cmakedefine HAVE_FTS64 1
+/* stat(), lstat(), fstatat() and their 64 bit variants are exported by libc.so,
+ * since glibc 2.33, before only __xstat() and friends were */
+#cmakedefine HAVE_STAT 1
+#cmakedefine HAVE_STATX 1
 
 #cmakedefine HAVE_ACCEPT_PSOCKLEN_T 1
 #cmakedefine HAVE_IOCTL_INT 1
@@ -1,18 +1,52 @@
 
 #define _GNU_SOURCE
+#include <features.h>
 #define HAVE_GETTIMEOFDAY_TZ_VOID
 #define HAVE_PROGRAM_INVOCATION_SHORT_NAME
 #define HAVE_OPEN64
 #define HAVE_FOPEN64
+#define HAVE_STAT64
 #define HAVE_CONSTRUCTOR_ATTRIBUTE
 #define HAVE_DESTRUCTOR_ATTRIBUTE
+#define HAVE_GCC_THREAD_LOCAL_STORAGE
+/*
+ * The functions config.h.cmake checks libc.so for, by the glibc version the
+ * Makefile build compiles against.
+ */
+#if __GLIBC_PREREQ(2, 25)
+#define HAVE_SYS_RANDOM_H
+#define HAVE_GETRANDOM
+#endif
+#if __GLIBC_PREREQ(2, 34)
+#define HAVE_CLOSE_RANGE
+#define HAVE_CLOSEFROM
+#define HAVE_FTS64
+#endif
+/* Before 2.33 stat() and friends were inline wrappers of __xstat() and friends */
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_STAT
+#endif
+#if __GLIBC_PREREQ(2, 28)
+#define HAVE_STATX
+#endif
 
 
 #define INTERCEPT_OPEN
 #define INTERCEPT_OPEN64
-#define INTERVEPT_OPENAT
+#define INTERCEPT_OPENAT
 #define INTERCEPT_FOPEN
 #define INTERCEPT_FOPEN64
+#define INTERCEPT_CLOSE
+#define INTERCEPT_FCLOSE
+#define INTERCEPT_CLOSEDIR
+#define INTERCEPT_DUP
+#define INTERCEPT_STAT
+#define INTERCEPT_XSTAT
+#ifdef HAVE_STATX
+#define INTERCEPT_STATX
+#endif
+#define INTERCEPT_ACCESS
+#define INTERCEPT_OPENDIR
 #define INTERCEPT_SYMLINK
 #define INTERCEPT_SYMLINKAT
 #define INTERCEPT_LINK
@@ -22,6 +56,10 @@
 #define INTERCEPT_CHMOD
 #define INTERCEPT_FCHMOD
 #define INTERCEPT_FCHMODAT
+#define INTERCEPT_CHDIR
+#define INTERCEPT_FCHDIR
+#define INTERCEPT_NFTW
+#define INTERCEPT_FTS
 #define INTERCEPT_EXECVE
 #define INTERCEPT_EXECV
 #define INTERCEPT_EXECVP
@@ -33,3 +71,4 @@
 #define INTERCEPT_EXECVEAT
 #define INTERCEPT_POSIX_SPAWN
 #define INTERCEPT_POSIX_SPAWNP
+#define INTERCEPT_EXIT
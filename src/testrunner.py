@@ -3,12 +3,10 @@ import os
 import subprocess
 import threading
 from common import env
+import wisktrack
 
 log = logging.getLogger(__name__)  # pylint: disable=locally-disabled, invalid-name
 
-WISK_TRACKER_PIPE='/tmp/wisk_tracker.pipe'
-WISK_TRACKER_UUID='XXXXXXXX-XXXXXXXX-XXXXXXXX'
-
 
 class TrackedRunner(object):
     def __init__(self, args):
@@ -25,8 +23,9 @@ class TrackedRunner(object):
             'WISK_TRACKER_PIPE_FD': '-1',
             'WISK_TRACKER_DEBUGLOG': "%s.log" % args.test_id,
             'WISK_TRACKER_DEBUGLOG_FD': "-1",
-            'WISK_TRACKER_PIPE': WISK_TRACKER_PIPE,
-            'WISK_TRACKER_UUID': WISK_TRACKER_UUID,
+            # The session wisktrack.create_reciever() started
+            'WISK_TRACKER_PIPE': wisktrack.WISK_TRACKER_PIPE,
+            'WISK_TRACKER_UUID': wisktrack.session_uuid(),
             'WISK_TRACKER_DEBUGLEVEL': ('%d' % (self.wisk_verbosity))})
         open(self.cmdenv['WISK_TRACKER_DEBUGLOG'], 'w').close()
         print(self.cmdenv)
@@ -0,0 +1,1117 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2019-2020, Sarvi Shanmugham <sarvi@cisco.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+   WISK Collector. Drains the FIFO shards libwisktrack.so writes its records
+   to, WISK_TRACKER_PIPE_SHARDS, with epoll and appends what it reads to the
+   raw trace through a large buffer.
+
+   wiskcollect [-i seconds] [-z level] [-O <overflow dir>] -o <rawfile> <fifo>...
+   wiskcollect [-i seconds] -s <control fifo>
+
+   A tracked process writes whole batches of whole records, each at most
+   PIPE_BUF and so atomic, and a read takes everything buffered in a pipe, so
+   the raw trace is a sequence of whole batches whatever the shards. A FIFO
+   signals the end of its last writer with EPOLLHUP, it is then reopened for
+   the next process to connect to.
+
+   Closing stdin, or SIGTERM, tells the collector the tracked command is done.
+   It exits once every shard is drained and has no writer left, the processes
+   the command left running keep being collected until then. Counters for
+   records and bytes, in total and per second, are printed to stderr every
+   -i seconds and at exit.
+
+   With -s one collector serves the sessions of any number of wisktrack runs
+   on the host, each with FIFOs and a raw trace of its own. A session is
+   started and ended with tab separated lines written to the control FIFO,
+   each in a single write:
+     open     <session> <level> <rawfile> <status fifo> <fifo>...
+     overflow <session> <overflow dir>
+     close    <session>
+   The collector answers "ok" or "error <reason>" on the status FIFO, which
+   the session opened for reading beforehand, and closes it once the raw
+   trace of the session is complete, the session waits for that EOF. A level
+   of -1 writes the trace uncompressed. Closing stdin, or SIGTERM, stops the
+   collector once the open sessions are closed and drained.
+
+   The collector creates the raw traces of its sessions with its own
+   credentials, so whoever can write the control FIFO can have it create
+   files. Make the FIFO mode 0620, or 0600 for a collector of your own, with
+   the group of the users sharing the collector, never writable by others.
+   The raw trace of a session must not exist yet, it is created with
+   O_EXCL and so never truncates, or follows a link to, a file already
+   there. The session removes a trace left by an earlier run beforehand.
+
+   A tracked process that finds its FIFO full does not wait for the
+   collector, with WISK_TRACKER_OVERFLOW it appends that batch and all it
+   writes after it to a file of its own in the overflow directory, -O or the
+   overflow request. Once its shards are drained the session appends those
+   files to the trace, in name order, and removes them and the directory.
+   The records of a process stay in order, what it wrote to the FIFO comes
+   first.
+
+   With -z the raw trace is written as independently decodable zlib blocks
+   of WISK_BLOCK_SIZE, the last one shorter, followed by an index of them,
+   so the parser can decompress them in parallel. Shared with RawBlockReader in wisktrack.py:
+     block:   magic "WZB1", compressed length, length        (3 x u32)
+              the zlib stream
+     index:   offset (u64), compressed length, length (u32)  per block
+     trailer: magic "WZI1", block count (u32), index offset (u64)
+   A trace cut short has no index, the blocks still are found by walking
+   their headers.
+
+   A process reports what it reads beneath an immutable root of the path
+   filter as a single USES of the root. The first USES of a root in a
+   session has a child of the collector fingerprint the tree, so the build
+   goes on being drained meanwhile: a 64 bit FNV-1a hash of a line
+     <path relative to the root>\t<mode, octal>\t<size>\t<mtime, seconds>[\t<link target>]\n
+   for every entry, walked depth first in strcmp() order, lstat() and not
+   following links, as fingerprint_root() in wisktrack.py. It is added to the
+   trace as the text record of the session's root
+     FINGERPRINT ["<root>", "<hash, 16 hex digits>", "<entries>", "<bytes of the regular files>"]
+   and the session is complete once its fingerprints are.
+*/
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <zlib.h>
+
+#define WISK_RECORD_MAGIC 0xB7
+#define WISK_RECORD_HEADER_SIZE 44
+#define WISK_RECORD_LEN_OFFSET 4
+#define WISK_RECORD_OP_OFFSET 2
+#define WISK_RECORD_FLAGS_OFFSET 3
+#define WISK_RECORD_MORE 0x02
+#define WISK_OP_USES 18
+#define WISK_USES_SIZE (PATH_MAX + 128)
+#define WISK_READ_SIZE (1 << 20)
+#define WISK_OUT_SIZE (8 << 20)
+#define WISK_STOP_POLL_MSEC 10
+#define WISK_MAX_EVENTS 64
+#define WISK_BLOCK_SIZE (1 << 20)
+#define WISK_BLOCK_MAGIC "WZB1"
+#define WISK_INDEX_MAGIC "WZI1"
+#define WISK_CONTROL_ARGS 64
+
+#define WISK_LOG(fmt, ...) \
+	fprintf(stderr, "wiskcollect[%d] %s: " fmt "\n", getpid(), __func__, ##__VA_ARGS__)
+
+/* Where a shard is in the record stream, records may straddle reads */
+enum wisk_scan_e {
+	WISK_SCAN_START,
+	WISK_SCAN_LINE,
+	WISK_SCAN_HEADER,
+	WISK_SCAN_PAYLOAD
+};
+
+struct wisk_session;
+
+struct wisk_channel {
+	struct wisk_session *session;
+	char *path;
+	int fd;
+	enum wisk_scan_e scan;
+	unsigned char hdr[WISK_RECORD_HEADER_SIZE];
+	size_t hdrlen;
+	size_t skip;
+	// The record being read while it may still be a USES
+	bool capture;
+	size_t reclen;
+	char rec[WISK_USES_SIZE];
+	uint64_t records;
+	uint64_t bytes;
+	unsigned int writers;
+};
+
+struct wisk_block_index {
+	uint64_t offset;
+	uint32_t clen;
+	uint32_t len;
+};
+
+/* A root the processes of a session USES, channel from the child fingerprinting it */
+struct wisk_root {
+	struct wisk_root *next;
+	char *path;
+	struct wisk_channel ch;
+};
+
+/* A raw trace and the shards feeding it */
+struct wisk_session {
+	struct wisk_session *next;
+	char *name;
+	char *output;
+	int out;
+	int status;
+	int zlevel;
+	bool stopping;
+	char *outbuf;
+	size_t outlen;
+	uint64_t out_offset;
+	struct wisk_block_index *index;
+	size_t index_count, index_size;
+	struct wisk_channel *channels;
+	int count;
+	struct wisk_root *roots;
+	// The overflow directory, its files are read through spill
+	char *overflow;
+	bool merged;
+	struct wisk_channel spill;
+	double start;
+	uint64_t records, bytes;
+};
+
+/* The control FIFO of -s, lines may straddle reads */
+struct wisk_control {
+	const char *path;
+	int fd;
+	char buf[2 * PIPE_BUF];
+	size_t len;
+};
+
+static int wisk_epoll = -1;
+static char *wisk_zbuf;
+static struct wisk_session *wisk_sessions;
+
+struct wisk_block_hdr {
+	char magic[4];
+	uint32_t clen;
+	uint32_t len;
+};
+
+struct wisk_index_trailer {
+	char magic[4];
+	uint32_t count;
+	uint64_t offset;
+};
+
+struct wisk_fingerprint {
+	uint64_t hash;
+	uint64_t entries;
+	uint64_t bytes;
+};
+
+static int wisk_name_cmp(const struct dirent **a, const struct dirent **b)
+{
+	return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/* FNV-1a */
+static uint64_t wisk_fnv(uint64_t h, const char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)buf[i]) * 1099511628211ULL;
+	return h;
+}
+
+/* Adds the entries beneath root, rel is "" or the '/' led path of a directory in it */
+static void wisk_fingerprint_dir(struct wisk_fingerprint *fp, const char *root, const char *rel)
+{
+	char path[PATH_MAX], sub[PATH_MAX], target[PATH_MAX], line[2 * PATH_MAX + 64];
+	struct dirent **names;
+	struct stat st;
+	ssize_t tlen;
+	int n, i, len;
+
+	snprintf(path, sizeof(path), "%s%s", root, rel);
+	n = scandir(path, &names, NULL, wisk_name_cmp);
+	if (n < 0)
+		return;
+	for (i = 0; i < n; i++) {
+		if (strcmp(names[i]->d_name, ".") == 0 || strcmp(names[i]->d_name, "..") == 0 ||
+		    snprintf(sub, sizeof(sub), "%s/%s", rel, names[i]->d_name) >= (int)sizeof(sub) ||
+		    snprintf(path, sizeof(path), "%s%s", root, sub) >= (int)sizeof(path) || lstat(path, &st) != 0) {
+			free(names[i]);
+			continue;
+		}
+		free(names[i]);
+		len = snprintf(line, sizeof(line), "%s\t%o\t%lld\t%lld", sub + 1, (unsigned int)st.st_mode,
+			       (long long)st.st_size, (long long)st.st_mtime);
+		if (S_ISLNK(st.st_mode) && (tlen = readlink(path, target, sizeof(target) - 1)) >= 0)
+			len += snprintf(line + len, sizeof(line) - len, "\t%.*s", (int)tlen, target);
+		line[len++] = '\n';
+		fp->hash = wisk_fnv(fp->hash, line, len);
+		fp->entries++;
+		if (S_ISREG(st.st_mode))
+			fp->bytes += st.st_size;
+		else if (S_ISDIR(st.st_mode))
+			wisk_fingerprint_dir(fp, root, sub);
+	}
+	free(names);
+}
+
+/* In the child, the FINGERPRINT record of root goes to fd in a single write */
+static void wisk_fingerprint(const char *session, const char *root, int fd)
+{
+	struct wisk_fingerprint fp = { 14695981039346656037ULL, 0, 0 };
+	char line[PIPE_BUF], *d, *end = line + sizeof(line) - 128;
+	const char *c;
+
+	wisk_fingerprint_dir(&fp, root, "");
+	d = line + snprintf(line, sizeof(line), "%s-XXXXXXXX-XXXXXXXX-XXXXXXXX@%d.0:0 FINGERPRINT [\"",
+			    session[0] ? session : "XXXXXXXX", (int)getpid());
+	for (c = root; *c && d < end; c++) {
+		if ((unsigned char)*c < 0x20) {
+			d += sprintf(d, "\\u%04x", (unsigned char)*c);
+			continue;
+		}
+		if (*c == '"' || *c == '\\')
+			*d++ = '\\';
+		*d++ = *c;
+	}
+	if (*c) {
+		WISK_LOG("Root %s is too long for a record", root);
+		return;
+	}
+	d += snprintf(d, line + sizeof(line) - d, "\", \"%016llx\", \"%llu\", \"%llu\"]\n", (unsigned long long)fp.hash,
+		      (unsigned long long)fp.entries, (unsigned long long)fp.bytes);
+	if (write(fd, line, d - line) < 0)
+		WISK_LOG("Fingerprint of %s lost: %s", root, strerror(errno));
+}
+
+/* The child keeps none of the FIFOs, nor the status of any session, open */
+static void wisk_close_fds(int keep)
+{
+	struct dirent *e;
+	DIR *dir;
+	int fd;
+
+	dir = opendir("/proc/self/fd");
+	if (dir == NULL)
+		return;
+	while ((e = readdir(dir)) != NULL) {
+		fd = atoi(e->d_name);
+		if (fd > STDERR_FILENO && fd != keep && fd != dirfd(dir))
+			close(fd);
+	}
+	closedir(dir);
+}
+
+/* The first USES of root in the session starts a child fingerprinting it */
+static void wisk_root_use(struct wisk_session *s, const char *path)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct wisk_root *r;
+	int fds[2];
+	pid_t pid;
+
+	for (r = s->roots; r; r = r->next) {
+		if (strcmp(r->path, path) == 0)
+			return;
+	}
+	r = calloc(1, sizeof(*r));
+	if (r == NULL || (r->path = strdup(path)) == NULL) {
+		WISK_LOG("Out of memory for root %s", path);
+		free(r);
+		return;
+	}
+	r->ch.session = s;
+	r->ch.fd = -1;
+	r->next = s->roots;
+	s->roots = r;
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		WISK_LOG("Cannot fingerprint %s: %s", path, strerror(errno));
+		return;
+	}
+	pid = fork();
+	if (pid == 0) {
+		wisk_close_fds(fds[1]);
+		wisk_fingerprint(s->name, path, fds[1]);
+		_exit(0);
+	}
+	close(fds[1]);
+	ev.data.ptr = &r->ch;
+	if (pid < 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 || epoll_ctl(wisk_epoll, EPOLL_CTL_ADD, fds[0], &ev) < 0) {
+		WISK_LOG("Cannot fingerprint %s: %s", path, strerror(errno));
+		close(fds[0]);
+		return;
+	}
+	r->ch.fd = fds[0];
+}
+
+/* The value of the 4 hex digits at s, as a \\u escape carries them */
+static bool wisk_hex4(const char *s, const char *end, unsigned int *value)
+{
+	int i;
+
+	if (end - s < 4)
+		return false;
+	for (*value = 0, i = 0; i < 4; i++) {
+		if (!isxdigit((unsigned char)s[i]))
+			return false;
+		*value = *value << 4 | (isdigit((unsigned char)s[i]) ? s[i] - '0' : (tolower((unsigned char)s[i]) - 'a' + 10));
+	}
+	return true;
+}
+
+/* Writes code point c at d in UTF-8, returns the end of it */
+static char *wisk_utf8(char *d, unsigned int c)
+{
+	if (c < 0x80) {
+		*d++ = c;
+	} else if (c < 0x800) {
+		*d++ = 0xC0 | c >> 6;
+		*d++ = 0x80 | (c & 0x3F);
+	} else if (c < 0x10000) {
+		*d++ = 0xE0 | c >> 12;
+		*d++ = 0x80 | (c >> 6 & 0x3F);
+		*d++ = 0x80 | (c & 0x3F);
+	} else {
+		*d++ = 0xF0 | c >> 18;
+		*d++ = 0x80 | (c >> 12 & 0x3F);
+		*d++ = 0x80 | (c >> 6 & 0x3F);
+		*d++ = 0x80 | (c & 0x3F);
+	}
+	return d;
+}
+
+/* A text record held in rec, <uuid>@<frame> USES "<root>\n", the root is unescaped in place */
+static void wisk_uses_text(struct wisk_channel *ch)
+{
+	static const char from[] = "abfnrtv", to[] = "\a\b\f\n\r\t\v";
+	char *s, *d, *end = ch->rec + ch->reclen;
+	const char *e;
+	unsigned int c, lo;
+
+	s = memchr(ch->rec, ' ', ch->reclen);
+	if (s == NULL || end - s < 8 || memcmp(s, " USES \"", 7) != 0)
+		return;
+	for (s += 7, d = ch->rec; s < end && *s != '"'; s++) {
+		if (*s == '\\' && s + 1 < end && s[1] == 'u' && wisk_hex4(s + 2, end, &c)) {
+			s += 5;
+			// A surrogate pair is one code point, the decoded bytes never outgrow the escape
+			if (c >= 0xD800 && c < 0xDC00 && end - s > 6 && s[1] == '\\' && s[2] == 'u' &&
+			    wisk_hex4(s + 3, end, &lo) && lo >= 0xDC00 && lo < 0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+				s += 6;
+			}
+			d = wisk_utf8(d, c);
+		} else if (*s == '\\' && s + 1 < end) {
+			s++;
+			e = strchr(from, *s);
+			*d++ = e && *s ? to[e - from] : *s;
+		} else {
+			*d++ = *s;
+		}
+	}
+	if (s == end)
+		return;
+	*d = '\0';
+	wisk_root_use(ch->session, ch->rec);
+}
+
+/* Keeps the next len bytes of the record in rec, while it fits */
+static void wisk_capture(struct wisk_channel *ch, const unsigned char *buf, size_t len)
+{
+	if (!ch->capture)
+		return;
+	if (len > sizeof(ch->rec) - ch->reclen) {
+		ch->capture = false;
+		return;
+	}
+	memcpy(ch->rec + ch->reclen, buf, len);
+	ch->reclen += len;
+}
+
+/*
+ * Keeps a piece of a text line while it may be a USES. The operation follows
+ * the first space, the line is dropped as soon as that is in and is not USES.
+ */
+static void wisk_capture_line(struct wisk_channel *ch, const unsigned char *buf, size_t len)
+{
+	const char *s;
+
+	if (ch->reclen == 0 && (s = memchr(buf, ' ', len)) != NULL && (const unsigned char *)s + 6 <= buf + len)
+		ch->capture = memcmp(s, " USES ", 6) == 0;
+	wisk_capture(ch, buf, len);
+	// The line came in pieces, its operation may only be in now
+	if (ch->capture && (s = memchr(ch->rec, ' ', ch->reclen)) != NULL && s + 6 <= ch->rec + ch->reclen)
+		ch->capture = memcmp(s, " USES ", 6) == 0;
+}
+
+/*
+ * A record starts with the binary magic, or is a text line. The records that
+ * may be a USES are held on to, the collector acts on those.
+ */
+static void wisk_count(struct wisk_channel *ch, const unsigned char *buf, size_t len)
+{
+	const unsigned char *nl;
+	uint32_t reclen;
+	size_t n;
+
+	while (len > 0) {
+		switch (ch->scan) {
+		case WISK_SCAN_START:
+			ch->records++;
+			ch->scan = buf[0] == WISK_RECORD_MAGIC ? WISK_SCAN_HEADER : WISK_SCAN_LINE;
+			ch->hdrlen = 0;
+			ch->capture = ch->scan == WISK_SCAN_LINE;
+			ch->reclen = 0;
+			break;
+		case WISK_SCAN_LINE:
+			nl = memchr(buf, '\n', len);
+			n = nl ? (size_t)(nl - buf + 1) : len;
+			wisk_capture_line(ch, buf, n);
+			buf += n;
+			len -= n;
+			if (nl == NULL)
+				return;
+			if (ch->capture)
+				wisk_uses_text(ch);
+			ch->scan = WISK_SCAN_START;
+			break;
+		case WISK_SCAN_HEADER:
+			n = WISK_RECORD_HEADER_SIZE - ch->hdrlen;
+			n = n < len ? n : len;
+			memcpy(ch->hdr + ch->hdrlen, buf, n);
+			ch->hdrlen += n;
+			buf += n;
+			len -= n;
+			if (ch->hdrlen < WISK_RECORD_HEADER_SIZE)
+				return;
+			memcpy(&reclen, ch->hdr + WISK_RECORD_LEN_OFFSET, sizeof(reclen));
+			ch->skip = reclen;
+			ch->scan = reclen ? WISK_SCAN_PAYLOAD : WISK_SCAN_START;
+			ch->capture = ch->hdr[WISK_RECORD_OP_OFFSET] == WISK_OP_USES &&
+				      !(ch->hdr[WISK_RECORD_FLAGS_OFFSET] & WISK_RECORD_MORE);
+			break;
+		case WISK_SCAN_PAYLOAD:
+			n = ch->skip < len ? ch->skip : len;
+			wisk_capture(ch, buf, n);
+			ch->skip -= n;
+			buf += n;
+			len -= n;
+			if (ch->skip)
+				break;
+			// The payload of a USES is the root and its '\0'
+			if (ch->capture && ch->rec[ch->reclen - 1] == '\0')
+				wisk_root_use(ch->session, ch->rec);
+			ch->scan = WISK_SCAN_START;
+			break;
+		}
+	}
+}
+
+static void wisk_write(struct wisk_session *s, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(s->out, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			WISK_LOG("Raw trace %s write failed: %s", s->output, strerror(errno));
+			exit(1);
+		}
+		buf += n;
+		len -= n;
+		s->out_offset += n;
+	}
+}
+
+static void wisk_write_block(struct wisk_session *s, const char *buf, size_t len)
+{
+	struct wisk_block_hdr *hdr = (struct wisk_block_hdr *)wisk_zbuf;
+	uLongf clen = compressBound(WISK_BLOCK_SIZE);
+
+	if (compress2((Bytef *)(hdr + 1), &clen, (const Bytef *)buf, len, s->zlevel) != Z_OK) {
+		WISK_LOG("Raw trace compression failed");
+		exit(1);
+	}
+	memcpy(hdr->magic, WISK_BLOCK_MAGIC, sizeof(hdr->magic));
+	hdr->clen = clen;
+	hdr->len = len;
+	if (s->index_count == s->index_size) {
+		s->index_size = s->index_size ? s->index_size * 2 : 1024;
+		s->index = realloc(s->index, s->index_size * sizeof(*s->index));
+		if (s->index == NULL) {
+			WISK_LOG("Out of memory for the block index");
+			exit(1);
+		}
+	}
+	s->index[s->index_count++] = (struct wisk_block_index){ s->out_offset, clen, len };
+	wisk_write(s, wisk_zbuf, sizeof(*hdr) + clen);
+}
+
+static void wisk_write_index(struct wisk_session *s)
+{
+	struct wisk_index_trailer trailer = { WISK_INDEX_MAGIC, s->index_count, s->out_offset };
+
+	wisk_write(s, (const char *)s->index, s->index_count * sizeof(*s->index));
+	wisk_write(s, (const char *)&trailer, sizeof(trailer));
+}
+
+/*
+ * Compressed, only whole blocks are written, what is left of one waits in
+ * the buffer for more until the final flush of the session
+ */
+static void wisk_flush(struct wisk_session *s, bool final)
+{
+	size_t off, n;
+
+	if (s->zlevel < 0) {
+		wisk_write(s, s->outbuf, s->outlen);
+		s->outlen = 0;
+		return;
+	}
+	for (off = 0; off < s->outlen; off += n) {
+		n = s->outlen - off < WISK_BLOCK_SIZE ? s->outlen - off : WISK_BLOCK_SIZE;
+		if (n < WISK_BLOCK_SIZE && !final)
+			break;
+		wisk_write_block(s, s->outbuf + off, n);
+	}
+	memmove(s->outbuf, s->outbuf + off, s->outlen - off);
+	s->outlen -= off;
+}
+
+/* Opened non blocking, a reader does not wait for the first writer */
+static int wisk_open_polled(const char *path, void *ptr)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = ptr };
+	int fd;
+
+	fd = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	if (fd < 0) {
+		WISK_LOG("Cannot open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (epoll_ctl(wisk_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		WISK_LOG("Cannot poll %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Reads everything buffered in the pipe, returns false once there is no
+ * writer left and nothing more to read.
+ */
+static bool wisk_channel_drain(struct wisk_channel *ch)
+{
+	struct wisk_session *s = ch->session;
+	ssize_t n;
+
+	while (true) {
+		if (WISK_OUT_SIZE - s->outlen < WISK_READ_SIZE)
+			wisk_flush(s, false);
+		n = read(ch->fd, s->outbuf + s->outlen, WISK_READ_SIZE);
+		if (n > 0) {
+			wisk_count(ch, (unsigned char *)s->outbuf + s->outlen, n);
+			s->outlen += n;
+			ch->bytes += n;
+			continue;
+		}
+		if (n == 0)
+			return false;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			WISK_LOG("Read from %s failed: %s", ch->path, strerror(errno));
+		return true;
+	}
+}
+
+/*
+ * The last writer is gone. The new reader is opened before the old one is
+ * closed, so the FIFO never is without a reader and a process connecting in
+ * between neither blocks nor loses what it wrote.
+ */
+static void wisk_channel_reopen(struct wisk_channel *ch)
+{
+	int fd;
+
+	// The pipe from the child fingerprinting a root has no path, it is done
+	if (ch->path == NULL) {
+		epoll_ctl(wisk_epoll, EPOLL_CTL_DEL, ch->fd, NULL);
+		close(ch->fd);
+		ch->fd = -1;
+		return;
+	}
+	ch->writers++;
+	fd = wisk_open_polled(ch->path, ch);
+	if (fd < 0)
+		return;
+	wisk_channel_drain(ch);
+	epoll_ctl(wisk_epoll, EPOLL_CTL_DEL, ch->fd, NULL);
+	close(ch->fd);
+	ch->fd = fd;
+}
+
+/*
+ * Appends the overflow files of the session to the trace, the records they
+ * hold are counted, and acted on, as those of a shard.
+ */
+static void wisk_overflow_merge(struct wisk_session *s)
+{
+	struct dirent **names;
+	char path[PATH_MAX];
+	int i, n;
+
+	s->merged = true;
+	n = scandir(s->overflow, &names, NULL, wisk_name_cmp);
+	if (n < 0) {
+		if (errno != ENOENT)
+			WISK_LOG("Cannot read overflow %s: %s", s->overflow, strerror(errno));
+		return;
+	}
+	s->spill.session = s;
+	s->spill.path = path;
+	for (i = 0; i < n; i++) {
+		if (names[i]->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", s->overflow, names[i]->d_name);
+			s->spill.fd = open(path, O_RDONLY|O_CLOEXEC);
+			if (s->spill.fd < 0) {
+				WISK_LOG("Cannot open %s: %s", path, strerror(errno));
+			} else {
+				s->spill.scan = WISK_SCAN_START;
+				wisk_channel_drain(&s->spill);
+				close(s->spill.fd);
+				s->spill.writers++;
+				unlink(path);
+			}
+		}
+		free(names[i]);
+	}
+	free(names);
+	s->spill.fd = -1;
+	s->spill.path = NULL;
+	if (rmdir(s->overflow) < 0)
+		WISK_LOG("Cannot remove overflow %s: %s", s->overflow, strerror(errno));
+}
+
+static double wisk_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wisk_stats(struct wisk_session *s, double elapsed, double interval, bool final)
+{
+	uint64_t records = 0, bytes = 0;
+	int i;
+
+	for (i = 0; i < s->count; i++) {
+		records += s->channels[i].records;
+		bytes += s->channels[i].bytes;
+	}
+	records += s->spill.records;
+	bytes += s->spill.bytes;
+	fprintf(stderr, "wiskcollect: %s%s%llu records, %llu bytes, %.0f records/s, %.2f MB/s\n",
+		s->name, s->name[0] ? ": " : "", (unsigned long long)records, (unsigned long long)bytes,
+		(records - s->records) / interval, (bytes - s->bytes) / interval / (1 << 20));
+	s->records = records;
+	s->bytes = bytes;
+	if (!final)
+		return;
+	fprintf(stderr, "wiskcollect: %s%s%.1f seconds, %d shards\n", s->name, s->name[0] ? ": " : "", elapsed, s->count);
+	for (i = 0; i < s->count; i++)
+		fprintf(stderr, "wiskcollect:   %s: %llu records, %llu bytes, %u writer sessions\n",
+			s->channels[i].path, (unsigned long long)s->channels[i].records,
+			(unsigned long long)s->channels[i].bytes, s->channels[i].writers);
+	if (s->spill.writers)
+		fprintf(stderr, "wiskcollect:   %s: %llu records, %llu bytes, %u overflow files\n",
+			s->overflow, (unsigned long long)s->spill.records,
+			(unsigned long long)s->spill.bytes, s->spill.writers);
+}
+
+/* Tells the wisktrack run of the session, a write to a FIFO it has gone from is dropped */
+static void wisk_session_reply(struct wisk_session *s, const char *reply)
+{
+	if (s->status >= 0 && write(s->status, reply, strlen(reply)) < 0)
+		WISK_LOG("Session %s gone: %s", s->name, strerror(errno));
+}
+
+/* Writes out, and frees, the session once its shards are drained */
+static void wisk_session_close(struct wisk_session *s)
+{
+	struct wisk_session **p;
+	struct wisk_root *r;
+	double now = wisk_now();
+	int i;
+
+	if (s->out >= 0) {
+		wisk_flush(s, true);
+		if (s->zlevel >= 0)
+			wisk_write_index(s);
+		close(s->out);
+		s->records = s->bytes = 0;
+		wisk_stats(s, now - s->start, now - s->start > 0 ? now - s->start : 1, true);
+	}
+	for (i = 0; i < s->count; i++) {
+		if (s->channels[i].fd >= 0) {
+			epoll_ctl(wisk_epoll, EPOLL_CTL_DEL, s->channels[i].fd, NULL);
+			close(s->channels[i].fd);
+		}
+		free(s->channels[i].path);
+	}
+	while ((r = s->roots) != NULL) {
+		s->roots = r->next;
+		if (r->ch.fd >= 0) {
+			epoll_ctl(wisk_epoll, EPOLL_CTL_DEL, r->ch.fd, NULL);
+			close(r->ch.fd);
+		}
+		free(r->path);
+		free(r);
+	}
+	if (s->status >= 0)
+		close(s->status);
+	for (p = &wisk_sessions; *p; p = &(*p)->next) {
+		if (*p == s) {
+			*p = s->next;
+			break;
+		}
+	}
+	free(s->channels);
+	free(s->outbuf);
+	free(s->index);
+	free(s->overflow);
+	free(s->output);
+	free(s->name);
+	free(s);
+}
+
+/*
+ * A session writing output from the given shards, answered on the status
+ * FIFO when there is one. NULL if it cannot be set up, the reason is logged
+ * and sent back.
+ */
+static struct wisk_session *wisk_session_open(const char *name, int zlevel, const char *output,
+					      const char *status, char *const paths[], int count)
+{
+	struct wisk_session *s;
+	char reply[PATH_MAX + 64];
+	int i;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return NULL;
+	s->out = s->status = s->spill.fd = -1;
+	s->zlevel = zlevel;
+	s->start = wisk_now();
+	s->name = strdup(name);
+	s->output = strdup(output);
+	s->outbuf = malloc(WISK_OUT_SIZE);
+	s->channels = calloc(count, sizeof(*s->channels));
+	s->count = count;
+	s->next = wisk_sessions;
+	wisk_sessions = s;
+	if (status && status[0])
+		s->status = open(status, O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+	if (s->name == NULL || s->output == NULL || s->outbuf == NULL || s->channels == NULL) {
+		snprintf(reply, sizeof(reply), "error out of memory\n");
+		s->count = 0;
+		goto fail;
+	}
+	for (i = 0; i < count; i++)
+		s->channels[i].fd = -1;
+	// A session of a shared collector must not reach files it does not own, see the top of the file
+	s->out = open(output, O_WRONLY|O_CREAT|O_CLOEXEC|(status ? O_EXCL : O_TRUNC), 0644);
+	if (s->out < 0) {
+		snprintf(reply, sizeof(reply), "error %s: %s\n", output, strerror(errno));
+		goto fail;
+	}
+	for (i = 0; i < count; i++) {
+		s->channels[i].session = s;
+		s->channels[i].path = strdup(paths[i]);
+		s->channels[i].fd = s->channels[i].path ? wisk_open_polled(paths[i], &s->channels[i]) : -1;
+		if (s->channels[i].fd < 0) {
+			snprintf(reply, sizeof(reply), "error %s: %s\n", paths[i], strerror(errno));
+			goto fail;
+		}
+	}
+	wisk_session_reply(s, "ok\n");
+	return s;
+fail:
+	WISK_LOG("Session %s: %s", name, reply);
+	wisk_session_reply(s, reply);
+	if (s->out >= 0) {
+		close(s->out);
+		s->out = -1;
+	}
+	wisk_session_close(s);
+	return NULL;
+}
+
+static struct wisk_session *wisk_session_find(const char *name)
+{
+	struct wisk_session *s;
+
+	for (s = wisk_sessions; s; s = s->next) {
+		if (strcmp(s->name, name) == 0)
+			return s;
+	}
+	return NULL;
+}
+
+/* One line of the control FIFO, see the top of the file */
+static void wisk_control_line(char *line)
+{
+	char *argv[WISK_CONTROL_ARGS], *save = NULL, *arg;
+	struct wisk_session *s;
+	int argc = 0;
+
+	for (arg = strtok_r(line, "\t", &save); arg && argc < WISK_CONTROL_ARGS; arg = strtok_r(NULL, "\t", &save))
+		argv[argc++] = arg;
+	if (argc >= 6 && strcmp(argv[0], "open") == 0) {
+		if (wisk_session_find(argv[1])) {
+			WISK_LOG("Session %s is already open", argv[1]);
+			return;
+		}
+		wisk_session_open(argv[1], atoi(argv[2]), argv[3], argv[4], argv + 5, argc - 5);
+	} else if (argc == 3 && strcmp(argv[0], "overflow") == 0) {
+		s = wisk_session_find(argv[1]);
+		if (s == NULL)
+			WISK_LOG("No session %s to overflow", argv[1]);
+		else if (s->overflow == NULL && (s->overflow = strdup(argv[2])) == NULL)
+			WISK_LOG("Out of memory for overflow %s", argv[2]);
+	} else if (argc == 2 && strcmp(argv[0], "close") == 0) {
+		s = wisk_session_find(argv[1]);
+		if (s)
+			s->stopping = true;
+		else
+			WISK_LOG("No session %s to close", argv[1]);
+	} else if (argc > 0) {
+		WISK_LOG("Bad control request %s", argv[0]);
+	}
+}
+
+/* Like a shard, the control FIFO is reopened when its last writer goes */
+static void wisk_control_read(struct wisk_control *ctl)
+{
+	char *nl, *line;
+	ssize_t n;
+	int fd;
+
+	while (true) {
+		if (ctl->len == sizeof(ctl->buf)) {
+			WISK_LOG("Control request too long, dropped");
+			ctl->len = 0;
+		}
+		n = read(ctl->fd, ctl->buf + ctl->len, sizeof(ctl->buf) - ctl->len);
+		if (n > 0) {
+			ctl->len += n;
+			line = ctl->buf;
+			while ((nl = memchr(line, '\n', ctl->buf + ctl->len - line)) != NULL) {
+				*nl = '\0';
+				wisk_control_line(line);
+				line = nl + 1;
+			}
+			ctl->len -= line - ctl->buf;
+			memmove(ctl->buf, line, ctl->len);
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return;
+		fd = wisk_open_polled(ctl->path, ctl);
+		if (fd < 0)
+			return;
+		epoll_ctl(wisk_epoll, EPOLL_CTL_DEL, ctl->fd, NULL);
+		close(ctl->fd);
+		ctl->fd = fd;
+		return;
+	}
+}
+
+static void wisk_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-i seconds] [-z level] [-O <overflow dir>] -o <rawfile> <fifo>...\n"
+		"       %s [-i seconds] -s <control fifo>\n", prog, prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct epoll_event events[WISK_MAX_EVENTS], ev;
+	struct wisk_session *s, *next;
+	struct wisk_channel *ch;
+	struct wisk_root *r;
+	struct wisk_control ctl = { NULL, -1, "", 0 };
+	struct signalfd_siginfo si;
+	const char *output = NULL, *overflow = NULL;
+	double interval = 0, last, now;
+	bool stopping = false, idle;
+	sigset_t mask;
+	int sigfd, n, i, opt, timeout, zlevel = -1;
+	char c;
+
+	while ((opt = getopt(argc, argv, "i:o:O:s:z:")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'O':
+			overflow = optarg;
+			break;
+		case 's':
+			ctl.path = optarg;
+			break;
+		case 'z':
+			zlevel = atoi(optarg);
+			break;
+		default:
+			wisk_usage(argv[0]);
+		}
+	}
+	if (ctl.path ? output != NULL || overflow != NULL || optind < argc : output == NULL || optind >= argc)
+		wisk_usage(argv[0]);
+
+	wisk_zbuf = malloc(sizeof(struct wisk_block_hdr) + compressBound(WISK_BLOCK_SIZE));
+	wisk_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (wisk_zbuf == NULL || wisk_epoll < 0) {
+		WISK_LOG("Cannot set up: %s", strerror(errno));
+		return 1;
+	}
+	if (ctl.path) {
+		ctl.fd = wisk_open_polled(ctl.path, &ctl);
+		if (ctl.fd < 0)
+			return 1;
+	} else if ((s = wisk_session_open("", zlevel, output, NULL, argv + optind, argc - optind)) == NULL) {
+		return 1;
+	} else if (overflow && (s->overflow = strdup(overflow)) == NULL) {
+		WISK_LOG("Out of memory for overflow %s", overflow);
+		return 1;
+	}
+
+	// A session gone from its status FIFO must not take the collector with it
+	signal(SIGPIPE, SIG_IGN);
+	// Nor wait for the children fingerprinting roots
+	signal(SIGCHLD, SIG_IGN);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sigfd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &sigfd;
+	epoll_ctl(wisk_epoll, EPOLL_CTL_ADD, sigfd, &ev);
+	// stdin may well be something epoll refuses, then only SIGTERM stops us
+	ev.data.ptr = NULL;
+	epoll_ctl(wisk_epoll, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+
+	last = wisk_now();
+	while (true) {
+		// Only flush once nothing is ready, so a busy build gets large writes
+		n = epoll_wait(wisk_epoll, events, WISK_MAX_EVENTS, 0);
+		if (n == 0) {
+			for (s = wisk_sessions; s; s = s->next)
+				wisk_flush(s, false);
+			idle = stopping;
+			for (s = wisk_sessions; s; s = s->next)
+				idle |= s->stopping;
+			timeout = idle ? WISK_STOP_POLL_MSEC : interval > 0 ? (int)(interval * 1000) : -1;
+			n = epoll_wait(wisk_epoll, events, WISK_MAX_EVENTS, timeout);
+		}
+		if (n < 0 && errno != EINTR) {
+			WISK_LOG("epoll_wait: %s", strerror(errno));
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &sigfd) {
+				while (read(sigfd, &si, sizeof(si)) == sizeof(si))
+					stopping = true;
+			} else if (events[i].data.ptr == NULL) {
+				if (read(STDIN_FILENO, &c, 1) <= 0) {
+					epoll_ctl(wisk_epoll, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+					stopping = true;
+				}
+			} else if (events[i].data.ptr == &ctl) {
+				wisk_control_read(&ctl);
+			} else {
+				ch = events[i].data.ptr;
+				if (!wisk_channel_drain(ch))
+					wisk_channel_reopen(ch);
+			}
+		}
+		// A session closed from the control FIFO goes from the list, so no
+		// event of this round may still point at one of its channels
+		for (s = wisk_sessions; s; s = next) {
+			next = s->next;
+			if (!stopping && !s->stopping)
+				continue;
+			idle = true;
+			for (i = 0; i < s->count; i++)
+				idle &= !wisk_channel_drain(&s->channels[i]);
+			// What overflowed follows what the shards had, its USES may add roots
+			if (idle && s->overflow && !s->merged)
+				wisk_overflow_merge(s);
+			// Complete once the roots the last records USES are fingerprinted too
+			for (r = s->roots; r; r = r->next) {
+				if (r->ch.fd >= 0 && !wisk_channel_drain(&r->ch))
+					wisk_channel_reopen(&r->ch);
+				idle &= r->ch.fd < 0;
+			}
+			if (idle)
+				wisk_session_close(s);
+		}
+		if (stopping && wisk_sessions == NULL)
+			break;
+		now = wisk_now();
+		if (interval > 0 && now - last >= interval) {
+			for (s = wisk_sessions; s; s = s->next)
+				wisk_stats(s, now - s->start, now - last, false);
+			last = now;
+		}
+	}
+	while (wisk_sessions)
+		wisk_session_close(wisk_sessions);
+	return 0;
+}
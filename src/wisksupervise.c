@@ -0,0 +1,1589 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2019-2020, Sarvi Shanmugham <sarvi@cisco.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+   WISK Supervisor. Runs a command under ptrace with a seccomp filter that
+   traps only the file system calls libwisktrack.so tracks, and reports them
+   for the programs the library cannot see: statically linked binaries, Go
+   programs and anything else making raw system calls. Programs that load
+   libwisktrack.so report themselves, the supervisor only follows them.
+
+   The filter is not installed up front. When a program that does not load
+   the library is exec'ed, the supervisor has it make the seccomp() call
+   before its first instruction. A program that loads the library runs
+   without the filter and so never stops on a call, unless it inherited one
+   from a program exec'ed before it. A filter cannot be removed, and a traced
+   call finding no tracer fails with ENOSYS, so the supervisor never detaches.
+
+   wisksupervise <command> [args...]
+
+   Configured by the same WISK_TRACKER_* environment as the library, the
+   records go to WISK_TRACKER_PIPE in the same format, or to a spill file of
+   its own, <pid>.supervise, under WISK_TRACKER_SPILLDIR. The supervisor itself
+   is not tracked, the library to preload into the command is passed as
+   WISK_TRACKER_PRELOAD rather than LD_PRELOAD.
+*/
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/syscall.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/limits.h>
+#include <elf.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+
+#if defined(__x86_64__)
+#define WISK_AUDIT_ARCH AUDIT_ARCH_X86_64
+#define WISK_REG_RET(r) ((long)(r).rax)
+#define WISK_REG_ARGS(r) { (r).rdi, (r).rsi, (r).rdx, (r).r10, (r).r8, (r).r9 }
+#define WISK_REG_PC(r) ((r).rip)
+#define WISK_REG_SP(r) ((r).rsp)
+#define WISK_REG_SYSCALL(r, nr, a0, a1, a2) ((r).rax = (nr), (r).rdi = (a0), (r).rsi = (a1), (r).rdx = (a2))
+// syscall, 0f 05
+#define WISK_SYSCALL_INSN 0x050fUL
+#define WISK_SYSCALL_MASK 0xffffUL
+// Below the stack pointer, the ABI's red zone is left alone
+#define WISK_STACK_RESERVED 128
+#elif defined(__aarch64__)
+#define WISK_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#define WISK_REG_RET(r) ((long)(r).regs[0])
+#define WISK_REG_ARGS(r) { (r).regs[0], (r).regs[1], (r).regs[2], (r).regs[3], (r).regs[4], (r).regs[5] }
+#define WISK_REG_PC(r) ((r).pc)
+#define WISK_REG_SP(r) ((r).sp)
+#define WISK_REG_SYSCALL(r, nr, a0, a1, a2) ((r).regs[8] = (nr), (r).regs[0] = (a0), (r).regs[1] = (a1), (r).regs[2] = (a2))
+// svc #0
+#define WISK_SYSCALL_INSN 0xd4000001UL
+#define WISK_SYSCALL_MASK 0xffffffffUL
+#define WISK_STACK_RESERVED 0
+#else
+#error "wisksupervise supports x86_64 and aarch64 only"
+#endif
+
+#ifndef PTRACE_EVENT_STOP
+#define PTRACE_EVENT_STOP 128
+#endif
+
+#define BUFFER_SIZE 4096
+#define UUID_SIZE 36
+
+#define WISK_TRACKER_PIPE "WISK_TRACKER_PIPE"
+#define WISK_TRACKER_SPILLDIR "WISK_TRACKER_SPILLDIR"
+#define WISK_TRACKER_UUID "WISK_TRACKER_UUID"
+#define WISK_TRACKER_DEBUGLEVEL "WISK_TRACKER_DEBUGLEVEL"
+#define WISK_TRACKER_EVENTFILTER "WISK_TRACKER_EVENTFILTER"
+#define WISK_TRACKER_FORMAT "WISK_TRACKER_FORMAT"
+#define WISK_TRACKER_PRELOAD "WISK_TRACKER_PRELOAD"
+#define LD_PRELOAD "LD_PRELOAD"
+
+/* Must match the library, these are what the parser sees */
+enum wisk_eventfilter_e {
+	WISK_TRACK_WRITES = 0,
+	WISK_TRACK_READS,
+	WISK_TRACK_LINKS,
+	WISK_TRACK_CHMODS,
+	WISK_TRACK_PROCESS,
+	WISK_TRACK_PROBES
+};
+
+#define WISK_TRACK_EVENT(x) (wisk_eventfilter & (1<<(x)))
+
+enum wisk_op_e {
+	WISK_OP_CALLS = 1,
+	WISK_OP_PID,
+	WISK_OP_PPID,
+	WISK_OP_WORKING_DIRECTORY,
+	WISK_OP_COMMAND_PATH,
+	WISK_OP_COMMAND,
+	WISK_OP_ENVIRONMENT,
+	WISK_OP_READS,
+	WISK_OP_WRITES,
+	WISK_OP_READS_UNKNOWN,
+	WISK_OP_LINKS,
+	WISK_OP_UNLINK,
+	WISK_OP_CHMOD,
+	WISK_OP_COMPLETE,
+	WISK_OP_REPEATS,
+	WISK_OP_ENVIRONMENT_DELTA,
+	WISK_OP_PROBES
+};
+
+static const char *wisk_op_names[] = {
+	NULL, "CALLS", "PID", "PPID", "WORKING_DIRECTORY", "COMMAND_PATH", "COMMAND", "ENVIRONMENT",
+	"READS", "WRITES", "READS-UNKNOWN", "LINKS", "UNLINK", "CHMOD", "COMPLETE", "REPEATS",
+	"ENVIRONMENT-DELTA", "PROBES"
+};
+
+#define WISK_RECORD_MAGIC 0xB7
+#define WISK_RECORD_VERSION 4
+#define WISK_RECORD_LIST 0x01
+#define WISK_RECORD_MORE 0x02
+#define WISK_RECORD_EPOCH 0x04
+
+typedef struct random_uuid_ {
+    int i1;
+    int i2;
+    int i3;
+    int i4;
+} random_uuid_t;
+
+struct wisk_record_hdr {
+	uint8_t magic;
+	uint8_t version;
+	uint8_t op;
+	uint8_t flags;
+	uint32_t len;
+	uint32_t pid;
+	uint32_t seq;
+	uint16_t frag;
+	uint16_t reserved;
+	random_uuid_t id;
+	uint64_t time;
+} __attribute__((packed));
+
+static int wisk_loglevel;
+static int wisk_pipe = -1;
+static unsigned int wisk_eventfilter = 0xFFFFFFFF;
+static bool wisk_binary;
+static char wisk_root_puuid[UUID_SIZE+1] = "XXXXXXXX-XXXXXXXX-XXXXXXXX-XXXXXXXX";
+
+#define WISK_LOG(level, fmt, ...) do { \
+		if ((level) <= wisk_loglevel) \
+			fprintf(stderr, "wisksupervise[%d] %s: " fmt "\n", getpid(), __func__, ##__VA_ARGS__); \
+	} while (0)
+
+enum wisk_dbglvl_e {
+	WISK_LOG_ERROR = 0,
+	WISK_LOG_WARN,
+	WISK_LOG_INFO,
+	WISK_LOG_DEBUG,
+	WISK_LOG_TRACE
+};
+
+/****************************************************************************
+ *   SYSTEM CALLS
+ ***************************************************************************/
+
+enum wisk_sys_kind_e {
+	WISK_SYS_OPEN,
+	WISK_SYS_LOOKUP,
+	WISK_SYS_EXEC,
+	WISK_SYS_UNLINK,
+	WISK_SYS_LINK,
+	WISK_SYS_CHMOD,
+	WISK_SYS_FCHMOD
+};
+
+/*
+ * The traced calls, the counterparts of the library's hooks. Arguments are
+ * given by index, -1 when the call has no such argument: a missing dirfd
+ * is AT_FDCWD, missing flags of an open are those of creat(). The flags of
+ * a lookup are its AT_* flags, with AT_EMPTY_PATH it is an fstat() of the
+ * dirfd and runs without stopping. The index of an entry is the data of its
+ * SECCOMP_RET_TRACE, so a stop needs no lookup.
+ */
+struct wisk_syscall {
+	long nr;
+	const char *name;
+	enum wisk_sys_kind_e kind;
+	int dirfd;
+	int path;
+	int flags;
+	int dirfd2;
+	int path2;
+};
+
+static const struct wisk_syscall wisk_syscalls[] = {
+#ifdef __NR_open
+	{ __NR_open, "open", WISK_SYS_OPEN, -1, 0, 1, -1, -1 },
+#endif
+#ifdef __NR_creat
+	{ __NR_creat, "creat", WISK_SYS_OPEN, -1, 0, -1, -1, -1 },
+#endif
+	{ __NR_openat, "openat", WISK_SYS_OPEN, 0, 1, 2, -1, -1 },
+#ifdef __NR_stat
+	{ __NR_stat, "stat", WISK_SYS_LOOKUP, -1, 0, -1, -1, -1 },
+#endif
+#ifdef __NR_lstat
+	{ __NR_lstat, "lstat", WISK_SYS_LOOKUP, -1, 0, -1, -1, -1 },
+#endif
+#ifdef __NR_newfstatat
+	{ __NR_newfstatat, "newfstatat", WISK_SYS_LOOKUP, 0, 1, 3, -1, -1 },
+#endif
+#ifdef __NR_statx
+	{ __NR_statx, "statx", WISK_SYS_LOOKUP, 0, 1, 2, -1, -1 },
+#endif
+#ifdef __NR_access
+	{ __NR_access, "access", WISK_SYS_LOOKUP, -1, 0, -1, -1, -1 },
+#endif
+	{ __NR_faccessat, "faccessat", WISK_SYS_LOOKUP, 0, 1, -1, -1, -1 },
+#ifdef __NR_faccessat2
+	{ __NR_faccessat2, "faccessat2", WISK_SYS_LOOKUP, 0, 1, 3, -1, -1 },
+#endif
+	{ __NR_execve, "execve", WISK_SYS_EXEC, -1, 0, 2, -1, -1 },
+#ifdef __NR_execveat
+	{ __NR_execveat, "execveat", WISK_SYS_EXEC, 0, 1, 3, -1, -1 },
+#endif
+#ifdef __NR_unlink
+	{ __NR_unlink, "unlink", WISK_SYS_UNLINK, -1, 0, -1, -1, -1 },
+#endif
+	{ __NR_unlinkat, "unlinkat", WISK_SYS_UNLINK, 0, 1, -1, -1, -1 },
+#ifdef __NR_link
+	{ __NR_link, "link", WISK_SYS_LINK, -1, 0, -1, -1, 1 },
+#endif
+	{ __NR_linkat, "linkat", WISK_SYS_LINK, 0, 1, -1, 2, 3 },
+#ifdef __NR_symlink
+	{ __NR_symlink, "symlink", WISK_SYS_LINK, -1, 0, -1, -1, 1 },
+#endif
+	{ __NR_symlinkat, "symlinkat", WISK_SYS_LINK, -1, 0, -1, 1, 2 },
+#ifdef __NR_chmod
+	{ __NR_chmod, "chmod", WISK_SYS_CHMOD, -1, 0, -1, -1, -1 },
+#endif
+	{ __NR_fchmodat, "fchmodat", WISK_SYS_CHMOD, 0, 1, -1, -1, -1 },
+	{ __NR_fchmod, "fchmod", WISK_SYS_FCHMOD, 0, -1, -1, -1, -1 },
+};
+
+#define WISK_SYSCALL_COUNT (sizeof(wisk_syscalls) / sizeof(wisk_syscalls[0]))
+
+/* The low 32 bits of a call argument, all BPF_LD can load */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WISK_SECCOMP_ARG(i) offsetof(struct seccomp_data, args[i])
+#else
+#define WISK_SECCOMP_ARG(i) (offsetof(struct seccomp_data, args[i]) + sizeof(uint32_t))
+#endif
+
+#define WISK_FILTER_MAX (4 + 4 * WISK_SYSCALL_COUNT + 1)
+
+/*
+ * Everything but the calls above, and every call of another architecture,
+ * e.g. a 32 bit program on a 64 bit kernel, runs without stopping. Returns
+ * the length of the program.
+ */
+static size_t wisk_seccomp_filter(struct sock_filter filter[WISK_FILTER_MAX])
+{
+	const struct wisk_syscall *sys;
+	size_t i, n = 0;
+
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, arch));
+	filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, WISK_AUDIT_ARCH, 1, 0);
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr));
+	for (i = 0; i < WISK_SYSCALL_COUNT; i++) {
+		sys = &wisk_syscalls[i];
+		if (sys->kind != WISK_SYS_LOOKUP || sys->flags < 0) {
+			filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, sys->nr, 0, 1);
+			filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE | i);
+			continue;
+		}
+		// The nr is not needed past its match, every way out returns
+		filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, sys->nr, 0, 4);
+		filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, WISK_SECCOMP_ARG(sys->flags));
+		filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, AT_EMPTY_PATH, 0, 1);
+		filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+		filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE | i);
+	}
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+	return n;
+}
+
+/****************************************************************************
+ *   PROCESSES
+ ***************************************************************************/
+
+/*
+ * A node is a program the parser sees, created at exec and shared by the
+ * threads and not yet exec'ed children of the process. Only supervised
+ * nodes, those not running libwisktrack.so, are reported on.
+ */
+struct wisk_node {
+	int refs;
+	bool supervised;
+	pid_t pid;
+	pid_t ppid;
+	uint32_t seq;
+	uint64_t time;
+	char uuid[UUID_SIZE+1];
+	random_uuid_t raw;
+	char *argv;
+	size_t argvlen;
+	struct wisk_probes *probes;
+};
+
+/* Where a task is in the seccomp() call wisk_inject() has it make, at its syscall stops */
+enum wisk_inject_e {
+	WISK_INJECT_NONE = 0,
+	WISK_INJECT_EXEC,
+	WISK_INJECT_ENTER,
+	WISK_INJECT_EXIT
+};
+
+/*
+ * A traced thread, and the call it is in when waiting for its result. A
+ * thread has the filter when it made the seccomp() call, or inherited the
+ * filter from the thread that created it.
+ */
+struct wisk_task {
+	struct wisk_task *next;
+	pid_t tid;
+	bool attached;
+	bool held;
+	bool filtered;
+	enum wisk_inject_e inject;
+	struct user_regs_struct saved;
+	unsigned long text;
+	struct wisk_node *node;
+	const struct wisk_syscall *sys;
+	unsigned long args[6];
+	char path[PATH_MAX];
+	char path2[PATH_MAX];
+};
+
+#define WISK_TASK_BUCKETS 1024
+static struct wisk_task *wisk_tasks[WISK_TASK_BUCKETS];
+
+static struct wisk_task *wisk_task_get(pid_t tid, bool create)
+{
+	struct wisk_task **b = &wisk_tasks[tid % WISK_TASK_BUCKETS], *t;
+
+	for (t = *b; t; t = t->next) {
+		if (t->tid == tid)
+			return t;
+	}
+	if (!create)
+		return NULL;
+	t = calloc(1, sizeof(*t));
+	if (t == NULL) {
+		WISK_LOG(WISK_LOG_ERROR, "Out of memory tracing %d", tid);
+		exit(1);
+	}
+	t->tid = tid;
+	t->next = *b;
+	*b = t;
+	return t;
+}
+
+static void wisk_probes_flush(struct wisk_node *node);
+static void wisk_probes_free(struct wisk_probes *p);
+
+static void wisk_node_put(struct wisk_node *node)
+{
+	if (node && --node->refs == 0) {
+		wisk_probes_flush(node);
+		wisk_probes_free(node->probes);
+		free(node->argv);
+		free(node);
+	}
+}
+
+static void wisk_task_del(pid_t tid)
+{
+	struct wisk_task **b = &wisk_tasks[tid % WISK_TASK_BUCKETS], *t;
+
+	for (; (t = *b); b = &t->next) {
+		if (t->tid == tid) {
+			*b = t->next;
+			wisk_node_put(t->node);
+			free(t);
+			return;
+		}
+	}
+}
+
+static void wisk_resume(pid_t tid, int request, int sig)
+{
+	if (ptrace(request, tid, 0, sig) < 0 && errno != ESRCH)
+		WISK_LOG(WISK_LOG_ERROR, "ptrace(%d, %d): %s", request, tid, strerror(errno));
+}
+
+/* Copies len bytes, a multiple of the word size, to the word aligned addr of the task */
+static int wisk_poke(pid_t tid, unsigned long addr, const void *buf, size_t len)
+{
+	unsigned long word;
+	size_t i;
+
+	for (i = 0; i < len; i += sizeof(word)) {
+		memcpy(&word, (const char *)buf + i, sizeof(word));
+		if (ptrace(PTRACE_POKEDATA, tid, addr + i, word) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Has the task, stopped in the syscall stops of its exec, install the
+ * filter. On the exit of the execve() its registers are saved, the filter
+ * is copied below its stack pointer and the instruction at its pc replaced
+ * with a system call, seccomp(SECCOMP_SET_MODE_FILTER) in the registers.
+ * On the exit of that call the instruction and registers are put back. The
+ * no_new_privs the filter needs is set for all by wisk_child(). Returns
+ * whether the task is to be resumed to its next syscall stop.
+ */
+static bool wisk_inject(struct wisk_task *t)
+{
+	struct sock_filter filter[WISK_FILTER_MAX];
+	struct sock_fprog prog;
+	struct user_regs_struct regs;
+	struct iovec iov = {&regs, sizeof(regs)};
+	unsigned long addr, pc;
+	size_t n;
+	long ret;
+
+	if (ptrace(PTRACE_GETREGSET, t->tid, NT_PRSTATUS, &iov) < 0)
+		goto fail;
+	switch (t->inject) {
+	case WISK_INJECT_EXEC:
+		// A program of another architecture would not stop anyway
+		if (iov.iov_len != sizeof(regs))
+			break;
+		t->saved = regs;
+		n = wisk_seccomp_filter(filter);
+		addr = (WISK_REG_SP(regs) - WISK_STACK_RESERVED - n * sizeof(*filter) - sizeof(prog)) & ~15UL;
+		prog.len = n;
+		prog.filter = (struct sock_filter *)(addr + sizeof(prog));
+		pc = WISK_REG_PC(regs);
+		errno = 0;
+		t->text = ptrace(PTRACE_PEEKTEXT, t->tid, pc, 0);
+		if (errno || wisk_poke(t->tid, addr, &prog, sizeof(prog)) < 0 ||
+		    wisk_poke(t->tid, addr + sizeof(prog), filter, n * sizeof(*filter)) < 0 ||
+		    ptrace(PTRACE_POKETEXT, t->tid, pc, (t->text & ~WISK_SYSCALL_MASK) | WISK_SYSCALL_INSN) < 0)
+			goto fail;
+		WISK_REG_SYSCALL(regs, __NR_seccomp, SECCOMP_SET_MODE_FILTER, 0, addr);
+		if (ptrace(PTRACE_SETREGSET, t->tid, NT_PRSTATUS, &iov) < 0) {
+			ptrace(PTRACE_POKETEXT, t->tid, pc, t->text);
+			goto fail;
+		}
+		t->inject = WISK_INJECT_ENTER;
+		return true;
+	case WISK_INJECT_ENTER:
+		t->inject = WISK_INJECT_EXIT;
+		return true;
+	case WISK_INJECT_EXIT:
+		ret = WISK_REG_RET(regs);
+		iov.iov_base = &t->saved;
+		if (ptrace(PTRACE_POKETEXT, t->tid, WISK_REG_PC(t->saved), t->text) < 0 ||
+		    ptrace(PTRACE_SETREGSET, t->tid, NT_PRSTATUS, &iov) < 0) {
+			// Nothing the program could run on
+			WISK_LOG(WISK_LOG_ERROR, "%d: cannot restore: %s", t->tid, strerror(errno));
+			kill(t->tid, SIGKILL);
+			break;
+		}
+		if (ret < 0) {
+			errno = -ret;
+			goto fail;
+		}
+		WISK_LOG(WISK_LOG_DEBUG, "%d: filter installed", t->tid);
+		t->filtered = true;
+		break;
+	default:
+		break;
+	}
+	t->inject = WISK_INJECT_NONE;
+	return false;
+fail:
+	WISK_LOG(WISK_LOG_ERROR, "%d: cannot install the filter: %s", t->tid, strerror(errno));
+	t->inject = WISK_INJECT_NONE;
+	return false;
+}
+
+/****************************************************************************
+ *   REPORTING
+ ***************************************************************************/
+
+static void wisk_write(const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(wisk_pipe, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Records are framed as the library's, with the pid and a sequence number
+ * per node, and timestamped as its wisk_record_next() does, against the time
+ * of the first record of the node. A text record is
+ * split into lines of at most BUFFER_SIZE, written whole so they do not
+ * interleave with the library's, each "<uuid>@<pid>.<seq>~<time>:<frag>"
+ * with a '+' for the ':' on all but the last.
+ */
+#define WISK_RECORD_RESYNC 256
+
+static uint32_t wisk_node_next(struct wisk_node *node, uint64_t *time, uint64_t *epoch)
+{
+	struct timespec ts;
+	uint64_t now;
+	uint32_t seq;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	seq = node->seq++;
+	if (seq == 0)
+		node->time = now;
+	*time = now - node->time;
+	*epoch = (seq % WISK_RECORD_RESYNC) ? 0 : node->time;
+	return seq;
+}
+
+struct wisk_text {
+	char buf[BUFFER_SIZE];
+	char *dest;
+	char *more;
+	const char *uuid;
+	const char *op;
+	pid_t pid;
+	uint32_t seq;
+	uint64_t time;
+	uint64_t epoch;
+	unsigned int frag;
+};
+
+static void wisk_text_start(struct wisk_text *t)
+{
+	int n = snprintf(t->buf, BUFFER_SIZE, "%s@%d.%u~%" PRIu64, t->uuid, t->pid, t->seq, t->time);
+
+	if (t->epoch)
+		n += snprintf(t->buf + n, BUFFER_SIZE - n, "/%" PRIu64, t->epoch);
+
+	t->more = t->buf + n;
+	t->dest = t->more + snprintf(t->more, BUFFER_SIZE - n, ":%u %s ", t->frag, t->op);
+}
+
+static void wisk_text_put(struct wisk_text *t, char c, bool escape)
+{
+	static const char esc_char[] = { '\a','\b','\f','\n','\r','\t','\v','\\', '"', '\0'};
+	static const char esc_str[] = {  'a', 'b', 'f', 'n', 'r', 't', 'v','\\', '"'};
+	const char *e = escape && c ? strchr(esc_char, c) : NULL;
+
+	if (t->dest >= t->buf + BUFFER_SIZE - 10) {
+		*t->more = '+';
+		*t->dest++ = '\n';
+		wisk_write(t->buf, t->dest - t->buf);
+		t->frag++;
+		wisk_text_start(t);
+	}
+	if (e) {
+		*t->dest++ = '\\';
+		*t->dest++ = esc_str[e - esc_char];
+	} else {
+		*t->dest++ = c;
+	}
+}
+
+static void wisk_text_raw(struct wisk_text *t, const char *s)
+{
+	while (*s)
+		wisk_text_put(t, *s++, false);
+}
+
+static void wisk_report_text(struct wisk_node *node, const char *uuid, enum wisk_op_e op, bool list, char *const listp[])
+{
+	struct wisk_text t;
+	const char *s;
+	int i;
+
+	t.uuid = uuid;
+	t.op = wisk_op_names[op];
+	t.pid = node->pid;
+	t.seq = wisk_node_next(node, &t.time, &t.epoch);
+	t.frag = 0;
+	wisk_text_start(&t);
+	if (list)
+		wisk_text_raw(&t, "[");
+	for (i = 0; listp[i]; i++) {
+		if (i)
+			wisk_text_raw(&t, ", ");
+		wisk_text_raw(&t, "\"");
+		for (s = listp[i]; *s; s++)
+			wisk_text_put(&t, *s, true);
+		wisk_text_raw(&t, "\"");
+	}
+	if (list)
+		wisk_text_raw(&t, "]");
+	*t.dest++ = '\n';
+	wisk_write(t.buf, t.dest - t.buf);
+}
+
+static void wisk_report_binary(struct wisk_node *node, enum wisk_op_e op, uint8_t flags, char *const listp[])
+{
+	char msgbuffer[BUFFER_SIZE];
+	struct wisk_record_hdr *hdr = (struct wisk_record_hdr *)msgbuffer;
+	char *payload = msgbuffer + sizeof(*hdr);
+	char *dest = payload, *end = msgbuffer + BUFFER_SIZE;
+	const char *src;
+	uint64_t time, epoch;
+	size_t len, n;
+	int i;
+
+	hdr->magic = WISK_RECORD_MAGIC;
+	hdr->version = WISK_RECORD_VERSION;
+	hdr->op = op;
+	hdr->pid = node->pid;
+	hdr->seq = wisk_node_next(node, &time, &epoch);
+	hdr->time = time;
+	hdr->frag = 0;
+	hdr->reserved = 0;
+	hdr->id = node->raw;
+	if (epoch) {
+		memcpy(dest, &epoch, sizeof(epoch));
+		dest += sizeof(epoch);
+		flags |= WISK_RECORD_EPOCH;
+	}
+	for (i = 0; listp[i]; i++) {
+		src = listp[i];
+		len = strlen(src) + 1;
+		while (len) {
+			if (dest == end) {
+				hdr->flags = flags | WISK_RECORD_MORE;
+				hdr->len = dest - payload;
+				wisk_write(msgbuffer, dest - msgbuffer);
+				hdr->frag++;
+				dest = payload;
+			}
+			n = len < (size_t)(end - dest) ? len : (size_t)(end - dest);
+			memcpy(dest, src, n);
+			dest += n;
+			src += n;
+			len -= n;
+		}
+	}
+	hdr->flags = flags;
+	hdr->len = dest - payload;
+	wisk_write(msgbuffer, dest - msgbuffer);
+}
+
+static void wisk_report_list(struct wisk_node *node, enum wisk_op_e op, char *listp[])
+{
+	if (wisk_binary)
+		wisk_report_binary(node, op, WISK_RECORD_LIST, listp);
+	else
+		wisk_report_text(node, node->uuid, op, true, listp);
+}
+
+static void wisk_report(struct wisk_node *node, enum wisk_op_e op, char *valuestr)
+{
+	char *listp[] = {valuestr, NULL};
+
+	if (wisk_binary)
+		wisk_report_binary(node, op, 0, listp);
+	else
+		wisk_report_text(node, node->uuid, op, false, listp);
+}
+
+/* The CALLS record of a node is keyed by its parent in text, by itself in binary */
+static void wisk_report_calls(struct wisk_node *node, char *puuid)
+{
+	char *listp[] = {NULL, NULL};
+
+	if (wisk_binary) {
+		listp[0] = puuid;
+		wisk_report_binary(node, WISK_OP_CALLS, 0, listp);
+	} else {
+		listp[0] = node->uuid;
+		wisk_report_text(node, puuid, WISK_OP_CALLS, false, listp);
+	}
+}
+
+/* Split a buffer of '\0' terminated strings into a NULL terminated list */
+static char **wisk_split(char *buf, size_t len)
+{
+	char **listp;
+	size_t i, n = 0;
+
+	for (i = 0; i < len; i++)
+		n += (buf[i] == '\0');
+	listp = malloc((n + 1) * sizeof(*listp));
+	if (listp == NULL)
+		return NULL;
+	for (i = 0, n = 0; i < len; i += strlen(buf + i) + 1)
+		listp[n++] = buf + i;
+	listp[n] = NULL;
+	return listp;
+}
+
+static char *wisk_readfile(const char *path, size_t *lenp)
+{
+	size_t len = 0, size = 4096;
+	char *buf = malloc(size), *nbuf;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || buf == NULL) {
+		if (fd >= 0)
+			close(fd);
+		free(buf);
+		return NULL;
+	}
+	while ((n = read(fd, buf + len, size - len - 1)) > 0) {
+		len += n;
+		if (len + 1 == size) {
+			nbuf = realloc(buf, size *= 2);
+			if (nbuf == NULL)
+				break;
+			buf = nbuf;
+		}
+	}
+	close(fd);
+	// Lists from /proc end in '\0', make sure of it
+	if (len && buf[len-1] != '\0')
+		buf[len++] = '\0';
+	*lenp = len;
+	return buf;
+}
+
+/****************************************************************************
+ *   TRACEE MEMORY AND PATHS
+ ***************************************************************************/
+
+/* Read a string of the tracee, false when it is unreadable or truncated to fit size */
+static bool wisk_peekstr(pid_t tid, unsigned long addr, char *buf, size_t size)
+{
+	struct iovec local, remote;
+	size_t n = 0, chunk;
+
+	buf[0] = '\0';
+	if (addr == 0)
+		return false;
+	while (n < size - 1) {
+		chunk = 4096 - ((addr + n) & 4095);
+		if (chunk > size - 1 - n)
+			chunk = size - 1 - n;
+		local.iov_base = buf + n;
+		local.iov_len = chunk;
+		remote.iov_base = (void *)(addr + n);
+		remote.iov_len = chunk;
+		if (process_vm_readv(tid, &local, 1, &remote, 1, 0) != (ssize_t)chunk) {
+			buf[n] = '\0';
+			return false;
+		}
+		if (memchr(buf + n, '\0', chunk))
+			return true;
+		n += chunk;
+	}
+	buf[size-1] = '\0';
+	return false;
+}
+
+static void wisk_path_normalize(char *buf, const char *path)
+{
+	const char *s = path;
+	char *d = buf;
+	size_t n;
+
+	while (*s) {
+		while (*s == '/')
+			s++;
+		n = strcspn(s, "/");
+		if (n == 0 || (n == 1 && s[0] == '.')) {
+			/* skip */
+		} else if (n == 2 && s[0] == '.' && s[1] == '.') {
+			while (d > buf && *--d != '/');
+		} else if ((size_t)(d - buf) + n + 2 < PATH_MAX) {
+			*d++ = '/';
+			memcpy(d, s, n);
+			d += n;
+		}
+		s += n;
+	}
+	if (d == buf)
+		*d++ = '/';
+	*d = '\0';
+}
+
+/* Absolute path of path relative to dirfd of the tracee, in buf */
+static bool wisk_path_resolve(pid_t tid, int dirfd, const char *path, char *buf)
+{
+	char link[64], base[PATH_MAX], full[2*PATH_MAX];
+	ssize_t n;
+
+	if (path[0] == '/') {
+		wisk_path_normalize(buf, path);
+		return true;
+	}
+	if (dirfd == AT_FDCWD)
+		snprintf(link, sizeof(link), "/proc/%d/cwd", tid);
+	else
+		snprintf(link, sizeof(link), "/proc/%d/fd/%d", tid, dirfd);
+	n = readlink(link, base, sizeof(base)-1);
+	if (n < 0)
+		return false;
+	base[n] = '\0';
+	snprintf(full, sizeof(full), "%s/%s", base, path);
+	wisk_path_normalize(buf, full);
+	return true;
+}
+
+static bool wisk_sysarg_path(struct wisk_task *t, int dirfd, int path, char *buf)
+{
+	char raw[PATH_MAX];
+
+	if (!wisk_peekstr(t->tid, t->args[path], raw, sizeof(raw)) || raw[0] == '\0')
+		return false;
+	return wisk_path_resolve(t->tid, dirfd < 0 ? AT_FDCWD : (int)t->args[dirfd], raw, buf);
+}
+
+/*
+ * Children of a supervised program inherit the WISK_TRACKER_UUID it was
+ * started with, it cannot export its own. Rewrite it in place in the
+ * environment passed to exec, so programs running the library know their
+ * parent. The uuids all have the same length.
+ */
+static void wisk_exec_setuuid(struct wisk_task *t, unsigned long envp)
+{
+	size_t n = strlen(WISK_TRACKER_UUID);
+	char env[n + 1 + UUID_SIZE + 1];
+	unsigned long addr;
+	struct iovec local, remote;
+	int i;
+
+	for (i = 0; envp && i < 65536; i++) {
+		local.iov_base = &addr;
+		local.iov_len = sizeof(addr);
+		remote.iov_base = (void *)(envp + i * sizeof(addr));
+		remote.iov_len = sizeof(addr);
+		if (process_vm_readv(t->tid, &local, 1, &remote, 1, 0) != sizeof(addr) || addr == 0)
+			return;
+		wisk_peekstr(t->tid, addr, env, n + 2);
+		if (strncmp(env, WISK_TRACKER_UUID "=", n + 1) != 0)
+			continue;
+		if (!wisk_peekstr(t->tid, addr, env, sizeof(env)) || strlen(env + n + 1) != strlen(t->node->uuid))
+			return;
+		local.iov_base = t->node->uuid;
+		local.iov_len = strlen(t->node->uuid);
+		remote.iov_base = (void *)(addr + n + 1);
+		remote.iov_len = local.iov_len;
+		if (process_vm_writev(t->tid, &local, 1, &remote, 1, 0) != (ssize_t)local.iov_len)
+			WISK_LOG(WISK_LOG_WARN, "%d: cannot pass %s to exec: %s", t->tid, WISK_TRACKER_UUID, strerror(errno));
+		return;
+	}
+}
+
+/****************************************************************************
+ *   EVENTS
+ ***************************************************************************/
+
+/*
+ * Probes are reported as the library's wisk_probe_add() does: once per path
+ * and kind for a node, and held back so that those of a directory go out
+ * together, as one PROBES record [dir, item...]. The pending ones are sent
+ * when WISK_PROBE_DIRS directories have some, before the COMPLETE of the
+ * node, and when the node is let go.
+ */
+#define WISK_PROBE_BUCKETS 256
+#define WISK_PROBE_DIRS 64
+#define WISK_PROBES_PER_RECORD 128
+
+struct wisk_probe {
+	struct wisk_probe *next;
+	char item[];
+};
+
+struct wisk_probes {
+	struct wisk_probe *seen[WISK_PROBE_BUCKETS];
+	struct {
+		char *dir;
+		struct wisk_probe *probes, **tail;
+	} dirs[WISK_PROBE_DIRS];
+	int ndirs;
+};
+
+static void wisk_probe_list_free(struct wisk_probe *q)
+{
+	struct wisk_probe *next;
+
+	for (; q; q = next) {
+		next = q->next;
+		free(q);
+	}
+}
+
+static void wisk_probes_free(struct wisk_probes *p)
+{
+	int i;
+
+	if (p == NULL)
+		return;
+	for (i = 0; i < WISK_PROBE_BUCKETS; i++)
+		wisk_probe_list_free(p->seen[i]);
+	free(p);
+}
+
+/* Whether the node reported the probe already, it counts as reported from now on */
+static bool wisk_probe_seen(struct wisk_probes *p, char kind, const char *path)
+{
+	struct wisk_probe *q, **b;
+	uint32_t h = 2166136261U;
+	const char *c;
+	size_t len;
+
+	h = (h ^ (unsigned char)kind) * 16777619U;
+	for (c = path; *c; c++)
+		h = (h ^ (unsigned char)*c) * 16777619U;
+	len = c - path;
+	b = &p->seen[h % WISK_PROBE_BUCKETS];
+	for (q = *b; q; q = q->next) {
+		if (q->item[0] == kind && strcmp(q->item + 1, path) == 0)
+			return true;
+	}
+	q = malloc(sizeof(*q) + len + 2);
+	if (q) {
+		q->item[0] = kind;
+		memcpy(q->item + 1, path, len + 1);
+		q->next = *b;
+		*b = q;
+	}
+	return false;
+}
+
+static void wisk_probes_flush(struct wisk_node *node)
+{
+	struct wisk_probes *p = node->probes;
+	char *listp[WISK_PROBES_PER_RECORD + 2];
+	struct wisk_probe *q;
+	int i, n;
+
+	if (p == NULL)
+		return;
+	for (i = 0; i < p->ndirs; i++) {
+		listp[0] = p->dirs[i].dir;
+		n = 1;
+		for (q = p->dirs[i].probes; q; q = q->next) {
+			listp[n++] = q->item;
+			if (n == WISK_PROBES_PER_RECORD + 1 || q->next == NULL) {
+				listp[n] = NULL;
+				wisk_report_list(node, WISK_OP_PROBES, listp);
+				n = 1;
+			}
+		}
+		wisk_probe_list_free(p->dirs[i].probes);
+		free(p->dirs[i].dir);
+	}
+	p->ndirs = 0;
+}
+
+static void wisk_report_probe(struct wisk_node *node, char kind, const char *path)
+{
+	const char *s = strrchr(path, '/'), *name;
+	char dir[PATH_MAX];
+	struct wisk_probes *p;
+	struct wisk_probe *q;
+	size_t len;
+	int i;
+
+	if (!WISK_TRACK_EVENT(WISK_TRACK_PROBES))
+		return;
+	if (kind == '*') {
+		snprintf(dir, sizeof(dir), "%s", path);
+		name = "";
+	} else {
+		if (s == NULL || s[1] == '\0')
+			return;
+		snprintf(dir, sizeof(dir), "%.*s", s == path ? 1 : (int)(s - path), path);
+		name = s + 1;
+	}
+	if (node->probes == NULL && (node->probes = calloc(1, sizeof(*node->probes))) == NULL) {
+		WISK_LOG(WISK_LOG_ERROR, "Out of memory for the probes of %s", node->uuid);
+		return;
+	}
+	p = node->probes;
+	if (wisk_probe_seen(p, kind, path))
+		return;
+	for (i = 0; i < p->ndirs && strcmp(p->dirs[i].dir, dir) != 0; i++);
+	if (i == WISK_PROBE_DIRS) {
+		wisk_probes_flush(node);
+		i = 0;
+	}
+	len = strlen(name);
+	q = malloc(sizeof(*q) + len + 2);
+	if (q == NULL)
+		return;
+	if (i == p->ndirs) {
+		if ((p->dirs[i].dir = strdup(dir)) == NULL) {
+			free(q);
+			return;
+		}
+		p->dirs[i].probes = NULL;
+		p->dirs[i].tail = &p->dirs[i].probes;
+		p->ndirs++;
+	}
+	q->item[0] = kind;
+	memcpy(q->item + 1, name, len + 1);
+	q->next = NULL;
+	*p->dirs[i].tail = q;
+	p->dirs[i].tail = &q->next;
+}
+
+static void wisk_report_lookup(struct wisk_node *node, long ret, const char *path)
+{
+	if (ret >= 0)
+		wisk_report_probe(node, '+', path);
+	else if (ret == -ENOENT || ret == -ENOTDIR)
+		wisk_report_probe(node, '-', path);
+}
+
+static void wisk_report_open(struct wisk_node *node, long ret, int flags, const char *path)
+{
+	if (ret < 0 || (flags & O_PATH)) {
+		wisk_report_lookup(node, ret, path);
+	} else if (flags & O_DIRECTORY) {
+		wisk_report_probe(node, '*', path);
+	} else {
+		if ((flags & O_ACCMODE) != O_WRONLY && WISK_TRACK_EVENT(WISK_TRACK_READS))
+			wisk_report(node, WISK_OP_READS, (char *)path);
+		if ((flags & O_ACCMODE) != O_RDONLY && WISK_TRACK_EVENT(WISK_TRACK_WRITES))
+			wisk_report(node, WISK_OP_WRITES, (char *)path);
+	}
+}
+
+/* Stopped on entry to one of wisk_syscalls. Returns whether its result is needed */
+static bool wisk_syscall_enter(struct wisk_task *t, unsigned long idx)
+{
+	struct user_regs_struct regs;
+	struct iovec iov = {&regs, sizeof(regs)};
+	const struct wisk_syscall *sys;
+	int i;
+
+	if (t->node == NULL || !t->node->supervised || idx >= WISK_SYSCALL_COUNT)
+		return false;
+	if (ptrace(PTRACE_GETREGSET, t->tid, NT_PRSTATUS, &iov) < 0)
+		return false;
+	{
+		unsigned long args[6] = WISK_REG_ARGS(regs);
+
+		for (i = 0; i < 6; i++)
+			t->args[i] = args[i];
+	}
+	sys = &wisk_syscalls[idx];
+	WISK_LOG(WISK_LOG_TRACE, "%d: %s", t->tid, sys->name);
+	t->sys = NULL;
+	switch (sys->kind) {
+	case WISK_SYS_EXEC:
+		wisk_exec_setuuid(t, t->args[sys->flags]);
+		return false;
+	case WISK_SYS_FCHMOD:
+		if (!wisk_path_resolve(t->tid, (int)t->args[sys->dirfd], "", t->path))
+			return false;
+		break;
+	case WISK_SYS_LINK:
+		// As the library does, the target of a symlink is taken relative to the cwd
+		if (!wisk_sysarg_path(t, sys->dirfd2, sys->path2, t->path2))
+			return false;
+		/* fall through */
+	default:
+		if (!wisk_sysarg_path(t, sys->dirfd, sys->path, t->path))
+			return false;
+		break;
+	}
+	t->sys = sys;
+	return true;
+}
+
+/* Stopped on exit of the call wisk_syscall_enter() asked the result of */
+static void wisk_syscall_exit(struct wisk_task *t)
+{
+	struct user_regs_struct regs;
+	struct iovec iov = {&regs, sizeof(regs)};
+	const struct wisk_syscall *sys = t->sys;
+	char *listp[] = {t->path, t->path2, NULL};
+	long ret;
+	int flags;
+
+	t->sys = NULL;
+	if (sys == NULL || ptrace(PTRACE_GETREGSET, t->tid, NT_PRSTATUS, &iov) < 0)
+		return;
+	ret = WISK_REG_RET(regs);
+	WISK_LOG(WISK_LOG_TRACE, "%d: %s(%s) = %ld", t->tid, sys->name, t->path, ret);
+	switch (sys->kind) {
+	case WISK_SYS_OPEN:
+		flags = sys->flags < 0 ? O_WRONLY|O_CREAT|O_TRUNC : (int)t->args[sys->flags];
+		wisk_report_open(t->node, ret, flags, t->path);
+		break;
+	case WISK_SYS_LOOKUP:
+		wisk_report_lookup(t->node, ret, t->path);
+		break;
+	case WISK_SYS_UNLINK:
+		if (ret == 0 && WISK_TRACK_EVENT(WISK_TRACK_LINKS))
+			wisk_report(t->node, WISK_OP_UNLINK, t->path);
+		break;
+	case WISK_SYS_LINK:
+		if (ret == 0 && WISK_TRACK_EVENT(WISK_TRACK_LINKS))
+			wisk_report_list(t->node, WISK_OP_LINKS, listp);
+		break;
+	case WISK_SYS_CHMOD:
+	case WISK_SYS_FCHMOD:
+		if (ret == 0 && WISK_TRACK_EVENT(WISK_TRACK_CHMODS))
+			wisk_report(t->node, WISK_OP_CHMOD, t->path);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Whether the program just exec'ed by tid runs libwisktrack.so, i.e. is dynamic and has it preloaded */
+static bool wisk_exec_tracked(pid_t tid, char *const envp[])
+{
+	char path[64];
+	unsigned char ident[EI_NIDENT];
+	Elf64_Ehdr eh64;
+	Elf32_Ehdr eh32;
+	Elf64_Phdr ph64;
+	Elf32_Phdr ph32;
+	uint64_t phoff;
+	int i, fd, phnum, phentsize;
+	bool dynamic = false;
+
+	for (i = 0; envp[i]; i++) {
+		if (strncmp(envp[i], LD_PRELOAD "=", strlen(LD_PRELOAD) + 1) == 0)
+			break;
+	}
+	if (envp[i] == NULL || strstr(envp[i], "libwisktrack") == NULL)
+		return false;
+	snprintf(path, sizeof(path), "/proc/%d/exe", tid);
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	if (pread(fd, ident, sizeof(ident), 0) != sizeof(ident) || memcmp(ident, ELFMAG, SELFMAG) != 0)
+		goto done;
+	if (ident[EI_CLASS] == ELFCLASS64) {
+		if (pread(fd, &eh64, sizeof(eh64), 0) != sizeof(eh64))
+			goto done;
+		phoff = eh64.e_phoff;
+		phnum = eh64.e_phnum;
+		phentsize = eh64.e_phentsize;
+	} else {
+		if (pread(fd, &eh32, sizeof(eh32), 0) != sizeof(eh32))
+			goto done;
+		phoff = eh32.e_phoff;
+		phnum = eh32.e_phnum;
+		phentsize = eh32.e_phentsize;
+	}
+	for (i = 0; i < phnum && !dynamic; i++) {
+		if (ident[EI_CLASS] == ELFCLASS64) {
+			if (pread(fd, &ph64, sizeof(ph64), phoff + i * phentsize) != sizeof(ph64))
+				break;
+			dynamic = (ph64.p_type == PT_INTERP);
+		} else {
+			if (pread(fd, &ph32, sizeof(ph32), phoff + i * phentsize) != sizeof(ph32))
+				break;
+			dynamic = (ph32.p_type == PT_INTERP);
+		}
+	}
+done:
+	close(fd);
+	return dynamic;
+}
+
+static pid_t wisk_getppid(pid_t tid)
+{
+	char path[64], buf[1024], *s;
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", tid);
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+	// pid (comm) state ppid, comm may hold anything
+	s = strrchr(buf, ')');
+	return s ? atoi(s + 4) : 0;
+}
+
+static int wisk_getrandom(void *buf, size_t len)
+{
+	ssize_t n = -1;
+	int fd;
+
+#ifdef HAVE_GETRANDOM
+	n = getrandom(buf, len, GRND_NONBLOCK);
+	if (n == (ssize_t)len)
+		return 0;
+#endif
+	fd = open("/dev/urandom", O_RDONLY|O_CLOEXEC);
+	if (fd >= 0) {
+		n = read(fd, buf, len);
+		close(fd);
+	}
+	return n == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * The task exec'ed a new program. The new node is the child of the node
+ * that exec'ed it when that one is supervised, else of the uuid the program
+ * got from a parent running the library.
+ */
+static void wisk_exec(struct wisk_task *t)
+{
+	struct wisk_node *old = t->node, *node;
+	char path[64], value[PATH_MAX], puuid[UUID_SIZE+1];
+	char *envbuf, **envp, **argv = NULL;
+	size_t envlen = 0, n = strlen(WISK_TRACKER_UUID);
+	ssize_t len;
+	int i;
+
+	node = calloc(1, sizeof(*node));
+	if (node == NULL)
+		return;
+	node->refs = 1;
+	node->pid = t->tid;
+	t->node = node;
+	snprintf(path, sizeof(path), "/proc/%d/environ", t->tid);
+	envbuf = wisk_readfile(path, &envlen);
+	envp = envbuf ? wisk_split(envbuf, envlen) : NULL;
+	if (envp == NULL) {
+		WISK_LOG(WISK_LOG_ERROR, "%d: cannot read the environment", t->tid);
+		goto done;
+	}
+	node->supervised = !wisk_exec_tracked(t->tid, envp);
+	WISK_LOG(WISK_LOG_DEBUG, "%d: exec, %s", t->tid, node->supervised ? "supervised" : "runs the library");
+	if (!node->supervised)
+		goto done;
+
+	if (old && old->supervised) {
+		snprintf(puuid, sizeof(puuid), "%s", old->uuid);
+	} else {
+		snprintf(puuid, sizeof(puuid), "%s", wisk_root_puuid);
+		for (i = 0; envp[i]; i++) {
+			if (strncmp(envp[i], WISK_TRACKER_UUID "=", n + 1) == 0)
+				snprintf(puuid, sizeof(puuid), "%s", envp[i] + n + 1);
+		}
+	}
+	if (wisk_getrandom(&node->raw, sizeof(node->raw)) < 0) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		node->raw.i1 = now.tv_sec;
+		node->raw.i2 = now.tv_nsec;
+		node->raw.i3 = t->tid;
+		node->raw.i4 = getpid();
+	}
+	// The first group is the session, see wisk_uuid_session() of the library
+	for (i = 0; i < 8 && isxdigit((unsigned char)puuid[i]); i++);
+	if (i == 8 && puuid[8] == '-')
+		node->raw.i1 = strtoul(puuid, NULL, 16);
+	snprintf(node->uuid, UUID_SIZE, "%08x-%08x-%08x-%08x", node->raw.i1, node->raw.i2, node->raw.i3, node->raw.i4);
+	node->ppid = wisk_getppid(t->tid);
+	snprintf(path, sizeof(path), "/proc/%d/cmdline", t->tid);
+	node->argv = wisk_readfile(path, &node->argvlen);
+	if (node->argv)
+		argv = wisk_split(node->argv, node->argvlen);
+
+	if (!WISK_TRACK_EVENT(WISK_TRACK_PROCESS))
+		goto done;
+	wisk_report_calls(node, puuid);
+	snprintf(value, sizeof(value), "%d", node->pid);
+	wisk_report(node, WISK_OP_PID, value);
+	snprintf(value, sizeof(value), "%d", node->ppid);
+	wisk_report(node, WISK_OP_PPID, value);
+	snprintf(path, sizeof(path), "/proc/%d/cwd", t->tid);
+	len = readlink(path, value, sizeof(value)-1);
+	value[len < 0 ? 0 : len] = '\0';
+	wisk_report(node, WISK_OP_WORKING_DIRECTORY, value);
+	snprintf(path, sizeof(path), "/proc/%d/exe", t->tid);
+	len = readlink(path, value, sizeof(value)-1);
+	value[len < 0 ? 0 : len] = '\0';
+	wisk_report(node, WISK_OP_COMMAND_PATH, value);
+	if (argv)
+		wisk_report_list(node, WISK_OP_COMMAND, argv);
+	wisk_report_list(node, WISK_OP_ENVIRONMENT, envp);
+done:
+	free(argv);
+	free(envp);
+	free(envbuf);
+	wisk_node_put(old);
+}
+
+/*
+ * The library's COMPLETE, with the rusage wait4() gave for the task. That is
+ * the kernel's RUSAGE_BOTH, the task and its waited for children together,
+ * so it goes out as rusage.both.
+ */
+static void wisk_exit(struct wisk_task *t, const struct rusage *ru)
+{
+	struct wisk_node *node = t->node;
+	char procpbuf[16], pbuf[16], ppbuf[16], argcbuf[16], rubuf[160];
+	char **argv, **listp;
+	int count;
+
+	if (node == NULL || !node->supervised || t->tid != node->pid || !WISK_TRACK_EVENT(WISK_TRACK_PROCESS))
+		return;
+	wisk_probes_flush(node);
+	argv = node->argv ? wisk_split(node->argv, node->argvlen) : NULL;
+	for (count = 0; argv && argv[count]; count++);
+	listp = malloc((count + 6) * sizeof(*listp));
+	if (listp) {
+		snprintf(procpbuf, sizeof(procpbuf), "%d", node->pid);
+		snprintf(pbuf, sizeof(pbuf), "%d", node->pid);
+		snprintf(ppbuf, sizeof(ppbuf), "%d", node->ppid);
+		snprintf(argcbuf, sizeof(argcbuf), "%d", count);
+		listp[0] = procpbuf;
+		listp[1] = pbuf;
+		listp[2] = ppbuf;
+		listp[3] = argcbuf;
+		memcpy(listp + 4, argv ? argv : listp + 4, count * sizeof(*listp));
+		snprintf(rubuf, sizeof(rubuf), "rusage.both=%ld,%ld,%ld,%ld,%ld,%ld,%ld",
+			 (long)ru->ru_utime.tv_sec * 1000000L + (long)ru->ru_utime.tv_usec,
+			 (long)ru->ru_stime.tv_sec * 1000000L + (long)ru->ru_stime.tv_usec,
+			 ru->ru_maxrss, ru->ru_inblock, ru->ru_oublock, ru->ru_nvcsw, ru->ru_nivcsw);
+		listp[count + 4] = rubuf;
+		listp[count + 5] = NULL;
+		wisk_report_list(node, WISK_OP_COMPLETE, listp);
+		free(listp);
+	}
+	free(argv);
+}
+
+/****************************************************************************
+ *   SUPERVISOR
+ ***************************************************************************/
+
+static void wisk_child(char *argv[])
+{
+	char *s = getenv(WISK_TRACKER_PRELOAD);
+
+	if (s) {
+		setenv(LD_PRELOAD, s, 1);
+		unsetenv(WISK_TRACKER_PRELOAD);
+	}
+	if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0) {
+		perror("wisksupervise: ptrace");
+		_exit(127);
+	}
+	raise(SIGSTOP);
+	// For the filter, see wisk_inject()
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+		perror("wisksupervise: prctl");
+		_exit(127);
+	}
+	execvp(argv[0], argv);
+	fprintf(stderr, "wisksupervise: %s: %s\n", argv[0], strerror(errno));
+	_exit(127);
+}
+
+static int wisk_supervise(pid_t root)
+{
+	struct wisk_task *t, *nt;
+	struct rusage ru;
+	unsigned long msg;
+	int status, sig, event, retval = 0, i;
+	pid_t tid;
+
+	wisk_task_get(root, true);
+	for (;;) {
+		tid = wait4(-1, &status, __WALL, &ru);
+		if (tid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			if (tid == root)
+				retval = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+			t = wisk_task_get(tid, false);
+			if (t) {
+				wisk_exit(t, &ru);
+				wisk_task_del(tid);
+			}
+			continue;
+		}
+		if (!WIFSTOPPED(status))
+			continue;
+		sig = WSTOPSIG(status);
+		event = status >> 16;
+		t = wisk_task_get(tid, true);
+		if (!t->attached) {
+			// The SIGSTOP every new task starts with
+			if (sig != SIGSTOP) {
+				wisk_resume(tid, PTRACE_CONT, sig);
+				continue;
+			}
+			t->attached = true;
+			if (tid == root) {
+				if (ptrace(PTRACE_SETOPTIONS, tid, 0, PTRACE_O_TRACESECCOMP|PTRACE_O_TRACEFORK|
+					   PTRACE_O_TRACEVFORK|PTRACE_O_TRACECLONE|PTRACE_O_TRACEEXEC|
+					   PTRACE_O_TRACESYSGOOD|PTRACE_O_EXITKILL) < 0) {
+					WISK_LOG(WISK_LOG_ERROR, "ptrace(PTRACE_SETOPTIONS): %s", strerror(errno));
+					kill(root, SIGKILL);
+				}
+			} else if (t->node == NULL) {
+				// Stopped ahead of the fork event of its parent, which gives it its node
+				t->held = true;
+				continue;
+			}
+			wisk_resume(tid, PTRACE_CONT, 0);
+			continue;
+		}
+		if (sig == (SIGTRAP|0x80) && t->inject) {
+			wisk_resume(tid, wisk_inject(t) ? PTRACE_SYSCALL : PTRACE_CONT, 0);
+			continue;
+		}
+		if (sig == (SIGTRAP|0x80)) {
+			wisk_syscall_exit(t);
+			wisk_resume(tid, PTRACE_CONT, 0);
+			continue;
+		}
+		if (sig != SIGTRAP || event == 0 || event == PTRACE_EVENT_STOP) {
+			wisk_resume(tid, t->inject ? PTRACE_SYSCALL : PTRACE_CONT, sig == SIGTRAP && event ? 0 : sig);
+			continue;
+		}
+		msg = 0;
+		ptrace(PTRACE_GETEVENTMSG, tid, 0, &msg);
+		switch (event) {
+		case PTRACE_EVENT_SECCOMP:
+			wisk_resume(tid, wisk_syscall_enter(t, msg) ? PTRACE_SYSCALL : PTRACE_CONT, 0);
+			continue;
+		case PTRACE_EVENT_FORK:
+		case PTRACE_EVENT_VFORK:
+		case PTRACE_EVENT_CLONE:
+			nt = wisk_task_get((pid_t)msg, true);
+			nt->filtered = t->filtered;
+			if (nt->node == NULL && t->node) {
+				nt->node = t->node;
+				nt->node->refs++;
+			}
+			if (nt->held) {
+				nt->held = false;
+				wisk_resume(nt->tid, PTRACE_CONT, 0);
+			}
+			break;
+		case PTRACE_EVENT_EXEC:
+			// A thread other than the leader exec'ed, it now has the leader's tid
+			if ((pid_t)msg != tid) {
+				nt = wisk_task_get((pid_t)msg, false);
+				if (nt) {
+					wisk_node_put(t->node);
+					t->node = nt->node;
+					t->filtered = nt->filtered;
+					nt->node = NULL;
+					wisk_task_del(nt->tid);
+				}
+			}
+			wisk_exec(t);
+			if (t->node && t->node->supervised && !t->filtered) {
+				t->inject = WISK_INJECT_EXEC;
+				wisk_resume(tid, PTRACE_SYSCALL, 0);
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+		wisk_resume(tid, PTRACE_CONT, 0);
+	}
+	// Tasks not seen to exit still have their nodes' probes to send
+	for (i = 0; i < WISK_TASK_BUCKETS; i++) {
+		while (wisk_tasks[i])
+			wisk_task_del(wisk_tasks[i]->tid);
+	}
+	return retval;
+}
+
+int main(int argc, char *argv[])
+{
+	char *s, spill[PATH_MAX];
+	pid_t root;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <command> [args...]\n", argv[0]);
+		return 1;
+	}
+	s = getenv(WISK_TRACKER_DEBUGLEVEL);
+	if (s)
+		wisk_loglevel = atoi(s);
+	s = getenv(WISK_TRACKER_EVENTFILTER);
+	if (s)
+		wisk_eventfilter = strtoul(s, NULL, 0);
+	s = getenv(WISK_TRACKER_FORMAT);
+	wisk_binary = s && strcmp(s, "binary") == 0;
+	s = getenv(WISK_TRACKER_UUID);
+	if (s)
+		snprintf(wisk_root_puuid, sizeof(wisk_root_puuid), "%s", s);
+	s = getenv(WISK_TRACKER_PIPE);
+	if (getenv(WISK_TRACKER_SPILLDIR)) {
+		snprintf(spill, sizeof(spill), "%s/%d.supervise", getenv(WISK_TRACKER_SPILLDIR), (int)getpid());
+		s = spill;
+	}
+	if (s == NULL) {
+		fprintf(stderr, "%s: %s is not set\n", argv[0], WISK_TRACKER_PIPE);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	root = fork();
+	if (root < 0) {
+		perror("wisksupervise: fork");
+		return 1;
+	}
+	if (root == 0)
+		wisk_child(argv + 1);
+	wisk_pipe = open(s, O_WRONLY|O_APPEND|O_CLOEXEC|(s == spill ? O_CREAT : 0), 0644);
+	if (wisk_pipe < 0)
+		WISK_LOG(WISK_LOG_ERROR, "Tracker pipe %s cannot be opened for write: %s", s, strerror(errno));
+	return wisk_supervise(root);
+}
@@ -43,19 +43,33 @@
 #include <sys/time.h>
 #include <sys/timeb.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/un.h>
 #include <errno.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <spawn.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <fts.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
 #include <linux/limits.h>
+#include <sys/syscall.h>
+#if defined(HAVE_GETRANDOM) && defined(HAVE_SYS_RANDOM_H)
+#include <sys/random.h>
+#endif
 
 
 enum wisk_dbglvl_e {
@@ -123,8 +137,14 @@ enum wisk_dbglvl_e {
 /* Add new global locks here please */
 # define WISK_LOCK_ALL \
 	wisk_mutex_lock(&libc_symbol_binding_mutex); \
+	wisk_mutex_lock(&wisk_batch_list_mutex); \
+	wisk_mutex_lock(&wisk_path_mutex); \
+	wisk_mutex_lock(&wisk_cwd_mutex); \
 
 # define WISK_UNLOCK_ALL \
+	wisk_mutex_unlock(&wisk_cwd_mutex); \
+	wisk_mutex_unlock(&wisk_path_mutex); \
+	wisk_mutex_unlock(&wisk_batch_list_mutex); \
 	wisk_mutex_unlock(&libc_symbol_binding_mutex); \
 
 #define BUFFER_SIZE 4096
@@ -143,8 +163,21 @@ enum wisk_dbglvl_e {
 #define WISK_TRACKER_DEBUGLOG_FD "WISK_TRACKER_DEBUGLOG_FD"
 #define WISK_TRACKER_PIPE "WISK_TRACKER_PIPE"
 #define WISK_TRACKER_PIPE_FD "WISK_TRACKER_PIPE_FD"
+#define WISK_TRACKER_PIPE_SHARDS "WISK_TRACKER_PIPE_SHARDS"
+#define WISK_TRACKER_PIPE_SHARD "WISK_TRACKER_PIPE_SHARD"
 #define WISK_TRACKER_DISABLE_DEEPBIND "WISK_TRACKER_DISABLE_DEEPBIND"
 #define WISK_TRACKER_EVENTFILTER "WISK_TRACKER_EVENTFILTER"
+#define WISK_TRACKER_SHM_FD "WISK_TRACKER_SHM_FD"
+#define WISK_TRACKER_SHM_WAKE_FD "WISK_TRACKER_SHM_WAKE_FD"
+#define WISK_TRACKER_FORMAT "WISK_TRACKER_FORMAT"
+#define WISK_TRACKER_PATHFILTER "WISK_TRACKER_PATHFILTER"
+#define WISK_TRACKER_DEBUGRING "WISK_TRACKER_DEBUGRING"
+#define WISK_TRACKER_ENVIRONMENT "WISK_TRACKER_ENVIRONMENT"
+#define WISK_TRACKER_ENVDIGEST "WISK_TRACKER_ENVDIGEST"
+#define WISK_TRACKER_SPILLDIR "WISK_TRACKER_SPILLDIR"
+#define WISK_TRACKER_SAMPLE "WISK_TRACKER_SAMPLE"
+#define WISK_TRACKER_POLICY "WISK_TRACKER_POLICY"
+#define WISK_TRACKER_OVERFLOW "WISK_TRACKER_OVERFLOW"
 
 char *wisk_env_vars[] = {
 	LD_PRELOAD,
@@ -157,8 +190,21 @@ char *wisk_env_vars[] = {
 	WISK_TRACKER_DEBUGLOG_FD,
 	WISK_TRACKER_PIPE,
 	WISK_TRACKER_PIPE_FD,
+	WISK_TRACKER_PIPE_SHARDS,
+	WISK_TRACKER_PIPE_SHARD,
 	WISK_TRACKER_DISABLE_DEEPBIND,
-	WISK_TRACKER_EVENTFILTER
+	WISK_TRACKER_EVENTFILTER,
+	WISK_TRACKER_SHM_FD,
+	WISK_TRACKER_SHM_WAKE_FD,
+	WISK_TRACKER_FORMAT,
+	WISK_TRACKER_PATHFILTER,
+	WISK_TRACKER_DEBUGRING,
+	WISK_TRACKER_ENVIRONMENT,
+	WISK_TRACKER_ENVDIGEST,
+	WISK_TRACKER_SPILLDIR,
+	WISK_TRACKER_SAMPLE,
+	WISK_TRACKER_POLICY,
+	WISK_TRACKER_OVERFLOW
 };
 
 typedef struct random_uuid_ {
@@ -186,11 +232,56 @@ enum wisk_eventfilter_e {
 	WISK_TRACK_READS,
 	WISK_TRACK_LINKS,
 	WISK_TRACK_CHMODS,
-	WISK_TRACK_PROCESS
+	WISK_TRACK_PROCESS,
+	WISK_TRACK_PROBES
 };
 
 #define WISK_TRACK_EVENT(x) (fs_tracker_eventfilter & (1<<(x)))
 
+/* Operations reported to the tracker, the tag of a binary record */
+enum wisk_op_e {
+	WISK_OP_CALLS = 1,
+	WISK_OP_PID,
+	WISK_OP_PPID,
+	WISK_OP_WORKING_DIRECTORY,
+	WISK_OP_COMMAND_PATH,
+	WISK_OP_COMMAND,
+	WISK_OP_ENVIRONMENT,
+	WISK_OP_READS,
+	WISK_OP_WRITES,
+	WISK_OP_READS_UNKNOWN,
+	WISK_OP_LINKS,
+	WISK_OP_UNLINK,
+	WISK_OP_CHMOD,
+	WISK_OP_COMPLETE,
+	WISK_OP_REPEATS,
+	WISK_OP_ENVIRONMENT_DELTA,
+	WISK_OP_PROBES,
+	WISK_OP_USES
+};
+
+static const char *wisk_op_names[] = {
+	NULL,
+	"CALLS",
+	"PID",
+	"PPID",
+	"WORKING_DIRECTORY",
+	"COMMAND_PATH",
+	"COMMAND",
+	"ENVIRONMENT",
+	"READS",
+	"WRITES",
+	"READS-UNKNOWN",
+	"LINKS",
+	"UNLINK",
+	"CHMOD",
+	"COMPLETE",
+	"REPEATS",
+	"ENVIRONMENT-DELTA",
+	"PROBES",
+	"USES"
+};
+
 #define VNAME(x) wisk_env_vars[x]
 
 #define WISK_ENV_VARCOUNT (sizeof((wisk_env_vars))/sizeof((wisk_env_vars)[0]))
@@ -203,6 +294,8 @@ static int fs_tracker_pipe = -1;
 static int fs_tracker_debuglog = -1;
 static char fs_tracker_uuid[UUID_SIZE+1];
 static char fs_tracker_puuid[UUID_SIZE+1];
+static random_uuid_t fs_tracker_uuid_raw;
+static bool fs_tracker_binary = false;
 static int fs_tracker_eventfilter=0xFFFFFFFF;
 
 /* Mutex to synchronize access to global libc.symbols */
@@ -211,6 +304,13 @@ static pthread_mutex_t libc_symbol_binding_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* Mutex to guard the initialization of array of fs_info structures */
 static pthread_mutex_t fs_tracker_pipe_mutex;
 
+/* Mutex to guard the list of per-thread event batches */
+static pthread_mutex_t wisk_batch_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wisk_path_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wisk_cwd_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Mutex to number and timestamp the records of the process in the same order */
+
 /* Function prototypes */
 
 bool fs_tracker_enabled(void);
@@ -239,8 +339,75 @@ int fd_is_valid(int fd)
     return fcntl(fd, F_GETFD) != -1 || errno != EBADF;
 }
 
+/*
+ * Log sites above WISK_LOG_MAXLEVEL are compiled out; build with
+ * -DWISK_LOG_MAXLEVEL=WISK_LOG_DEBUG (make TRACE=0) to drop the TRACE calls
+ * in every hook. The rest cost a compare against fs_tracker_loglevel, which
+ * is resolved from the environment once, not per call.
+ */
+#ifndef WISK_LOG_MAXLEVEL
+#define WISK_LOG_MAXLEVEL WISK_LOG_TRACE
+#endif
+
+static int fs_tracker_loglevel = -1;
+static int wisk_log_resolve(void);
+
+static inline int wisk_loglevel(void)
+{
+	if (__builtin_expect(fs_tracker_loglevel >= 0, 1))
+		return fs_tracker_loglevel;
+	return wisk_log_resolve();
+}
+
 static void wisk_log(enum wisk_dbglvl_e dbglvl, const char *func, const char *format, ...) PRINTF_ATTRIBUTE(3, 4);
-# define WISK_LOG(dbglvl, ...) wisk_log((dbglvl), __func__, __VA_ARGS__)
+# define WISK_LOG(dbglvl, ...) \
+	do { \
+		if ((dbglvl) <= WISK_LOG_MAXLEVEL && (int)(dbglvl) <= wisk_loglevel()) \
+			wisk_log((dbglvl), __func__, __VA_ARGS__); \
+	} while (0)
+
+/*
+ * Optional in-memory debug ring, WISK_TRACKER_DEBUGRING=<entries>. Every
+ * message up to WISK_LOG_MAXLEVEL is formatted into the next entry, without
+ * a lock or a syscall, and the ring is written to the debug log at exit or
+ * when the process dies of a fatal signal. Entries are claimed with an atomic
+ * counter; an entry overwritten while being dumped is skipped.
+ */
+#define WISK_DEBUGRING_ENTRY 256
+
+struct wisk_debugring_entry {
+	volatile uint64_t seq;
+	char text[WISK_DEBUGRING_ENTRY - sizeof(uint64_t)];
+};
+
+static struct wisk_debugring_entry *wisk_debugring = NULL;
+static uint64_t wisk_debugring_size = 0;
+static uint64_t wisk_debugring_head = 0;
+
+static const int wisk_debugring_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+static struct sigaction wisk_debugring_oldact[sizeof(wisk_debugring_signals)/sizeof(wisk_debugring_signals[0])];
+
+/* The message levels that go straight to the log fd, the ring takes everything */
+static int fs_tracker_loglevel_fd = WISK_LOG_ERROR;
+
+static int wisk_log_resolve(void)
+{
+	const char *d;
+	int lvl = 0;
+
+	if (fs_tracker_debuglog != -1 && fs_tracker_debuglog != 2) {
+		// A dedicated log file gets everything
+		lvl = WISK_LOG_TRACE;
+	} else {
+		d = getenv(WISK_TRACKER_DEBUGLEVEL);
+		if (d != NULL) {
+			lvl = atoi(d);
+		}
+	}
+	fs_tracker_loglevel_fd = lvl;
+	fs_tracker_loglevel = wisk_debugring ? WISK_LOG_TRACE : lvl;
+	return fs_tracker_loglevel;
+}
 
 static void wisk_log(enum wisk_dbglvl_e dbglvl,
 		      const char *func,
@@ -248,23 +415,14 @@ static void wisk_log(enum wisk_dbglvl_e dbglvl,
 {
 	char buffer[1024];
 	va_list va;
-	const char *d;
-	int fdout=2;
-	unsigned int lvl = 0;
+	int fdout=2, n;
+	uint64_t seq;
+	struct wisk_debugring_entry *e;
 	const char *prefix = "WISK";
 	const char *progname = getprogname();
 
 	if (fs_tracker_debuglog != -1 && fs_tracker_debuglog != 2) {
 		fdout = fs_tracker_debuglog;
-	} else {
-		d = getenv(WISK_TRACKER_DEBUGLEVEL);
-		if (d != NULL) {
-			lvl = atoi(d);
-		}
-
-		if (lvl < dbglvl) {
-			return;
-		}
 	}
 
 	va_start(va, format);
@@ -293,6 +451,21 @@ static void wisk_log(enum wisk_dbglvl_e dbglvl,
 		progname = "<unknown>";
 	}
 
+	if (wisk_debugring) {
+		seq = __sync_fetch_and_add(&wisk_debugring_head, 1);
+		e = &wisk_debugring[seq % wisk_debugring_size];
+		e->seq = 0;
+		__sync_synchronize();
+		// An entry is of a fixed size, the message is cut to what is left of it
+		n = snprintf(e->text, sizeof(e->text), "%s[%u] - %s: ", prefix, (unsigned int)getpid(), func);
+		if (n >= 0 && (size_t)n < sizeof(e->text))
+			snprintf(e->text + n, sizeof(e->text) - n, "%.*s", (int)(sizeof(e->text) - n - 1), buffer);
+		__sync_synchronize();
+		e->seq = seq + 1;
+	}
+	if ((int)dbglvl > fs_tracker_loglevel_fd)
+		return;
+
 	dprintf(fdout,
 		"%s[%s (%u:%d:%d:%d)] - %s: %s\n",
 		prefix,
@@ -302,6 +475,74 @@ static void wisk_log(enum wisk_dbglvl_e dbglvl,
 		buffer);
 }
 
+/* Only async signal safe calls, this runs from the fatal signal handler too */
+static void wisk_debugring_dump(const char *why)
+{
+	struct wisk_debugring_entry *e;
+	uint64_t head, seq;
+	int fdout = (fs_tracker_debuglog != -1) ? fs_tracker_debuglog : 2;
+	char line[sizeof(e->text) + 1];
+	size_t len;
+
+	if (wisk_debugring == NULL)
+		return;
+	head = wisk_debugring_head;
+	len = strlen(why);
+	write(fdout, why, len);
+	for (seq = (head > wisk_debugring_size) ? head - wisk_debugring_size : 0; seq < head; seq++) {
+		e = &wisk_debugring[seq % wisk_debugring_size];
+		if (e->seq != seq + 1)
+			continue;
+		len = strnlen(e->text, sizeof(e->text));
+		memcpy(line, e->text, len);
+		__sync_synchronize();
+		if (e->seq != seq + 1)
+			continue;
+		line[len++] = '\n';
+		write(fdout, line, len);
+	}
+}
+
+static void wisk_debugring_signal(int sig, siginfo_t *info, void *ucontext)
+{
+	size_t i;
+
+	(void)ucontext;
+	wisk_debugring_dump("WISK debug ring at fatal signal:\n");
+	// Put back what the program had; the fault repeats, or abort() re-raises, into it
+	for (i = 0; i < sizeof(wisk_debugring_signals)/sizeof(wisk_debugring_signals[0]); i++) {
+		if (wisk_debugring_signals[i] == sig)
+			sigaction(sig, &wisk_debugring_oldact[i], NULL);
+	}
+	// A signal sent with kill() does not repeat, send it again; it is delivered once this returns
+	if (info == NULL || info->si_code <= 0)
+		raise(sig);
+}
+
+static void wisk_debugring_init(void)
+{
+	struct sigaction act;
+	uint64_t entries;
+	void *addr;
+	size_t i;
+	char *d;
+
+	d = getenv(WISK_TRACKER_DEBUGRING);
+	if (d == NULL || wisk_debugring != NULL || (entries = strtoull(d, NULL, 0)) == 0)
+		return;
+	addr = mmap(NULL, entries * sizeof(*wisk_debugring), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return;
+	wisk_debugring_size = entries;
+	wisk_debugring = addr;
+	memset(&act, 0, sizeof(act));
+	act.sa_sigaction = wisk_debugring_signal;
+	act.sa_flags = SA_SIGINFO;
+	sigemptyset(&act.sa_mask);
+	for (i = 0; i < sizeof(wisk_debugring_signals)/sizeof(wisk_debugring_signals[0]); i++)
+		sigaction(wisk_debugring_signals[i], &act, &wisk_debugring_oldact[i]);
+}
+
 /*********************************************************
  * WISK LOADING LIBC FUNCTIONS
  *********************************************************/
@@ -318,6 +559,18 @@ typedef int (*__libc_open)(const char *pathname, int flags, ...);
 typedef int (*__libc_open64)(const char *pathname, int flags, ...);
 #endif /* HAVE_OPEN64 */
 typedef int (*__libc_openat)(int dirfd, const char *path, int flags, ...);
+typedef int (*__libc_close)(int fd);
+typedef int (*__libc_fclose)(FILE *stream);
+typedef int (*__libc_closedir)(DIR *dirp);
+#ifdef HAVE_CLOSE_RANGE
+typedef int (*__libc_close_range)(unsigned int first, unsigned int last, int flags);
+#endif
+#ifdef HAVE_CLOSEFROM
+typedef void (*__libc_closefrom)(int lowfd);
+#endif
+typedef int (*__libc_dup)(int oldfd);
+typedef int (*__libc_dup2)(int oldfd, int newfd);
+typedef int (*__libc_dup3)(int oldfd, int newfd, int flags);
 //typedef int (*__libc_execl)(const char *path, char *const arg, ...);
 //typedef int (*__libc_execlp)(const char *file, char *const arg, ...);
 //typedef int (*__libc_execlpe)(const char *path, const char *arg,..., char * const envp[]);
@@ -340,6 +593,40 @@ typedef int (*__libc_unlinkat)(int dirfd, const char *pathname, int flags);
 typedef int (*__libc_chmod)(__const char *__file, __mode_t __mode);
 typedef int (*__libc_fchmod)(int __fd, __mode_t __mode);
 typedef int (*__libc_fchmodat)(int __fd, __const char *__file, __mode_t __mode, int flags);
+typedef int (*__libc_chdir)(__const char *__path);
+typedef int (*__libc_stat)(const char *pathname, struct stat *statbuf);
+typedef int (*__libc_lstat)(const char *pathname, struct stat *statbuf);
+typedef int (*__libc_fstatat)(int dirfd, const char *pathname, struct stat *statbuf, int flags);
+#ifdef HAVE_STAT64
+typedef int (*__libc_stat64)(const char *pathname, struct stat64 *statbuf);
+typedef int (*__libc_lstat64)(const char *pathname, struct stat64 *statbuf);
+typedef int (*__libc_fstatat64)(int dirfd, const char *pathname, struct stat64 *statbuf, int flags);
+#endif
+typedef int (*__libc___xstat)(int ver, const char *pathname, struct stat *statbuf);
+typedef int (*__libc___lxstat)(int ver, const char *pathname, struct stat *statbuf);
+typedef int (*__libc___fxstatat)(int ver, int dirfd, const char *pathname, struct stat *statbuf, int flags);
+#ifdef HAVE_STAT64
+typedef int (*__libc___xstat64)(int ver, const char *pathname, struct stat64 *statbuf);
+typedef int (*__libc___lxstat64)(int ver, const char *pathname, struct stat64 *statbuf);
+typedef int (*__libc___fxstatat64)(int ver, int dirfd, const char *pathname, struct stat64 *statbuf, int flags);
+#endif
+#ifdef INTERCEPT_STATX
+typedef int (*__libc_statx)(int dirfd, const char *pathname, int flags, unsigned int mask, struct statx *statxbuf);
+#endif
+typedef int (*__libc_access)(const char *pathname, int mode);
+typedef int (*__libc_faccessat)(int dirfd, const char *pathname, int mode, int flags);
+typedef DIR *(*__libc_opendir)(const char *name);
+typedef int (*__libc_fchdir)(int __fd);
+typedef int (*__libc_nftw)(const char *dirpath, __nftw_func_t fn, int nopenfd, int flags);
+typedef int (*__libc_nftw64)(const char *dirpath, __nftw64_func_t fn, int nopenfd, int flags);
+typedef FTS *(*__libc_fts_open)(char * const *argv, int options, int (*compar)(const FTSENT **, const FTSENT **));
+typedef int (*__libc_fts_close)(FTS *ftsp);
+#ifdef HAVE_FTS64
+typedef FTS64 *(*__libc_fts64_open)(char * const *argv, int options, int (*compar)(const FTSENT64 **, const FTSENT64 **));
+typedef int (*__libc_fts64_close)(FTS64 *ftsp);
+#endif
+typedef void (*__libc__exit)(int status);
+typedef void (*__libc__Exit)(int status);
 
 #define WISK_SYMBOL_ENTRY(i) \
 	union { \
@@ -361,6 +648,18 @@ struct wisk_libc_symbols {
 // 	WISK_SYMBOL_ENTRY(execlp);
 // 	WISK_SYMBOL_ENTRY(execlpe);
 	WISK_SYMBOL_ENTRY(openat);
+	WISK_SYMBOL_ENTRY(close);
+	WISK_SYMBOL_ENTRY(fclose);
+	WISK_SYMBOL_ENTRY(closedir);
+#ifdef HAVE_CLOSE_RANGE
+	WISK_SYMBOL_ENTRY(close_range);
+#endif
+#ifdef HAVE_CLOSEFROM
+	WISK_SYMBOL_ENTRY(closefrom);
+#endif
+	WISK_SYMBOL_ENTRY(dup);
+	WISK_SYMBOL_ENTRY(dup2);
+	WISK_SYMBOL_ENTRY(dup3);
  	WISK_SYMBOL_ENTRY(execv);
  	WISK_SYMBOL_ENTRY(execvp);
  	WISK_SYMBOL_ENTRY(execvpe);
@@ -378,6 +677,40 @@ struct wisk_libc_symbols {
 	WISK_SYMBOL_ENTRY(chmod);
 	WISK_SYMBOL_ENTRY(fchmod);
 	WISK_SYMBOL_ENTRY(fchmodat);
+	WISK_SYMBOL_ENTRY(chdir);
+	WISK_SYMBOL_ENTRY(fchdir);
+	WISK_SYMBOL_ENTRY(nftw);
+	WISK_SYMBOL_ENTRY(nftw64);
+	WISK_SYMBOL_ENTRY(fts_open);
+	WISK_SYMBOL_ENTRY(fts_close);
+#ifdef HAVE_FTS64
+	WISK_SYMBOL_ENTRY(fts64_open);
+	WISK_SYMBOL_ENTRY(fts64_close);
+#endif
+	WISK_SYMBOL_ENTRY(stat);
+	WISK_SYMBOL_ENTRY(lstat);
+	WISK_SYMBOL_ENTRY(fstatat);
+#ifdef HAVE_STAT64
+	WISK_SYMBOL_ENTRY(stat64);
+	WISK_SYMBOL_ENTRY(lstat64);
+	WISK_SYMBOL_ENTRY(fstatat64);
+#endif
+	WISK_SYMBOL_ENTRY(__xstat);
+	WISK_SYMBOL_ENTRY(__lxstat);
+	WISK_SYMBOL_ENTRY(__fxstatat);
+#ifdef HAVE_STAT64
+	WISK_SYMBOL_ENTRY(__xstat64);
+	WISK_SYMBOL_ENTRY(__lxstat64);
+	WISK_SYMBOL_ENTRY(__fxstatat64);
+#endif
+#ifdef INTERCEPT_STATX
+	WISK_SYMBOL_ENTRY(statx);
+#endif
+	WISK_SYMBOL_ENTRY(access);
+	WISK_SYMBOL_ENTRY(faccessat);
+	WISK_SYMBOL_ENTRY(opendir);
+	WISK_SYMBOL_ENTRY(_exit);
+	WISK_SYMBOL_ENTRY(_Exit);
 };
 
 struct wisk {
@@ -390,10 +723,6 @@ struct wisk {
 
 static struct wisk wisk;
 
-/* LIBC fopen and open for internale use */
-__libc_fopen internal_fopen = NULL;
-__libc_open internal_open = NULL;
-
 
 /* prototypes */
 static char *fs_tracker_pipe_getpath(void);
@@ -519,7 +848,7 @@ static void *wisk_load_lib_handle(enum wisk_lib lib, bool nocache)
 	return handle;
 }
 
-static void *_wisk_bind_symbol(enum wisk_lib lib, const char *fn_name, bool nocache)
+static void *_wisk_bind_symbol_optional(enum wisk_lib lib, const char *fn_name, bool nocache)
 {
 	void *handle;
 	void *func;
@@ -528,11 +857,11 @@ static void *_wisk_bind_symbol(enum wisk_lib lib, const char *fn_name, bool noca
 
 	func = dlsym(handle, fn_name);
 	if (func == NULL) {
-		WISK_LOG(WISK_LOG_ERROR,
-			  "Failed to find %s: %s\n",
+		WISK_LOG(WISK_LOG_DEBUG,
+			  "Failed to find %s: %s",
 			  fn_name,
 			  dlerror());
-		exit(-1);
+		return NULL;
 	}
 
 	WISK_LOG(WISK_LOG_TRACE,
@@ -543,6 +872,21 @@ static void *_wisk_bind_symbol(enum wisk_lib lib, const char *fn_name, bool noca
 	return func;
 }
 
+static void *_wisk_bind_symbol(enum wisk_lib lib, const char *fn_name, bool nocache)
+{
+	void *func;
+
+	func = _wisk_bind_symbol_optional(lib, fn_name, nocache);
+	if (func == NULL) {
+		WISK_LOG(WISK_LOG_ERROR,
+			  "Failed to find %s\n",
+			  fn_name);
+		exit(-1);
+	}
+
+	return func;
+}
+
 static void wisk_mutex_lock(pthread_mutex_t *mutex)
 {
 	int ret;
@@ -581,6 +925,22 @@ static void wisk_mutex_unlock(pthread_mutex_t *mutex)
 		wisk_mutex_unlock(&libc_symbol_binding_mutex); \
 	}
 
+/*
+ * For the symbols only newer libcs export, the library may run on an older
+ * one than it was built against. fallback stands in when it is not there.
+ */
+#define wisk_bind_symbol_libc_or(sym_name, fallback) \
+	if (wisk.libc.symbols._libc_##sym_name.obj == NULL) { \
+		wisk_mutex_lock(&libc_symbol_binding_mutex); \
+		if (wisk.libc.symbols._libc_##sym_name.obj == NULL) { \
+			wisk.libc.symbols._libc_##sym_name.obj = \
+				_wisk_bind_symbol_optional(WISK_NONE, #sym_name, false); \
+			if (wisk.libc.symbols._libc_##sym_name.obj == NULL) \
+				wisk.libc.symbols._libc_##sym_name.f = fallback; \
+		} \
+		wisk_mutex_unlock(&libc_symbol_binding_mutex); \
+	}
+
 /****************************************************************************
  *                               IMPORTANT
  ****************************************************************************
@@ -693,7 +1053,7 @@ static FILE *libc_popen(const char *command, const char *type)
 
 static FILE *libc_fopen(const char *name, const char *mode)
 {
-	WISK_LOG(WISK_LOG_TRACE, "static libc_fopen(%s, %s)", name, mode);
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_fopen(%s, %s)", name, mode);
 	wisk_bind_symbol_libc(fopen);
 
 	return wisk.libc.symbols._libc_fopen.f(name, mode);
@@ -848,240 +1208,2645 @@ static int libc_fchmodat(int __fd, __const char *__file, __mode_t __mode, int fl
 	return wisk.libc.symbols._libc_fchmodat.f(__fd, __file, __mode, flags);
 }
 
-
-/* DO NOT call this function during library initialization! */
-static void wisk_bind_symbol_all(void)
+static int libc_close(int fd)
 {
-    internal_fopen = (__libc_fopen)_wisk_bind_symbol(WISK_LIBC, "fopen", true);
-    internal_open = (__libc_open)_wisk_bind_symbol(WISK_LIBC, "open", true);
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_close(%d)", fd) ;
+	wisk_bind_symbol_libc(close);
 
-	wisk_bind_symbol_libc(fopen);
-#ifdef HAVE_FOPEN64
-	wisk_bind_symbol_libc(fopen64);
-#endif
-	wisk_bind_symbol_libc(open);
-#ifdef HAVE_OPEN64
-	wisk_bind_symbol_libc(open64);
-#endif
-	wisk_bind_symbol_libc(openat);
-// 	wisk_bind_symbol_libc(execl);
-// 	wisk_bind_symbol_libc(execlp);
-// 	wisk_bind_symbol_libc(execlpe);
- 	wisk_bind_symbol_libc(execv);
- 	wisk_bind_symbol_libc(execvp);
- 	wisk_bind_symbol_libc(execvpe);
- 	wisk_bind_symbol_libc(execve);
-// 	wisk_bind_symbol_libc(execveat);
- 	wisk_bind_symbol_libc(posix_spawn);
- 	wisk_bind_symbol_libc(posix_spawnp);
- 	wisk_bind_symbol_libc(symlink);
- 	wisk_bind_symbol_libc(symlinkat);
- 	wisk_bind_symbol_libc(link);
- 	wisk_bind_symbol_libc(linkat);
-	wisk_bind_symbol_libc(unlink);
-	wisk_bind_symbol_libc(unlinkat);
-	wisk_bind_symbol_libc(chmod);
-	wisk_bind_symbol_libc(fchmod);
-	wisk_bind_symbol_libc(fchmodat);
+	return wisk.libc.symbols._libc_close.f(fd);
 }
 
-/*********************************************************
- * SWRAP HELPER FUNCTIONS
- *********************************************************/
-
-char* ifnotabsolute(char *retbuf, const char *fname)
+static int libc_fclose(FILE *stream)
 {
-	char buf[PATH_MAX];
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_fclose(%p)", stream) ;
+	wisk_bind_symbol_libc(fclose);
 
-	if (fname[0] == '/')
-		return (char*)fname;
-	else {
-		getcwd(buf, PATH_MAX);
-		snprintf(retbuf, PATH_MAX, "%s/%s", buf, fname);
-		return retbuf;
-	}
+	return wisk.libc.symbols._libc_fclose.f(stream);
 }
 
-static inline void escapedcharcopy(char **d, char **s)
+static int libc_closedir(DIR *dirp)
 {
-    int j;
-    char esc_char[]= { '\a','\b','\f','\n','\r','\t','\v','\\', '"'};
-    char essc_str[]= {  'a', 'b', 'f', 'n', 'r', 't', 'v','\\', '"'};
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_closedir(%p)", dirp) ;
+	wisk_bind_symbol_libc(closedir);
 
-    for(j=0; j< 9 ;j++){
-        if( **s==esc_char[j] ){
-          *(*d)++ = '\\';
-          *(*d)++ = essc_str[j];
-          *(*d) = '\0';
-          (*s)++;
-          break;
-        }
-    }
-    if(j == 9 ) {
-        *(*d)++ = *(*s)++;
-        *(*d) = '\0';
-    }
+	return wisk.libc.symbols._libc_closedir.f(dirp);
 }
 
-static inline void flushbuffer(char *msgbuffer, char **trackdest, int *trackcont)
+/* glibc before 2.34 has neither close_range() nor closefrom(), the kernel may still have the syscall */
+#ifdef HAVE_CLOSE_RANGE
+static int wisk_close_range(unsigned int first, unsigned int last, int flags)
 {
-//	msgbuffer[BUFFER_SIZE-1] = '\0';
-    *(*trackdest)++ = '\n';
-    **trackdest='\0';
-    WISK_LOG(WISK_LOG_TRACE, "%d: %.*s", *trackdest - msgbuffer, *trackdest - msgbuffer, msgbuffer);
-	write(fs_tracker_pipe, msgbuffer, *trackdest - msgbuffer);
-    *trackdest = msgbuffer;
-    *msgbuffer='\0';
-    if (trackcont)
-        *trackcont = true;
+#ifdef SYS_close_range
+	return syscall(SYS_close_range, first, last, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
 }
 
-
-// msgbuffer - to use for reporting opersation
-// uuid - associated with operation
-// operation - string
-// valuestr - to copy over
-// idx - < 0 means, it is a single string, if >=0 it is a list, and this is the idx
-// trackdest - current ptr within msgbuffer where the next character can be copied
-// trackcont - Are we in operation start or continuation mode
-static void wisk_report_operation(char *msgbuffer, char const *uuid, char const *operation, char *valuestr, int idx, char **trackdest, int *trackcont)
+static int libc_close_range(unsigned int first, unsigned int last, int flags)
 {
-    char *src, *ldest;
-    int lcont=false;
+	wisk_bind_symbol_libc_or(close_range, wisk_close_range);
 
-//    WISK_LOG(WISK_LOG_TRACE, "%s: %s", uuid, operation);
-    if (trackcont == NULL) {
-        trackcont = &lcont;
-    }
-    if (trackdest == NULL) {
-        ldest = msgbuffer;
-        trackdest = &ldest;
-    }
-    if (*trackdest >= msgbuffer+BUFFER_SIZE-10) { // Enough space to copy a char+'\0' OR escaped char + '\0'
-        flushbuffer(msgbuffer, trackdest, trackcont);
-    }
-    if (*trackdest==msgbuffer) { // If beginning of Buffer
-        *trackdest = msgbuffer+snprintf(*trackdest, BUFFER_SIZE, "%s %s ", uuid, operation);
-        if (*trackcont) {
-            *(*trackdest)++ = '*';
-            *(*trackdest) = '\0';
-        }
-    }
-	if (idx > 0) {
-        *(*trackdest)++ = ',';
-        *(*trackdest)++ = ' ';
-	}
-    *(*trackdest)++ = '"';
-    *(*trackdest) = '\0';
-    for(src=valuestr; *src; ) {
-        if (*trackdest >= msgbuffer+BUFFER_SIZE-10) { // Enough space to copy a char+'\0' OR escaped char + '\0'
-            flushbuffer(msgbuffer, trackdest, trackcont);
-        }
-        if (*trackdest==msgbuffer) { // If beginning of Buffer
-            *trackdest = msgbuffer+snprintf(*trackdest, BUFFER_SIZE, "%s %s ", uuid, operation);
-            if (*trackcont) {
-                *(*trackdest)++ = '*';
-                *(*trackdest) = '\0';
-            }
-            continue;
-        }
-        escapedcharcopy(trackdest, &src);
-	}
-    *(*trackdest)++ = '"';
-    *(*trackdest) = '\0';
-    if (idx < 0) // If idx < 0, its not a list, nothing more flush it
-        flushbuffer(msgbuffer, trackdest, trackcont);
+	return wisk.libc.symbols._libc_close_range.f(first, last, flags);
 }
+#endif
 
-static wisk_report_operationlist(char *msgbuffer, char const *uuid, char const *operation, char *listp[])
+#ifdef HAVE_CLOSEFROM
+static void wisk_closefrom(int lowfd)
 {
-	char *dest = msgbuffer;
-    int cont=0, idx;
+	long fd, max = sysconf(_SC_OPEN_MAX);
 
-//    WISK_LOG(WISK_LOG_TRACE, "%s: %s", uuid, operation);
-    dest = msgbuffer+snprintf(dest, BUFFER_SIZE, "%s %s [", uuid, operation);
-	for(idx=0; listp[idx]; idx++) {
-        WISK_LOG(WISK_LOG_TRACE, "%s: ['%s']", operation, listp[idx]);
-	    wisk_report_operation(msgbuffer, uuid, operation, listp[idx], idx, &dest, &cont);
-	}
-    *dest++ = ']';
-    flushbuffer(msgbuffer, &dest, &cont);
+#ifdef SYS_close_range
+	if (syscall(SYS_close_range, lowfd, ~0U, 0) == 0)
+		return;
+#endif
+	for (fd = lowfd; fd < max; fd++)
+		libc_close(fd);
 }
 
-
-void wisk_report_link(const char *target, const char *linkpath)
+/* Returns 0 as closefrom() has no result, so it passes through WISK_HOOK_REAL() */
+static int libc_closefrom(int lowfd)
 {
-    char msgbuffer[BUFFER_SIZE];
-    char *listp[] = {NULL, NULL, NULL};
-    char tbuf[PATH_MAX], lbuf[PATH_MAX];
-    int msglen;
+	wisk_bind_symbol_libc_or(closefrom, wisk_closefrom);
 
-    if (fs_tracker_pipe < 0)
-    	return;
-	if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_LINKS)) {
-        listp[0] = ifnotabsolute(tbuf, target);
-        listp[1] = ifnotabsolute(lbuf, linkpath);
-        wisk_report_operationlist(msgbuffer, fs_tracker_uuid, "LINKS", listp);
-    } else {
-        WISK_LOG(WISK_LOG_TRACE, "LINKS %s %s", target, linkpath);
-	}
+	wisk.libc.symbols._libc_closefrom.f(lowfd);
+	return 0;
 }
+#endif
 
-void wisk_report_unlink(const char *pathname)
+static int libc_dup(int oldfd)
 {
-    char msgbuffer[BUFFER_SIZE];
-    char buf[PATH_MAX], lbuf[PATH_MAX];
-    int msglen;
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_dup(%d)", oldfd) ;
+	wisk_bind_symbol_libc(dup);
 
-    if (fs_tracker_pipe < 0)
-        return;
-    if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_LINKS)) {
-        wisk_report_operation(msgbuffer, fs_tracker_uuid, "UNLINK", ifnotabsolute(buf, pathname), -1, NULL, NULL);
-    } else {
-        WISK_LOG(WISK_LOG_TRACE, "UNLINK %s", pathname);
-    }
+	return wisk.libc.symbols._libc_dup.f(oldfd);
 }
 
-void wisk_report_chmod(const char *pathname)
+static int libc_dup2(int oldfd, int newfd)
 {
-    char msgbuffer[BUFFER_SIZE];
-    char buf[PATH_MAX], lbuf[PATH_MAX];
-    int msglen;
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_dup2(%d, %d)", oldfd, newfd) ;
+	wisk_bind_symbol_libc(dup2);
 
-    if (fs_tracker_pipe < 0)
-        return;
-    if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_CHMODS)) {
-        wisk_report_operation(msgbuffer, fs_tracker_uuid, "CHMOD", ifnotabsolute(buf, pathname), -1, NULL, NULL);
-    } else {
-        WISK_LOG(WISK_LOG_TRACE, "CHMOD %s", pathname);
-    }
+	return wisk.libc.symbols._libc_dup2.f(oldfd, newfd);
 }
 
-void wisk_report_write(const char *fname)
+static int libc_dup3(int oldfd, int newfd, int flags)
 {
-    char msgbuffer[BUFFER_SIZE];
-    char buf[PATH_MAX];
-    int msglen;
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_dup3(%d, %d, %d)", oldfd, newfd, flags) ;
+	wisk_bind_symbol_libc(dup3);
 
-    if (fs_tracker_pipe < 0)
-    	return;
-	if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_WRITES)) {
-        wisk_report_operation(msgbuffer, fs_tracker_uuid, "WRITES", ifnotabsolute(buf, fname), -1, NULL, NULL);
-    } else {
-        WISK_LOG(WISK_LOG_TRACE, "WRITES %s", fname);
-	}
+	return wisk.libc.symbols._libc_dup3.f(oldfd, newfd, flags);
 }
 
-void wisk_report_read(const char *fname)
+#ifdef INTERCEPT_STAT
+/*
+ * Before glibc 2.33 stat() and friends were inline wrappers of __xstat() and
+ * friends, and libc.so exported only those. _STAT_VER went with them.
+ */
+#ifdef _STAT_VER
+#define WISK_STAT_VER _STAT_VER
+#elif defined(__x86_64__)
+#define WISK_STAT_VER 1
+#elif defined(__i386__)
+#define WISK_STAT_VER 3
+#else
+#define WISK_STAT_VER 0
+#endif
+
+static int wisk_xstat(const char *pathname, struct stat *statbuf)
 {
-    char msgbuffer[BUFFER_SIZE];
-    char buf[PATH_MAX];
-    int msglen;
+	wisk_bind_symbol_libc(__xstat);
 
-    if (fs_tracker_pipe < 0)
+	return wisk.libc.symbols._libc___xstat.f(WISK_STAT_VER, pathname, statbuf);
+}
+
+static int wisk_lxstat(const char *pathname, struct stat *statbuf)
+{
+	wisk_bind_symbol_libc(__lxstat);
+
+	return wisk.libc.symbols._libc___lxstat.f(WISK_STAT_VER, pathname, statbuf);
+}
+
+static int wisk_fxstatat(int dirfd, const char *pathname, struct stat *statbuf, int flags)
+{
+	wisk_bind_symbol_libc(__fxstatat);
+
+	return wisk.libc.symbols._libc___fxstatat.f(WISK_STAT_VER, dirfd, pathname, statbuf, flags);
+}
+
+static int libc_stat(const char *pathname, struct stat *statbuf)
+{
+	wisk_bind_symbol_libc_or(stat, wisk_xstat);
+
+	return wisk.libc.symbols._libc_stat.f(pathname, statbuf);
+}
+
+static int libc_lstat(const char *pathname, struct stat *statbuf)
+{
+	wisk_bind_symbol_libc_or(lstat, wisk_lxstat);
+
+	return wisk.libc.symbols._libc_lstat.f(pathname, statbuf);
+}
+
+static int libc_fstatat(int dirfd, const char *pathname, struct stat *statbuf, int flags)
+{
+	wisk_bind_symbol_libc_or(fstatat, wisk_fxstatat);
+
+	return wisk.libc.symbols._libc_fstatat.f(dirfd, pathname, statbuf, flags);
+}
+
+#ifdef HAVE_STAT64
+static int wisk_xstat64(const char *pathname, struct stat64 *statbuf)
+{
+	wisk_bind_symbol_libc(__xstat64);
+
+	return wisk.libc.symbols._libc___xstat64.f(WISK_STAT_VER, pathname, statbuf);
+}
+
+static int wisk_lxstat64(const char *pathname, struct stat64 *statbuf)
+{
+	wisk_bind_symbol_libc(__lxstat64);
+
+	return wisk.libc.symbols._libc___lxstat64.f(WISK_STAT_VER, pathname, statbuf);
+}
+
+static int wisk_fxstatat64(int dirfd, const char *pathname, struct stat64 *statbuf, int flags)
+{
+	wisk_bind_symbol_libc(__fxstatat64);
+
+	return wisk.libc.symbols._libc___fxstatat64.f(WISK_STAT_VER, dirfd, pathname, statbuf, flags);
+}
+
+static int libc_stat64(const char *pathname, struct stat64 *statbuf)
+{
+	wisk_bind_symbol_libc_or(stat64, wisk_xstat64);
+
+	return wisk.libc.symbols._libc_stat64.f(pathname, statbuf);
+}
+
+static int libc_lstat64(const char *pathname, struct stat64 *statbuf)
+{
+	wisk_bind_symbol_libc_or(lstat64, wisk_lxstat64);
+
+	return wisk.libc.symbols._libc_lstat64.f(pathname, statbuf);
+}
+
+static int libc_fstatat64(int dirfd, const char *pathname, struct stat64 *statbuf, int flags)
+{
+	wisk_bind_symbol_libc_or(fstatat64, wisk_fxstatat64);
+
+	return wisk.libc.symbols._libc_fstatat64.f(dirfd, pathname, statbuf, flags);
+}
+#endif /* HAVE_STAT64 */
+#endif
+
+#ifdef INTERCEPT_XSTAT
+static int libc___xstat(int ver, const char *pathname, struct stat *statbuf)
+{
+	wisk_bind_symbol_libc(__xstat);
+
+	return wisk.libc.symbols._libc___xstat.f(ver, pathname, statbuf);
+}
+
+static int libc___lxstat(int ver, const char *pathname, struct stat *statbuf)
+{
+	wisk_bind_symbol_libc(__lxstat);
+
+	return wisk.libc.symbols._libc___lxstat.f(ver, pathname, statbuf);
+}
+
+static int libc___fxstatat(int ver, int dirfd, const char *pathname, struct stat *statbuf, int flags)
+{
+	wisk_bind_symbol_libc(__fxstatat);
+
+	return wisk.libc.symbols._libc___fxstatat.f(ver, dirfd, pathname, statbuf, flags);
+}
+
+#ifdef HAVE_STAT64
+static int libc___xstat64(int ver, const char *pathname, struct stat64 *statbuf)
+{
+	wisk_bind_symbol_libc(__xstat64);
+
+	return wisk.libc.symbols._libc___xstat64.f(ver, pathname, statbuf);
+}
+
+static int libc___lxstat64(int ver, const char *pathname, struct stat64 *statbuf)
+{
+	wisk_bind_symbol_libc(__lxstat64);
+
+	return wisk.libc.symbols._libc___lxstat64.f(ver, pathname, statbuf);
+}
+
+static int libc___fxstatat64(int ver, int dirfd, const char *pathname, struct stat64 *statbuf, int flags)
+{
+	wisk_bind_symbol_libc(__fxstatat64);
+
+	return wisk.libc.symbols._libc___fxstatat64.f(ver, dirfd, pathname, statbuf, flags);
+}
+#endif /* HAVE_STAT64 */
+#endif
+
+#ifdef INTERCEPT_STATX
+/* glibc before 2.28 has no statx(), the kernel may still have the syscall */
+static int wisk_statx(int dirfd, const char *pathname, int flags, unsigned int mask, struct statx *statxbuf)
+{
+#ifdef SYS_statx
+	return syscall(SYS_statx, dirfd, pathname, flags, mask, statxbuf);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int libc_statx(int dirfd, const char *pathname, int flags, unsigned int mask, struct statx *statxbuf)
+{
+	wisk_bind_symbol_libc_or(statx, wisk_statx);
+
+	return wisk.libc.symbols._libc_statx.f(dirfd, pathname, flags, mask, statxbuf);
+}
+#endif
+
+#ifdef INTERCEPT_ACCESS
+static int libc_access(const char *pathname, int mode)
+{
+	wisk_bind_symbol_libc(access);
+
+	return wisk.libc.symbols._libc_access.f(pathname, mode);
+}
+
+static int libc_faccessat(int dirfd, const char *pathname, int mode, int flags)
+{
+	wisk_bind_symbol_libc(faccessat);
+
+	return wisk.libc.symbols._libc_faccessat.f(dirfd, pathname, mode, flags);
+}
+#endif
+
+#ifdef INTERCEPT_OPENDIR
+static DIR * libc_opendir(const char *name)
+{
+	wisk_bind_symbol_libc(opendir);
+
+	return wisk.libc.symbols._libc_opendir.f(name);
+}
+#endif
+
+static int libc_chdir(__const char *__path)
+{
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_chdir(%s)", __path) ;
+	wisk_bind_symbol_libc(chdir);
+
+	return wisk.libc.symbols._libc_chdir.f(__path);
+}
+
+static int libc_fchdir(int __fd)
+{
+//	WISK_LOG(WISK_LOG_TRACE, "static libc_fchdir(%d)", __fd) ;
+	wisk_bind_symbol_libc(fchdir);
+
+	return wisk.libc.symbols._libc_fchdir.f(__fd);
+}
+
+static int libc_nftw(const char *dirpath, __nftw_func_t fn, int nopenfd, int flags)
+{
+	wisk_bind_symbol_libc(nftw);
+
+	return wisk.libc.symbols._libc_nftw.f(dirpath, fn, nopenfd, flags);
+}
+
+static int libc_nftw64(const char *dirpath, __nftw64_func_t fn, int nopenfd, int flags)
+{
+	wisk_bind_symbol_libc(nftw64);
+
+	return wisk.libc.symbols._libc_nftw64.f(dirpath, fn, nopenfd, flags);
+}
+
+static FTS *libc_fts_open(char * const *argv, int options, int (*compar)(const FTSENT **, const FTSENT **))
+{
+	wisk_bind_symbol_libc(fts_open);
+
+	return wisk.libc.symbols._libc_fts_open.f(argv, options, compar);
+}
+
+static int libc_fts_close(FTS *ftsp)
+{
+	wisk_bind_symbol_libc(fts_close);
+
+	return wisk.libc.symbols._libc_fts_close.f(ftsp);
+}
+
+#ifdef HAVE_FTS64
+/* glibc before 2.34 has no fts64, a program that calls it was not linked against one */
+static FTS64 *wisk_fts64_open(char * const *argv, int options, int (*compar)(const FTSENT64 **, const FTSENT64 **))
+{
+	(void)argv, (void)options, (void)compar;
+	errno = ENOSYS;
+	return NULL;
+}
+
+static int wisk_fts64_close(FTS64 *ftsp)
+{
+	(void)ftsp;
+	errno = ENOSYS;
+	return -1;
+}
+
+static FTS64 *libc_fts64_open(char * const *argv, int options, int (*compar)(const FTSENT64 **, const FTSENT64 **))
+{
+	wisk_bind_symbol_libc_or(fts64_open, wisk_fts64_open);
+
+	return wisk.libc.symbols._libc_fts64_open.f(argv, options, compar);
+}
+
+static int libc_fts64_close(FTS64 *ftsp)
+{
+	wisk_bind_symbol_libc_or(fts64_close, wisk_fts64_close);
+
+	return wisk.libc.symbols._libc_fts64_close.f(ftsp);
+}
+#endif
+
+static void libc__exit(int status)
+{
+//	WISK_LOG(WISK_LOG_TRACE, "static libc__exit(%d)", status) ;
+	wisk_bind_symbol_libc(_exit);
+
+	wisk.libc.symbols._libc__exit.f(status);
+}
+
+static void libc__Exit(int status)
+{
+//	WISK_LOG(WISK_LOG_TRACE, "static libc__Exit(%d)", status) ;
+	wisk_bind_symbol_libc(_Exit);
+
+	wisk.libc.symbols._libc__Exit.f(status);
+}
+
+
+/* DO NOT call this function during library initialization! */
+static void wisk_bind_symbol_all(void)
+{
+	wisk_bind_symbol_libc(fopen);
+#ifdef HAVE_FOPEN64
+	wisk_bind_symbol_libc(fopen64);
+#endif
+	wisk_bind_symbol_libc(open);
+#ifdef HAVE_OPEN64
+	wisk_bind_symbol_libc(open64);
+#endif
+	wisk_bind_symbol_libc(openat);
+	wisk_bind_symbol_libc(close);
+	wisk_bind_symbol_libc(fclose);
+	wisk_bind_symbol_libc(closedir);
+#ifdef HAVE_CLOSE_RANGE
+	wisk_bind_symbol_libc_or(close_range, wisk_close_range);
+#endif
+#ifdef HAVE_CLOSEFROM
+	wisk_bind_symbol_libc_or(closefrom, wisk_closefrom);
+#endif
+	wisk_bind_symbol_libc(dup);
+	wisk_bind_symbol_libc(dup2);
+	wisk_bind_symbol_libc(dup3);
+// 	wisk_bind_symbol_libc(execl);
+// 	wisk_bind_symbol_libc(execlp);
+// 	wisk_bind_symbol_libc(execlpe);
+ 	wisk_bind_symbol_libc(execv);
+ 	wisk_bind_symbol_libc(execvp);
+ 	wisk_bind_symbol_libc(execvpe);
+ 	wisk_bind_symbol_libc(execve);
+// 	wisk_bind_symbol_libc(execveat);
+ 	wisk_bind_symbol_libc(posix_spawn);
+ 	wisk_bind_symbol_libc(posix_spawnp);
+ 	wisk_bind_symbol_libc(symlink);
+ 	wisk_bind_symbol_libc(symlinkat);
+ 	wisk_bind_symbol_libc(link);
+ 	wisk_bind_symbol_libc(linkat);
+	wisk_bind_symbol_libc(unlink);
+	wisk_bind_symbol_libc(unlinkat);
+	wisk_bind_symbol_libc(chmod);
+	wisk_bind_symbol_libc(fchmod);
+	wisk_bind_symbol_libc(fchmodat);
+	wisk_bind_symbol_libc(chdir);
+	wisk_bind_symbol_libc(fchdir);
+#ifdef INTERCEPT_NFTW
+	wisk_bind_symbol_libc(nftw);
+	wisk_bind_symbol_libc(nftw64);
+#endif
+#ifdef INTERCEPT_FTS
+	wisk_bind_symbol_libc(fts_open);
+	wisk_bind_symbol_libc(fts_close);
+#ifdef HAVE_FTS64
+	wisk_bind_symbol_libc_or(fts64_open, wisk_fts64_open);
+	wisk_bind_symbol_libc_or(fts64_close, wisk_fts64_close);
+#endif
+#endif
+// Without them the hooks fall back to __xstat() and friends when called
+#if defined(INTERCEPT_STAT) && defined(HAVE_STAT)
+	wisk_bind_symbol_libc_or(stat, wisk_xstat);
+	wisk_bind_symbol_libc_or(lstat, wisk_lxstat);
+	wisk_bind_symbol_libc_or(fstatat, wisk_fxstatat);
+#ifdef HAVE_STAT64
+	wisk_bind_symbol_libc_or(stat64, wisk_xstat64);
+	wisk_bind_symbol_libc_or(lstat64, wisk_lxstat64);
+	wisk_bind_symbol_libc_or(fstatat64, wisk_fxstatat64);
+#endif
+#endif
+#ifdef INTERCEPT_XSTAT
+	wisk_bind_symbol_libc(__xstat);
+	wisk_bind_symbol_libc(__lxstat);
+	wisk_bind_symbol_libc(__fxstatat);
+#ifdef HAVE_STAT64
+	wisk_bind_symbol_libc(__xstat64);
+	wisk_bind_symbol_libc(__lxstat64);
+	wisk_bind_symbol_libc(__fxstatat64);
+#endif
+#endif
+#ifdef INTERCEPT_STATX
+	wisk_bind_symbol_libc_or(statx, wisk_statx);
+#endif
+#ifdef INTERCEPT_ACCESS
+	wisk_bind_symbol_libc(access);
+	wisk_bind_symbol_libc(faccessat);
+#endif
+#ifdef INTERCEPT_OPENDIR
+	wisk_bind_symbol_libc(opendir);
+#endif
+	wisk_bind_symbol_libc(_exit);
+	wisk_bind_symbol_libc(_Exit);
+}
+
+/*********************************************************
+ * WISK SHARED MEMORY TRANSPORT
+ *********************************************************/
+
+/*
+ * When the collector passes WISK_TRACKER_SHM_FD, batches are published into a
+ * shared memory region of lock-free multi-producer rings instead of being
+ * written to the FIFO, so the common case costs no syscall. A process always
+ * publishes into the same ring, which keeps its records in order. The FIFO is
+ * still opened: the collector uses it to find out that every tracked process
+ * is gone, and it takes the records of a process whose ring stayed full for
+ * too long.
+ *
+ * Layout, shared with TrackerRing in wisktrack.py:
+ *   header:  magic, version, nrings, ringsize, waiting (64 bytes)
+ *   ring[i]: head (64 bytes), tail (64 bytes), data[ringsize]
+ * A record is a 32 bit length/flags word, the 32 bit pid of the process that
+ * reserved it, then the data, padded to 8 bytes. The collector zeroes what it
+ * consumed before it moves tail, so free space always reads as zero.
+ *
+ * A process reserves a slot by swapping the zero header at head for its
+ * WISK_SHM_RESERVED length and pid in one 64 bit CAS, and only then moves
+ * head past it. Any process that finds the header at head already taken
+ * moves head past it for its owner, so every slot below head carries its
+ * length. A process killed before it commits leaves a slot the collector can
+ * step over once the pid is gone, rather than stall the ring behind it.
+ *
+ * A collector with nothing left to drain sets waiting and sleeps on the
+ * WISK_TRACKER_SHM_WAKE_FD eventfd. The first process to commit after that
+ * clears waiting and writes the eventfd, the others don't make the syscall.
+ */
+#define WISK_SHM_MAGIC 0x4d485357	/* "WSHM" */
+#define WISK_SHM_VERSION 3
+#define WISK_SHM_HEADER_SIZE 64
+#define WISK_SHM_RING_HEADER_SIZE 128
+#define WISK_SHM_COMMITTED 0x80000000U
+#define WISK_SHM_PADDING 0x40000000U
+#define WISK_SHM_RESERVED 0x20000000U
+#define WISK_SHM_LENMASK 0x1FFFFFFFU
+#define WISK_SHM_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+#define WISK_SHM_WAIT_USEC 50
+#define WISK_SHM_WAIT_LIMIT 2000
+
+struct wisk_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nrings;
+	uint32_t ringsize;
+	uint32_t waiting;
+};
+
+struct wisk_shm_ring {
+	uint64_t head;
+	char pad1[56];
+	uint64_t tail;
+	char pad2[56];
+	char data[];
+};
+
+static char *fs_tracker_shm = NULL;
+static size_t fs_tracker_shm_size = 0;
+static struct wisk_shm_ring *fs_tracker_ring = NULL;
+static bool fs_tracker_ring_overflowed = false;
+static int fs_tracker_shm_wake = -1;
+
+static void wisk_shm_select_ring(void)
+{
+	struct wisk_shm_header *hdr = (struct wisk_shm_header *)fs_tracker_shm;
+
+	if (fs_tracker_shm == NULL)
+		return;
+	fs_tracker_ring = (struct wisk_shm_ring *)(fs_tracker_shm + WISK_SHM_HEADER_SIZE +
+			(getpid() % hdr->nrings) * (size_t)(WISK_SHM_RING_HEADER_SIZE + hdr->ringsize));
+	fs_tracker_ring_overflowed = false;
+}
+
+static void wisk_shm_init(void)
+{
+	struct wisk_shm_header *hdr;
+	struct stat st;
+	void *addr;
+	char *d;
+	int fd;
+
+	d = getenv(WISK_TRACKER_SHM_FD);
+	if (d == NULL)
+		return;
+	fd = atoi(d);
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < WISK_SHM_HEADER_SIZE) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Shared Memory %s=%s is not usable, using the Pipe", WISK_TRACKER_SHM_FD, d);
+		return;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Shared Memory mmap failed, %d: %s", errno, strerror(errno));
+		return;
+	}
+	hdr = addr;
+	if (hdr->magic != WISK_SHM_MAGIC || hdr->version != WISK_SHM_VERSION || hdr->nrings == 0 ||
+	    hdr->ringsize == 0 || (hdr->ringsize & (hdr->ringsize - 1)) ||
+	    WISK_SHM_HEADER_SIZE + hdr->nrings * (uint64_t)(WISK_SHM_RING_HEADER_SIZE + hdr->ringsize) > (uint64_t)st.st_size) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Shared Memory has an unrecognized layout, using the Pipe");
+		munmap(addr, st.st_size);
+		return;
+	}
+	fs_tracker_shm = addr;
+	fs_tracker_shm_size = st.st_size;
+	d = getenv(WISK_TRACKER_SHM_WAKE_FD);
+	if (d && fd_is_valid(atoi(d)))
+		fs_tracker_shm_wake = atoi(d);
+	wisk_shm_select_ring();
+	WISK_LOG(WISK_LOG_TRACE, "Tracker Shared Memory: %u rings of %u bytes", hdr->nrings, hdr->ringsize);
+}
+
+/* The commit must be visible before waiting is read, or the collector could miss both */
+static inline void wisk_shm_wake(void)
+{
+	struct wisk_shm_header *hdr = (struct wisk_shm_header *)fs_tracker_shm;
+	uint64_t one = 1;
+	int saved_errno;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (fs_tracker_shm_wake < 0 || !__atomic_load_n(&hdr->waiting, __ATOMIC_RELAXED) ||
+	    !__atomic_exchange_n(&hdr->waiting, 0, __ATOMIC_SEQ_CST))
+		return;
+	saved_errno = errno;
+	if (write(fs_tracker_shm_wake, &one, sizeof(one)) < 0)
+		WISK_LOG(WISK_LOG_DEBUG, "Tracker Shared Memory wakeup failed, %d: %s", errno, strerror(errno));
+	errno = saved_errno;
+}
+
+/*
+ * Returns false if the record has to go to the FIFO instead. Once the ring
+ * stays full for WISK_SHM_WAIT_LIMIT waits the process keeps using the FIFO,
+ * rather than stalling on every batch.
+ */
+static bool wisk_shm_publish(const char *buf, size_t len)
+{
+	struct wisk_shm_ring *ring = fs_tracker_ring;
+	struct timespec wait = {0, WISK_SHM_WAIT_USEC * 1000};
+	uint64_t head, tail, need, pad, size, span;
+	uint64_t off, word, claim;
+	uint64_t *slot;
+	uint32_t pair[2];
+	int waits = 0;
+
+	if (ring == NULL || fs_tracker_ring_overflowed)
+		return false;
+	size = ((struct wisk_shm_header *)fs_tracker_shm)->ringsize;
+	need = WISK_SHM_ALIGN(8 + len);
+	if (need > size / 2)
+		return false;
+	for (;;) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		off = head & (size - 1);
+		pad = (off + need > size) ? size - off : 0;
+		if (head + pad + need - tail > size) {
+			if (++waits > WISK_SHM_WAIT_LIMIT) {
+				WISK_LOG(WISK_LOG_WARN, "Tracker Shared Memory ring full, falling back to the Pipe");
+				fs_tracker_ring_overflowed = true;
+				return false;
+			}
+			nanosleep(&wait, NULL);
+			continue;
+		}
+		/* The padding up to the end of the ring is a slot of its own, committed as it is claimed */
+		pair[0] = pad ? (uint32_t)(pad - 8) | WISK_SHM_PADDING | WISK_SHM_COMMITTED : (uint32_t)len | WISK_SHM_RESERVED;
+		pair[1] = (uint32_t)getpid();
+		memcpy(&claim, pair, sizeof(claim));
+		span = pad ? pad : need;
+		slot = (uint64_t *)(ring->data + off);
+		word = 0;
+		if (!__atomic_compare_exchange_n(slot, &word, claim, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			/* Taken by another process that has yet to move head past it */
+			memcpy(pair, &word, sizeof(pair));
+			__atomic_compare_exchange_n(&ring->head, &head,
+						    head + WISK_SHM_ALIGN(8 + (pair[0] & WISK_SHM_LENMASK)),
+						    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+			continue;
+		}
+		/*
+		 * head was stale: the slot it pointed at was claimed, drained and
+		 * zeroed meanwhile. Hand the word back, it is free space.
+		 */
+		if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > head) {
+			__atomic_compare_exchange_n(slot, &claim, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+			continue;
+		}
+		/* Fails only when another process already moved head past the claim */
+		__atomic_compare_exchange_n(&ring->head, &head, head + span, false,
+					    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		if (!pad)
+			break;
+	}
+	memcpy(ring->data + off + 8, buf, len);
+	__atomic_store_n((uint32_t *)(ring->data + off), (uint32_t)len | WISK_SHM_COMMITTED, __ATOMIC_RELEASE);
+	wisk_shm_wake();
+	return true;
+}
+
+/*********************************************************
+ * WISK SPILL FILE TRANSPORT
+ *********************************************************/
+
+/*
+ * When the collector passes WISK_TRACKER_SPILLDIR, every tracked process
+ * appends its records to a file of its own, <dir>/<pid>.<uuid>, instead of
+ * writing to the shared FIFO. No two processes ever write to the same file,
+ * so there is no contention and no reader to keep up with, and whatever was
+ * written survives the collector. The collector merges the files into the raw
+ * trace once the build is done. A child forked without exec switches to a
+ * file of its own as well, it keeps the file of the parent only if its own
+ * cannot be created.
+ */
+static char wisk_spill_dir[PATH_MAX];
+
+static int wisk_spill_open(void)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%d.%s", wisk_spill_dir, (int)getpid(), fs_tracker_uuid) >= (int)sizeof(path)) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Spill File in %s, path too long", wisk_spill_dir);
+		return -1;
+	}
+	fd = libc_open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+	if (fd == -1) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Spill File %s cannot be opened for write, %d: %s",
+			 path, errno, strerror(errno));
+	}
+	return fd;
+}
+
+static void wisk_spill_atfork_child(void)
+{
+	int fd;
+
+	if (wisk_spill_dir[0] == '\0' || fs_tracker_pipe < 0)
+		return;
+	fd = wisk_spill_open();
+	if (fd == -1)
+		return;
+	libc_dup3(fd, fs_tracker_pipe, O_CLOEXEC);
+	libc_close(fd);
+}
+
+/*********************************************************
+ * WISK OVERFLOW SPILL
+ *********************************************************/
+
+/*
+ * With WISK_TRACKER_OVERFLOW the FIFO is written without blocking, a stalled
+ * collector must not stall the build. A batch the FIFO has no room for goes
+ * to a file of the process, <dir>/<pid>.<uuid>, and so does everything the
+ * process writes after it, its records must reach the trace in order. The
+ * collector appends the overflow files to the trace once the session is
+ * drained. What cannot be written anywhere is dropped, the FIFO is tried
+ * again for the next batch when there is no overflow file, so the COMPLETE
+ * of the process still has a chance. Both are counted in records and
+ * reported in COMPLETE.
+ *
+ * The state belongs to wisk_overflow_owner. A vfork() child flushing before
+ * its exec shares the memory of its parent, it writes to a file of its own
+ * that it closes again and leaves the fd, the flag and the counts alone.
+ */
+static char wisk_overflow_dir[PATH_MAX];
+static pid_t wisk_overflow_owner;
+static int wisk_overflow_fd = -1;
+static int wisk_overflowed;
+static uint64_t wisk_overflow_spilled;
+static uint64_t wisk_overflow_dropped;
+
+/* Called with the tracker pipe open, only a FIFO can be full */
+static void wisk_overflow_init(void)
+{
+	struct stat st;
+	char *d;
+	int flags;
+
+	d = getenv(WISK_TRACKER_OVERFLOW);
+	if (d == NULL || d[0] == '\0' || fs_tracker_pipe < 0)
+		return;
+	if (fstat(fs_tracker_pipe, &st) != 0 || !S_ISFIFO(st.st_mode))
+		return;
+	flags = fcntl(fs_tracker_pipe, F_GETFL);
+	if (flags == -1 || fcntl(fs_tracker_pipe, F_SETFL, flags|O_NONBLOCK) == -1) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Pipe cannot be made non blocking, %d: %s", errno, strerror(errno));
+		return;
+	}
+	snprintf(wisk_overflow_dir, sizeof(wisk_overflow_dir), "%s", d);
+	wisk_overflow_owner = getpid();
+	WISK_LOG(WISK_LOG_TRACE, "Tracker Overflow Directory %s", wisk_overflow_dir);
+}
+
+static int wisk_overflow_create(pid_t pid)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%d.%s", wisk_overflow_dir, (int)pid, fs_tracker_uuid) >= (int)sizeof(path)) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Overflow File in %s, path too long", wisk_overflow_dir);
+		return -1;
+	}
+	fd = libc_open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+	if (fd == -1) {
+		WISK_LOG(WISK_LOG_ERROR, "Tracker Overflow File %s cannot be opened for write, %d: %s",
+			 path, errno, strerror(errno));
+	}
+	return fd;
+}
+
+/* Opened on the first overflow of the owner, by whichever thread gets there first */
+static int wisk_overflow_open(void)
+{
+	int fd;
+
+	if (wisk_overflow_fd >= 0)
+		return wisk_overflow_fd;
+	fd = wisk_overflow_create(wisk_overflow_owner);
+	if (fd == -1)
+		return -1;
+	if (!__sync_bool_compare_and_swap(&wisk_overflow_fd, -1, fd))
+		libc_close(fd);
+	return wisk_overflow_fd;
+}
+
+/* Whole records, so the collector can append the file as it is */
+static void wisk_overflow_write(const char *buf, size_t len, unsigned int records)
+{
+	pid_t pid = getpid();
+	bool owner = pid == wisk_overflow_owner;
+	int fd = owner ? wisk_overflow_open() : wisk_overflow_create(pid);
+	ssize_t n;
+
+	if (fd >= 0 && owner)
+		wisk_overflowed = 1;
+	while (fd >= 0 && len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			WISK_LOG(WISK_LOG_ERROR, "Tracker Overflow write failed, %d: %s", errno, strerror(errno));
+			break;
+		}
+		buf += n;
+		len -= n;
+	}
+	if (!owner) {
+		if (fd >= 0)
+			libc_close(fd);
+		return;
+	}
+	if (len == 0)
+		__sync_fetch_and_add(&wisk_overflow_spilled, records);
+	else
+		__sync_fetch_and_add(&wisk_overflow_dropped, records);
+}
+
+/* A child forked without exec overflows to a file of its own, if at all */
+static void wisk_overflow_atfork_child(void)
+{
+	if (wisk_overflow_fd >= 0)
+		libc_close(wisk_overflow_fd);
+	wisk_overflow_fd = -1;
+	wisk_overflow_owner = getpid();
+	wisk_overflowed = 0;
+	wisk_overflow_spilled = 0;
+	wisk_overflow_dropped = 0;
+}
+
+/*********************************************************
+ * WISK OVERHEAD ACCOUNTING
+ *********************************************************/
+
+/*
+ * Every hook counts its calls, the records it emits, their bytes and the
+ * cycles spent in the library itself, the real libc call excluded. The
+ * counters are per thread, they live in the thread's batch, and are summed up
+ * into the COMPLETE record of the process. Where there is no TSC the clock is
+ * in nanoseconds. Hooks nest, for one the library's initialization inside
+ * the first intercepted call, and the outer hook is paused meanwhile.
+ */
+enum wisk_hook_e {
+	WISK_HOOK_INIT = 0,
+	WISK_HOOK_EXIT,
+	WISK_HOOK_OPEN,
+	WISK_HOOK_OPEN64,
+	WISK_HOOK_OPENAT,
+	WISK_HOOK_FOPEN,
+	WISK_HOOK_FOPEN64,
+	WISK_HOOK_CLOSE,
+	WISK_HOOK_DUP,
+	WISK_HOOK_STAT,
+	WISK_HOOK_ACCESS,
+	WISK_HOOK_OPENDIR,
+	WISK_HOOK_EXEC,
+	WISK_HOOK_SPAWN,
+	WISK_HOOK_LINK,
+	WISK_HOOK_UNLINK,
+	WISK_HOOK_CHMOD,
+	WISK_HOOK_CHDIR,
+	WISK_HOOK_COUNT
+};
+
+static const char *wisk_hook_names[WISK_HOOK_COUNT] = {
+	"init", "exit", "open", "open64", "openat", "fopen", "fopen64", "close", "dup",
+	"stat", "access", "opendir", "exec", "spawn", "link", "unlink", "chmod", "chdir"
+};
+
+struct wisk_hook_stats {
+	uint64_t calls;
+	uint64_t events;
+	uint64_t bytes;
+	uint64_t cycles;
+};
+
+struct wisk_hook_frame {
+	struct wisk_hook_frame *outer;
+	enum wisk_hook_e hook;
+	uint64_t start;
+	uint64_t cycles;
+};
+
+static WISK_THREAD struct wisk_hook_frame *wisk_hook_top;
+static struct wisk_hook_stats wisk_hook_exited[WISK_HOOK_COUNT];
+static uint64_t wisk_hook_epoch;
+
+static inline uint64_t wisk_hook_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline void wisk_hook_pause(struct wisk_hook_frame *frame)
+{
+	frame->cycles += wisk_hook_clock() - frame->start;
+}
+
+static inline void wisk_hook_resume(struct wisk_hook_frame *frame)
+{
+	frame->start = wisk_hook_clock();
+}
+
+static inline struct wisk_hook_frame wisk_hook_enter(enum wisk_hook_e hook);
+static inline void wisk_hook_leave(struct wisk_hook_frame *frame);
+
+/* Accounts the rest of the enclosing block to hook h */
+#define WISK_HOOK(h) \
+	struct wisk_hook_frame wisk_hook_frame __attribute__((cleanup(wisk_hook_leave))) = wisk_hook_enter(h); \
+	wisk_hook_top = &wisk_hook_frame
+
+/*
+ * The real call, which is not the library's overhead. The frame is unlinked
+ * while it runs: an exec from a vfork() child never returns and must not leave
+ * the parent's wisk_hook_top pointing into the child's stack.
+ */
+#define WISK_HOOK_REAL(call) ({ \
+	wisk_hook_pause(&wisk_hook_frame); \
+	wisk_hook_top = wisk_hook_frame.outer; \
+	__typeof__(call) __wisk_ret = (call); \
+	wisk_hook_top = &wisk_hook_frame; \
+	wisk_hook_resume(&wisk_hook_frame); \
+	__wisk_ret; })
+
+/*********************************************************
+ * WISK EVENT BATCHING
+ *********************************************************/
+
+/*
+ * Records are packed into a per-thread batch and written to the tracker pipe
+ * with a single write() when the batch fills up, before the process image is
+ * replaced (exec/spawn), before fork() and at exit. A batch never exceeds
+ * PIPE_BUF and only ever holds whole records, so each write to the FIFO stays
+ * atomic with respect to the other tracked processes.
+ */
+#define WISK_BATCH_SIZE PIPE_BUF
+
+struct wisk_batch {
+	struct wisk_batch *next;
+	int busy;
+	bool registered;
+	size_t len;
+	unsigned int records;
+	char buf[WISK_BATCH_SIZE];
+	struct wisk_hook_stats hooks[WISK_HOOK_COUNT];
+};
+
+static WISK_THREAD struct wisk_batch wisk_thread_batch;
+static struct wisk_batch *wisk_batch_list = NULL;
+static pthread_key_t wisk_batch_key;
+static pthread_once_t wisk_batch_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Writes of at most PIPE_BUF to a non blocking FIFO are all or nothing. A
+ * larger record the FIFO took part of has to be finished there, waiting for
+ * room, as it does when the pipe is inherited non blocking without an
+ * overflow directory.
+ */
+static void wisk_write_pipe(const char *buf, size_t len, unsigned int records)
+{
+	struct pollfd pfd = { fs_tracker_pipe, POLLOUT, 0 };
+	int saved_errno = errno;
+	bool started = false;
+	ssize_t n;
+
+	if (wisk_overflowed && getpid() == wisk_overflow_owner) {
+		wisk_overflow_write(buf, len, records);
+		errno = saved_errno;
+		return;
+	}
+	while (len > 0) {
+		n = write(fs_tracker_pipe, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN && !started && wisk_overflow_dir[0]) {
+				wisk_overflow_write(buf, len, records);
+				break;
+			}
+			if (errno == EAGAIN) {
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			WISK_LOG(WISK_LOG_ERROR, "Tracker Pipe write failed, %d: %s", errno, strerror(errno));
+			if (!started)
+				__sync_fetch_and_add(&wisk_overflow_dropped, records);
+			break;
+		}
+		started = true;
+		buf += n;
+		len -= n;
+	}
+	errno = saved_errno;
+}
+
+/*
+ * The busy flag is only ever contended when a signal handler interrupts the
+ * owning thread in the middle of an append, or when the process is exiting
+ * and another thread flushes all batches.
+ */
+static inline bool wisk_batch_trylock(struct wisk_batch *batch)
+{
+	return __sync_lock_test_and_set(&batch->busy, 1) == 0;
+}
+
+static inline void wisk_batch_unlock(struct wisk_batch *batch)
+{
+	__sync_lock_release(&batch->busy);
+}
+
+static void wisk_transport_write(const char *buf, size_t len, unsigned int records)
+{
+	if (!wisk_shm_publish(buf, len))
+		wisk_write_pipe(buf, len, records);
+}
+
+static void wisk_batch_flush_locked(struct wisk_batch *batch)
+{
+	if (batch->len == 0)
+		return;
+	wisk_transport_write(batch->buf, batch->len, batch->records);
+	batch->len = 0;
+	batch->records = 0;
+}
+
+static void wisk_batch_thread_exit(void *arg)
+{
+	struct wisk_batch *batch = arg;
+	struct wisk_batch **b;
+	int i;
+
+	wisk_mutex_lock(&wisk_batch_list_mutex);
+	for (b = &wisk_batch_list; *b; b = &(*b)->next) {
+		if (*b == batch) {
+			*b = batch->next;
+			break;
+		}
+	}
+	batch->registered = false;
+	for (i = 0; i < WISK_HOOK_COUNT; i++) {
+		wisk_hook_exited[i].calls += batch->hooks[i].calls;
+		wisk_hook_exited[i].events += batch->hooks[i].events;
+		wisk_hook_exited[i].bytes += batch->hooks[i].bytes;
+		wisk_hook_exited[i].cycles += batch->hooks[i].cycles;
+	}
+	wisk_mutex_unlock(&wisk_batch_list_mutex);
+	if (wisk_batch_trylock(batch)) {
+		wisk_batch_flush_locked(batch);
+		wisk_batch_unlock(batch);
+	}
+}
+
+static void wisk_batch_key_init(void)
+{
+	pthread_key_create(&wisk_batch_key, wisk_batch_thread_exit);
+}
+
+static void wisk_batch_register(struct wisk_batch *batch)
+{
+	pthread_once(&wisk_batch_key_once, wisk_batch_key_init);
+	wisk_mutex_lock(&wisk_batch_list_mutex);
+	batch->next = wisk_batch_list;
+	wisk_batch_list = batch;
+	batch->registered = true;
+	wisk_mutex_unlock(&wisk_batch_list_mutex);
+	pthread_setspecific(wisk_batch_key, batch);
+}
+
+static void wisk_batch_append(const char *record, size_t len)
+{
+	struct wisk_batch *batch = &wisk_thread_batch;
+
+	if (!batch->registered)
+		wisk_batch_register(batch);
+	if (wisk_hook_top) {
+		batch->hooks[wisk_hook_top->hook].events++;
+		batch->hooks[wisk_hook_top->hook].bytes += len;
+	}
+	if (!wisk_batch_trylock(batch)) {
+		wisk_transport_write(record, len, 1);
+		return;
+	}
+	if (batch->len + len > WISK_BATCH_SIZE)
+		wisk_batch_flush_locked(batch);
+	if (len > WISK_BATCH_SIZE) {
+		wisk_transport_write(record, len, 1);
+	} else {
+		memcpy(batch->buf + batch->len, record, len);
+		batch->len += len;
+		batch->records++;
+	}
+	wisk_batch_unlock(batch);
+}
+
+/* Flush the calling thread's batch */
+static void wisk_batch_flush(void)
+{
+	struct wisk_batch *batch = &wisk_thread_batch;
+
+	if (batch->len == 0)
+		return;
+	if (wisk_batch_trylock(batch)) {
+		wisk_batch_flush_locked(batch);
+		wisk_batch_unlock(batch);
+	}
+}
+
+/* Flush the batches of all threads, before exec or exit */
+static void wisk_batch_flush_all(void)
+{
+	struct wisk_batch *batch;
+
+	wisk_batch_flush();
+	wisk_mutex_lock(&wisk_batch_list_mutex);
+	for (batch = wisk_batch_list; batch; batch = batch->next) {
+		if (batch->len && wisk_batch_trylock(batch)) {
+			wisk_batch_flush_locked(batch);
+			wisk_batch_unlock(batch);
+		}
+	}
+	wisk_mutex_unlock(&wisk_batch_list_mutex);
+}
+
+/*
+ * Called in the child after fork() with wisk_batch_list_mutex held. The
+ * forking thread's batch was flushed in the prepare handler. The batches of
+ * the other threads were copied from the parent, which still owns and
+ * flushes those records, so the child must forget about them.
+ */
+static void wisk_batch_atfork_child(void)
+{
+	wisk_batch_list = NULL;
+	wisk_thread_batch.registered = false;
+	wisk_thread_batch.len = 0;
+	wisk_thread_batch.records = 0;
+	memset(wisk_thread_batch.hooks, 0, sizeof(wisk_thread_batch.hooks));
+	memset(wisk_hook_exited, 0, sizeof(wisk_hook_exited));
+	wisk_hook_epoch = wisk_hook_clock();
+	wisk_shm_select_ring();
+}
+
+static inline struct wisk_hook_frame wisk_hook_enter(enum wisk_hook_e hook)
+{
+	struct wisk_hook_frame frame = { wisk_hook_top, hook, 0, 0 };
+
+	if (frame.outer)
+		wisk_hook_pause(frame.outer);
+	if (!wisk_thread_batch.registered)
+		wisk_batch_register(&wisk_thread_batch);
+	wisk_thread_batch.hooks[hook].calls++;
+	frame.start = wisk_hook_clock();
+	return frame;
+}
+
+static inline void wisk_hook_leave(struct wisk_hook_frame *frame)
+{
+	wisk_hook_pause(frame);
+	wisk_thread_batch.hooks[frame->hook].cycles += frame->cycles;
+	wisk_hook_top = frame->outer;
+	if (frame->outer)
+		wisk_hook_resume(frame->outer);
+}
+
+/* Accounts the cycles of the frame so far, for a hook that reports the counters itself */
+static inline void wisk_hook_fold(struct wisk_hook_frame *frame)
+{
+	wisk_hook_pause(frame);
+	wisk_thread_batch.hooks[frame->hook].cycles += frame->cycles;
+	frame->cycles = 0;
+	wisk_hook_resume(frame);
+}
+
+/* The counters of every thread, live or gone */
+static void wisk_hook_totals(struct wisk_hook_stats *totals)
+{
+	struct wisk_batch *batch;
+	int i;
+
+	wisk_mutex_lock(&wisk_batch_list_mutex);
+	memcpy(totals, wisk_hook_exited, sizeof(wisk_hook_exited));
+	for (batch = wisk_batch_list; batch; batch = batch->next) {
+		for (i = 0; i < WISK_HOOK_COUNT; i++) {
+			totals[i].calls += batch->hooks[i].calls;
+			totals[i].events += batch->hooks[i].events;
+			totals[i].bytes += batch->hooks[i].bytes;
+			totals[i].cycles += batch->hooks[i].cycles;
+		}
+	}
+	wisk_mutex_unlock(&wisk_batch_list_mutex);
+}
+
+/*********************************************************
+ * WISK PATH TABLE
+ *********************************************************/
+
+/*
+ * Every path a process reports, or holds open, is interned here once. The
+ * entry remembers which operations were already reported on the path, so
+ * only the first occurrence of an (operation, path) pair goes to the tracker.
+ * Later occurrences are counted and reported together, as REPEATS records,
+ * when the process completes. The table is open addressed and the paths are
+ * kept in an arena, both mmap'ed, so nothing here calls malloc() from inside
+ * an intercepted call. Interned paths are never freed, the fd table below
+ * points at them.
+ *
+ * Entries are only added under wisk_path_mutex, but wisk_path_find() reads
+ * without it: an entry is published by storing its path last, the table by
+ * storing it before its size, and a table outgrown is not unmapped as a
+ * reader may still be walking it. Those add up to less than the table in use.
+ */
+#define WISK_PATH_SLOTS 1024
+#define WISK_PATH_ARENA_CHUNK (256 * 1024)
+
+/* Operations deduplicated per path, index into wisk_path_entry.repeats */
+enum wisk_dedup_e {
+	WISK_DEDUP_READS,
+	WISK_DEDUP_WRITES,
+	WISK_DEDUP_READS_UNKNOWN,
+	WISK_DEDUP_UNLINK,
+	WISK_DEDUP_CHMOD,
+	WISK_DEDUP_USES,
+	WISK_DEDUP_COUNT
+};
+
+static const enum wisk_op_e wisk_dedup_ops[WISK_DEDUP_COUNT] = {
+	WISK_OP_READS,
+	WISK_OP_WRITES,
+	WISK_OP_READS_UNKNOWN,
+	WISK_OP_UNLINK,
+	WISK_OP_CHMOD,
+	WISK_OP_USES
+};
+
+struct wisk_path_entry {
+	const char *path;
+	uint32_t hash;
+	uint16_t len;
+	uint8_t reported;
+	uint8_t probed;
+	uint32_t repeats[WISK_DEDUP_COUNT];
+};
+
+static struct wisk_path_entry *wisk_path_table = NULL;
+static size_t wisk_path_slots = 0;
+static size_t wisk_path_used = 0;
+static char *wisk_path_arena = NULL;
+static size_t wisk_path_arena_left = 0;
+
+static int wisk_op_dedup(enum wisk_op_e op)
+{
+	int i;
+
+	for (i = 0; i < WISK_DEDUP_COUNT; i++) {
+		if (wisk_dedup_ops[i] == op)
+			return i;
+	}
+	return -1;
+}
+
+/* FNV-1a */
+static uint32_t wisk_path_hash(const char *path, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)path[i]) * 16777619U;
+	return h;
+}
+
+static void *wisk_path_map(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* Memory from the arena. Chunks are never released, they live as long as the process */
+static void *wisk_path_alloc(size_t size)
+{
+	char *p;
+
+	if (wisk_path_arena_left < size) {
+		p = wisk_path_map(WISK_PATH_ARENA_CHUNK);
+		if (p == NULL)
+			return NULL;
+		wisk_path_arena = p;
+		wisk_path_arena_left = WISK_PATH_ARENA_CHUNK;
+	}
+	p = wisk_path_arena;
+	wisk_path_arena += size;
+	wisk_path_arena_left -= size;
+	return p;
+}
+
+static const char *wisk_path_strdup(const char *path, size_t len)
+{
+	char *p = wisk_path_alloc(len + 1);
+
+	if (p == NULL)
+		return NULL;
+	memcpy(p, path, len);
+	p[len] = '\0';
+	return p;
+}
+
+static struct wisk_path_entry *wisk_path_slot(struct wisk_path_entry *table, size_t slots,
+					       uint32_t hash, const char *path, size_t len)
+{
+	size_t i;
+
+	for (i = hash & (slots - 1); table[i].path; i = (i + 1) & (slots - 1)) {
+		if (table[i].hash == hash && table[i].len == len &&
+		    memcmp(table[i].path, path, len) == 0)
+			break;
+	}
+	return &table[i];
+}
+
+/* Double the table once it is half full */
+static bool wisk_path_grow(void)
+{
+	size_t slots = wisk_path_slots ? wisk_path_slots * 2 : WISK_PATH_SLOTS;
+	struct wisk_path_entry *table, *e;
+	size_t i;
+
+	table = wisk_path_map(slots * sizeof(*table));
+	if (table == NULL)
+		return false;
+	for (i = 0; i < wisk_path_slots; i++) {
+		e = &wisk_path_table[i];
+		if (e->path)
+			*wisk_path_slot(table, slots, e->hash, e->path, e->len) = *e;
+	}
+	__atomic_store_n(&wisk_path_table, table, __ATOMIC_RELEASE);
+	__atomic_store_n(&wisk_path_slots, slots, __ATOMIC_RELEASE);
+	return true;
+}
+
+/*
+ * Find, or add, the entry of path. Called with wisk_path_mutex held.
+ * Returns NULL when out of memory.
+ */
+static struct wisk_path_entry *wisk_path_lookup(const char *path)
+{
+	struct wisk_path_entry *e;
+	const char *p;
+	size_t len = strlen(path);
+	uint32_t hash;
+
+	if (len > UINT16_MAX)
+		return NULL;
+	if (wisk_path_used * 2 >= wisk_path_slots && !wisk_path_grow())
+		return NULL;
+	hash = wisk_path_hash(path, len);
+	e = wisk_path_slot(wisk_path_table, wisk_path_slots, hash, path, len);
+	if (e->path == NULL) {
+		if ((p = wisk_path_strdup(path, len)) == NULL)
+			return NULL;
+		e->hash = hash;
+		e->len = len;
+		__atomic_store_n(&e->path, p, __ATOMIC_RELEASE);
+		wisk_path_used++;
+	}
+	return e;
+}
+
+/*
+ * The entry of path without taking wisk_path_mutex, NULL when it is not in
+ * the table or only just being added. The size is read before the table, so
+ * it is never larger than the table read, and the walk is bounded as a
+ * table just grown may be read with the size of the one before.
+ */
+static struct wisk_path_entry *wisk_path_find(const char *path, size_t len)
+{
+	size_t slots = __atomic_load_n(&wisk_path_slots, __ATOMIC_ACQUIRE);
+	struct wisk_path_entry *table = __atomic_load_n(&wisk_path_table, __ATOMIC_ACQUIRE);
+	uint32_t hash = wisk_path_hash(path, len);
+	const char *p;
+	size_t i, n;
+
+	if (slots == 0)
+		return NULL;
+	for (i = hash & (slots - 1), n = 0; n < slots; i = (i + 1) & (slots - 1), n++) {
+		p = __atomic_load_n(&table[i].path, __ATOMIC_ACQUIRE);
+		if (p == NULL)
+			break;
+		if (table[i].hash == hash && table[i].len == len && memcmp(p, path, len) == 0)
+			return &table[i];
+	}
+	return NULL;
+}
+
+/* The interned copy of path, valid for the life of the process, or NULL */
+static const char *wisk_path_intern(const char *path)
+{
+	struct wisk_path_entry *e;
+
+	wisk_mutex_lock(&wisk_path_mutex);
+	e = wisk_path_lookup(path);
+	wisk_mutex_unlock(&wisk_path_mutex);
+	return e ? e->path : NULL;
+}
+
+/*
+ * Returns true when this process already reported op on path, counting the
+ * repeat. When out of memory every access is reported, as without the table.
+ */
+static bool wisk_dedup_seen(int dedup, const char *path)
+{
+	struct wisk_path_entry *e;
+	bool seen = false;
+
+	wisk_mutex_lock(&wisk_path_mutex);
+	e = wisk_path_lookup(path);
+	if (e && (e->reported & (1 << dedup))) {
+		e->repeats[dedup]++;
+		seen = true;
+	} else if (e) {
+		e->reported |= (1 << dedup);
+	}
+	wisk_mutex_unlock(&wisk_path_mutex);
+	return seen;
+}
+
+/*
+ * Probes are the lookups that decide what a program goes on to read, e.g.
+ * the search of the include and PATH directories: stat(), access(),
+ * opendir(), O_PATH opens, and opens that fail as the path does not exist.
+ * The negative ones matter most, a file that appears in a directory searched
+ * earlier changes the result. Each is reported once per path and kind, and
+ * held back so that those of a directory go out together, as a PROBES
+ * record [dir, item...]. An item is "+name" for a path found, "-name" for
+ * one missing, and "*" for the directory having been listed. Kept with the
+ * path table and under wisk_path_mutex, the directories are interned so
+ * their pending lists are found by pointer.
+ */
+enum wisk_probe_e {
+	WISK_PROBE_FOUND = 1,
+	WISK_PROBE_MISSING = 2,
+	WISK_PROBE_LISTED = 4
+};
+
+#define WISK_PROBE_DIRS 64
+
+struct wisk_probe {
+	struct wisk_probe *next;
+	char item[];
+};
+
+static struct {
+	const char *dir;
+	struct wisk_probe *probes, **tail;
+} wisk_probe_dirs[WISK_PROBE_DIRS];
+static int wisk_probe_ndirs = 0;
+
+static void wisk_report_probes_locked(void);
+
+/* Hold back a probe of an absolute path, called with wisk_path_mutex held */
+static void wisk_probe_add(enum wisk_probe_e kind, const char *path, size_t len)
+{
+	struct wisk_path_entry *e;
+	struct wisk_probe *p;
+	const char *dir, *name;
+	char dirbuf[PATH_MAX];
+	size_t dirlen, namelen;
+	int i;
+
+	e = wisk_path_lookup(path);
+	if (e == NULL || (e->probed & kind))
+		return;
+	__atomic_or_fetch(&e->probed, kind, __ATOMIC_RELAXED);
+	if (kind == WISK_PROBE_LISTED) {
+		dirlen = len;
+		name = path + len;
+	} else {
+		for (name = path + len; name[-1] != '/'; name--);
+		dirlen = (name - path > 1) ? name - path - 1 : 1;
+	}
+	namelen = path + len - name;
+	memcpy(dirbuf, path, dirlen);
+	dirbuf[dirlen] = '\0';
+	if ((e = wisk_path_lookup(dirbuf)) == NULL)
+		return;
+	dir = e->path;
+	for (i = 0; i < wisk_probe_ndirs; i++) {
+		if (wisk_probe_dirs[i].dir == dir)
+			break;
+	}
+	if (i == WISK_PROBE_DIRS) {
+		wisk_report_probes_locked();
+		i = 0;
+	}
+	if (i == wisk_probe_ndirs) {
+		wisk_probe_dirs[i].dir = dir;
+		wisk_probe_dirs[i].probes = NULL;
+		wisk_probe_dirs[i].tail = &wisk_probe_dirs[i].probes;
+		wisk_probe_ndirs++;
+	}
+	// Room for a pointer aligned node
+	p = wisk_path_alloc(sizeof(*p) + namelen + 2 + sizeof(void *));
+	if (p == NULL)
+		return;
+	p = (struct wisk_probe *)(((uintptr_t)p + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1));
+	p->item[0] = (kind == WISK_PROBE_FOUND) ? '+' : (kind == WISK_PROBE_MISSING) ? '-' : '*';
+	memcpy(p->item + 1, name, namelen);
+	p->item[namelen + 1] = '\0';
+	p->next = NULL;
+	*wisk_probe_dirs[i].tail = p;
+	wisk_probe_dirs[i].tail = &p->next;
+}
+
+/*
+ * Called in the child after fork() with wisk_path_mutex held. The child
+ * reports under the same uuid as the parent, so it keeps suppressing what
+ * the parent already reported, but only counts its own repeats. The pending
+ * probes are the parent's to send.
+ */
+static void wisk_path_atfork_child(void)
+{
+	size_t i;
+
+	wisk_probe_ndirs = 0;
+	for (i = 0; i < wisk_path_slots; i++)
+		memset(wisk_path_table[i].repeats, 0, sizeof(wisk_path_table[i].repeats));
+}
+
+/*********************************************************
+ * WISK FD TABLE
+ *********************************************************/
+
+/*
+ * The path each file descriptor was opened with, kept by the open, dup and
+ * close hooks so dirfd relative *at() calls and fchmod() can be resolved
+ * without a readlink() of /proc/self/fd. Descriptors this library didn't see
+ * opened, e.g. inherited or opened inside libc, are looked up in /proc once
+ * and then cached. The table is sized for WISK_FD_MAX descriptors up front,
+ * the kernel only backs the pages that get used, so it is never moved and
+ * the slots are read and written without locking.
+ */
+#define WISK_FD_MAX 65536
+
+static const char **wisk_fd_paths = NULL;
+static int wisk_fd_paths_once = 0;
+
+static bool wisk_fd_init(void)
+{
+	const char **table;
+
+	if (wisk_fd_paths)
+		return true;
+	if (__sync_lock_test_and_set(&wisk_fd_paths_once, 1))
+		return wisk_fd_paths != NULL;
+	table = wisk_path_map(WISK_FD_MAX * sizeof(*table));
+	__sync_synchronize();
+	wisk_fd_paths = table;
+	return table != NULL;
+}
+
+static void wisk_fd_set(int fd, const char *path)
+{
+	if (fd < 0 || fd >= WISK_FD_MAX || !wisk_fd_init())
+		return;
+	__atomic_store_n(&wisk_fd_paths[fd], path ? wisk_path_intern(path) : NULL, __ATOMIC_RELEASE);
+}
+
+static void wisk_fd_clear(int fd)
+{
+	if (fd < 0 || fd >= WISK_FD_MAX || wisk_fd_paths == NULL)
+		return;
+	__atomic_store_n(&wisk_fd_paths[fd], NULL, __ATOMIC_RELEASE);
+}
+
+/* The descriptors first to last, as close_range() and closefrom() take them */
+static void wisk_fd_clear_range(unsigned int first, unsigned int last)
+{
+	unsigned int fd;
+
+	if (wisk_fd_paths == NULL || first >= WISK_FD_MAX)
+		return;
+	if (last >= WISK_FD_MAX)
+		last = WISK_FD_MAX - 1;
+	for (fd = first; fd <= last; fd++) {
+		if (__atomic_load_n(&wisk_fd_paths[fd], __ATOMIC_RELAXED))
+			__atomic_store_n(&wisk_fd_paths[fd], NULL, __ATOMIC_RELEASE);
+	}
+}
+
+static void wisk_fd_dup(int oldfd, int newfd)
+{
+	if (newfd < 0 || newfd >= WISK_FD_MAX || wisk_fd_paths == NULL)
+		return;
+	__atomic_store_n(&wisk_fd_paths[newfd],
+			 (oldfd >= 0 && oldfd < WISK_FD_MAX) ? __atomic_load_n(&wisk_fd_paths[oldfd], __ATOMIC_ACQUIRE) : NULL,
+			 __ATOMIC_RELEASE);
+}
+
+/* The path fd was opened with. buf, PATH_MAX long, is used when it has to come from /proc */
+static const char *wisk_fd_path(int fd, char *buf)
+{
+	const char *path;
+	char fdstr[32];
+	int i;
+
+	if (fd >= 0 && fd < WISK_FD_MAX && wisk_fd_paths) {
+		path = __atomic_load_n(&wisk_fd_paths[fd], __ATOMIC_ACQUIRE);
+		if (path)
+			return path;
+	}
+	snprintf(fdstr, sizeof(fdstr), "/proc/self/fd/%d", fd);
+	i = readlink(fdstr, buf, PATH_MAX-1);
+	if (i == -1) {
+		WISK_LOG(WISK_LOG_ERROR, "Cannot resolve fd %d, %d: %s", fd, errno, strerror(errno));
+		strncpy(buf, "FAILED_FILE_PATH", PATH_MAX);
+		return buf;
+	}
+	buf[i] = '\0';
+	if (buf[0] == '/')
+		wisk_fd_set(fd, buf);
+	return buf;
+}
+
+/*********************************************************
+ * WISK PATH FILTER
+ *********************************************************/
+
+/*
+ * Include/exclude path prefixes, compiled by compile_path_filter() in
+ * wisktrack.py into a byte trie that is mapped read only from the file named
+ * by WISK_TRACKER_PATHFILTER. A prefix matches whole path components and the
+ * longest matching prefix decides; paths matching nothing are included.
+ * Excluded paths are dropped before anything is serialized. Immutable ones,
+ * the install trees of the toolchain and the sysroot that do not change
+ * during a build, are read without a record of each: reads and probes
+ * beneath such a prefix are reported as a USES of the prefix, once per
+ * process, and the collector fingerprints the tree once per session.
+ */
+#define WISK_PATHFILTER_MAGIC 0x54465057
+#define WISK_PATHFILTER_VERSION 1
+#define WISK_PATHFILTER_INCLUDE 1
+#define WISK_PATHFILTER_EXCLUDE 2
+#define WISK_PATHFILTER_IMMUTABLE 3
+
+struct wisk_pathfilter_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nnodes;
+	uint32_t nedges;
+};
+
+struct wisk_pathfilter_node {
+	uint32_t first_edge;
+	uint16_t nedges;
+	uint8_t verdict;
+	uint8_t pad;
+};
+
+struct wisk_pathfilter_edge {
+	uint8_t ch;
+	uint8_t pad[3];
+	uint32_t child;
+};
+
+static const struct wisk_pathfilter_node *fs_tracker_filter_nodes = NULL;
+static const struct wisk_pathfilter_edge *fs_tracker_filter_edges = NULL;
+
+/*
+ * Map the trie of file, checking its layout once so the lookups can trust the
+ * indices. The path filter and the command policy share it, told apart by
+ * the magic.
+ */
+static bool wisk_trie_map(const char *what, const char *file, uint32_t magic,
+			  const struct wisk_pathfilter_node **nodesp, const struct wisk_pathfilter_edge **edgesp)
+{
+	const struct wisk_pathfilter_header *hdr;
+	const struct wisk_pathfilter_node *nodes;
+	const struct wisk_pathfilter_edge *edges;
+	struct stat st;
+	void *addr;
+	uint32_t i;
+	int fd;
+
+	fd = libc_open(file, O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*hdr)) {
+		WISK_LOG(WISK_LOG_ERROR, "%s %s cannot be read", what, file);
+		if (fd >= 0)
+			libc_close(fd);
+		return false;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	libc_close(fd);
+	if (addr == MAP_FAILED) {
+		WISK_LOG(WISK_LOG_ERROR, "%s mmap failed, %d: %s", what, errno, strerror(errno));
+		return false;
+	}
+	hdr = addr;
+	nodes = (const struct wisk_pathfilter_node *)(hdr + 1);
+	edges = (const struct wisk_pathfilter_edge *)(nodes + hdr->nnodes);
+	if (hdr->magic != magic || hdr->version != WISK_PATHFILTER_VERSION || hdr->nnodes == 0 ||
+	    sizeof(*hdr) + hdr->nnodes * (uint64_t)sizeof(*nodes) + hdr->nedges * (uint64_t)sizeof(*edges) != (uint64_t)st.st_size)
+		goto invalid;
+	for (i = 0; i < hdr->nnodes; i++) {
+		if ((uint64_t)nodes[i].first_edge + nodes[i].nedges > hdr->nedges)
+			goto invalid;
+	}
+	for (i = 0; i < hdr->nedges; i++) {
+		if (edges[i].child >= hdr->nnodes)
+			goto invalid;
+	}
+	*edgesp = edges;
+	*nodesp = nodes;
+	WISK_LOG(WISK_LOG_TRACE, "%s %s: %u nodes", what, file, hdr->nnodes);
+	return true;
+invalid:
+	WISK_LOG(WISK_LOG_ERROR, "%s %s has an unrecognized layout", what, file);
+	munmap(addr, st.st_size);
+	return false;
+}
+
+static void wisk_trie_unmap(const struct wisk_pathfilter_node *nodes)
+{
+	const struct wisk_pathfilter_header *hdr = (const struct wisk_pathfilter_header *)nodes - 1;
+
+	munmap((void *)hdr, sizeof(*hdr) + hdr->nnodes * sizeof(*nodes) + hdr->nedges * sizeof(struct wisk_pathfilter_edge));
+}
+
+/* The child of node on c, or NULL */
+static const struct wisk_pathfilter_node *wisk_trie_next(const struct wisk_pathfilter_node *nodes,
+							 const struct wisk_pathfilter_edge *edges,
+							 const struct wisk_pathfilter_node *node, unsigned char c)
+{
+	int lo, hi, mid;
+
+	edges += node->first_edge;
+	lo = 0;
+	hi = node->nedges - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (edges[mid].ch == c)
+			return nodes + edges[mid].child;
+		if (edges[mid].ch < c)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+static void wisk_pathfilter_init(void)
+{
+	char *d;
+
+	d = getenv(WISK_TRACKER_PATHFILTER);
+	if (d == NULL || d[0] == '\0')
+		return;
+	if (!wisk_trie_map("Path Filter", d, WISK_PATHFILTER_MAGIC, &fs_tracker_filter_nodes, &fs_tracker_filter_edges))
+		WISK_LOG(WISK_LOG_ERROR, "Path Filter %s not used, tracking all paths", d);
+}
+
+/*
+ * Lexically drop "." and ".." components and repeated slashes of an absolute
+ * path, so that e.g. "/ws/../usr/include/x.h" matches "/usr/include".
+ */
+static const char *wisk_path_normalize(char *buf, const char *path)
+{
+	const char *s = path;
+	char *d = buf;
+	size_t n;
+
+	if (!strstr(path, "//") && !strstr(path, "/./") && !strstr(path, "/../") &&
+	    !(((n = strlen(path)) >= 2 && strcmp(path + n - 2, "/.") == 0) ||
+	      (n >= 3 && strcmp(path + n - 3, "/..") == 0)))
+		return path;
+	while (*s) {
+		while (*s == '/')
+			s++;
+		n = strcspn(s, "/");
+		if (n == 0 || (n == 1 && s[0] == '.')) {
+			/* skip */
+		} else if (n == 2 && s[0] == '.' && s[1] == '.') {
+			while (d > buf && *--d != '/');
+		} else if ((size_t)(d - buf) + n + 2 < PATH_MAX) {
+			*d++ = '/';
+			memcpy(d, s, n);
+			d += n;
+		}
+		s += n;
+	}
+	if (d == buf)
+		*d++ = '/';
+	*d = '\0';
+	return buf;
+}
+
+/*
+ * The verdict of the longest prefix of path that has one, 0 for none. The
+ * prefix is copied to prefix, of PATH_MAX, when given.
+ */
+static int wisk_path_verdict(const char *path, char *prefix)
+{
+	const struct wisk_pathfilter_node *node = fs_tracker_filter_nodes;
+	char buf[PATH_MAX];
+	const char *s;
+	int verdict = 0;
+	size_t len = 0;
+
+	if (node == NULL || path[0] != '/')
+		return 0;
+	path = s = wisk_path_normalize(buf, path);
+	for (;;) {
+		if (node->verdict && (*s == '/' || *s == '\0')) {
+			verdict = node->verdict;
+			len = s - path;
+		}
+		if (*s == '\0')
+			break;
+		node = wisk_trie_next(fs_tracker_filter_nodes, fs_tracker_filter_edges, node, *s);
+		if (node == NULL)
+			break;
+		s++;
+	}
+	if (prefix && verdict)
+		snprintf(prefix, PATH_MAX, "%.*s", (int)len, path);
+	return verdict;
+}
+
+static bool wisk_path_excluded(const char *path)
+{
+	return wisk_path_verdict(path, NULL) == WISK_PATHFILTER_EXCLUDE;
+}
+
+/*
+ * Sampling, WISK_TRACKER_SAMPLE=process:<rate> or event:<rate>, for tracking
+ * left on where all of it costs too much. The records the tree is built from,
+ * CALLS, COMMAND, COMPLETE and the like, are always sent, the file events are
+ * sampled. With process, a process sends all of its file events or none, a
+ * process not in the sample masks them in the event filter and pays nothing
+ * for them. With event, each path is kept or not on its own, by its hash
+ * mixed with the random id of the process, so every access to a path in the
+ * process goes the same way and the dedup and REPEATS of the paths kept stay
+ * exact. An event sample takes the same paths on every run when given a
+ * seed, as event:<rate>:<seed>, in place of the random id. The choice, the
+ * rate and the events kept and dropped are reported in COMPLETE, the parser
+ * scales the counts by the rate.
+ */
+enum wisk_sample_e {
+	WISK_SAMPLE_ALL = 0,
+	WISK_SAMPLE_PROCESS,
+	WISK_SAMPLE_EVENT
+};
+
+static const char *wisk_sample_names[] = {"all", "process", "event"};
+static enum wisk_sample_e wisk_sample_mode = WISK_SAMPLE_ALL;
+static double wisk_sample_rate = 1.0;
+static uint64_t wisk_sample_threshold;
+static uint32_t wisk_sample_seed;
+static bool wisk_sample_selected = true;
+static uint64_t wisk_sample_kept;
+static uint64_t wisk_sample_dropped;
+
+#define WISK_SAMPLE_EVENTS ((1<<WISK_TRACK_WRITES)|(1<<WISK_TRACK_READS)|(1<<WISK_TRACK_LINKS)| \
+			    (1<<WISK_TRACK_CHMODS)|(1<<WISK_TRACK_PROBES))
+
+/* The finalizer of MurmurHash3, spreads the seed over all the bits of the path hash */
+static uint32_t wisk_sample_mix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+static void wisk_sample_init(void)
+{
+	char *d, *end;
+	double rate;
+
+	d = getenv(WISK_TRACKER_SAMPLE);
+	if (d == NULL || d[0] == '\0')
+		return;
+	if (strncmp(d, "process:", 8) == 0)
+		wisk_sample_mode = WISK_SAMPLE_PROCESS;
+	else if (strncmp(d, "event:", 6) == 0)
+		wisk_sample_mode = WISK_SAMPLE_EVENT;
+	else {
+		WISK_LOG(WISK_LOG_ERROR, "Sample %s is not process:<rate> or event:<rate>, tracking all events", d);
+		return;
+	}
+	rate = strtod(strchr(d, ':') + 1, &end);
+	wisk_sample_seed = (uint32_t)fs_tracker_uuid_raw.i2;
+	if (*end == ':')
+		wisk_sample_seed = (uint32_t)strtoul(end + 1, &end, 0);
+	if (*end != '\0' || !(rate > 0.0 && rate <= 1.0)) {
+		WISK_LOG(WISK_LOG_ERROR, "Sample %s has a rate not in (0, 1], tracking all events", d);
+		wisk_sample_mode = WISK_SAMPLE_ALL;
+		return;
+	}
+	wisk_sample_rate = rate;
+	wisk_sample_threshold = (uint64_t)(rate * 4294967296.0);
+	if (wisk_sample_mode == WISK_SAMPLE_PROCESS) {
+		wisk_sample_selected = (uint32_t)fs_tracker_uuid_raw.i3 < wisk_sample_threshold;
+		if (!wisk_sample_selected)
+			fs_tracker_eventfilter &= ~WISK_SAMPLE_EVENTS;
+	}
+	WISK_LOG(WISK_LOG_TRACE, "Sample %s, rate %f, %s", wisk_sample_names[wisk_sample_mode], rate,
+		 wisk_sample_selected ? "selected" : "not selected");
+}
+
+/* Whether the file event of path is in the sample, counting it */
+static bool wisk_sample_keep(const char *path)
+{
+	bool keep;
+
+	if (wisk_sample_mode == WISK_SAMPLE_ALL)
+		return true;
+	if (wisk_sample_mode == WISK_SAMPLE_PROCESS)
+		keep = wisk_sample_selected;
+	else
+		keep = wisk_sample_mix(wisk_path_hash(path, strlen(path)) ^ wisk_sample_seed) < wisk_sample_threshold;
+	__atomic_fetch_add(keep ? &wisk_sample_kept : &wisk_sample_dropped, 1, __ATOMIC_RELAXED);
+	return keep;
+}
+
+/*********************************************************
+ * WISK COMMAND POLICY
+ *********************************************************/
+
+/*
+ * How much of a process is tracked, chosen once at init from its
+ * COMMAND_PATH, to skip the noisy helpers of a build, e.g. sed, grep and
+ * uname. compile_command_policy() in wisktrack.py writes the command_policy
+ * of the config, to the file named by WISK_TRACKER_POLICY, as a trie of the
+ * layout of the path filter keyed by the full path of the executable or its
+ * base name, the full path winning. The policy narrows the event filter, so
+ * the hooks of the process cost no more than the check of it. Off reports
+ * nothing and hands the uuid of our parent on to the children, which are
+ * tracked as its own.
+ */
+#define WISK_POLICY_MAGIC 0x50435057
+
+enum wisk_policy_e {
+	WISK_POLICY_FULL = 0,
+	WISK_POLICY_WRITES,
+	WISK_POLICY_LIFECYCLE,
+	WISK_POLICY_OFF,
+	WISK_POLICY_COUNT
+};
+
+static const char *wisk_policy_names[] = {"full", "writes", "lifecycle", "off"};
+static enum wisk_policy_e wisk_policy = WISK_POLICY_FULL;
+
+static const int wisk_policy_events[] = {
+	[WISK_POLICY_FULL] = ~0,
+	[WISK_POLICY_WRITES] = (1<<WISK_TRACK_WRITES)|(1<<WISK_TRACK_LINKS)|(1<<WISK_TRACK_CHMODS)|(1<<WISK_TRACK_PROCESS),
+	[WISK_POLICY_LIFECYCLE] = (1<<WISK_TRACK_PROCESS),
+	[WISK_POLICY_OFF] = 0
+};
+
+/* The policy of key, matched whole, 0 when it has none */
+static int wisk_policy_lookup(const struct wisk_pathfilter_node *nodes, const struct wisk_pathfilter_edge *edges,
+			      const char *key)
+{
+	const struct wisk_pathfilter_node *node = nodes;
+
+	for (; node && *key; key++)
+		node = wisk_trie_next(nodes, edges, node, *key);
+	return node ? node->verdict : 0;
+}
+
+static void wisk_policy_init(const char *command_path)
+{
+	const struct wisk_pathfilter_node *nodes;
+	const struct wisk_pathfilter_edge *edges;
+	const char *base;
+	int policy;
+	char *d;
+
+	d = getenv(WISK_TRACKER_POLICY);
+	if (d == NULL || d[0] == '\0')
+		return;
+	if (!wisk_trie_map("Command Policy", d, WISK_POLICY_MAGIC, &nodes, &edges))
+		return;
+	policy = wisk_policy_lookup(nodes, edges, command_path);
+	if (policy == 0 && (base = strrchr(command_path, '/')) != NULL)
+		policy = wisk_policy_lookup(nodes, edges, base + 1);
+	wisk_trie_unmap(nodes);
+	if (policy <= WISK_POLICY_FULL || policy >= WISK_POLICY_COUNT)
+		return;
+	wisk_policy = policy;
+	fs_tracker_eventfilter &= wisk_policy_events[policy];
+	if (wisk_policy == WISK_POLICY_OFF)
+		memcpy(fs_tracker_uuid, fs_tracker_puuid, sizeof(fs_tracker_uuid));
+	WISK_LOG(WISK_LOG_TRACE, "Command Policy %s: %s, 0x%X", command_path, wisk_policy_names[policy], fs_tracker_eventfilter);
+}
+
+/*********************************************************
+ * SWRAP HELPER FUNCTIONS
+ *********************************************************/
+
+/*
+ * The working directory, cached so relative paths can be resolved without a
+ * getcwd() syscall each. It is refreshed after every successful chdir() and
+ * fchdir(), which hold wisk_cwd_mutex across the change so the cache can't
+ * end up behind the kernel. Readers don't lock; they retry their copy when
+ * fs_tracker_cwd_seq says it overlapped an update (odd while updating).
+ *
+ * libc changes directory without calling either while nftw() with FTW_CHDIR,
+ * or an fts stream opened without FTS_NOCHDIR, walks a tree. For as long as
+ * one does, fs_tracker_cwd_bypass has the cache skipped, it is refreshed
+ * once the walk is over. A vfork() child shares the cache with its parent,
+ * only fs_tracker_cwd_owner, the process itself, fills or refreshes it.
+ */
+static char fs_tracker_cwd[PATH_MAX];
+static volatile size_t fs_tracker_cwd_len = 0;
+static volatile unsigned fs_tracker_cwd_seq = 0;
+static volatile int fs_tracker_cwd_bypass = 0;
+static pid_t fs_tracker_cwd_owner = 0;
+
+/* Called with wisk_cwd_mutex held */
+static void wisk_cwd_refresh(void)
+{
+	char buf[PATH_MAX];
+	size_t len = 0;
+	int saved_errno = errno;
+
+	if (getcwd(buf, PATH_MAX) != NULL)
+		len = strlen(buf);
+	errno = saved_errno;
+	__sync_fetch_and_add(&fs_tracker_cwd_seq, 1);
+	memcpy(fs_tracker_cwd, buf, len);
+	fs_tracker_cwd_len = len;
+	__sync_fetch_and_add(&fs_tracker_cwd_seq, 1);
+}
+
+/* Called with wisk_cwd_mutex held, after a change of directory */
+static void wisk_cwd_changed(void)
+{
+	if (getpid() == fs_tracker_cwd_owner)
+		wisk_cwd_refresh();
+}
+
+static void wisk_cwd_bypass_begin(void)
+{
+	__sync_fetch_and_add(&fs_tracker_cwd_bypass, 1);
+}
+
+/* The walk put the directory back, or not, either way the cache is redone before it is used again */
+static void wisk_cwd_bypass_end(void)
+{
+	int saved_errno = errno;
+
+	wisk_mutex_lock(&wisk_cwd_mutex);
+	wisk_cwd_changed();
+	wisk_mutex_unlock(&wisk_cwd_mutex);
+	__sync_fetch_and_sub(&fs_tracker_cwd_bypass, 1);
+	errno = saved_errno;
+}
+
+static void wisk_cwd_atfork_child(void)
+{
+	fs_tracker_cwd_owner = getpid();
+}
+
+/* Copy the working directory to buf, PATH_MAX long, and return its length */
+static size_t wisk_getcwd(char *buf)
+{
+	unsigned seq;
+	size_t len;
+
+#if defined(INTERCEPT_CHDIR) && defined(INTERCEPT_FCHDIR)
+	if (fs_tracker_cwd_bypass)
+		goto uncached;
+	if (fs_tracker_cwd_len == 0) {
+		wisk_mutex_lock(&wisk_cwd_mutex);
+		if (fs_tracker_cwd_len == 0)
+			wisk_cwd_changed();
+		wisk_mutex_unlock(&wisk_cwd_mutex);
+	}
+	do {
+		seq = fs_tracker_cwd_seq;
+		__sync_synchronize();
+		len = fs_tracker_cwd_len;
+		memcpy(buf, fs_tracker_cwd, len);
+		__sync_synchronize();
+	} while ((seq & 1) || seq != fs_tracker_cwd_seq);
+	if (len) {
+		buf[len] = '\0';
+		return len;
+	}
+uncached:
+#endif
+	// Not cached, or getcwd() fails (e.g. the directory was removed)
+	if (getcwd(buf, PATH_MAX) == NULL)
+		buf[0] = '\0';
+	return strlen(buf);
+}
+
+char* ifnotabsolute(char *retbuf, const char *fname)
+{
+	size_t len;
+
+	if (fname[0] == '/')
+		return (char*)fname;
+	else {
+		len = wisk_getcwd(retbuf);
+		snprintf(retbuf + len, PATH_MAX - len, "/%s", fname);
+		return retbuf;
+	}
+}
+
+/* ifnotabsolute() for the *at() calls, relative paths are relative to dirfd */
+char* ifnotabsoluteat(char *retbuf, int dirfd, const char *fname)
+{
+	char buf[PATH_MAX];
+
+	if (fname[0] == '/' || dirfd == AT_FDCWD)
+		return ifnotabsolute(retbuf, fname);
+	else {
+		snprintf(retbuf, PATH_MAX, "%s/%s", wisk_fd_path(dirfd, buf), fname);
+		return retbuf;
+	}
+}
+
+static inline void escapedcharcopy(char **d, char **s)
+{
+    int j;
+    char esc_char[]= { '\a','\b','\f','\n','\r','\t','\v','\\', '"'};
+    char essc_str[]= {  'a', 'b', 'f', 'n', 'r', 't', 'v','\\', '"'};
+
+    for(j=0; j< 9 ;j++){
+        if( **s==esc_char[j] ){
+          *(*d)++ = '\\';
+          *(*d)++ = essc_str[j];
+          *(*d) = '\0';
+          (*s)++;
+          break;
+        }
+    }
+    if(j == 9 ) {
+        *(*d)++ = *(*s)++;
+        *(*d) = '\0';
+    }
+}
+
+/*
+ * Every record carries the pid of the process sending it and a sequence
+ * number, counting the records of the process from 0. A record too long for
+ * one atomic write goes out as numbered fragments. The parser reassembles a
+ * record by its (uuid, pid, seq) alone, and a gap in the sequence numbers of
+ * a process is a lost record. A child forked without exec keeps our uuid and
+ * starts a sequence of its own.
+ *
+ * Records are also stamped with CLOCK_MONOTONIC, read through the vDSO, as the
+ * ns since wisk_record_epoch, taken when the process starts sending, before
+ * it has threads of its own. Every WISK_RECORD_RESYNC-th record, the first
+ * one included, also carries the absolute epoch, in a field of its own.
+ * Nothing is shared but the sequence number, a lost record costs its own
+ * time only.
+ */
+#define WISK_RECORD_RESYNC 256
+
+static pid_t wisk_record_pid;
+static uint32_t wisk_record_seq;
+static uint64_t wisk_record_epoch;
+
+static inline uint64_t wisk_record_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* epoch is 0 on the records that do not carry it */
+static inline uint32_t wisk_record_next(uint64_t *time, uint64_t *epoch)
+{
+	uint32_t seq = __sync_fetch_and_add(&wisk_record_seq, 1);
+
+	*time = wisk_record_clock() - wisk_record_epoch;
+	*epoch = (seq % WISK_RECORD_RESYNC) ? 0 : wisk_record_epoch;
+	return seq;
+}
+
+static void wisk_record_init(pid_t pid)
+{
+	wisk_record_pid = pid;
+	wisk_record_seq = 0;
+	wisk_record_epoch = wisk_record_clock();
+}
+
+static void wisk_record_atfork_child(void)
+{
+	wisk_record_init(getpid());
+}
+
+/*
+ * Text records are lines of "<uuid>@<pid>.<seq>~<time>:<frag> <OPERATION> <json>".
+ * The ':' is a '+' on every fragment but the last, the json value is split
+ * across the fragments as is. A record that carries the epoch has it after
+ * the time, as "~<time>/<epoch>".
+ */
+struct wisk_text_frame {
+	uint32_t seq;
+	uint64_t time;
+	uint64_t epoch;
+	unsigned int frag;
+	char *more;
+};
+
+static inline void wisk_text_header(char *msgbuffer, char **trackdest, char const *uuid, char const *operation,
+				    struct wisk_text_frame *frame)
+{
+	int n;
+
+	n = snprintf(msgbuffer, BUFFER_SIZE, "%s@%d.%u~%" PRIu64, uuid, wisk_record_pid, frame->seq, frame->time);
+	if (frame->epoch)
+		n += snprintf(msgbuffer + n, BUFFER_SIZE - n, "/%" PRIu64, frame->epoch);
+	frame->more = msgbuffer + n;
+	*trackdest = msgbuffer + n + snprintf(msgbuffer + n, BUFFER_SIZE - n, ":%u %s ", frame->frag, operation);
+}
+
+static inline void flushbuffer(char *msgbuffer, char **trackdest, struct wisk_text_frame *frame, bool more)
+{
+//	msgbuffer[BUFFER_SIZE-1] = '\0';
+    if (more) {
+        *frame->more = '+';
+        frame->frag++;
+    }
+    *(*trackdest)++ = '\n';
+    **trackdest='\0';
+    WISK_LOG(WISK_LOG_TRACE, "%d: %.*s", *trackdest - msgbuffer, *trackdest - msgbuffer, msgbuffer);
+	wisk_batch_append(msgbuffer, *trackdest - msgbuffer);
+    *trackdest = msgbuffer;
+    *msgbuffer='\0';
+}
+
+
+// msgbuffer - to use for reporting opersation
+// uuid - associated with operation
+// operation - string
+// valuestr - to copy over
+// idx - < 0 means, it is a single string, if >=0 it is a list, and this is the idx
+// trackdest - current ptr within msgbuffer where the next character can be copied
+// frame - of the record, NULL for a new one
+static void wisk_report_operation(char *msgbuffer, char const *uuid, char const *operation, char *valuestr, int idx, char **trackdest, struct wisk_text_frame *frame)
+{
+    char *src, *ldest;
+    struct wisk_text_frame lframe;
+
+//    WISK_LOG(WISK_LOG_TRACE, "%s: %s", uuid, operation);
+    if (frame == NULL) {
+        lframe.seq = wisk_record_next(&lframe.time, &lframe.epoch);
+        lframe.frag = 0;
+        frame = &lframe;
+    }
+    if (trackdest == NULL) {
+        ldest = msgbuffer;
+        trackdest = &ldest;
+    }
+    if (*trackdest >= msgbuffer+BUFFER_SIZE-10) { // Enough space to copy a char+'\0' OR escaped char + '\0'
+        flushbuffer(msgbuffer, trackdest, frame, true);
+    }
+    if (*trackdest==msgbuffer) { // If beginning of Buffer
+        wisk_text_header(msgbuffer, trackdest, uuid, operation, frame);
+    }
+	if (idx > 0) {
+        *(*trackdest)++ = ',';
+        *(*trackdest)++ = ' ';
+	}
+    *(*trackdest)++ = '"';
+    *(*trackdest) = '\0';
+    for(src=valuestr; *src; ) {
+        if (*trackdest >= msgbuffer+BUFFER_SIZE-10) { // Enough space to copy a char+'\0' OR escaped char + '\0'
+            flushbuffer(msgbuffer, trackdest, frame, true);
+        }
+        if (*trackdest==msgbuffer) { // If beginning of Buffer
+            wisk_text_header(msgbuffer, trackdest, uuid, operation, frame);
+            continue;
+        }
+        escapedcharcopy(trackdest, &src);
+	}
+    *(*trackdest)++ = '"';
+    *(*trackdest) = '\0';
+    if (idx < 0) // If idx < 0, its not a list, nothing more flush it
+        flushbuffer(msgbuffer, trackdest, frame, false);
+}
+
+static void wisk_report_operationlist(char *msgbuffer, char const *uuid, char const *operation, char *listp[])
+{
+	char *dest = msgbuffer;
+    struct wisk_text_frame frame = {0, 0, 0, 0, NULL};
+    int idx;
+
+    frame.seq = wisk_record_next(&frame.time, &frame.epoch);
+//    WISK_LOG(WISK_LOG_TRACE, "%s: %s", uuid, operation);
+    wisk_text_header(msgbuffer, &dest, uuid, operation, &frame);
+    *dest++ = '[';
+	for(idx=0; listp[idx]; idx++) {
+        WISK_LOG(WISK_LOG_TRACE, "%s: ['%s']", operation, listp[idx]);
+	    wisk_report_operation(msgbuffer, uuid, operation, listp[idx], idx, &dest, &frame);
+	}
+    *dest++ = ']';
+    flushbuffer(msgbuffer, &dest, &frame, false);
+}
+
+
+/*
+ * Binary records, selected with WISK_TRACKER_FORMAT=binary. Each record is a
+ * struct wisk_record_hdr followed by len bytes of payload. The payload is
+ * the raw, unescaped values, each terminated by a '\0'. A payload that does
+ * not fit in BUFFER_SIZE goes out as fragments numbered from 0, all but the
+ * last one flagged WISK_RECORD_MORE. Decoded by read_raw_records() in
+ * wisktrack.py. Version 3 added the time, see wisk_record_next(). Since
+ * version 4, a record flagged WISK_RECORD_EPOCH starts its payload with the
+ * 64 bit epoch.
+ */
+#define WISK_RECORD_MAGIC 0xB7
+#define WISK_RECORD_VERSION 4
+#define WISK_RECORD_LIST 0x01
+#define WISK_RECORD_MORE 0x02
+#define WISK_RECORD_EPOCH 0x04
+
+struct wisk_record_hdr {
+	uint8_t magic;
+	uint8_t version;
+	uint8_t op;
+	uint8_t flags;
+	uint32_t len;
+	uint32_t pid;
+	uint32_t seq;
+	uint16_t frag;
+	uint16_t reserved;
+	random_uuid_t id;
+	uint64_t time;
+} __attribute__((packed));
+
+static void wisk_report_binary(char *msgbuffer, enum wisk_op_e op, uint8_t flags, char *const listp[])
+{
+	struct wisk_record_hdr *hdr = (struct wisk_record_hdr *)msgbuffer;
+	char *payload = msgbuffer + sizeof(*hdr);
+	char *dest = payload, *end = msgbuffer + BUFFER_SIZE;
+	const char *src;
+	uint64_t time, epoch;
+	size_t len, n;
+	int i;
+
+	hdr->magic = WISK_RECORD_MAGIC;
+	hdr->version = WISK_RECORD_VERSION;
+	hdr->op = op;
+	hdr->pid = wisk_record_pid;
+	hdr->seq = wisk_record_next(&time, &epoch);
+	hdr->time = time;
+	hdr->frag = 0;
+	hdr->reserved = 0;
+	hdr->id = fs_tracker_uuid_raw;
+	if (epoch) {
+		memcpy(dest, &epoch, sizeof(epoch));
+		dest += sizeof(epoch);
+		flags |= WISK_RECORD_EPOCH;
+	}
+	for (i = 0; listp[i]; i++) {
+		src = listp[i];
+		len = strlen(src) + 1;
+		while (len) {
+			if (dest == end) {
+				hdr->flags = flags | WISK_RECORD_MORE;
+				hdr->len = dest - payload;
+				wisk_batch_append(msgbuffer, dest - msgbuffer);
+				hdr->frag++;
+				dest = payload;
+			}
+			n = MIN(len, (size_t)(end - dest));
+			memcpy(dest, src, n);
+			dest += n;
+			src += n;
+			len -= n;
+		}
+	}
+	hdr->flags = flags;
+	hdr->len = dest - payload;
+	wisk_batch_append(msgbuffer, dest - msgbuffer);
+}
+
+/* Report a single value of an operation, in the configured format */
+static void wisk_report(enum wisk_op_e op, char *valuestr)
+{
+	char msgbuffer[BUFFER_SIZE];
+	char *listp[] = {valuestr, NULL};
+	char root[PATH_MAX];
+	int dedup = wisk_op_dedup(op), verdict = 0;
+
+	// A USES is not sampled, it is all there is of the root in the process
+	if (dedup >= 0 && op != WISK_OP_USES) {
+		verdict = wisk_path_verdict(valuestr, op == WISK_OP_READS ? root : NULL);
+		if (verdict == WISK_PATHFILTER_IMMUTABLE && op == WISK_OP_READS) {
+			op = WISK_OP_USES;
+			dedup = wisk_op_dedup(op);
+			valuestr = listp[0] = root;
+		} else if (verdict == WISK_PATHFILTER_EXCLUDE || !wisk_sample_keep(valuestr)) {
+			return;
+		}
+	}
+	if (dedup >= 0 && wisk_dedup_seen(dedup, valuestr))
+		return;
+	if (fs_tracker_binary) {
+		// The record is tagged with our own id, so CALLS carries the parent's
+		if (op == WISK_OP_CALLS)
+			listp[0] = fs_tracker_puuid;
+		wisk_report_binary(msgbuffer, op, 0, listp);
+	} else {
+		wisk_report_operation(msgbuffer, op == WISK_OP_CALLS ? fs_tracker_puuid : fs_tracker_uuid,
+				      wisk_op_names[op], valuestr, -1, NULL, NULL);
+	}
+}
+
+/* Report a NULL terminated list of values of an operation, in the configured format */
+static void wisk_report_list(enum wisk_op_e op, char *listp[])
+{
+	char msgbuffer[BUFFER_SIZE];
+
+	if (fs_tracker_binary)
+		wisk_report_binary(msgbuffer, op, WISK_RECORD_LIST, listp);
+	else
+		wisk_report_operationlist(msgbuffer, fs_tracker_uuid, wisk_op_names[op], listp);
+}
+
+/*
+ * Report the repeat counts of the dedup table as REPEATS records, lists of
+ * (operation, count, path) triples. Sent in several records when there are
+ * many, the counts add up.
+ */
+#define WISK_REPEATS_PER_RECORD 64
+static void wisk_report_repeats(void)
+{
+	char *listp[3 * WISK_REPEATS_PER_RECORD + 1];
+	char counts[WISK_REPEATS_PER_RECORD][12];
+	struct wisk_path_entry *e;
+	size_t i;
+	int d, n = 0;
+
+	if (fs_tracker_pipe < 0)
+		return;
+	wisk_mutex_lock(&wisk_path_mutex);
+	for (i = 0; i < wisk_path_slots; i++) {
+		e = &wisk_path_table[i];
+		if (!e->path)
+			continue;
+		for (d = 0; d < WISK_DEDUP_COUNT; d++) {
+			if (!e->repeats[d])
+				continue;
+			snprintf(counts[n], sizeof(counts[n]), "%u", e->repeats[d]);
+			listp[3 * n] = (char *)wisk_op_names[wisk_dedup_ops[d]];
+			listp[3 * n + 1] = counts[n];
+			listp[3 * n + 2] = (char *)e->path;
+			e->repeats[d] = 0;
+			if (++n == WISK_REPEATS_PER_RECORD) {
+				listp[3 * n] = NULL;
+				wisk_report_list(WISK_OP_REPEATS, listp);
+				n = 0;
+			}
+		}
+	}
+	if (n) {
+		listp[3 * n] = NULL;
+		wisk_report_list(WISK_OP_REPEATS, listp);
+	}
+	wisk_mutex_unlock(&wisk_path_mutex);
+}
+
+/* Send the pending probes, a PROBES record per directory. Called with wisk_path_mutex held */
+#define WISK_PROBES_PER_RECORD 128
+static void wisk_report_probes_locked(void)
+{
+	char *listp[WISK_PROBES_PER_RECORD + 2];
+	struct wisk_probe *p;
+	int i, n;
+
+	for (i = 0; i < wisk_probe_ndirs; i++) {
+		listp[0] = (char *)wisk_probe_dirs[i].dir;
+		n = 1;
+		for (p = wisk_probe_dirs[i].probes; p; p = p->next) {
+			listp[n++] = p->item;
+			if (n == WISK_PROBES_PER_RECORD + 1 || p->next == NULL) {
+				listp[n] = NULL;
+				wisk_report_list(WISK_OP_PROBES, listp);
+				n = 1;
+			}
+		}
+	}
+	wisk_probe_ndirs = 0;
+}
+
+static void wisk_report_probes(void)
+{
+	if (fs_tracker_pipe < 0)
+		return;
+	wisk_mutex_lock(&wisk_path_mutex);
+	wisk_report_probes_locked();
+	wisk_mutex_unlock(&wisk_path_mutex);
+}
+
+static void wisk_report_probe(enum wisk_probe_e kind, const char *path)
+{
+	struct wisk_path_entry *e;
+	char buf[PATH_MAX];
+	size_t len;
+
+	if (!fs_tracker_enabled() || !WISK_TRACK_EVENT(WISK_TRACK_PROBES)) {
+		WISK_LOG(WISK_LOG_TRACE, "PROBES %d %s", kind, path);
+		return;
+	}
+	if (path[0] != '/')
+		return;
+	switch (wisk_path_verdict(path, buf)) {
+	case WISK_PATHFILTER_EXCLUDE:
+		return;
+	case WISK_PATHFILTER_IMMUTABLE:
+		wisk_report(WISK_OP_USES, buf);
+		return;
+	}
+	path = wisk_path_normalize(buf, path);
+	if (path != buf)
+		snprintf(buf, sizeof(buf), "%s", path);
+	for (len = strlen(buf); len > 1 && buf[len - 1] == '/'; len--)
+		buf[len - 1] = '\0';
+	if (!wisk_sample_keep(buf))
+		return;
+	// Most probes repeat, those are told apart without the lock
+	e = wisk_path_find(buf, len);
+	if (e && (__atomic_load_n(&e->probed, __ATOMIC_RELAXED) & kind))
+		return;
+	wisk_mutex_lock(&wisk_path_mutex);
+	wisk_probe_add(kind, buf, len);
+	wisk_mutex_unlock(&wisk_path_mutex);
+}
+
+/*
+ * Report the outcome of a lookup of path, relative to dirfd: found when ret
+ * is not negative, missing on ENOENT and ENOTDIR. Other failures, e.g.
+ * EACCES, tell nothing about the path. errno is left as the call set it.
+ */
+static void wisk_report_lookup(int ret, int dirfd, const char *path)
+{
+	char buf[PATH_MAX];
+	int err = errno;
+
+	if (fs_tracker_pipe < 0 || path == NULL || path[0] == '\0')
+		return;
+	if (ret >= 0)
+		wisk_report_probe(WISK_PROBE_FOUND, ifnotabsoluteat(buf, dirfd, path));
+	else if (err == ENOENT || err == ENOTDIR)
+		wisk_report_probe(WISK_PROBE_MISSING, ifnotabsoluteat(buf, dirfd, path));
+	errno = err;
+}
+
+void wisk_report_link(const char *target, const char *linkpath)
+{
+    char *listp[] = {NULL, NULL, NULL};
+    char tbuf[PATH_MAX], lbuf[PATH_MAX];
+
+    if (fs_tracker_pipe < 0)
+    	return;
+	if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_LINKS)) {
+        listp[0] = ifnotabsolute(tbuf, target);
+        listp[1] = ifnotabsolute(lbuf, linkpath);
+        if (wisk_path_excluded(listp[0]) && wisk_path_excluded(listp[1]))
+            return;
+        if (!wisk_sample_keep(listp[1]))
+            return;
+        wisk_report_list(WISK_OP_LINKS, listp);
+    } else {
+        WISK_LOG(WISK_LOG_TRACE, "LINKS %s %s", target, linkpath);
+	}
+}
+
+void wisk_report_unlink(const char *pathname)
+{
+    char buf[PATH_MAX];
+
+    if (fs_tracker_pipe < 0)
+        return;
+    if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_LINKS)) {
+        wisk_report(WISK_OP_UNLINK, ifnotabsolute(buf, pathname));
+    } else {
+        WISK_LOG(WISK_LOG_TRACE, "UNLINK %s", pathname);
+    }
+}
+
+void wisk_report_chmod(const char *pathname)
+{
+    char buf[PATH_MAX];
+
+    if (fs_tracker_pipe < 0)
+        return;
+    if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_CHMODS)) {
+        wisk_report(WISK_OP_CHMOD, ifnotabsolute(buf, pathname));
+    } else {
+        WISK_LOG(WISK_LOG_TRACE, "CHMOD %s", pathname);
+    }
+}
+
+void wisk_report_write(const char *fname)
+{
+    char buf[PATH_MAX];
+
+    if (fs_tracker_pipe < 0)
+    	return;
+	if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_WRITES)) {
+        wisk_report(WISK_OP_WRITES, ifnotabsolute(buf, fname));
+    } else {
+        WISK_LOG(WISK_LOG_TRACE, "WRITES %s", fname);
+	}
+}
+
+void wisk_report_read(const char *fname)
+{
+    char buf[PATH_MAX];
+
+    if (fs_tracker_pipe < 0)
     	return;
 	if (fs_tracker_enabled() && WISK_TRACK_EVENT(WISK_TRACK_READS)) {
-        wisk_report_operation(msgbuffer, fs_tracker_uuid, "READS", ifnotabsolute(buf, fname), -1, NULL, NULL);
+        wisk_report(WISK_OP_READS, ifnotabsolute(buf, fname));
     } else {
         WISK_LOG(WISK_LOG_TRACE, "READS %s", fname);
 	}
@@ -1089,91 +3854,370 @@ void wisk_report_read(const char *fname)
 
 void wisk_report_unknown(const char *fname, const char *mode)
 {
-    char msgbuffer[BUFFER_SIZE];
-    char buf[PATH_MAX];
-    int msglen;
-
 	if (fs_tracker_enabled() && (fs_tracker_pipe >=0) && WISK_TRACK_EVENT(WISK_TRACK_READS)) {
-        wisk_report_operation(msgbuffer, fs_tracker_uuid, "READS-UNKNOWN", (char*)fname, -1, NULL, NULL);
+        wisk_report(WISK_OP_READS_UNKNOWN, (char*)fname);
     } else {
         WISK_LOG(WISK_LOG_TRACE, "READS %s", fname);
 	}
 }
 
-static void  wisk_report_command()
+/*
+ * The environment is reported relative to the one the parent reported, it
+ * rarely differs by more than a few variables. A process hands each program
+ * it runs WISK_TRACKER_ENVDIGEST=<uuid>:<sum>:<change>..., where a change is
+ * +<hash> of an entry the program has that it did not report itself, or
+ * -<hash> of one it reported that the program lacks, a 64 bit FNV-1a hash of
+ * the entry, and <sum> adds up the hashes of all the program's entries. Only
+ * the changes travel, so the digest stays short however large the
+ * environment, and with more than WISK_ENVDIGEST_CHANGES of them it is left
+ * out. The child reports ENVIRONMENT-DELTA [<uuid>, its entries of the +
+ * hashes..., =<hash> of each -], the parser resolves the hashes against the
+ * entries of <uuid>. Children of system() and popen() inherit environ, and
+ * with it the digest our parent handed us, which holds for them as long as
+ * environ is as we got it; the child checks <sum> against its own entries to
+ * tell. The WISK_ and LD_PRELOAD entries are left out of all of it, the
+ * parser drops them anyway.
+ *
+ * Without a digest that holds, or with WISK_TRACKER_ENVIRONMENT=full, the
+ * complete environment is reported as ENVIRONMENT.
+ */
+#define WISK_ENVHASH_LEN 16
+#define WISK_ENVDIGEST_CHANGES 64
+#define WISK_ENVDIGEST_SIZE (sizeof(WISK_TRACKER_ENVDIGEST) + UUID_SIZE + WISK_ENVHASH_LEN + 3 + \
+			     WISK_ENVDIGEST_CHANGES * (WISK_ENVHASH_LEN + 1))
+
+// The hashes of the entries we reported, sorted, the digests of the programs we run are taken against them
+static uint64_t *wisk_env_hashes;
+static size_t wisk_env_nhashes;
+
+static bool wisk_env_reported(const char *env)
 {
-    int i, msglen, envcount, count;
-    char curprog[PATH_MAX];
-	char curpath[PATH_MAX];
-	char pidstr[PATH_MAX];
-	char ppidstr[PATH_MAX];
-    char msgbuffer[BUFFER_SIZE];
-    char envstr[BUFFER_SIZE];
+	return strncmp(env, "WISK_", 5) != 0 && strncmp(env, LD_PRELOAD, strlen(LD_PRELOAD)) != 0;
+}
 
-    if (fs_tracker_pipe < 0)
-    	return;
-    if (!WISK_TRACK_EVENT(WISK_TRACK_PROCESS))
-    	return;
-    i = readlink("/proc/self/exe", curprog, sizeof(curprog)-1);
+/*
+ * FNV-1a of the entry as envhash() in wisktrack.py hashes it, "name=value".
+ * The parser reads an entry without a '=' as a name with an empty value, so
+ * that one is hashed with a '=' after it.
+ */
+static uint64_t wisk_env_hash(const char *env)
+{
+	uint64_t h = 14695981039346656037ULL;
+	bool value = false;
+
+	for (; *env; env++) {
+		value |= *env == '=';
+		h = (h ^ (unsigned char)*env) * 1099511628211ULL;
+	}
+	if (!value)
+		h = (h ^ (unsigned char)'=') * 1099511628211ULL;
+	return h;
+}
+
+static int wisk_env_hashcmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The WISK_TRACKER_ENVDIGEST entry for a program run with envp, in buf of WISK_ENVDIGEST_SIZE */
+static char *wisk_env_digest(char *const envp[], char *buf)
+{
+	char *s, *sum_at, *end = buf + WISK_ENVDIGEST_SIZE;
+	bool kept[wisk_env_nhashes+1];
+	uint64_t h, sum = 0, *p;
+	size_t n = 0, i;
+
+	if (wisk_env_hashes == NULL)
+		return NULL;
+	memset(kept, 0, sizeof(kept));
+	s = buf + snprintf(buf, WISK_ENVDIGEST_SIZE, "%s=%s:", WISK_TRACKER_ENVDIGEST, fs_tracker_uuid);
+	sum_at = s;
+	s += WISK_ENVHASH_LEN + 1;
+	for (i = 0; envp[i]; i++) {
+		if (!wisk_env_reported(envp[i]))
+			continue;
+		h = wisk_env_hash(envp[i]);
+		sum += h;
+		p = bsearch(&h, wisk_env_hashes, wisk_env_nhashes, sizeof(h), wisk_env_hashcmp);
+		if (p) {
+			kept[p - wisk_env_hashes] = true;
+			continue;
+		}
+		if (++n > WISK_ENVDIGEST_CHANGES)
+			return NULL;
+		s += snprintf(s, end - s, "+%016" PRIx64, h);
+	}
+	for (i = 0; i < wisk_env_nhashes; i++) {
+		if (kept[i])
+			continue;
+		if (++n > WISK_ENVDIGEST_CHANGES)
+			return NULL;
+		s += snprintf(s, end - s, "-%016" PRIx64, wisk_env_hashes[i]);
+	}
+	snprintf(sum_at, WISK_ENVHASH_LEN + 1, "%016" PRIx64, sum);
+	sum_at[WISK_ENVHASH_LEN] = ':';
+	return buf;
+}
+
+/* Reports environ against the digest our parent handed us, false when the digest does not hold */
+static bool wisk_report_envdelta(const char *pdigest, const uint64_t *hashes, size_t count, uint64_t sum)
+{
+	const char *s = strchr(pdigest, ':'), *changes;
+	char hex[WISK_ENVHASH_LEN+1], base[UUID_SIZE+1];
+	size_t nchanges, nadded = 0, nremoved = 0, n = 0, i;
+
+	if (s == NULL || s - pdigest > UUID_SIZE || strnlen(s + 1, WISK_ENVHASH_LEN + 1) < WISK_ENVHASH_LEN + 1 ||
+	    s[WISK_ENVHASH_LEN + 1] != ':')
+		return false;
+	snprintf(base, sizeof(base), "%.*s", (int)(s - pdigest), pdigest);
+	snprintf(hex, sizeof(hex), "%s", s + 1);
+	if (strtoull(hex, NULL, 16) != sum) {
+		WISK_LOG(WISK_LOG_TRACE, "Environment changed since the digest of %s was taken", base);
+		return false;
+	}
+	changes = s + WISK_ENVHASH_LEN + 2;
+	nchanges = strlen(changes) / (WISK_ENVHASH_LEN + 1);
+	uint64_t added[nchanges+1];
+	char removed[nchanges+1][WISK_ENVHASH_LEN+2];
+	char *listp[count+nchanges+2];
+
+	for (i = 0; i < nchanges; i++, changes += WISK_ENVHASH_LEN + 1) {
+		snprintf(hex, sizeof(hex), "%s", changes + 1);
+		if (*changes == '+')
+			added[nadded++] = strtoull(hex, NULL, 16);
+		else
+			snprintf(removed[nremoved++], sizeof(removed[0]), "=%s", hex);
+	}
+	qsort(added, nadded, sizeof(added[0]), wisk_env_hashcmp);
+	listp[n++] = base;
+	for (i = 0; i < count; i++) {
+		if (wisk_env_reported(environ[i]) &&
+		    bsearch(&hashes[i], added, nadded, sizeof(added[0]), wisk_env_hashcmp))
+			listp[n++] = environ[i];
+	}
+	for (i = 0; i < nremoved; i++)
+		listp[n++] = removed[i];
+	listp[n] = NULL;
+	WISK_LOG(WISK_LOG_TRACE, "Environment of %zu entries reported as %zu changes to %s", count, n-1, base);
+	wisk_report_list(WISK_OP_ENVIRONMENT_DELTA, listp);
+	return true;
+}
+
+static void wisk_report_environment(void)
+{
+	char *s, *pdigest;
+	size_t count, i, j;
+	uint64_t sum = 0;
+
+	for (count = 0; environ && environ[count]; count++);
+	uint64_t hashes[count+1];
+
+	for (i = 0; i < count; i++) {
+		hashes[i] = wisk_env_reported(environ[i]) ? wisk_env_hash(environ[i]) : 0;
+		sum += hashes[i];
+	}
+	wisk_env_hashes = malloc((count + 1) * sizeof(hashes[0]));
+	if (wisk_env_hashes) {
+		for (i = 0, j = 0; i < count; i++) {
+			if (wisk_env_reported(environ[i]))
+				wisk_env_hashes[j++] = hashes[i];
+		}
+		qsort(wisk_env_hashes, j, sizeof(hashes[0]), wisk_env_hashcmp);
+		for (i = 0, wisk_env_nhashes = 0; i < j; i++) {
+			if (wisk_env_nhashes == 0 || wisk_env_hashes[i] != wisk_env_hashes[wisk_env_nhashes-1])
+				wisk_env_hashes[wisk_env_nhashes++] = wisk_env_hashes[i];
+		}
+	}
+
+	pdigest = getenv(WISK_TRACKER_ENVDIGEST);
+	s = getenv(WISK_TRACKER_ENVIRONMENT);
+	if ((s && strcmp(s, "full") == 0) || pdigest == NULL || !wisk_report_envdelta(pdigest, hashes, count, sum))
+		wisk_report_list(WISK_OP_ENVIRONMENT, environ);
+}
+
+/* COMMAND_PATH, the executable of the process, read once at init */
+static char fs_tracker_command_path[PATH_MAX];
+
+static void wisk_command_path_init(void)
+{
+    char *curprog = fs_tracker_command_path;
+    int i;
+
+    i = readlink("/proc/self/exe", curprog, PATH_MAX-1);
     if (i == PATH_MAX) {
       curprog[PATH_MAX-1] = '\0';
     } else if (i == -1) {
     	WISK_LOG(WISK_LOG_ERROR, "Falling back to ArgV, %d: %s", errno, strerror(errno));
-    	strncpy(curprog, saved_argv[0], PATH_MAX);
+    	snprintf(curprog, PATH_MAX, "%s", saved_argv[0] ? saved_argv[0] : "");
     } else {
     	curprog[i] = '\0';
     }
     WISK_LOG(WISK_LOG_TRACE, "%d: %s", i, curprog);
+}
+
+static void  wisk_report_command()
+{
+	char curpath[PATH_MAX];
+	char pidstr[PATH_MAX];
+	char ppidstr[PATH_MAX];
 
-	getcwd(curpath, PATH_MAX);
+    if (fs_tracker_pipe < 0)
+    	return;
+    if (!WISK_TRACK_EVENT(WISK_TRACK_PROCESS))
+    	return;
+	wisk_getcwd(curpath);
     WISK_LOG(WISK_LOG_TRACE, "%s CALLS %s PID=%d PPID=%d)",fs_tracker_puuid, fs_tracker_uuid, getpid(), getppid());
-    wisk_report_operation(msgbuffer, fs_tracker_puuid, "CALLS", fs_tracker_uuid, -1, NULL, NULL);
+    wisk_report(WISK_OP_CALLS, fs_tracker_uuid);
     snprintf(pidstr, PATH_MAX, "%d", getpid());
-    wisk_report_operation(msgbuffer, fs_tracker_uuid, "PID", pidstr, -1, NULL, NULL);
+    wisk_report(WISK_OP_PID, pidstr);
     snprintf(ppidstr, PATH_MAX, "%d", getppid());
-    wisk_report_operation(msgbuffer, fs_tracker_uuid, "PPID", ppidstr, -1, NULL, NULL);
-    wisk_report_operation(msgbuffer, fs_tracker_uuid, "WORKING_DIRECTORY", curpath, -1, NULL, NULL);
-    wisk_report_operation(msgbuffer, fs_tracker_uuid, "COMMAND_PATH", curprog, -1, NULL, NULL);
-    wisk_report_operationlist(msgbuffer, fs_tracker_uuid, "COMMAND", saved_argv);
-    wisk_report_operationlist(msgbuffer, fs_tracker_uuid, "ENVIRONMENT", environ);
+    wisk_report(WISK_OP_PPID, ppidstr);
+    wisk_report(WISK_OP_WORKING_DIRECTORY, curpath);
+    wisk_report(WISK_OP_COMMAND_PATH, fs_tracker_command_path);
+    wisk_report_list(WISK_OP_COMMAND, saved_argv);
+    wisk_report_environment();
+    // Ahead of anything the other threads batch up, so the node exists first
+    wisk_batch_flush();
 }
 
-static void  wisk_report_commandcomplete()
+/*
+ * rusage.<who>=<utime us>,<stime us>,<maxrss KB>,<inblock>,<oublock>,<nvcsw>,<nivcsw>
+ * of getrusage(). RUSAGE_SELF still counts the images the process had before
+ * an exec, RUSAGE_CHILDREN the children it waited for.
+ */
+static char *wisk_rusage_format(char *buf, size_t size, const char *who, int which)
 {
-    int count;
-    char pbuf[PATH_MAX], ppbuf[PATH_MAX], procpbuf[PATH_MAX];
-    char msgbuffer[BUFFER_SIZE];
+	struct rusage ru;
 
-    if (fs_tracker_pipe < 0)
+	if (getrusage(which, &ru) != 0)
+		return NULL;
+	snprintf(buf, size, "rusage.%s=%ld,%ld,%ld,%ld,%ld,%ld,%ld", who,
+		 (long)ru.ru_utime.tv_sec * 1000000L + (long)ru.ru_utime.tv_usec,
+		 (long)ru.ru_stime.tv_sec * 1000000L + (long)ru.ru_stime.tv_usec,
+		 ru.ru_maxrss, ru.ru_inblock, ru.ru_oublock, ru.ru_nvcsw, ru.ru_nivcsw);
+	return buf;
+}
+
+/*
+ * COMPLETE is [pid at init, pid, ppid, argc, argv..., key=value...]. The
+ * keys are the clock of the overhead counters, the lifetime of the process
+ * in it, overhead.<hook>=<calls>,<events>,<bytes>,<cycles> for every hook
+ * that was called, the rusage.self and rusage.children of
+ * wisk_rusage_format(), when sampling, sample=<mode>,<rate>,<selected>,
+ * <kept>,<dropped>, policy=<policy> when the command policy narrowed the
+ * tracking and overflow=<spilled>,<dropped> when the FIFO could not take all
+ * records. Reported from the destructor and from _exit(), once.
+ */
+static bool wisk_completed;
+
+static void  wisk_report_commandcomplete()
+{
+    int count, n, i;
+    char pbuf[PATH_MAX], ppbuf[PATH_MAX], procpbuf[PATH_MAX], argcbuf[16];
+    char lifebuf[64], hookbuf[WISK_HOOK_COUNT][96], selfbuf[160], childbuf[160], samplebuf[96], policybuf[32];
+    char overflowbuf[64];
+    struct wisk_hook_stats totals[WISK_HOOK_COUNT];
+    WISK_HOOK(WISK_HOOK_EXIT);
+
+    if (fs_tracker_pipe < 0 || wisk_completed)
     	return;
+    // What the other threads still have batched must reach the reader ahead of the COMPLETE
+    wisk_batch_flush_all();
+    wisk_report_probes();
+    wisk_report_repeats();
     if (!WISK_TRACK_EVENT(WISK_TRACK_PROCESS))
     	return;
     for(count=0; saved_argv[count]; count++); 
-    char *listp[count+4];
+    char *listp[count+WISK_HOOK_COUNT+12];
     snprintf(procpbuf, PATH_MAX, "%d", fs_tracker_pid);
     snprintf(pbuf, PATH_MAX, "%d", getpid());
     snprintf(ppbuf, PATH_MAX, "%d", getppid());
+    snprintf(argcbuf, sizeof(argcbuf), "%d", count);
     listp[0] = procpbuf;
     listp[1] = pbuf;
     listp[2] = ppbuf;
-    for(count=3; saved_argv[count-3]; count++)
-        listp[count] = saved_argv[count-3];
-    listp[count] = saved_argv[count-3];
+    listp[3] = argcbuf;
+    for(n=4; saved_argv[n-4]; n++)
+        listp[n] = saved_argv[n-4];
+#if defined(__x86_64__) || defined(__i386__)
+    listp[n++] = "clock=tsc";
+#else
+    listp[n++] = "clock=ns";
+#endif
+    snprintf(lifebuf, sizeof(lifebuf), "lifetime=%llu", (unsigned long long)(wisk_hook_clock() - wisk_hook_epoch));
+    listp[n++] = lifebuf;
+    // The exit hook is still running, what it has spent so far is counted
+    wisk_hook_fold(&wisk_hook_frame);
+    wisk_hook_totals(totals);
+    for (i = 0; i < WISK_HOOK_COUNT; i++) {
+        if (totals[i].calls == 0)
+            continue;
+        snprintf(hookbuf[i], sizeof(hookbuf[i]), "overhead.%s=%llu,%llu,%llu,%llu", wisk_hook_names[i],
+                 (unsigned long long)totals[i].calls, (unsigned long long)totals[i].events,
+                 (unsigned long long)totals[i].bytes, (unsigned long long)totals[i].cycles);
+        listp[n++] = hookbuf[i];
+    }
+    if (wisk_rusage_format(selfbuf, sizeof(selfbuf), "self", RUSAGE_SELF))
+        listp[n++] = selfbuf;
+    if (wisk_rusage_format(childbuf, sizeof(childbuf), "children", RUSAGE_CHILDREN))
+        listp[n++] = childbuf;
+    if (wisk_sample_mode != WISK_SAMPLE_ALL) {
+        snprintf(samplebuf, sizeof(samplebuf), "sample=%s,%g,%d,%llu,%llu", wisk_sample_names[wisk_sample_mode],
+                 wisk_sample_rate, wisk_sample_selected, (unsigned long long)wisk_sample_kept,
+                 (unsigned long long)wisk_sample_dropped);
+        listp[n++] = samplebuf;
+    }
+    if (wisk_policy != WISK_POLICY_FULL) {
+        snprintf(policybuf, sizeof(policybuf), "policy=%s", wisk_policy_names[wisk_policy]);
+        listp[n++] = policybuf;
+    }
+    // Written out first, so the counts cover all but the COMPLETE itself
+    if (wisk_overflow_dir[0])
+        wisk_batch_flush_all();
+    if (wisk_overflow_spilled || wisk_overflow_dropped) {
+        snprintf(overflowbuf, sizeof(overflowbuf), "overflow=%llu,%llu",
+                 (unsigned long long)wisk_overflow_spilled, (unsigned long long)wisk_overflow_dropped);
+        listp[n++] = overflowbuf;
+    }
+    listp[n] = NULL;
     if(getpid() == fs_tracker_pid || getppid() == 1) {
-        wisk_report_operationlist(msgbuffer, fs_tracker_uuid, "COMPLETE", listp);
+        wisk_completed = true;
+        wisk_report_list(WISK_OP_COMPLETE, listp);
     }
     else {
     	WISK_LOG(WISK_LOG_TRACE, "%s COMPLETE_THREAD [\"%d\" \"%d\" \"%d\" \"%s\" \"%s\" \"%s\" \"%s\" %s]",
-    			fs_tracker_uuid, fs_tracker_pid, getpid(), getppid(), listp[3], count>4?listp[4]:"", count>5?listp[5]:"", count>6?listp[6]:"", count>7?"...":"");
-//        wisk_report_operationlist(msgbuffer, fs_tracker_uuid, "COMPLETE_THREAD", listp);
+    			fs_tracker_uuid, fs_tracker_pid, getpid(), getppid(), listp[3], count>0?listp[4]:"", count>1?listp[5]:"", count>2?listp[6]:"", count>3?"...":"");
+//        wisk_report_list(WISK_OP_COMPLETE_THREAD, listp);
 
     }
 }
 
 
-static int generate_uniqueid(char *str)
+/* getrandom(), or /dev/urandom where the kernel lacks it, without stdio */
+static bool wisk_getrandom(void *buf, size_t len)
+{
+	ssize_t n = -1;
+	int fd;
+
+#if defined(HAVE_GETRANDOM) && defined(HAVE_SYS_RANDOM_H)
+	do {
+		n = getrandom(buf, len, GRND_NONBLOCK);
+	} while (n == -1 && errno == EINTR);
+	if (n == (ssize_t)len)
+		return true;
+#endif
+	fd = libc_open("/dev/urandom", O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	n = read(fd, buf, len);
+	libc_close(fd);
+	return n == (ssize_t)len;
+}
+
+static int generate_uniqueid(char *str, random_uuid_t *raw)
 {
-    FILE *randfile;
     random_uuid_t random_uuid;
 
 //    struct timespec epochtime;
@@ -1199,16 +4243,44 @@ static int generate_uniqueid(char *str)
 //    i4 = random();
 //    snprintf(str, UUID_SIZE, "%08x-%08x-%08x-%08x", i1, i2, i3, i4);
 
-    randfile = internal_fopen("/dev/urandom", "rb");
-    WISK_LOG(WISK_LOG_TRACE, "Randomize Device File: %p", randfile);
-    fread(&random_uuid, sizeof(random_uuid), 1, randfile);
-    fclose(randfile);
+    if (!wisk_getrandom(&random_uuid, sizeof(random_uuid))) {
+        struct timespec now;
+
+        WISK_LOG(WISK_LOG_ERROR, "No random source, deriving UniqeID from time and pid");
+        clock_gettime(CLOCK_REALTIME, &now);
+        random_uuid.i1 = now.tv_sec;
+        random_uuid.i2 = now.tv_nsec;
+        random_uuid.i3 = getpid();
+        random_uuid.i4 = getppid() ^ (uintptr_t)&now;
+    }
     snprintf(str, UUID_SIZE, "%08x-%08x-%08x-%08x", random_uuid.i1, random_uuid.i2, random_uuid.i3, random_uuid.i4);
+    *raw = random_uuid;
     WISK_LOG(WISK_LOG_TRACE, "Random UniqeID(%s)", str);
+    return 0;
 //	WISK_LOG(WISK_LOG_TRACE, "Seconds: %d, Nanoseconds: %d, PID: %d, PPID: %d, UniqeID(%s)", epochtime.tv_sec, epochtime.tv_nsec, getpid(), getppid(), str);
 //    WISK_LOG(WISK_LOG_TRACE, "PID: %d, UniqeID(%s), with %d", getpid(), str, millisecond);
 }
 
+/*
+ * The first group of a uuid is the session of the wisktrack run, which passes
+ * <session>-XXXXXXXX-XXXXXXXX-XXXXXXXX as the root's uuid. Every process takes
+ * it over from its parent, so each record names its session. A parent uuid
+ * without a session, XXXXXXXX-..., leaves the uuid fully random.
+ */
+static void wisk_uuid_session(char *str, random_uuid_t *raw, const char *puuid)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        if (!isxdigit((unsigned char)puuid[i]))
+            return;
+    }
+    if (puuid[8] != '-')
+        return;
+    raw->i1 = strtoul(puuid, NULL, 16);
+    memcpy(str, puuid, 8);
+}
+
 static int envcmp(const char *env, const char *var)
 {
     int len;
@@ -1237,6 +4309,26 @@ static void debug_log_wiskenv(char *msg, char *const envp[])
 
 }
 
+/*
+ * Storage of the WISK environment entries, they live as long as the process.
+ * It is only taken from while the tracker initializes, a static arena rather
+ * than an allocation per entry.
+ */
+#define WISK_ENV_ARENA_SIZE (64*1024)
+
+static char *wisk_env_alloc(size_t len)
+{
+	static char arena[WISK_ENV_ARENA_SIZE];
+	static size_t used;
+	char *p;
+
+	if (used + len > sizeof(arena))
+		return malloc(len);
+	p = arena + used;
+	used += len;
+	return p;
+}
+
 static void wisk_env_update(char *var, char *value, int *count, bool update)
 {
     char *s;
@@ -1249,7 +4341,7 @@ static void wisk_env_update(char *var, char *value, int *count, bool update)
 			wisk_envp[i] = NULL;
 	}
 	for(i=0; i< *count; i++)
-		if (envcmp(var, wisk_env_vars[i]))
+		if (envcmp(wisk_envp[i], var))
 			break;
 	if (strncmp(var, WISK_TRACKER_UUID, strlen(WISK_TRACKER_UUID)) == 0)
 		value = fs_tracker_uuid;
@@ -1264,11 +4356,11 @@ static void wisk_env_update(char *var, char *value, int *count, bool update)
 		return;
 	}
 	len = strlen(var)+strlen(value) + 2;
-	if (wisk_envp[i] !=  NULL) {
-	    SAFE_FREE(wisk_envp[i]);
+	wisk_envp[i] = wisk_env_alloc(len);
+	if (wisk_envp[i] == NULL) {
+		WISK_LOG(WISK_LOG_ERROR, "No room for WISK Environment %s", var);
+		return;
 	}
-	wisk_envp[i] = malloc(len);
-	wisk_envp[i][0] ='\0';
 	WISK_LOG(WISK_LOG_TRACE, "WISK Environment %s=%s, len=%d", var, value, len);
     snprintf(wisk_envp[i], len, "%s=%s", var, value);
 //	WISK_LOG(WISK_LOG_TRACE, "WISK Environment %s", wisk_envp[i]);
@@ -1284,151 +4376,227 @@ static void wisk_env_update(char *var, char *value, int *count, bool update)
 //    }
 }
 
-static int wisk_getvarcount(char *const envp[])
+/*
+ * The WISK part of the environment of the programs we run is the same for
+ * every exec, so it is taken apart once, when the tracker is initialized:
+ * the WISK variables to add, and the LD_PRELOAD and LD_LIBRARY_PATH elements
+ * to merge into the program's own. An exec then only walks the environment
+ * it is given once, and merges into buffers on the stack.
+ */
+#define WISK_ENVT_ELEMENTS 16
+
+struct wisk_envelems {
+	int count;
+	const char *s[WISK_ENVT_ELEMENTS];
+	size_t len[WISK_ENVT_ELEMENTS];
+};
+
+static struct {
+	bool ready;
+	int count;
+	char *vars[WISK_ENV_VARCOUNT];
+	struct wisk_envelems preload_pre;	/* Ahead of the program's LD_PRELOAD */
+	struct wisk_envelems preload_post;	/* After the program's LD_PRELOAD */
+	struct wisk_envelems library_path;	/* After the program's LD_LIBRARY_PATH */
+} wisk_envt;
+
+static const struct wisk_envelems wisk_envelems_none;
+
+static bool wisk_env_issep(char c, char sep)
+{
+	// ld.so takes spaces and colons in LD_PRELOAD
+	return c == sep || (sep == LD_PRELOAD_SEPARATOR && c == ':');
+}
+
+/* Next element of a path list at *s, NULL at the end of it */
+static const char *wisk_env_element(const char **s, char sep, size_t *len)
 {
-    int envc, i;
+	const char *e;
 
-    for (i=0, envc=1; envp[i]; i++) {
-      if (wisk_isenv(envp[i])) {
-//          WISK_LOG(WISK_LOG_TRACE, "Skipping Environment %d: %s", i, envp[i]);
-          continue;
-        }
-//      WISK_LOG(WISK_LOG_TRACE, "Environment %d: %s", i, envp[i]);
-      envc++;
-    }
-//    WISK_LOG(WISK_LOG_TRACE, "Var Count: %d",  envc);
-    return envc;
-}
-
-static void wisk_path_append(char *dest, char *src, char separator, char **include, char **exclude)
-{
-    char *starts, *s, *d, **inc, **exc, *envdest=dest, *envsrc=src, *pinclude=NULL, *pexclude=NULL;
-    char sepstr[2];
-    int len, first=0, inexlen;
-    
-    sprintf(sepstr, "%c", separator);
-	WISK_LOG(WISK_LOG_TRACE, "dest:%s, src:%s, include=%s%s%s, exclude=%s%s%s", dest, src,
-			include?"{":"", include?include[0]:NULL, include?",..}":"",
-			exclude?"{":"", exclude?exclude[0]:NULL, exclude?",..}":"");
-    for(starts=envsrc, len=0; *envsrc && *envsrc != '='; envsrc++, len++);
-    envsrc++;
-    if (*envdest  == '\0') {
-        strncat(envdest, starts, len+1);
-    }
-    for(; *envdest && *envdest != '='; envdest++);
-    envdest++;
-    if (*envdest == '\0')
-        first=1;
-    for(starts=envsrc, s=envsrc, len=0; ; s++) {
-        if (*starts == '\0')
-            break;
-        if (*starts == separator) {
-            starts++;
-            s=starts;
-            len=1;
-            continue;
-        }
-        if (*s != separator && *s) {
-            len++;
-            continue;
-        }
-        for(d=envdest; *d; d++) {
-            if ((strncmp(d, starts, len) == 0) && (*(d+len) == '\0' || *(d+len) == separator)) {
-                len=0;
-                break;
-            }
-        }
-        if (len && include) {
-        	pinclude = include[0];
-//        	WISK_LOG(WISK_LOG_TRACE, "including: %s....", include[0]);
-        	for(inc=include; *inc; inc += 1) {
-            	inexlen=strlen(*inc);
-            	if (strncmp(starts, *inc, (len <= inexlen?len:inexlen))==0) {
-            		break;
-        	    }
-        	}
-        	if(!*inc) {
-//	            WISK_LOG(WISK_LOG_TRACE, "Skipping by Include-Only: %.*s", len, starts);
-        		len=0;
-        	}
-        }
-        if (len && exclude) {
-        	pexclude = exclude[0];
-//        	WISK_LOG(WISK_LOG_TRACE, "excluding: %s....", exclude[0]);
-        	for(exc=exclude; *exc; exc += 1) {
-				inexlen=strlen(*exc);
-//				WISK_LOG(WISK_LOG_TRACE, "Exclude Comparing: %.*s, %s, %d, %d, %d", len, starts, *exc, len, inexlen, (len <= inexlen?len:inexlen));
-				if (strncmp(starts, *exc, (len <= inexlen?len:inexlen))==0) {
-//		            WISK_LOG(WISK_LOG_TRACE, "Skipping by Exclude-Only: %.*s", len, starts);
-					len=0;
-					break;
-				}
-        	}
-        }
-        if (len) {
-            WISK_LOG(WISK_LOG_TRACE, "Adding: %.*s, include=%s, exclude=%s", len, starts, pinclude, pexclude);
-            if (!first)
-               strncat(envdest, sepstr, 1);
-            first=0;
-            strncat(envdest, starts, len);
-        }
-        starts=s;
-        len=1;
-    }
-	WISK_LOG(WISK_LOG_TRACE, "Return %s", dest);
-}
-
-static void wisk_loadenv(char *const envp[], char *nenvp[], char *ld_library_path, char *ld_preload)
-{
-    int envi=0, i;
-    char *wisk_ld_path=NULL;
-    char *wisk_ld_preload=NULL;
-
-//	WISK_LOG(WISK_LOG_TRACE, "WISK_ENV_COUNT: %d", wisk_env_count);
-    ld_library_path[0] = '\0';
-    ld_preload[0] = '\0';
-	for(envi=0; envi < wisk_env_count; envi++) {
-//	  WISK_LOG(WISK_LOG_TRACE, "Adding WISK_ENV: %s", wisk_envp[envi]);
-      if (envcmp(wisk_envp[envi], "LD_LIBRARY_PATH")) {
-		nenvp[envi] = ld_library_path;
-        wisk_ld_path = wisk_envp[envi];
-      }
-      else if (envcmp(wisk_envp[envi], "LD_PRELOAD")) {
-//      	WISK_LOG(WISK_LOG_TRACE, "Saved WISK ENV LDLOAD: %s", wisk_envp[envi]);
-		nenvp[envi] = ld_preload;
-        wisk_ld_preload = wisk_envp[envi];
-        wisk_path_append(ld_preload, wisk_ld_preload, LD_PRELOAD_SEPARATOR, preldload, NULL);
-      }
-      else
-		nenvp[envi] = wisk_envp[envi];
-//      WISK_LOG(WISK_LOG_TRACE, "Added WISK_ENV: %s", nenvp[envi]);
-	}
-//	WISK_LOG(WISK_LOG_TRACE, "Added by PRE LDLOAD: %s", ld_preload);
-    for (i=0; envp[i]; i++) {
-//      WISK_LOG(WISK_LOG_TRACE, "Adding ENV: %s", envp[i]);
-      if (envcmp(envp[i], "LD_LIBRARY_PATH")) {
-    	  nenvp[envi] = ld_library_path;
-          wisk_path_append(ld_library_path, envp[i], LD_LIBRARY_PATH_SEPARATOR, NULL, NULL);
-          continue;
-      } 
-      else if (envcmp(envp[i], "LD_PRELOAD")) {
-//    	  WISK_LOG(WISK_LOG_TRACE, "Current Original ENV LDLOAD: %s", envp[i]);
-    	  nenvp[envi] = ld_preload;
-          wisk_path_append(ld_preload, envp[i], LD_PRELOAD_SEPARATOR, NULL, ldload);
-          continue;
-      } 
-      else if (wisk_isenv(envp[i]))
-          continue;
-      nenvp[envi++] = envp[i];
-//      WISK_LOG(WISK_LOG_TRACE, "Added ENV: %s", nenvp[envi-1]);
-    }
-//    WISK_LOG(WISK_LOG_TRACE, "Added from Original LDLOAD: %s", ld_preload);
-    if (wisk_ld_path) 
-        wisk_path_append(ld_library_path, wisk_ld_path, LD_LIBRARY_PATH_SEPARATOR, NULL, NULL);
-    if (wisk_ld_preload)
-        wisk_path_append(ld_preload, wisk_ld_preload, LD_PRELOAD_SEPARATOR, postldload, NULL);
-    nenvp[envi++] = envp[i];
-//	WISK_LOG(WISK_LOG_TRACE, "Added by POST LDLOAD: %s", ld_preload);
+	while (**s && wisk_env_issep(**s, sep))
+		(*s)++;
+	if (**s == '\0')
+		return NULL;
+	for (e = *s; **s && !wisk_env_issep(**s, sep); (*s)++);
+	*len = *s - e;
+	return e;
+}
+
+/* The LD_PRELOAD element is one of the libraries in names, by file name */
+static bool wisk_env_isload(const char *e, size_t len, char **names)
+{
+	const char *base = e;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (e[i] == '/')
+			base = e + i + 1;
+	len -= base - e;
+	for (; *names; names++) {
+		if (strlen(*names) == len && strncmp(base, *names, len) == 0)
+			return true;
+	}
+	return false;
+}
+
+static int wisk_envelems_find(const struct wisk_envelems *l, const char *e, size_t len)
+{
+	int i;
+
+	for (i = 0; i < l->count; i++)
+		if (l->len[i] == len && strncmp(l->s[i], e, len) == 0)
+			return i;
+	return -1;
+}
+
+static void wisk_envelems_add(struct wisk_envelems *l, const char *e, size_t len)
+{
+	if (wisk_envelems_find(l, e, len) >= 0)
+		return;
+	if (l->count == WISK_ENVT_ELEMENTS) {
+		WISK_LOG(WISK_LOG_ERROR, "Too many path elements, dropping %.*s", (int)len, e);
+		return;
+	}
+	l->s[l->count] = e;
+	l->len[l->count++] = len;
+}
+
+static void wisk_envtemplate_init(void)
+{
+	const char *s, *e;
+	size_t len;
+	int i;
+
+	memset(&wisk_envt, 0, sizeof(wisk_envt));
+	for (i = 0; i < wisk_env_count; i++) {
+		if (envcmp(wisk_envp[i], LD_PRELOAD)) {
+			s = wisk_envp[i] + strlen(LD_PRELOAD) + 1;
+			while ((e = wisk_env_element(&s, LD_PRELOAD_SEPARATOR, &len))) {
+				if (wisk_env_isload(e, len, preldload))
+					wisk_envelems_add(&wisk_envt.preload_pre, e, len);
+				else if (wisk_env_isload(e, len, postldload))
+					wisk_envelems_add(&wisk_envt.preload_post, e, len);
+			}
+		} else if (envcmp(wisk_envp[i], LD_LIBRARY_PATH)) {
+			s = wisk_envp[i] + strlen(LD_LIBRARY_PATH) + 1;
+			while ((e = wisk_env_element(&s, LD_LIBRARY_PATH_SEPARATOR, &len)))
+				wisk_envelems_add(&wisk_envt.library_path, e, len);
+		} else if (!envcmp(wisk_envp[i], WISK_TRACKER_ENVDIGEST)) {
+			// Taken for each program against the environment it is given
+			wisk_envt.vars[wisk_envt.count++] = wisk_envp[i];
+		}
+	}
+	wisk_envt.ready = true;
+}
+
+/* Entries of envp, plus those wisk_loadenv() may add */
+static size_t wisk_envsize(char *const envp[])
+{
+	size_t i;
+
+	for (i = 0; envp[i]; i++);
+	return i + WISK_ENV_VARCOUNT + 4;
+}
+
+static char *wisk_env_append(char *d, char *end, const char *s, size_t len, bool sep, char sepc)
+{
+	if (d == NULL || d + len + 2 > end)
+		return NULL;
+	if (sep)
+		*d++ = sepc;
+	memcpy(d, s, len);
+	return d + len;
+}
+
+/*
+ * Merges into buf name=<pre><the elements of env, less our own library><post>,
+ * each element once. Returns env as is, NULL if unset, when there is nothing
+ * to merge, or no room to.
+ */
+static char *wisk_env_merge(char *buf, size_t size, const char *name, char sep, char *env,
+			    const struct wisk_envelems *pre, const struct wisk_envelems *post)
+{
+	char *d = buf, *end = buf + size;
+	const char *s, *e;
+	bool posted[WISK_ENVT_ELEMENTS] = {false};
+	bool first = true;
+	size_t len;
+	int i;
+
+	if (pre->count == 0 && post->count == 0)
+		return env;
+	d = wisk_env_append(d, end, name, strlen(name), false, sep);
+	d = wisk_env_append(d, end, "=", 1, false, sep);
+	for (i = 0; i < pre->count; i++, first = false)
+		d = wisk_env_append(d, end, pre->s[i], pre->len[i], !first, sep);
+	s = env ? env + strlen(name) + 1 : "";
+	while ((e = wisk_env_element(&s, sep, &len))) {
+		if (sep == LD_PRELOAD_SEPARATOR && wisk_env_isload(e, len, ldload))
+			continue;
+		if (wisk_envelems_find(pre, e, len) >= 0)
+			continue;
+		if ((i = wisk_envelems_find(post, e, len)) >= 0)
+			posted[i] = true;
+		d = wisk_env_append(d, end, e, len, !first, sep);
+		first = false;
+	}
+	for (i = 0; i < post->count; i++) {
+		if (posted[i])
+			continue;
+		d = wisk_env_append(d, end, post->s[i], post->len[i], !first, sep);
+		first = false;
+	}
+	if (d == NULL) {
+		WISK_LOG(WISK_LOG_ERROR, "%s does not fit in %zu bytes, passed on as is", name, size);
+		return env;
+	}
+	*d = '\0';
+	return buf;
+}
+
+static void wisk_loadenv(char *const envp[], char *nenvp[], char *ld_library_path, char *ld_preload,
+			 char *env_digest)
+{
+	char *preload = NULL, *library_path = NULL, *e;
+	int n = 0, i;
+
+	if (!wisk_envt.ready) {
+		for (i = 0; envp[i]; i++)
+			nenvp[i] = envp[i];
+		nenvp[i] = NULL;
+		return;
+	}
+	for (i = 0; i < wisk_envt.count; i++)
+		nenvp[n++] = wisk_envt.vars[i];
+	for (i = 0; envp[i]; i++) {
+		e = envp[i];
+		if (e[0] == 'L' && e[1] == 'D' && e[2] == '_') {
+			if (envcmp(e, LD_PRELOAD)) {
+				preload = e;
+				continue;
+			}
+			if (envcmp(e, LD_LIBRARY_PATH)) {
+				library_path = e;
+				continue;
+			}
+		} else if (e[0] == 'W' && strncmp(e, "WISK_TRACKER_", 13) == 0 && wisk_isenv(e)) {
+			continue;
+		}
+		nenvp[n++] = e;
+	}
+	library_path = wisk_env_merge(ld_library_path, PATH_MAX, LD_LIBRARY_PATH, LD_LIBRARY_PATH_SEPARATOR,
+				      library_path, &wisk_envelems_none, &wisk_envt.library_path);
+	if (library_path)
+		nenvp[n++] = library_path;
+	preload = wisk_env_merge(ld_preload, PATH_MAX, LD_PRELOAD, LD_PRELOAD_SEPARATOR,
+				 preload, &wisk_envt.preload_pre, &wisk_envt.preload_post);
+	if (preload)
+		nenvp[n++] = preload;
+	nenvp[n] = NULL;
+	if ((e = wisk_env_digest(nenvp, env_digest))) {
+		nenvp[n++] = e;
+		nenvp[n] = NULL;
+	}
 	debug_log_wiskenv("WISK Loaded Environment", nenvp);
 }
 
@@ -1437,10 +4605,21 @@ static char *fs_tracker_pipe_getpath(void)
 {
 	char *wisk_pipe_path = NULL;
 	char *s = getenv(WISK_TRACKER_PIPE);
+	char *d;
 
+	// Each process opens a spill file of its own, there is no pipe to resolve
+	d = getenv(WISK_TRACKER_SPILLDIR);
+	if (d) {
+		return strdup(d);
+	}
 	if (s == NULL) {
 		return NULL;
 	}
+	// Inherited already open, the path is only used for logging
+	d = getenv(WISK_TRACKER_PIPE_FD);
+	if (d && atoi(d) >= 0 && fd_is_valid(atoi(d))) {
+		return strdup(s);
+	}
 
 	wisk_pipe_path = realpath(s, NULL);
 	if (wisk_pipe_path == NULL) {
@@ -1492,69 +4671,115 @@ void logging_init(void)
 		d = getenv(WISK_TRACKER_DEBUGLOG);
 		WISK_LOG(WISK_LOG_TRACE, "Init: %s=%s", WISK_TRACKER_DEBUGLOG, d);
 		if (d) {
-			if (internal_open) {
-				WISK_LOG(WISK_LOG_TRACE, "Tracker Recieve Pipe Real open(%s), UUID=%s", d, fs_tracker_uuid);
-				fs_tracker_debuglog = internal_open(d, O_WRONLY|O_APPEND);
-			} else {
-				WISK_LOG(WISK_LOG_ERROR, "Tracker Recieve Pipe: Local open(%s), UUID=%s, PUUID=%s(Internal open not initialized)",
-						d, fs_tracker_uuid, fs_tracker_puuid);
-//				fs_tracker_debuglog = libc_open(d, O_WRONLY|O_APPEND);
-			}
+			WISK_LOG(WISK_LOG_TRACE, "Debug Log open(%s), UUID=%s", d, fs_tracker_uuid);
+			fs_tracker_debuglog = libc_open(d, O_WRONLY|O_APPEND);
 			snprintf(value, PATH_MAX, "%d", fs_tracker_debuglog);
 			wisk_env_update(WISK_TRACKER_DEBUGLOG_FD, value, &wisk_env_count, true);
 		}
 	}
-	if (fs_tracker_debuglog == -1) {
-		WISK_LOG(WISK_LOG_ERROR, "File System Tracker Pipe %s cannot be opened for write\n", fs_tracker_debuglog);
+	if (fs_tracker_debuglog == -1 && d) {
+		WISK_LOG(WISK_LOG_ERROR, "Debug Log %s cannot be opened for write\n", d);
 	}
+	wisk_debugring_init();
+	wisk_log_resolve();
 	WISK_LOG(WISK_LOG_TRACE, "Init done");
 }
 
+/*
+ * With WISK_TRACKER_PIPE_SHARDS=<n> the collector drains <pipe>.0 to
+ * <pipe>.<n-1> and a process writes to the shard its pid selects, so the
+ * processes of a build spread across the readers. The inherited pipe is
+ * kept when it already is that shard, WISK_TRACKER_PIPE_SHARD says which
+ * one it is, otherwise ours is opened onto the same descriptor.
+ */
+static char *wisk_shard_select(char *path, char *shardpath)
+{
+	char *d, value[32];
+	int shards, shard, fd;
+
+	d = getenv(WISK_TRACKER_PIPE_SHARDS);
+	if (d == NULL || (shards = atoi(d)) <= 1)
+		return path;
+	shard = getpid() % shards;
+	snprintf(shardpath, PATH_MAX, "%s.%d", path, shard);
+	d = getenv(WISK_TRACKER_PIPE_SHARD);
+	if (fs_tracker_pipe != -1 && (d == NULL || atoi(d) != shard)) {
+		fd = libc_open(shardpath, O_WRONLY|O_APPEND);
+		if (fd == -1) {
+			WISK_LOG(WISK_LOG_ERROR, "Tracker Pipe Shard %s cannot be opened for write, keeping the inherited one", shardpath);
+			return path;
+		}
+		libc_dup2(fd, fs_tracker_pipe);
+		libc_close(fd);
+	}
+	snprintf(value, sizeof(value), "%d", shard);
+	wisk_env_update(WISK_TRACKER_PIPE_SHARD, value, &wisk_env_count, true);
+	return shardpath;
+}
+
 static void fs_tracker_init_pipe(char *fs_tracker_pipe_path)
 {
-	char *uuidstr, *puuidstr, *d, value[PATH_MAX];
+	char *uuidstr, *puuidstr, *d, value[PATH_MAX], shardpath[PATH_MAX];
 	int ret, i;
+	WISK_HOOK(WISK_HOOK_INIT);
 
 	wisk_mutex_lock(&fs_tracker_pipe_mutex);
-	wisk_bind_symbol_all();
+	// libc symbols are bound on first use, most are never used by a short lived process
 	logging_init();
-    generate_uniqueid(fs_tracker_uuid);
+    generate_uniqueid(fs_tracker_uuid, &fs_tracker_uuid_raw);
 	uuidstr = getenv(WISK_TRACKER_UUID);
     if (uuidstr) {
         strncpy(fs_tracker_puuid, uuidstr, UUID_SIZE);
+        wisk_uuid_session(fs_tracker_uuid, &fs_tracker_uuid_raw, fs_tracker_puuid);
     } else {
         strncpy(fs_tracker_puuid, "XXXXXXXX-XXXXXXXX-XXXXXXXX-XXXXXXXX", UUID_SIZE);
     }
 
-	if (fs_tracker_pipe == -1) {
+	d = getenv(WISK_TRACKER_SPILLDIR);
+	if (d && fs_tracker_pipe == -1) {
+		snprintf(wisk_spill_dir, sizeof(wisk_spill_dir), "%s", d);
+		WISK_LOG(WISK_LOG_TRACE, "Tracker Spill Directory %s, UUID=%s", wisk_spill_dir, fs_tracker_uuid);
+		fs_tracker_pipe = wisk_spill_open();
+	}
+	if (fs_tracker_pipe == -1 && wisk_spill_dir[0] == '\0') {
 		d = getenv(WISK_TRACKER_PIPE_FD);
 		WISK_LOG(WISK_LOG_TRACE, "%s=%s", WISK_TRACKER_PIPE_FD, d);
 		if (d && fd_is_valid(atoi(d))) {
 			fs_tracker_pipe = atoi(d);
 		}
 	}
-	if (fs_tracker_pipe == -1) {
-		if (internal_open) {
-			WISK_LOG(WISK_LOG_TRACE, "Tracker Recieve Pipe Real open(%s), UUID=%s", fs_tracker_pipe_path, fs_tracker_uuid);
-			fs_tracker_pipe = internal_open(fs_tracker_pipe_path, O_WRONLY|O_APPEND);
-		} else {
-			WISK_LOG(WISK_LOG_ERROR, "Tracker Recieve Pipe: Local open(%s), UUID=%s, PUUID=%s(Internal open not initialized)",
-					fs_tracker_pipe_path, fs_tracker_uuid, fs_tracker_puuid);
-		}
+	if (wisk_spill_dir[0] == '\0')
+		fs_tracker_pipe_path = wisk_shard_select(fs_tracker_pipe_path, shardpath);
+	if (fs_tracker_pipe == -1 && wisk_spill_dir[0] == '\0') {
+		WISK_LOG(WISK_LOG_TRACE, "Tracker Recieve Pipe open(%s), UUID=%s", fs_tracker_pipe_path, fs_tracker_uuid);
+		fs_tracker_pipe = libc_open(fs_tracker_pipe_path, O_WRONLY|O_APPEND);
 		snprintf(value, PATH_MAX, "%d", fs_tracker_pipe);
 		wisk_env_update(WISK_TRACKER_PIPE_FD, value, &wisk_env_count, true);
 	}
 	if (fs_tracker_pipe == -1) {
 		WISK_LOG(WISK_LOG_ERROR, "File System Tracker Pipe %s cannot be opened for write\n", fs_tracker_pipe_path);
 	}
+	if (wisk_spill_dir[0] == '\0')
+		wisk_overflow_init();
+	wisk_shm_init();
+	wisk_pathfilter_init();
 	d = getenv(WISK_TRACKER_EVENTFILTER);
 	if (d != NULL) {
 		fs_tracker_eventfilter = atoi(d);
 		WISK_LOG(WISK_LOG_TRACE, "File System Tracker Event Filter: %s, 0x%X\n", d, fs_tracker_eventfilter);
 	}
+	wisk_command_path_init();
+	wisk_policy_init(fs_tracker_command_path);
+	wisk_sample_init();
+	d = getenv(WISK_TRACKER_FORMAT);
+	if (d != NULL) {
+		fs_tracker_binary = (strcmp(d, "binary") == 0);
+		WISK_LOG(WISK_LOG_TRACE, "File System Tracker Format: %s\n", d);
+	}
 	for(i=0; i< WISK_ENV_VARCOUNT; i++)
 		wisk_env_update(wisk_env_vars[i], NULL, &wisk_env_count, false);
 	fs_tracker_pid = getpid();
+	wisk_record_init(fs_tracker_pid);
 
 //    for(i=0; i<wisk_env_count; i++) {
 //	    WISK_LOG(WISK_LOG_TRACE, "WISK_ENV[%d: %s]", i, wisk_envp[i]);
@@ -1562,11 +4787,35 @@ static void fs_tracker_init_pipe(char *fs_tracker_pipe_path)
 //    WISK_LOG(WISK_LOG_TRACE, "WISK_ENV_COUNT: %d", wisk_env_count);
     debug_log_wiskenv("WISK Environment", wisk_envp);
     wisk_report_command();
+    wisk_envtemplate_init();
 
 done:
 	wisk_mutex_unlock(&fs_tracker_pipe_mutex);
 }
 
+/*
+ * Children started behind our back, e.g. by the spawn inside system() and
+ * popen(), inherit the environment as is, so it must carry our uuid. The
+ * entry inherited from the parent holds a uuid of the same length, so it is
+ * normally overwritten in place rather than having setenv() copy environ.
+ */
+static void wisk_setenv_uuid(void)
+{
+	size_t n = strlen(WISK_TRACKER_UUID);
+	char **e;
+
+	for (e = environ; e && *e; e++) {
+		if (strncmp(*e, WISK_TRACKER_UUID, n) == 0 && (*e)[n] == '=') {
+			if (strlen(*e + n + 1) == strlen(fs_tracker_uuid)) {
+				memcpy(*e + n + 1, fs_tracker_uuid, strlen(fs_tracker_uuid));
+				return;
+			}
+			break;
+		}
+	}
+	setenv(WISK_TRACKER_UUID, fs_tracker_uuid, 1);
+}
+
 bool fs_tracker_enabled(void)
 {
 	char *s;
@@ -1587,7 +4836,7 @@ bool fs_tracker_enabled(void)
 
 	// This needs to be done last for some reason. screws up thinigs otherwise. Thread safety?
 	// Cant handle being called from the constructor in clones
-	setenv(WISK_TRACKER_UUID, fs_tracker_uuid, 1);
+	wisk_setenv_uuid();
 	return true;
 }
 
@@ -1599,9 +4848,16 @@ bool fs_tracker_enabled(void)
 static FILE *wisk_fopen(const char *name, const char *mode)
 {
 	FILE *fp;
+	char buf[PATH_MAX];
+	WISK_HOOK(WISK_HOOK_FOPEN);
     WISK_LOG(WISK_LOG_TRACE, "wisk_fopen(%s, %s)", name, mode);
-    fp = libc_fopen(name, mode);
-    if (fp == NULL) return fp;
+    fp = WISK_HOOK_REAL(libc_fopen(name, mode));
+    if (fp == NULL) {
+        wisk_report_lookup(-1, AT_FDCWD, name);
+        return fp;
+    }
+    if (fs_tracker_pipe >= 0)
+        wisk_fd_set(fileno(fp), ifnotabsolute(buf, name));
     if ((mode[0] == 'w') || (mode[0] == 'a')) {
         wisk_report_write(name);
         if (mode[1] == '+')
@@ -1633,9 +4889,16 @@ FILE *fopen(const char *name, const char *mode)
 static FILE *wisk_fopen64(const char *name, const char *mode)
 {
 	FILE *fp;
+	char buf[PATH_MAX];
+	WISK_HOOK(WISK_HOOK_FOPEN64);
     WISK_LOG(WISK_LOG_TRACE, "wisk_fopen64(%s, %s)", name, mode);
-	fp = libc_fopen64(name, mode);
-	if (fp == NULL) return fp;
+	fp = WISK_HOOK_REAL(libc_fopen64(name, mode));
+	if (fp == NULL) {
+		wisk_report_lookup(-1, AT_FDCWD, name);
+		return fp;
+	}
+    if (fs_tracker_pipe >= 0)
+        wisk_fd_set(fileno(fp), ifnotabsolute(buf, name));
     if ((mode[0] == 'w') || (mode[0] == 'a')) {
         wisk_report_write(name);
         if (mode[1] == '+')
@@ -1665,9 +4928,18 @@ FILE *fopen64(const char *name, const char *mode)
 static int wisk_vopen(const char *pathname, int flags, va_list ap)
 {
     int fd;
+    char buf[PATH_MAX];
+	WISK_HOOK(WISK_HOOK_OPEN);
     WISK_LOG(WISK_LOG_TRACE, "wisk_vopen(%s, %d)", pathname, flags);
-	fd = libc_vopen(pathname, flags, ap);
-    if (fd == -1) return fd;
+	fd = WISK_HOOK_REAL(libc_vopen(pathname, flags, ap));
+    if (fd == -1 || (flags & O_PATH)) {
+        wisk_report_lookup(fd, AT_FDCWD, pathname);
+        if (fd != -1 && fs_tracker_pipe >= 0)
+            wisk_fd_set(fd, ifnotabsolute(buf, pathname));
+        return fd;
+    }
+    if (fs_tracker_pipe >= 0)
+        wisk_fd_set(fd, ifnotabsolute(buf, pathname));
     if ((flags & O_WRONLY) && (flags & O_RDONLY)) {
         wisk_report_read(pathname);
         wisk_report_write(pathname);
@@ -1704,10 +4976,19 @@ int open(const char *pathname, int flags, ...)
 static int wisk_vopen64(const char *pathname, int flags, va_list ap)
 {
 	int ret;
+	char buf[PATH_MAX];
 
+	WISK_HOOK(WISK_HOOK_OPEN64);
     WISK_LOG(WISK_LOG_TRACE, "wisk_vopen64(%s, %d)", pathname, flags);
-	ret = libc_vopen64(pathname, flags, ap);
-    if (ret == -1) return ret;
+	ret = WISK_HOOK_REAL(libc_vopen64(pathname, flags, ap));
+    if (ret == -1 || (flags & O_PATH)) {
+        wisk_report_lookup(ret, AT_FDCWD, pathname);
+        if (ret != -1 && fs_tracker_pipe >= 0)
+            wisk_fd_set(ret, ifnotabsolute(buf, pathname));
+        return ret;
+    }
+    if (fs_tracker_pipe >= 0)
+        wisk_fd_set(ret, ifnotabsolute(buf, pathname));
     if ((flags & O_WRONLY) && (flags & O_RDONLY)) {
         wisk_report_read(pathname);
         wisk_report_write(pathname);
@@ -1741,13 +5022,25 @@ int open64(const char *pathname, int flags, ...)
  ***************************************************************************/
 
 #ifdef INTERCEPT_OPENAT
-static int wisk_vopenat(int dirfd, const char *path, int flags, va_list ap)
+static int wisk_vopenat(int dirfd, const char *rpath, int flags, va_list ap)
 {
 	int ret;
+	char buf[PATH_MAX];
+	const char *path;
 
-    WISK_LOG(WISK_LOG_TRACE, "wisk_vopenat(%d, %s, %d)", dirfd, path, flags);
-	ret = libc_vopenat(dirfd, path, flags, ap);
-	if (ret == -1) return ret;
+	WISK_HOOK(WISK_HOOK_OPENAT);
+    WISK_LOG(WISK_LOG_TRACE, "wisk_vopenat(%d, %s, %d)", dirfd, rpath, flags);
+	ret = WISK_HOOK_REAL(libc_vopenat(dirfd, rpath, flags, ap));
+	if (ret == -1 || fs_tracker_pipe < 0) {
+		wisk_report_lookup(ret, dirfd, rpath);
+		return ret;
+	}
+	path = ifnotabsoluteat(buf, dirfd, rpath);
+	wisk_fd_set(ret, path);
+	if (flags & O_PATH) {
+		wisk_report_lookup(ret, dirfd, rpath);
+		return ret;
+	}
     if ((flags & O_WRONLY) && (flags & O_RDONLY)) {
         wisk_report_read(path);
         wisk_report_write(path);
@@ -1775,6 +5068,267 @@ int openat(int dirfd, const char *path, int flags, ...)
 }
 #endif
 
+/****************************************************************************
+ *   CLOSE, DUP
+ ***************************************************************************/
+
+#ifdef INTERCEPT_CLOSE
+int close(int fd)
+{
+	WISK_HOOK(WISK_HOOK_CLOSE);
+
+	wisk_fd_clear(fd);
+	return WISK_HOOK_REAL(libc_close(fd));
+}
+#endif
+
+#if defined(INTERCEPT_CLOSE) && defined(HAVE_CLOSE_RANGE)
+int close_range(unsigned int first, unsigned int last, int flags)
+{
+	WISK_HOOK(WISK_HOOK_CLOSE);
+	int ret = WISK_HOOK_REAL(libc_close_range(first, last, flags));
+
+	// With CLOSE_RANGE_CLOEXEC the descriptors stay open until an exec
+	if (ret == 0 && !(flags & CLOSE_RANGE_CLOEXEC))
+		wisk_fd_clear_range(first, last);
+	return ret;
+}
+#endif
+
+#if defined(INTERCEPT_CLOSE) && defined(HAVE_CLOSEFROM)
+void closefrom(int lowfd)
+{
+	WISK_HOOK(WISK_HOOK_CLOSE);
+
+	WISK_HOOK_REAL(libc_closefrom(lowfd));
+	if (lowfd >= 0)
+		wisk_fd_clear_range(lowfd, WISK_FD_MAX - 1);
+}
+#endif
+
+#ifdef INTERCEPT_FCLOSE
+int fclose(FILE *stream)
+{
+	WISK_HOOK(WISK_HOOK_CLOSE);
+
+	wisk_fd_clear(fileno(stream));
+	return WISK_HOOK_REAL(libc_fclose(stream));
+}
+#endif
+
+#ifdef INTERCEPT_CLOSEDIR
+int closedir(DIR *dirp)
+{
+	WISK_HOOK(WISK_HOOK_CLOSE);
+
+	wisk_fd_clear(dirfd(dirp));
+	return WISK_HOOK_REAL(libc_closedir(dirp));
+}
+#endif
+
+#ifdef INTERCEPT_DUP
+int dup(int oldfd)
+{
+	WISK_HOOK(WISK_HOOK_DUP);
+	int ret = WISK_HOOK_REAL(libc_dup(oldfd));
+
+	if (ret != -1)
+		wisk_fd_dup(oldfd, ret);
+	return ret;
+}
+
+int dup2(int oldfd, int newfd)
+{
+	WISK_HOOK(WISK_HOOK_DUP);
+	int ret = WISK_HOOK_REAL(libc_dup2(oldfd, newfd));
+
+	if (ret != -1 && oldfd != newfd)
+		wisk_fd_dup(oldfd, newfd);
+	return ret;
+}
+
+int dup3(int oldfd, int newfd, int flags)
+{
+	WISK_HOOK(WISK_HOOK_DUP);
+	int ret = WISK_HOOK_REAL(libc_dup3(oldfd, newfd, flags));
+
+	if (ret != -1)
+		wisk_fd_dup(oldfd, newfd);
+	return ret;
+}
+#endif
+
+/****************************************************************************
+ *   STAT, ACCESS, OPENDIR
+ ***************************************************************************/
+
+#ifdef INTERCEPT_STAT
+int stat(const char *pathname, struct stat *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc_stat(pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int lstat(const char *pathname, struct stat *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc_lstat(pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int fstatat(int dirfd, const char *pathname, struct stat *statbuf, int flags)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc_fstatat(dirfd, pathname, statbuf, flags));
+
+	wisk_report_lookup(ret, dirfd, pathname);
+	return ret;
+}
+
+#ifdef HAVE_STAT64
+int stat64(const char *pathname, struct stat64 *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc_stat64(pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int lstat64(const char *pathname, struct stat64 *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc_lstat64(pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int fstatat64(int dirfd, const char *pathname, struct stat64 *statbuf, int flags)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc_fstatat64(dirfd, pathname, statbuf, flags));
+
+	wisk_report_lookup(ret, dirfd, pathname);
+	return ret;
+}
+#endif /* HAVE_STAT64 */
+#endif
+
+/* What programs built against glibc before 2.33 call for stat() and friends */
+#ifdef INTERCEPT_XSTAT
+int __xstat(int ver, const char *pathname, struct stat *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc___xstat(ver, pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int __lxstat(int ver, const char *pathname, struct stat *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc___lxstat(ver, pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int __fxstatat(int ver, int dirfd, const char *pathname, struct stat *statbuf, int flags)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc___fxstatat(ver, dirfd, pathname, statbuf, flags));
+
+	wisk_report_lookup(ret, dirfd, pathname);
+	return ret;
+}
+
+#ifdef HAVE_STAT64
+int __xstat64(int ver, const char *pathname, struct stat64 *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc___xstat64(ver, pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int __lxstat64(int ver, const char *pathname, struct stat64 *statbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc___lxstat64(ver, pathname, statbuf));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int __fxstatat64(int ver, int dirfd, const char *pathname, struct stat64 *statbuf, int flags)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc___fxstatat64(ver, dirfd, pathname, statbuf, flags));
+
+	wisk_report_lookup(ret, dirfd, pathname);
+	return ret;
+}
+#endif /* HAVE_STAT64 */
+#endif
+
+#ifdef INTERCEPT_STATX
+int statx(int dirfd, const char *pathname, int flags, unsigned int mask, struct statx *statxbuf)
+{
+	WISK_HOOK(WISK_HOOK_STAT);
+	int ret = WISK_HOOK_REAL(libc_statx(dirfd, pathname, flags, mask, statxbuf));
+
+	wisk_report_lookup(ret, dirfd, pathname);
+	return ret;
+}
+#endif
+
+#ifdef INTERCEPT_ACCESS
+int access(const char *pathname, int mode)
+{
+	WISK_HOOK(WISK_HOOK_ACCESS);
+	int ret = WISK_HOOK_REAL(libc_access(pathname, mode));
+
+	wisk_report_lookup(ret, AT_FDCWD, pathname);
+	return ret;
+}
+
+int faccessat(int dirfd, const char *pathname, int mode, int flags)
+{
+	WISK_HOOK(WISK_HOOK_ACCESS);
+	int ret = WISK_HOOK_REAL(libc_faccessat(dirfd, pathname, mode, flags));
+
+	wisk_report_lookup(ret, dirfd, pathname);
+	return ret;
+}
+#endif
+
+#ifdef INTERCEPT_OPENDIR
+DIR *opendir(const char *name)
+{
+	WISK_HOOK(WISK_HOOK_OPENDIR);
+	DIR *dirp = WISK_HOOK_REAL(libc_opendir(name));
+	char buf[PATH_MAX];
+	int err = errno;
+
+	if (dirp == NULL) {
+		wisk_report_lookup(-1, AT_FDCWD, name);
+	} else if (fs_tracker_pipe >= 0) {
+		wisk_fd_set(dirfd(dirp), ifnotabsolute(buf, name));
+		wisk_report_probe(WISK_PROBE_LISTED, ifnotabsolute(buf, name));
+		errno = err;
+	}
+	return dirp;
+}
+#endif
+
 /****************************************************************************
  *   EXECVE
  ***************************************************************************/
@@ -1782,16 +5336,20 @@ int openat(int dirfd, const char *path, int flags, ...)
 #ifdef INTERCEPT_EXECL
 static int wisk_vexecl(const char *file, const char *arg, va_list ap, int argcount)
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_vexecl(%s)", file);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(environ) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(environ)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(file, arg, nenvp);
-	    return libc_vexecle(file, arg, ap, argcount, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_vexecle(file, arg, ap, argcount, nenvp));
     } else {
-	    return libc_vexecle(file, arg, ap, argcount, environ);
+	    return WISK_HOOK_REAL(libc_vexecle(file, arg, ap, argcount, environ));
     }
 }
 
@@ -1815,17 +5373,20 @@ int execl(const char *file, const char *arg, ...)
 #ifdef INTERCEPT_EXECLE
 static int wisk_vexecle(const char *file, const char *arg, va_list ap, int argcount, char *const envp[])
 {
-
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_vexecle(%s)", file);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(envp) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(envp)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(file, arg, nenvp);
-	    return libc_vexecle(file, arg, ap, argcount, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_vexecle(file, arg, ap, argcount, nenvp));
     } else {
-	    return libc_vexecle(file, arg, ap, argcount, envp);
+	    return WISK_HOOK_REAL(libc_vexecle(file, arg, ap, argcount, envp));
     }
 }
 
@@ -1852,16 +5413,20 @@ int execle(const char *file, const char *arg, ...)
 #ifdef INTERCEPT_EXECLP
 static int wisk_vexeclp(const char *file, const char *arg, va_list ap, int argcount)
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_vexeclp(%s)", file);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(environ) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(environ)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(file, arg, nenvp);
-	    return libc_vexeclpe(file, arg, ap, argcount, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_vexeclpe(file, arg, ap, argcount, nenvp));
     } else {
-	    return libc_vexeclpe(file, arg, ap, argcount, environ);
+	    return WISK_HOOK_REAL(libc_vexeclpe(file, arg, ap, argcount, environ));
     }
 }
 
@@ -1885,16 +5450,20 @@ int execlp(const char *file, const char *arg, ...)
 #ifdef INTERCEPT_EXECLPE
 static int wisk_vexeclpe(const char *file, const char *arg, va_list ap, int argcount, char *const envp[])
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_vexeclpe(%s)", file);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(envp) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(envp)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(file, argv, nenvp);
-	    return libc_vexeclpe(file, arg, ap, argcount, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_vexeclpe(file, arg, ap, argcount, nenvp));
     } else
-	    return libc_vexeclpe(file, arg, ap, argcount, envp);
+	    return WISK_HOOK_REAL(libc_vexeclpe(file, arg, ap, argcount, envp));
 }
 
 int execlpe(const char *file, const char *arg, ...)
@@ -1919,16 +5488,20 @@ int execlpe(const char *file, const char *arg, ...)
 #ifdef INTERCEPT_EXECV
 static int wisk_execv(const char *path, char *const argv[])
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_execv(%s)", path);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(environ) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(environ)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(path, argv, nenvp);
-	    return libc_execvpe(path, argv, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_execvpe(path, argv, nenvp));
     } else
-	    return libc_execvpe(path, argv, environ);
+	    return WISK_HOOK_REAL(libc_execvpe(path, argv, environ));
 }
 
 int execv(const char *path, char *const argv[])
@@ -1941,16 +5514,20 @@ int execv(const char *path, char *const argv[])
 #ifdef INTERCEPT_EXECVP
 static int wisk_execvp(const char *file, char *const argv[])
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_execvp(%s)", file);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(environ) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(environ)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(environ, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(file, argv, nenvp);
-	    return libc_execvpe(file, argv, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_execvpe(file, argv, nenvp));
     } else
-	    return libc_execvpe(file, argv, environ);
+	    return WISK_HOOK_REAL(libc_execvpe(file, argv, environ));
 }
 
 int execvp(const char *file, char *const argv[])
@@ -1963,16 +5540,20 @@ int execvp(const char *file, char *const argv[])
 #ifdef INTERCEPT_EXECVPE
 static int wisk_execvpe(const char *file, char *const argv[], char *const envp[])
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_execvpe(%s)", file);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(envp) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(envp)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(file, argv, nenvp);
-	    return libc_execvpe(file, argv, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_execvpe(file, argv, nenvp));
     } else
-	    return libc_execvpe(file, argv, envp);
+	    return WISK_HOOK_REAL(libc_execvpe(file, argv, envp));
 }
 
 int execvpe(const char *file, char *const argv[], char *const envp[])
@@ -1985,16 +5566,20 @@ int execvpe(const char *file, char *const argv[], char *const envp[])
 #ifdef INTERCEPT_EXECVE
 static int wisk_execve(const char *pathname, char *const argv[], char *const envp[])
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_execve(%s)", pathname);
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(envp) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(envp)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(pathname, argv, nenvp);
-	    return libc_execve(pathname, argv, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_execve(pathname, argv, nenvp));
     } else
-	    return libc_execve(pathname, argv, envp);
+	    return WISK_HOOK_REAL(libc_execve(pathname, argv, envp));
 }
 
 int execve(const char *pathname, char *const argv[], char *const envp[])
@@ -2007,8 +5592,13 @@ int execve(const char *pathname, char *const argv[], char *const envp[])
 #ifdef INTERCEPT_EXECVEAT
 static int wisk_execveat(int dirfd, const char *pathname, char *const argv[], char *const envp[], int flags)
 {
+	WISK_HOOK(WISK_HOOK_EXEC);
     WISK_LOG(WISK_LOG_TRACE, "wisk_execveat(%s)", pathname);
-	return libc_execveat(dirfd, pathname, argv, envp, flags);
+	if (fs_tracker_enabled()) {
+		wisk_report_probes();
+		wisk_batch_flush_all();
+	}
+	return WISK_HOOK_REAL(libc_execveat(dirfd, pathname, argv, envp, flags));
 }
 
 int execveat(int dirfd, const char *pathname, char *const argv[], char *const envp[], int flags)
@@ -2022,15 +5612,20 @@ int execveat(int dirfd, const char *pathname, char *const argv[], char *const en
 static int wisk_posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
 		                    const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
 {
+	WISK_HOOK(WISK_HOOK_SPAWN);
+
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(envp) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(envp)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(path, argv, nenvp);
-	    return libc_posix_spawn(pid, path, file_actions, attrp, argv, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_posix_spawn(pid, path, file_actions, attrp, argv, nenvp));
     } else
-	    return libc_posix_spawn(pid, path, file_actions, attrp, argv, envp);
+	    return WISK_HOOK_REAL(libc_posix_spawn(pid, path, file_actions, attrp, argv, envp));
 }
 
 int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
@@ -2045,15 +5640,20 @@ int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *
 static int wisk_posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
 		                    const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
 {
+	WISK_HOOK(WISK_HOOK_SPAWN);
+
 	if (fs_tracker_enabled()) {
-        char *nenvp[wisk_getvarcount(envp) + wisk_env_count + 1];
+        char *nenvp[wisk_envsize(envp)];
         char ld_library_path[PATH_MAX];
         char ld_preload[PATH_MAX];
-        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload);
+        char env_digest[WISK_ENVDIGEST_SIZE];
+        wisk_loadenv(envp, nenvp, ld_library_path, ld_preload, env_digest);
 //        wisk_report_command(file, argv, nenvp);
-	    return libc_posix_spawnp(pid, file, file_actions, attrp, argv, nenvp);
+        wisk_report_probes();
+        wisk_batch_flush_all();
+	    return WISK_HOOK_REAL(libc_posix_spawnp(pid, file, file_actions, attrp, argv, nenvp));
     } else
-	    return libc_posix_spawnp(pid, file, file_actions, attrp, argv, envp);
+	    return WISK_HOOK_REAL(libc_posix_spawnp(pid, file, file_actions, attrp, argv, envp));
 }
 
 int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
@@ -2083,11 +5683,12 @@ FILE *popen(const char *command, const char *type)
 #ifdef INTERCEPT_SYMLINK
 static int wisk_symlink(const char *target, const char *linkpath)
 {
+	WISK_HOOK(WISK_HOOK_LINK);
 	if (fs_tracker_enabled()) {
 		wisk_report_link(target, linkpath);
-	    return libc_symlink(target, linkpath);
+	    return WISK_HOOK_REAL(libc_symlink(target, linkpath));
     } else
-	    return libc_symlink(target, linkpath);
+	    return WISK_HOOK_REAL(libc_symlink(target, linkpath));
 }
 
 int symlink(const char *target, const char *linkpath)
@@ -2101,11 +5702,15 @@ int symlink(const char *target, const char *linkpath)
 #ifdef INTERCEPT_LINKAT
 static int wisk_symlinkat(const char *target, int newdirfd, const char *linkpath)
 {
+	char lbuf[PATH_MAX];
+
+	WISK_HOOK(WISK_HOOK_LINK);
+
 	if (fs_tracker_enabled()) {
-		wisk_report_link(target, linkpath);
-	    return libc_symlinkat(target, newdirfd, linkpath);
+		wisk_report_link(target, ifnotabsoluteat(lbuf, newdirfd, linkpath));
+	    return WISK_HOOK_REAL(libc_symlinkat(target, newdirfd, linkpath));
     } else
-	    return libc_symlinkat(target, newdirfd, linkpath);
+	    return WISK_HOOK_REAL(libc_symlinkat(target, newdirfd, linkpath));
 }
 
 int symlinkat(const char *target, int newdirfd, const char *linkpath)
@@ -2119,11 +5724,12 @@ int symlinkat(const char *target, int newdirfd, const char *linkpath)
 #ifdef INTERCEPT_LINK
 static int wisk_link(const char *oldpath, const char *newpath)
 {
+	WISK_HOOK(WISK_HOOK_LINK);
 	if (fs_tracker_enabled()) {
 		wisk_report_link(oldpath, newpath);
-	    return libc_link(oldpath, newpath);
+	    return WISK_HOOK_REAL(libc_link(oldpath, newpath));
     } else
-	    return libc_link(oldpath, newpath);
+	    return WISK_HOOK_REAL(libc_link(oldpath, newpath));
 }
 
 int link(const char *oldpath, const char *newpath)
@@ -2136,11 +5742,15 @@ int link(const char *oldpath, const char *newpath)
 #ifdef INTERCEPT_LINKAT
 static int wisk_linkat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags)
 {
+	char obuf[PATH_MAX], nbuf[PATH_MAX];
+
+	WISK_HOOK(WISK_HOOK_LINK);
+
 	if (fs_tracker_enabled()) {
-		wisk_report_link(oldpath, newpath);
-	    return libc_linkat(olddirfd, oldpath, newdirfd, newpath, flags);
+		wisk_report_link(ifnotabsoluteat(obuf, olddirfd, oldpath), ifnotabsoluteat(nbuf, newdirfd, newpath));
+	    return WISK_HOOK_REAL(libc_linkat(olddirfd, oldpath, newdirfd, newpath, flags));
     } else
-	    return libc_linkat(olddirfd, oldpath, newdirfd, newpath, flags);
+	    return WISK_HOOK_REAL(libc_linkat(olddirfd, oldpath, newdirfd, newpath, flags));
 }
 
 int linkat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags)
@@ -2153,11 +5763,12 @@ int linkat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath,
 #ifdef INTERCEPT_UNLINK
 static int wisk_unlink(const char *pathname)
 {
+	WISK_HOOK(WISK_HOOK_UNLINK);
 	if (fs_tracker_enabled()) {
 		wisk_report_unlink(pathname);
-	    return libc_unlink(pathname);
+	    return WISK_HOOK_REAL(libc_unlink(pathname));
     } else
-	    return libc_unlink(pathname);
+	    return WISK_HOOK_REAL(libc_unlink(pathname));
 }
 
 int unlink(const char *pathname)
@@ -2170,11 +5781,15 @@ int unlink(const char *pathname)
 #ifdef INTERCEPT_UNLINKAT
 static int wisk_unlinkat(int dirfd, const char *pathname, int flags)
 {
+	char buf[PATH_MAX];
+
+	WISK_HOOK(WISK_HOOK_UNLINK);
+
 	if (fs_tracker_enabled()) {
-		wisk_report_unlink(pathname);
-	    return libc_unlinkat(dirfd, pathname, flags);
+		wisk_report_unlink(ifnotabsoluteat(buf, dirfd, pathname));
+	    return WISK_HOOK_REAL(libc_unlinkat(dirfd, pathname, flags));
     } else
-	    return libc_unlinkat(dirfd, pathname, flags);
+	    return WISK_HOOK_REAL(libc_unlinkat(dirfd, pathname, flags));
 }
 
 int unlinkat(int dirfd, const char *pathname, int flags)
@@ -2187,11 +5802,12 @@ int unlinkat(int dirfd, const char *pathname, int flags)
 #ifdef INTERCEPT_CHMOD
 static int wisk_chmod(__const char *__file, __mode_t __mode)
 {
+	WISK_HOOK(WISK_HOOK_CHMOD);
 	if (fs_tracker_enabled()) {
 		wisk_report_chmod(__file);
-	    return libc_chmod(__file, __mode);
+	    return WISK_HOOK_REAL(libc_chmod(__file, __mode));
     } else
-	    return libc_chmod(__file, __mode);
+	    return WISK_HOOK_REAL(libc_chmod(__file, __mode));
 }
 
 int chmod(__const char *__file, __mode_t __mode)
@@ -2204,25 +5820,15 @@ int chmod(__const char *__file, __mode_t __mode)
 #ifdef INTERCEPT_FCHMOD
 static int wisk_fchmod(int __fd, __mode_t __mode)
 {
-	int i;
-	char fdstr[PATH_MAX];
-	char fdpath[PATH_MAX];
+	char buf[PATH_MAX];
+
+	WISK_HOOK(WISK_HOOK_CHMOD);
 
 	if (fs_tracker_enabled()) {
-		sprintf(fdstr, "/proc/self/fd/%d", __fd);
-		i = readlink(fdstr, fdpath, sizeof(fdpath)-1);
-		if (i == PATH_MAX) {
-			fdpath[PATH_MAX-1] = '\0';
-	    } else if (i == -1) {
-	        WISK_LOG(WISK_LOG_ERROR, "Falling back to ArgV, %d: %s", errno, strerror(errno));
-            strncpy(fdpath, "FAILED_FILE_PATH", PATH_MAX);
-	    } else {
-            fdpath[i] = '\0';
-	    }
-		wisk_report_chmod(fdpath);
-	    return libc_fchmod(__fd, __mode);
+		wisk_report_chmod(wisk_fd_path(__fd, buf));
+	    return WISK_HOOK_REAL(libc_fchmod(__fd, __mode));
     } else
-	    return libc_fchmod(__fd, __mode);
+	    return WISK_HOOK_REAL(libc_fchmod(__fd, __mode));
 }
 
 int fchmod(int __fd, __mode_t __mode)
@@ -2235,11 +5841,15 @@ int fchmod(int __fd, __mode_t __mode)
 #ifdef INTERCEPT_FCHMODAT
 static int wisk_fchmodat(int __fd, __const char *__file, __mode_t __mode, int flags)
 {
+	char buf[PATH_MAX];
+
+	WISK_HOOK(WISK_HOOK_CHMOD);
+
 	if (fs_tracker_enabled()) {
-		wisk_report_chmod(__file);
-	    return libc_fchmodat(__fd, __file, __mode, flags);
+		wisk_report_chmod(ifnotabsoluteat(buf, __fd, __file));
+	    return WISK_HOOK_REAL(libc_fchmodat(__fd, __file, __mode, flags));
     } else
-	    return libc_fchmodat(__fd, __file, __mode, flags);
+	    return WISK_HOOK_REAL(libc_fchmodat(__fd, __file, __mode, flags));
 }
 
 int fchmodat(int __fd, __const char *__file, __mode_t __mode, int flags)
@@ -2249,6 +5859,171 @@ int fchmodat(int __fd, __const char *__file, __mode_t __mode, int flags)
 }
 #endif
 
+#ifdef INTERCEPT_CHDIR
+static int wisk_chdir(__const char *__path)
+{
+	int ret;
+
+	WISK_HOOK(WISK_HOOK_CHDIR);
+	wisk_mutex_lock(&wisk_cwd_mutex);
+	ret = WISK_HOOK_REAL(libc_chdir(__path));
+	if (ret == 0)
+		wisk_cwd_changed();
+	wisk_mutex_unlock(&wisk_cwd_mutex);
+	return ret;
+}
+
+int chdir(__const char *__path)
+{
+    WISK_LOG(WISK_LOG_TRACE, "chdir(%s)", __path);
+	return wisk_chdir(__path);
+}
+#endif
+
+#ifdef INTERCEPT_FCHDIR
+static int wisk_fchdir(int __fd)
+{
+	int ret;
+
+	WISK_HOOK(WISK_HOOK_CHDIR);
+	wisk_mutex_lock(&wisk_cwd_mutex);
+	ret = WISK_HOOK_REAL(libc_fchdir(__fd));
+	if (ret == 0)
+		wisk_cwd_changed();
+	wisk_mutex_unlock(&wisk_cwd_mutex);
+	return ret;
+}
+
+int fchdir(int __fd)
+{
+    WISK_LOG(WISK_LOG_TRACE, "fchdir(%d)", __fd);
+	return wisk_fchdir(__fd);
+}
+#endif
+
+#ifdef INTERCEPT_NFTW
+int nftw(const char *dirpath, __nftw_func_t fn, int nopenfd, int flags)
+{
+	int ret;
+
+	WISK_LOG(WISK_LOG_TRACE, "nftw(%s, %d, 0x%x)", dirpath, nopenfd, flags);
+	if (!(flags & FTW_CHDIR))
+		return libc_nftw(dirpath, fn, nopenfd, flags);
+	wisk_cwd_bypass_begin();
+	ret = libc_nftw(dirpath, fn, nopenfd, flags);
+	wisk_cwd_bypass_end();
+	return ret;
+}
+
+int nftw64(const char *dirpath, __nftw64_func_t fn, int nopenfd, int flags)
+{
+	int ret;
+
+	WISK_LOG(WISK_LOG_TRACE, "nftw64(%s, %d, 0x%x)", dirpath, nopenfd, flags);
+	if (!(flags & FTW_CHDIR))
+		return libc_nftw64(dirpath, fn, nopenfd, flags);
+	wisk_cwd_bypass_begin();
+	ret = libc_nftw64(dirpath, fn, nopenfd, flags);
+	wisk_cwd_bypass_end();
+	return ret;
+}
+#endif
+
+#ifdef INTERCEPT_FTS
+/* fts_open() falls back to FTS_NOCHDIR itself when it cannot come back to ".", so the stream is asked */
+FTS *fts_open(char * const *argv, int options, int (*compar)(const FTSENT **, const FTSENT **))
+{
+	FTS *ftsp = libc_fts_open(argv, options, compar);
+
+	if (ftsp && !(ftsp->fts_options & FTS_NOCHDIR))
+		wisk_cwd_bypass_begin();
+	return ftsp;
+}
+
+int fts_close(FTS *ftsp)
+{
+	bool chdir = ftsp && !(ftsp->fts_options & FTS_NOCHDIR);
+	int ret = libc_fts_close(ftsp);
+
+	if (chdir)
+		wisk_cwd_bypass_end();
+	return ret;
+}
+
+#ifdef HAVE_FTS64
+FTS64 *fts64_open(char * const *argv, int options, int (*compar)(const FTSENT64 **, const FTSENT64 **))
+{
+	FTS64 *ftsp = libc_fts64_open(argv, options, compar);
+
+	if (ftsp && !(ftsp->fts_options & FTS_NOCHDIR))
+		wisk_cwd_bypass_begin();
+	return ftsp;
+}
+
+int fts64_close(FTS64 *ftsp)
+{
+	bool chdir = ftsp && !(ftsp->fts_options & FTS_NOCHDIR);
+	int ret = libc_fts64_close(ftsp);
+
+	if (chdir)
+		wisk_cwd_bypass_end();
+	return ret;
+}
+#endif
+#endif
+
+#ifdef INTERCEPT_EXIT
+/*
+ * _exit() skips the library destructor, so complete and flush here or whatever
+ * the process batched up would be lost. Shells commonly leave this way, as
+ * does the child of a vfork() whose exec failed.
+ *
+ * _exit() is also async-signal-safe and called from signal handlers. One that
+ * interrupted the library on this thread may have it holding wisk_path_mutex
+ * or wisk_batch_list_mutex, or halfway into its batch: the process then leaves
+ * without its COMPLETE rather than deadlock.
+ */
+static void wisk_exit_report(void)
+{
+	if (fs_tracker_pipe < 0)
+		return;
+	if (wisk_hook_top != NULL) {
+		WISK_LOG(WISK_LOG_DEBUG, "Exit from a signal handler within a hook, not completed");
+		return;
+	}
+	wisk_report_commandcomplete();
+	wisk_batch_flush_all();
+}
+
+static void wisk__exit(int status)
+{
+	wisk_exit_report();
+	wisk_debugring_dump("WISK debug ring at exit:\n");
+	libc__exit(status);
+}
+
+void _exit(int status)
+{
+    WISK_LOG(WISK_LOG_TRACE, "_exit(%d)", status);
+	wisk__exit(status);
+	__builtin_unreachable();
+}
+
+static void wisk__Exit(int status)
+{
+	wisk_exit_report();
+	wisk_debugring_dump("WISK debug ring at exit:\n");
+	libc__Exit(status);
+}
+
+void _Exit(int status)
+{
+    WISK_LOG(WISK_LOG_TRACE, "_Exit(%d)", status);
+	wisk__Exit(status);
+	__builtin_unreachable();
+}
+#endif
+
 
 /****************************
  * Thread safe code
@@ -2265,6 +6040,9 @@ static void wisk_thread_prepare(void)
 	 */
 	wisk_bind_symbol_all();
 
+	/* Flush so the child doesn't inherit, and write again, our records */
+	wisk_batch_flush();
+
 	WISK_LOCK_ALL;
 }
 
@@ -2277,7 +6055,13 @@ static void wisk_thread_parent(void)
 static void wisk_thread_child(void)
 {
 //	WISK_LOG(WISK_LOG_TRACE, "wisk_thread_child: ");
+	wisk_batch_atfork_child();
+	wisk_path_atfork_child();
+	wisk_record_atfork_child();
+	wisk_cwd_atfork_child();
 	WISK_UNLOCK_ALL;
+	wisk_spill_atfork_child();
+	wisk_overflow_atfork_child();
 }
 
 /****************************
@@ -2287,6 +6071,8 @@ void wisk_constructor(int argc, char** argv)
 {
 	int ret;
 
+	wisk_hook_epoch = wisk_hook_clock();
+	fs_tracker_cwd_owner = getpid();
 	saved_argc = argc;
 	saved_argv = argv;
 //	logging_init();
@@ -2319,8 +6105,11 @@ void wisk_constructor(int argc, char** argv)
  */
 void wisk_destructor(void)
 {
-	if (fs_tracker_enabled())
-    	wisk_report_commandcomplete();
+	if (fs_tracker_enabled()) {
+		wisk_report_commandcomplete();
+		wisk_batch_flush_all();
+	}
+	wisk_debugring_dump("WISK debug ring at exit:\n");
 	if (wisk.libc.handle != NULL && wisk.libc.handle != RTLD_NEXT) {
 		dlclose(wisk.libc.handle);
 	}
@@ -26,6 +26,17 @@ import configparser
 import itertools
 import shutil
 import pdb
+import mmap
+import struct
+import ctypes
+import select
+import tempfile
+import io
+import stat
+import zlib
+import time
+import collections
+import concurrent.futures
 from functools import partial
 from argparse import ArgumentParser
 from argparse import RawDescriptionHelpFormatter
@@ -49,16 +60,66 @@ WSROOT = None
 COMMAND_SEPARATOR='---'
 WISK_TRACKER_PIPE=None
 WISK_TRACKER_UUID='XXXXXXXX-XXXXXXXX-XXXXXXXX'
+# The session of this run, see create_reciever(), and where its FIFOs go
+WISK_SESSION=None
+WISK_SESSION_DIR=None
+# The uuid a session passes its root, or an unsessioned one, all read as WISK_TRACKER_UUID
+WISK_SESSION_ROOT=re.compile(r'^(?:[0-9a-f]{8}-)?XXXXXXXX-XXXXXXXX-XXXXXXXX(?:-XXXXXXXX)?$')
+WISK_COLLECTOR_TIMEOUT=10
 WISK_DEPDATA='wisk_depdata'
 WISK_PARSER_CFG='wisk_parser.cfg'
 WISK_DEBUGLOG='wisk_debug.log'
 WISK_INSIGHT_FILENAME='wisk_insight.data'
 WISK_INSIGHT_FILE=None
 WISK_ARGS=None
-WISK_EVENTFILTERS=['writes', 'reads', 'links', 'chmods','process']
+WISK_EVENTFILTERS=['writes', 'reads', 'links', 'chmods','process', 'probes']
+WISK_TRANSPORTS=['fifo', 'shm', 'spill']
+WISK_SPILL_BATCH=64
+WISK_SHM_MAGIC=0x4d485357
+WISK_SHM_VERSION=3
+WISK_SHM_RINGS=16
+WISK_SHM_RINGSIZE=1 << 20
+# Seconds the collector sleeps at most without a wakeup, and waits on an uncommitted record before it checks its owner
+WISK_SHM_WAKE_TIMEOUT=1.0
+WISK_SHM_COMMIT_TIMEOUT=2.0
+WISK_FORMATS=['text', 'binary']
+WISK_RECORD_MAGIC=0xB7
+WISK_RECORD_VERSION=4
+WISK_RECORD_LIST=0x01
+WISK_RECORD_MORE=0x02
+WISK_RECORD_EPOCH=0x04
+WISK_RECORD_HEADER=struct.Struct('=BBBBIIIHH16sQ')
+WISK_RECORD_RESYNC=256
+WISK_PATHFILTER_MAGIC=0x54465057
+WISK_RAWBLOCK_MAGIC=b'WZB1'
+WISK_RAWINDEX_MAGIC=b'WZI1'
+WISK_RAWBLOCK_SIZE=1 << 20
+WISK_RAWBLOCK_HEADER=struct.Struct('<4sII')
+WISK_RAWBLOCK_INDEX=struct.Struct('<QII')
+WISK_RAWBLOCK_TRAILER=struct.Struct('<4sIQ')
+WISK_PATHFILTER_VERSION=1
+WISK_PATHFILTER_INCLUDE=1
+WISK_PATHFILTER_EXCLUDE=2
+WISK_PATHFILTER_IMMUTABLE=3
+# The command policy is a trie of the layout of the path filter, see wisk_policy_init()
+WISK_POLICY_MAGIC=0x50435057
+WISK_POLICIES=['full', 'writes', 'lifecycle', 'off']
+WISK_OPS=[None, 'CALLS', 'PID', 'PPID', 'WORKING_DIRECTORY', 'COMMAND_PATH', 'COMMAND', 'ENVIRONMENT',
+          'READS', 'WRITES', 'READS-UNKNOWN', 'LINKS', 'UNLINK', 'CHMOD', 'COMPLETE', 'REPEATS',
+          'ENVIRONMENT-DELTA', 'PROBES', 'USES', 'FINGERPRINT']
+WISK_ENVIRONMENT_MODES=['delta', 'full']
+# rusage.<who>= of COMPLETE, times in us, maxrss in KB, see wisk_rusage_format()
+WISK_RUSAGE_FIELDS=['utime', 'stime', 'maxrss', 'inblock', 'oublock', 'nvcsw', 'nivcsw']
+# WISK_TRACKER_SAMPLE=<mode>:<rate>[:<seed>], and the sample= of COMPLETE, see wisk_sample_init()
+WISK_SAMPLE_MODES=['process', 'event']
+WISK_SAMPLE_FIELDS=['mode', 'rate', 'selected', 'kept', 'dropped']
+# overflow= of COMPLETE, records that went to the overflow file or were lost, see wisk_write_pipe()
+WISK_OVERFLOW_FIELDS=['spilled', 'dropped']
+WISK_SAMPLE_OPS=['READS', 'WRITES', 'READS-UNKNOWN', 'LINKS', 'UNLINK', 'CHMOD', 'PROBES']
 UNRECOGNIZED_TOOLS_CXT = []
 FIELDS_ALL = ['UUID', 'P-UUID', 'PID', 'PPID', 'WORKING_DIRECTORY', 'OPERATIONS', 'COMMAND', 'COMMAND_PATH', 
-              'ENVIRONMENT', 'COMPLETE', 'command_type', 'children', 'WSROOT', 'invokes', 'mergedcommands']
+              'ENVIRONMENT', 'COMPLETE', 'command_type', 'children', 'WSROOT', 'invokes', 'mergedcommands', 'REPEATS',
+              'START', 'END', 'DURATION', 'RUSAGE', 'SAMPLED', 'POLICY', 'TOOLCHAIN', 'OVERFLOW']
 
 CONFIG = None
 dosplitlist = lambda x: [i.strip() for i in x.split()]
@@ -79,12 +140,22 @@ CONFIG_DATATYPES = {
         'shelltool_patterns': ((dosplitlist, doregexlist), (doregexpatternlist, dojoinlist)),
         'hardtool_patterns':  ((dosplitlist, doregexlist), (doregexpatternlist, dojoinlist)),
         'interptool_patterns': ((dosplitlist, doregexlist), (doregexpatternlist, dojoinlist)),
+        },
+    'path_filter': {
+        'exclude_prefixes': ((dosplitlist,), (dojoinlist,)),
+        'include_prefixes': ((dosplitlist,), (dojoinlist,)),
+        'immutable_prefixes': ((dosplitlist,), (dojoinlist,)),
+        },
+    'command_policy': {
+        'writes_commands': ((dosplitlist,), (dojoinlist,)),
+        'lifecycle_commands': ((dosplitlist,), (dojoinlist,)),
+        'off_commands': ((dosplitlist,), (dojoinlist,)),
         }
 }
 
 CONFIG_DEFAULTS = {
 #    'filterfields': '',
-    'filterfields': 'COMMAND_PATH COMMAND OPERATIONS WORKING_DIRECTORY ENVIRONMENT invokes mergedcommands command_type',
+    'filterfields': 'COMMAND_PATH COMMAND OPERATIONS WORKING_DIRECTORY ENVIRONMENT invokes mergedcommands command_type DURATION RUSAGE SAMPLED TOOLCHAIN',
 #    'shelltool_patterns': '',
 #    'hardtool_patterns': '',
 #    'buildtool_patterns': '',
@@ -148,6 +219,8 @@ def compactcommand(cmd, length=100, partlen=30):
 
 class ProgramNode(object):
     progtree = {}
+    # FINGERPRINT of each immutable root, by root
+    fingerprints = {}
     count = 0
     
     def __init__(self, uuid, parent=None, **kwargs):
@@ -163,13 +236,24 @@ class ProgramNode(object):
         self.working_directory = None
         self.complete = False
         self.environment = {}
+        self.envdelta = None
         self.children = []
         self.operations = {}
+        self.repeats = {}
         self.pid = None
         self.ppid = None
         self.command_type = None
         self.filteredout = False
         self.mergedcommands=[]
+        self.start = None
+        self.end = None
+        self.lifetime = None
+        self.clock = None
+        self.overhead = {}
+        self.rusage = {}
+        self.sample = None
+        self.policy = 'full'
+        self.overflow = None
         if parent:
             p = ProgramNode.progtree[parent]
             p.children.append(self)
@@ -179,6 +263,43 @@ class ProgramNode(object):
         ProgramNode.progtree[uuid] = self
 
 
+    @property
+    def duration(self):
+        ''' ns from the first to the last record of the program, None when the trace has no times '''
+        if self.start is None:
+            return None
+        return self.end - self.start
+
+    @property
+    def toolchain(self):
+        '''
+        The fingerprint of each immutable root the node USES, a cache key for the tools it ran. One the
+        parser took of its own host, not the collector during the build, reads parser:<hash>
+        '''
+        toolchain = {}
+        for i in self.operations.get('USES', []):
+            fingerprint = ProgramNode.fingerprints.get(i) or {}
+            toolchain[i] = fingerprint.get('hash')
+            if toolchain[i] and fingerprint.get('source') == 'parser':
+                toolchain[i] = 'parser:' + toolchain[i]
+        return toolchain
+
+    @property
+    def sampled(self):
+        '''
+        The sampling of the file events of the node, None when all were
+        tracked. The estimate is the count of each operation scaled by the
+        rate, 0 for a process left out of a process sample, so that summed
+        over the nodes it estimates the events of the whole run.
+        '''
+        if self.sample is None:
+            return None
+        sampled = dict(self.sample)
+        scale = 1.0 / self.sample['rate'] if self.sample['selected'] else 0.0
+        sampled['estimate'] = {op: len(self.operations.get(op, []))*scale for op in WISK_SAMPLE_OPS
+                               if op in self.operations or not self.sample['selected']}
+        return sampled
+
     def remove(self):
         log.debug('Removing: %s', self.command_path) 
         self.operations = None
@@ -206,10 +327,19 @@ class ProgramNode(object):
         yield 'PID', self.pid
         yield 'PPID', self.ppid
         yield 'COMPLETE', self.complete
+        yield 'START', self.start
+        yield 'END', self.end
+        yield 'DURATION', self.duration
+        yield 'RUSAGE', self.rusage
+        yield 'SAMPLED', self.sampled
+        yield 'POLICY', self.policy
+        yield 'TOOLCHAIN', self.toolchain
+        yield 'OVERFLOW', self.overflow
         wsroot= getattr(self, 'WSROOT', None)
         if wsroot:
             yield 'WSROOT', wsroot
         yield 'OPERATIONS', self.operations
+        yield 'REPEATS', self.repeats
         yield 'mergedcommands', [' '.join(i.command) for i in self.mergedcommands]
         yield 'children', len(self.children)
         yield 'invokes', self.children
@@ -227,9 +357,9 @@ class ProgramNode(object):
         tab=''
         outdata=''
         cmdcxt=[]
-        while n.uuid != WISK_TRACKER_UUID:
+        while n and n.uuid != WISK_TRACKER_UUID:
             cmdcxt.append(command)
-            outdata = outdata + ('{!s} {!s} {!s} {!s:<.20} [{!r:<.100}]\n'.format(tab, n.command_type, n.uuid, os.path.basename(n.command_path), compactcommand(n.command)))
+            outdata = outdata + ('{!s} {!s} {!s} {!s:<.20} [{!r:<.100}]\n'.format(tab, n.command_type, n.uuid, os.path.basename(n.command_path or ''), compactcommand(n.command or [])))
             tab=tab+'    '
             n = n.parent
         print('\n%sUnrecognized Tool: %r\n[i]-InterpTool, [b] - Buildtool, [s] - ShellTool, [Enter] - hardtool, [e] - Save/Exit, [q] - Quit' % (outdata, compactcommand(self.command)))
@@ -267,9 +397,9 @@ class ProgramNode(object):
         tab=''
         outdata=''
         cmdcxt=[]
-        while n.uuid != WISK_TRACKER_UUID:
+        while n and n.uuid != WISK_TRACKER_UUID:
             cmdcxt.append(command)
-            outdata = outdata + ('{!s} {!s} {!s} {!s:<.20} [{!r:<.150}]\n'.format(tab, n.command_type, n.uuid, os.path.basename(n.command_path), ' '.join(n.command)))
+            outdata = outdata + ('{!s} {!s} {!s} {!s:<.20} [{!r:<.150}]\n'.format(tab, n.command_type, n.uuid, os.path.basename(n.command_path or ''), ' '.join(n.command or [])))
             tab=tab+'    '
             n = n.parent
         if cmdcxt not in UNRECOGNIZED_TOOLS_CXT:
@@ -342,15 +472,33 @@ class ProgramNode(object):
         self.match_command_type()
          
 
+    def add_repeats(self, operation, counts):
+        repeats = self.repeats.setdefault(operation, {})
+        for path, count in counts.items():
+            repeats[path] = repeats.get(path, 0) + count
+
+    def add_probes(self, probes):
+        ''' PROBES operation, {directory: [+name found, -name missing, * listed]} '''
+        dirs = self.operations.setdefault('PROBES', {})
+        for d, items in probes.items():
+            l = dirs.setdefault(d, [])
+            l.extend([i for i in items if i not in l])
+
     def domerge(self):
         assert self.uuid != WISK_TRACKER_UUID and self.parent.uuid != WISK_TRACKER_UUID
         log.info('Merging: [%s] %r\n   with: [%s] %r', self.uuid, compactcommand(self.command), self.uuid, compactcommand(self.parent.command))
         for k,v in self.operations.items():
+            if k in ['PROBES']:
+                self.parent.add_probes(v)
+                continue
             self.parent.operations.setdefault(k, [])
             for i in v:
                 if i not in self.parent.operations[k]:
                     self.parent.operations[k].append(i)
         self.operations=[]
+        for k,v in self.repeats.items():
+            self.parent.add_repeats(k, v)
+        self.repeats={}
         for cn in self.children:
             cn.parent = self.parent
             cn.parent.children.append(cn)
@@ -361,7 +509,7 @@ class ProgramNode(object):
         self.filteredout = True
 
     def node_complete(self):
-        for operation in ['COMMAND', 'ENVIRONMENT', 'COMPLETE']:
+        for operation in ['COMMAND', 'ENVIRONMENT', 'ENVIRONMENT-DELTA', 'COMPLETE']:
             buffer_name = '_'+operation.lower()+'_buffer'
             opbuffer = getattr(self, buffer_name, '')
             assert not opbuffer, "Data left in the buffer on COMPLETE\n%s" % (opbuffer)
@@ -396,6 +544,19 @@ class ProgramNode(object):
         return prog
 
 
+    @classmethod
+    def add_call(cls, parent, uuid):
+        # Records that come over different channels can be read before the
+        # CALLS that creates their node, so adopt a node created early
+        if WISK_SESSION_ROOT.match(parent):
+            parent = WISK_TRACKER_UUID
+        parent = cls.getorcreate(parent)
+        node = cls.getorcreate(uuid)
+        assert node.parent is None, "Conflicting UUID values"
+        node.parent = parent
+        parent.children.append(node)
+        return node
+
     @classmethod
     def add_operation(cls, uuid, operation, data, buffer=False):
         if uuid not in cls.progtree:
@@ -414,6 +575,10 @@ class ProgramNode(object):
         except json.decoder.JSONDecodeError as e:
             setattr(node, buffer_name, opbuffer)
             return
+        cls.apply_operation(node, operation, data)
+
+    @classmethod
+    def apply_operation(cls, node, operation, data):
         if operation in ['COMMAND_PATH', 'READS', 'WRITES', 'UNLINK']:
             data = os.path.normpath(data).replace(WSROOT+'/', '')
         elif operation in ['LINKS']:
@@ -424,18 +589,137 @@ class ProgramNode(object):
             data = dict([(i if len(i)==2 else (i[0], '')) for i in data])
             getattr(node, operation.lower()).update(data)
             node.command_clean()
+        elif operation in ['ENVIRONMENT-DELTA']:
+            # Resolved by resolve_environment() once the whole trace is read
+            node.envdelta = data
         elif operation in ['COMMAND', 'CALLS', 'PID', 'PPID', 'WORKING_DIRECTORY']:
             setattr(node, operation.lower(), data)
         elif operation in ['COMMAND_PATH',]:
             setattr(node, operation.lower(), data)
         elif operation in ['COMPLETE']:
+            # [pid at init, pid, ppid, argc, argv..., key=value...]
+            if len(data) > 3 and data[3].isdigit():
+                for item in data[4+int(data[3]):]:
+                    key, _, value = item.partition('=')
+                    if key == 'clock':
+                        node.clock = value
+                    elif key == 'lifetime':
+                        node.lifetime = int(value)
+                    elif key.startswith('overhead.'):
+                        node.overhead[key[len('overhead.'):]] = [int(i) for i in value.split(',')]
+                    elif key.startswith('rusage.'):
+                        node.rusage[key[len('rusage.'):]] = dict(zip(WISK_RUSAGE_FIELDS, (int(i) for i in value.split(','))))
+                    elif key == 'policy':
+                        node.policy = value
+                    elif key == 'overflow':
+                        node.overflow = dict(zip(WISK_OVERFLOW_FIELDS, (int(i) for i in value.split(','))))
+                    elif key == 'sample':
+                        mode, rate, selected, kept, dropped = value.split(',')
+                        node.sample = dict(zip(WISK_SAMPLE_FIELDS, (mode, float(rate), selected == '1',
+                                                                    int(kept), int(dropped))))
             node.node_complete()
+        elif operation in ['FINGERPRINT']:
+            # [root, hash, entries, bytes], added by the collector, see fingerprint_root()
+            cls.fingerprints[data[0]] = {'hash': data[1], 'entries': int(data[2]), 'bytes': int(data[3]),
+                                         'source': 'collector'}
+        elif operation in ['PROBES']:
+            # [directory, items...], the lookups of a directory the shim held back together
+            d = os.path.normpath(data[0]).replace(WSROOT+'/', '')
+            node.add_probes({d: data[1:]})
+        elif operation in ['REPEATS']:
+            # (operation, count, path) triples, the shim reported each path once
+            for op, count, path in zip(data[0::3], data[1::3], data[2::3]):
+                if op not in ['READS-UNKNOWN', 'USES']:
+                    path = os.path.normpath(path).replace(WSROOT+'/', '')
+                node.add_repeats(op, {path: int(count)})
         else:
             node.operations.setdefault(operation, [])
             if data not in node.operations[operation]:
                 node.operations[operation].append(data)
 
 
+    def environment_from_delta(self):
+        '''
+        Applies an ENVIRONMENT-DELTA to the environment of the node it was taken against, that one's
+        first. A loop rather than recursion, a process tree can be deeper than the recursion limit
+        '''
+        pending, waiting = [self], {self.uuid}
+        while pending:
+            node = pending[-1]
+            delta = node.envdelta
+            if delta is None:
+                waiting.discard(pending.pop().uuid)
+                continue
+            base = ProgramNode.progtree.get(delta[0])
+            if base is not None and base.envdelta is not None and base.uuid not in waiting:
+                pending.append(base)
+                waiting.add(base.uuid)
+                continue
+            waiting.discard(pending.pop().uuid)
+            node.envdelta = None
+            if base is None:
+                log.error('Environment of %s is relative to %s, which is not in the trace', node.uuid, delta[0])
+                environment = {}
+            else:
+                environment = dict(base.environment)
+            removed = [i[1:] for i in delta[1:] if i.startswith('=')]
+            if removed:
+                hashes = {envhash('%s=%s' % (k, v)): k for k, v in environment.items()}
+                for h in removed:
+                    if h in hashes:
+                        environment.pop(hashes[h])
+            data = [i.split('=',1) for i in delta[1:] if not i.startswith('=')]
+            environment.update(dict([(i if len(i)==2 else (i[0], '')) for i in data]))
+            node.environment.update(environment)
+            if node.command:
+                node.command_clean()
+            if node.parent and node.parent.envdelta is not None and node.parent.uuid not in waiting:
+                pending.append(node.parent)
+                waiting.add(node.parent.uuid)
+
+    @classmethod
+    def resolve_times(cls, times):
+        '''
+        Start and end of the nodes, in ns of CLOCK_MONOTONIC, from the
+        [epoch, first, last] of each process folded by fold_time(). A process
+        none of whose epoch records made it has no times.
+        '''
+        for (uuid, pid), (epoch, first, last) in times.items():
+            node = cls.progtree.get(uuid)
+            if node is None or epoch is None or first is None:
+                continue
+            node.start = epoch + first if node.start is None else min(node.start, epoch + first)
+            node.end = epoch + last if node.end is None else max(node.end, epoch + last)
+
+    @classmethod
+    def resolve_environment(cls):
+        for node in list(cls.progtree.values()):
+            node.environment_from_delta()
+
+    @classmethod
+    def resolve_fingerprints(cls):
+        '''
+        Fingerprints the roots used that the trace has none of, with no collector there was none to. These
+        are of the trees as they are on this host now, not as the build saw them, and are marked as such
+        '''
+        for node in cls.progtree.values():
+            for root in node.operations.get('USES', []) if node.operations else []:
+                if root not in cls.fingerprints:
+                    log.warning('No fingerprint of %s in the trace, taking one of this host', root)
+                    cls.fingerprints[root] = dict(fingerprint_root(root), source='parser')
+
+    @classmethod
+    def report_overflow(cls):
+        ''' What the processes could not write to the FIFO, spilled records are in the trace, dropped ones are not '''
+        totals = dict.fromkeys(WISK_OVERFLOW_FIELDS, 0)
+        for node in cls.progtree.values():
+            for k, v in (node.overflow or {}).items():
+                totals[k] += v
+        if totals['spilled']:
+            log.info('%d records overflowed the tracker FIFO', totals['spilled'])
+        if totals['dropped']:
+            log.warning('%d records were lost, the tracker FIFO and its overflow could not take them', totals['dropped'])
+
     @classmethod
     def prune_tree(cls, program=None):
         if program is None:
@@ -512,40 +796,287 @@ def uuid_list_complete(args, root):
     return rv
 
 
+def envhash(entry):
+    '''
+    64 bit FNV-1a of an environment entry, as in WISK_TRACKER_ENVDIGEST. The
+    entry is "name=value", with a '=' even when the process had none, as
+    wisk_env_hash() hashes it
+    '''
+    h = 0xcbf29ce484222325
+    for b in entry.encode('utf-8', 'surrogateescape'):
+        h = ((h ^ b) * 0x100000001b3) & 0xFFFFFFFFFFFFFFFF
+    return '%016x' % h
+
+def uuidstr(raw):
+    return '%08x-%08x-%08x-%08x' % struct.unpack('=4I', raw)
+
+def reassemble(fragments, key, frag, more, piece):
+    '''
+    Collects the numbered fragments of a record, in whatever order they come,
+    returns them all in order once every one up to the last is in. A record
+    missing a fragment stays in fragments, read_raw_records() reports it.
+    '''
+    parts, last = fragments.pop(key, ({}, None))
+    if frag in parts:
+        log.error('Fragment %d of record %s seen twice', frag, key)
+    parts[frag] = piece
+    if not more:
+        last = frag
+    if last is None or any(i not in parts for i in range(last + 1)):
+        fragments[key] = (parts, last)
+        return None
+    return [parts[i] for i in range(last + 1)]
+
+class RawBlockWriter(object):
+    '''
+    Writes the raw trace as independently decodable zlib blocks followed by
+    an index of them, the layout wiskcollect -z writes, see wiskcollect.c
+    '''
+    def __init__(self, filename, level):
+        self.ofile = open(filename, 'wb')
+        self.level = level
+        self.buf = bytearray()
+        self.blocks = []
+        self.offset = 0
+
+    def write(self, data):
+        self.buf += data
+        while len(self.buf) >= WISK_RAWBLOCK_SIZE:
+            self.block(self.buf[:WISK_RAWBLOCK_SIZE])
+            del self.buf[:WISK_RAWBLOCK_SIZE]
+
+    def block(self, data):
+        z = zlib.compress(bytes(data), self.level)
+        self.ofile.write(WISK_RAWBLOCK_HEADER.pack(WISK_RAWBLOCK_MAGIC, len(z), len(data)))
+        self.ofile.write(z)
+        self.blocks.append((self.offset, len(z), len(data)))
+        self.offset += WISK_RAWBLOCK_HEADER.size + len(z)
+
+    def close(self):
+        if self.buf:
+            self.block(self.buf)
+        self.ofile.write(b''.join(WISK_RAWBLOCK_INDEX.pack(*b) for b in self.blocks))
+        self.ofile.write(WISK_RAWBLOCK_TRAILER.pack(WISK_RAWINDEX_MAGIC, len(self.blocks), self.offset))
+        self.ofile.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+class RawBlockReader(io.RawIOBase):
+    ''' Reads back a block compressed raw trace, decompressing the blocks ahead in parallel '''
+    def __init__(self, filename, workers=None):
+        self.filename = filename
+        self.fd = os.open(filename, os.O_RDONLY)
+        self.blocks = self.index()
+        workers = workers or os.cpu_count() or 1
+        self.executor = concurrent.futures.ThreadPoolExecutor(workers)
+        self.depth = 2 * workers
+        self.ahead = collections.deque()
+        self.next = 0
+        self.data = memoryview(b'')
+
+    def index(self):
+        size = os.fstat(self.fd).st_size
+        if size >= WISK_RAWBLOCK_TRAILER.size:
+            magic, count, offset = WISK_RAWBLOCK_TRAILER.unpack(os.pread(self.fd, WISK_RAWBLOCK_TRAILER.size, size - WISK_RAWBLOCK_TRAILER.size))
+            if magic == WISK_RAWINDEX_MAGIC and offset + count * WISK_RAWBLOCK_INDEX.size + WISK_RAWBLOCK_TRAILER.size == size:
+                data = os.pread(self.fd, count * WISK_RAWBLOCK_INDEX.size, offset)
+                return list(WISK_RAWBLOCK_INDEX.iter_unpack(data))
+        # Cut short, the collector never wrote the index
+        log.warning('Raw trace %s has no block index, scanning its blocks', self.filename)
+        blocks = []
+        offset = 0
+        while offset + WISK_RAWBLOCK_HEADER.size <= size:
+            magic, clen, length = WISK_RAWBLOCK_HEADER.unpack(os.pread(self.fd, WISK_RAWBLOCK_HEADER.size, offset))
+            if magic != WISK_RAWBLOCK_MAGIC or offset + WISK_RAWBLOCK_HEADER.size + clen > size:
+                break
+            blocks.append((offset, clen, length))
+            offset += WISK_RAWBLOCK_HEADER.size + clen
+        return blocks
+
+    def decompress(self, block):
+        offset, clen, _ = block
+        return zlib.decompress(os.pread(self.fd, clen, offset + WISK_RAWBLOCK_HEADER.size))
+
+    def readable(self):
+        return True
+
+    def readinto(self, b):
+        while not self.data:
+            while self.next < len(self.blocks) and len(self.ahead) < self.depth:
+                self.ahead.append(self.executor.submit(self.decompress, self.blocks[self.next]))
+                self.next += 1
+            if not self.ahead:
+                return 0
+            self.data = memoryview(self.ahead.popleft().result())
+        n = min(len(b), len(self.data))
+        b[:n] = self.data[:n]
+        self.data = self.data[n:]
+        return n
+
+    def close(self):
+        if not self.closed:
+            self.executor.shutdown(wait=True)
+            os.close(self.fd)
+        super().close()
+
+def open_raw(filename):
+    ''' Opens a raw trace for reading, block compressed or not '''
+    with open(filename, 'rb') as ifile:
+        magic = ifile.read(len(WISK_RAWBLOCK_MAGIC))
+    # A trace with no records at all is just the index
+    if magic in (WISK_RAWBLOCK_MAGIC, WISK_RAWINDEX_MAGIC):
+        return io.BufferedReader(RawBlockReader(filename), WISK_RAWBLOCK_SIZE)
+    return open(filename, 'rb')
+
+def create_raw(filename, level):
+    ''' Opens a raw trace for writing, block compressed at a zlib level other than 0 '''
+    return RawBlockWriter(filename, level) if level else open(filename, 'wb')
+
+def fold_time(times, key, time, epoch=None):
+    '''
+    Folds the time of a record into the [epoch, first, last] of its process.
+    A time is in ns since the epoch of the process, which every
+    WISK_RECORD_RESYNC-th record also carries, in a field of its own.
+    '''
+    stream = times.setdefault(key, [None, None, None])
+    if epoch is not None:
+        stream[0] = epoch
+    stream[1] = time if stream[1] is None else min(stream[1], time)
+    stream[2] = time if stream[2] is None else max(stream[2], time)
+
+def read_raw_records(ifile, times=None):
+    """
+    Yields (uuid, operation, data, raw, decoded) for every record in the raw
+    trace, which may mix text lines and binary records. Records are framed
+    with the pid and a sequence number of the sending process, fragments are
+    reassembled by that key and the data decoded here. CALLS comes tagged
+    with the child and carries the parent, in either format. Text lines of
+    an unframed trace are passed on still json encoded, decoded is False.
+    Gaps in the sequence numbers of a process are logged as lost records.
+    A torn or garbled text line is skipped and logged, a record whose data
+    does not decode counts as lost.
+    The time of each record is folded into times, by (uuid, pid), see
+    fold_time().
+    """
+    fragments = {}
+    sequences = {}
+    garbled = 0
+    while True:
+        b = ifile.peek(1)[:1]
+        if not b:
+            break
+        if b[0] != WISK_RECORD_MAGIC:
+            l = ifile.readline()
+            parts = l.decode('utf-8', 'surrogateescape').split(' ',2)
+            uuid, _, frame = parts[0].partition('@')
+            # <pid>.<seq>~<time>/<epoch>:<frag>, a '+' instead of the ':' when more follow, the epoch only on some
+            match = re.match(r'(\d+)\.(\d+)(?:~(\d+)(?:/(\d+))?)?[:+](\d+)$', frame) if frame else None
+            if len(parts) < 3 or (frame and match is None):
+                log.warning('Skipping a garbled line in raw data: %r', l[:80])
+                garbled += 1
+                continue
+            if not frame:
+                yield parts[0], parts[1].strip(), parts[2], l, False
+                continue
+            pid, seq, time, epoch, frag = match.groups()
+            operation = parts[1]
+            parts = reassemble(fragments, (uuid, pid, seq), int(frag), '+' in frame, (l, parts[2].rstrip('\n')))
+            if parts is None:
+                continue
+            raw = b''.join(p[0] for p in parts)
+            try:
+                data = json.loads(''.join(p[1] for p in parts))
+            except ValueError:
+                log.warning('Skipping a corrupt %s record of %s pid %s seq %s', operation, uuid, pid, seq)
+                # Numbered but not counted, so it shows as lost below
+                stream = sequences.setdefault((uuid, int(pid)), [0, -1])
+                stream[1] = max(stream[1], int(seq))
+                continue
+            if operation == 'CALLS':
+                uuid, data = data, uuid
+        else:
+            hdr = ifile.read(WISK_RECORD_HEADER.size)
+            if len(hdr) < WISK_RECORD_HEADER.size:
+                log.error('Truncated record header at end of raw data')
+                break
+            magic, version, op, flags, length, pid, seq, frag, _, rawid, time = WISK_RECORD_HEADER.unpack(hdr)
+            if version != WISK_RECORD_VERSION or op >= len(WISK_OPS):
+                raise CmdException('Unsupported tracker record version %d op %d' % (version, op))
+            payload = ifile.read(length)
+            uuid = uuidstr(rawid)
+            operation = WISK_OPS[op]
+            parts = reassemble(fragments, (uuid, pid, seq), frag, flags & WISK_RECORD_MORE, (hdr, payload))
+            if parts is None:
+                continue
+            raw = b''.join(h + p for h, p in parts)
+            payload = b''.join(p for h, p in parts)
+            epoch = None
+            if flags & WISK_RECORD_EPOCH:
+                epoch, payload = struct.unpack('=Q', payload[:8])[0], payload[8:]
+            data = [i.decode('utf-8', 'surrogateescape') for i in payload.split(b'\0')[:-1]]
+            if not flags & WISK_RECORD_LIST:
+                data = data[0] if data else ''
+        # Records of a process are numbered from 0, count them against the highest
+        stream = sequences.setdefault((uuid, int(pid)), [0, -1])
+        stream[0] += 1
+        stream[1] = max(stream[1], int(seq))
+        if times is not None and time is not None:
+            fold_time(times, (uuid, int(pid)), int(time), epoch and int(epoch))
+        yield uuid, operation, data, raw, True
+    for key in fragments:
+        log.error('Incomplete record %s at end of raw data', key)
+    lost = [(k, v[1] + 1 - v[0]) for k, v in sequences.items() if v[1] + 1 > v[0]]
+    for (uuid, pid), count in lost:
+        log.warning('Lost %d records of %s pid %d', count, uuid, pid)
+    if lost:
+        log.error('Lost %d records from %d processes', sum(i[1] for i in lost), len(lost))
+    if garbled:
+        log.error('Lost %d garbled lines of raw data', garbled)
+
 @utils.timethis
 def read_raw_data(args, debug=False):
     print('Reading Raw Data: %s' %(args.trackfile + '.raw'))
-    ifile = open(args.trackfile + '.raw')
+    ifile = open_raw(args.trackfile + '.raw')
     extractfile=None
     if args.extract:
         print('Extracting Filtered Data: %s, UUIDs: %s' % (args.trackfile+'.ext.raw', args.extract))
-        extractfile = open(args.trackfile+'.ext.raw', 'w')
+        extractfile = open(args.trackfile+'.ext.raw', 'wb')
     root = ProgramNode(WISK_TRACKER_UUID).complete=True
     count = 0
     line = 0
-#    for l in ifile.readlines():
-    while True:
-        l = ifile.readline()
-        if not l:
-            break
+    times = {}
+    for uuid, operation, data, raw, decoded in read_raw_records(ifile, times):
         line += 1
         if not debug:
             print("\rReading %d ..." % (line), end='')
-        log.debug('(%s)', l)
-        parts = l.split(' ',2)
-        uuid = parts[0]
-        operation = parts[1].strip()
-        data = parts[2]
+        log.debug('(%s %s %s)', uuid, operation, data)
         if operation=='CALLS':
-            ProgramNode(json.loads(data), uuid)
+            # A decoded CALLS is tagged with the child and carries the parent
+            if decoded:
+                ProgramNode.add_call(data, uuid)
+            else:
+                ProgramNode.add_call(uuid, json.loads(data))
             count += 1
+        elif decoded:
+            # The collector adds records of its own, tagged with the session's root
+            if WISK_SESSION_ROOT.match(uuid):
+                uuid = WISK_TRACKER_UUID
+            ProgramNode.apply_operation(ProgramNode.getorcreate(uuid), operation, data)
         else:
             ProgramNode.add_operation(uuid, operation, data)
         if debug and operation in ['CALLS', 'COMMAND', 'COMPLETE']:
-            print(l.rstrip())
+            print(uuid, operation, data if decoded else data.rstrip())
         if extractfile and uuid in args.extract:
-            log.debug('Extracting: [%s]', l)
-            extractfile.write(l)
+            log.debug('Extracting: [%s]', raw)
+            extractfile.write(raw)
+    ProgramNode.resolve_environment()
+    ProgramNode.resolve_times(times)
+    ProgramNode.resolve_fingerprints()
+    ProgramNode.report_overflow()
     if args.extract and not uuid_list_complete(args, root):
         extractfile.close()
         root=None
@@ -576,32 +1107,410 @@ def extract_commands(args, root=None):
     print('Writing Top level Commands to %s' % (args.trackfile+'.cmds'))
     ProgramNode.show_nodes(args.trackfile+'.cmds')
 
+def write_overhead(args):
+    ''' Per hook and per tool cost of the shim, from the overhead counters of the COMPLETE records '''
+    hooks = {}
+    tools = {}
+    clocks = set()
+    for node in ProgramNode.progtree.values():
+        if not node.lifetime:
+            continue
+        clocks.add(node.clock)
+        tool = tools.setdefault(os.path.basename(node.command_path or '?'), [0, 0, 0, 0, 0, 0])
+        tool[0] += 1
+        tool[5] += node.lifetime
+        for hook, counters in node.overhead.items():
+            total = hooks.setdefault(hook, [0, 0, 0, 0])
+            for i, v in enumerate(counters):
+                total[i] += v
+                tool[i+1] += v
+    lifetime = sum(i[5] for i in tools.values()) or 1
+    print('Writing Tracking Overhead to %s' % (args.trackfile+'.overhead'))
+    with open(args.trackfile+'.overhead', 'w') as ofile:
+        ofile.write('# clock: %s, lifetime of %d processes: %d\n' % (','.join(sorted(str(i) for i in clocks)),
+                                                                    sum(i[0] for i in tools.values()), lifetime))
+        ofile.write('\n%-16s %12s %12s %14s %16s %8s\n' % ('HOOK', 'CALLS', 'EVENTS', 'BYTES', 'CYCLES', '%LIFE'))
+        for hook, (calls, events, nbytes, cycles) in sorted(hooks.items(), key=lambda i: -i[1][3]):
+            ofile.write('%-16s %12d %12d %14d %16d %8.2f\n' % (hook, calls, events, nbytes, cycles, 100.0*cycles/lifetime))
+        ofile.write('\n%-24s %8s %12s %12s %14s %16s %8s\n' % ('TOOL', 'PROCS', 'CALLS', 'EVENTS', 'BYTES', 'CYCLES', '%LIFE'))
+        for tool, (procs, calls, events, nbytes, cycles, life) in sorted(tools.items(), key=lambda i: -i[1][4]):
+            ofile.write('%-24s %8d %12d %12d %14d %16d %8.2f\n' % (tool[:24], procs, calls, events, nbytes, cycles,
+                                                                  100.0*cycles/(life or 1)))
+
+
+class TrackerRing(object):
+    ''' Shared memory rings libwisktrack publishes records into, see wisk_shm_publish() '''
+    HEADER_SIZE = 64
+    RING_HEADER_SIZE = 128
+    WAITING = 16
+    COMMITTED = 0x80000000
+    PADDING = 0x40000000
+    RESERVED = 0x20000000
+    LENMASK = 0x1FFFFFFF
+
+    def __init__(self, nrings=WISK_SHM_RINGS, ringsize=WISK_SHM_RINGSIZE):
+        self.nrings = nrings
+        self.ringsize = ringsize
+        size = self.HEADER_SIZE + nrings * (self.RING_HEADER_SIZE + ringsize)
+        if hasattr(os, 'memfd_create'):
+            self.fd = os.memfd_create('wisk_tracker', 0)
+        else:
+            tmpfile = tempfile.NamedTemporaryFile(dir='/dev/shm', prefix='wisk_tracker', delete=False)
+            self.fd = os.dup(tmpfile.fileno())
+            tmpfile.close()
+            os.unlink(tmpfile.name)
+        os.ftruncate(self.fd, size)
+        self.mm = mmap.mmap(self.fd, size)
+        struct.pack_into('<IIII', self.mm, 0, WISK_SHM_MAGIC, WISK_SHM_VERSION, nrings, ringsize)
+        self.rings = [self.HEADER_SIZE + i * (self.RING_HEADER_SIZE + ringsize) for i in range(nrings)]
+        self.tails = [0] * nrings
+        # Where each ring waits on an uncommitted record, and since when
+        self.stalls = [(None, 0)] * nrings
+        # Producers write the eventfd, a pipe where there is none
+        if hasattr(os, 'eventfd'):
+            self.wake = self.wakefd = os.eventfd(0, os.EFD_NONBLOCK|os.EFD_CLOEXEC)
+        else:
+            self.wake, self.wakefd = os.pipe()
+            os.set_blocking(self.wake, False)
+        log.info('Creating Recieving Shared Memory: %d rings of %d bytes, fd %d', nrings, ringsize, self.fd)
+
+    @staticmethod
+    def alive(pid):
+        ''' Whether the process is still there to commit what it reserved, a zombie is not '''
+        try:
+            with open('/proc/%d/stat' % pid, 'rb') as f:
+                return f.read().rpartition(b')')[2].split()[0] not in (b'Z', b'X')
+        except (OSError, IndexError):
+            return False
+
+    def stalled(self, i, tail, pid):
+        ''' Whether ring i waited long enough on the record at tail, reserved by pid, to step over it '''
+        if self.stalls[i][0] != tail:
+            self.stalls[i] = (tail, time.monotonic())
+            return False
+        return time.monotonic() - self.stalls[i][1] > WISK_SHM_COMMIT_TIMEOUT and not self.alive(pid)
+
+    def drain(self, ofile, final=False):
+        '''
+        Copy every committed record out to ofile, returns the number of bytes
+        copied. A record whose process died before committing it is skipped,
+        once it stalled the ring for long enough, or once the ring is final.
+        Whatever follows a slot that lost its header is dropped and logged.
+        '''
+        count = 0
+        mask = self.ringsize - 1
+        for i, base in enumerate(self.rings):
+            # head and tail are only ever accessed as whole aligned 64 bit words
+            head = ctypes.c_uint64.from_buffer(self.mm, base).value
+            tail = self.tails[i]
+            data = base + self.RING_HEADER_SIZE
+            while tail < head:
+                off = data + (tail & mask)
+                word = ctypes.c_uint32.from_buffer(self.mm, off).value
+                if not word:
+                    # Producers claim the header before they move head, a zero one lost its length
+                    if not (final or self.stalled(i, tail, 0)):
+                        break
+                    log.error('Dropping %d bytes of ring %d after a slot with no header', head - tail, i)
+                    while tail < head:
+                        off = tail & mask
+                        span = min(head - tail, self.ringsize - off)
+                        self.mm[data+off:data+off+span] = bytes(span)
+                        tail += span
+                    break
+                if not word & self.COMMITTED:
+                    pid = ctypes.c_uint32.from_buffer(self.mm, off + 4).value
+                    if not word & self.RESERVED or not (final or self.stalled(i, tail, pid)):
+                        break
+                    log.error('Dropping a record of %d bytes process %d reserved and never committed', word & self.LENMASK, pid)
+                    word &= ~self.RESERVED
+                length = word & self.LENMASK
+                span = (8 + length + 7) & ~7
+                if word & self.COMMITTED and not word & self.PADDING:
+                    ofile.write(self.mm[off+8:off+8+length])
+                    count += length
+                self.mm[off:off+span] = bytes(span)
+                tail += span
+            if tail != self.tails[i]:
+                ctypes.c_uint64.from_buffer(self.mm, base + 64).value = tail
+                self.tails[i] = tail
+        return count
+
+    def sleep(self, fds, ofile):
+        '''
+        Waits for a producer to wake the collector, or for one of fds, returns
+        those readable. A commit that came before waiting was set is drained
+        first. A wakeup can still be missed, this is not a full barrier, so the
+        wait is bounded by WISK_SHM_WAKE_TIMEOUT.
+        '''
+        waiting = ctypes.c_uint32.from_buffer(self.mm, self.WAITING)
+        waiting.value = 1
+        if self.drain(ofile):
+            waiting.value = 0
+            readable, _, _ = select.select(fds, [], [], 0)
+            return readable
+        readable, _, _ = select.select(fds + [self.wake], [], [], WISK_SHM_WAKE_TIMEOUT)
+        waiting.value = 0
+        if self.wake in readable:
+            try:
+                os.read(self.wake, 8)
+            except BlockingIOError:
+                pass
+            readable.remove(self.wake)
+        return readable
+
+    def close(self):
+        self.mm.close()
+        os.close(self.fd)
+        os.close(self.wake)
+        if self.wakefd != self.wake:
+            os.close(self.wakefd)
+
+
+def spill_complete(data):
+    ''' Length of the whole records at the start of a spill file, a process killed mid write leaves a partial one '''
+    pos = 0
+    while pos < len(data):
+        if data[pos] == WISK_RECORD_MAGIC:
+            if pos + WISK_RECORD_HEADER.size > len(data):
+                break
+            end = pos + WISK_RECORD_HEADER.size + WISK_RECORD_HEADER.unpack_from(data, pos)[4]
+        else:
+            end = data.find(b'\n', pos) + 1
+            if end == 0:
+                break
+        if end > len(data):
+            break
+        pos = end
+    return pos
+
+def read_spill(filename):
+    with open(filename, 'rb') as ifile:
+        data = ifile.read()
+    size = spill_complete(data)
+    if size < len(data):
+        log.warning('Dropping %d bytes of an incomplete record at the end of %s', len(data) - size, filename)
+    return data[:size]
+
+@utils.timethis
+def merge_spill(spilldir, rawfile, level=0):
+    '''
+    Concatenate the spill files of a session into the raw trace. Files are
+    read in parallel, a batch at a time, and written out in name order. The
+    records of a process stay in order within its file, the parser needs no
+    order across processes.
+    '''
+    names = sorted(os.listdir(spilldir))
+    print('Merging %d Spill Files from %s into %s' % (len(names), spilldir, rawfile))
+    with create_raw(rawfile, level) as ofile, concurrent.futures.ThreadPoolExecutor() as executor:
+        for i in range(0, len(names), WISK_SPILL_BATCH):
+            batch = [os.path.join(spilldir, n) for n in names[i:i+WISK_SPILL_BATCH]]
+            for data in executor.map(read_spill, batch):
+                ofile.write(data)
+    shutil.rmtree(spilldir)
+
 
 class TrackerReciever(object):
     def __init__(self, args):
         self.rawfile = args.trackfile + '.raw'
+        self.compress = getattr(args, 'compress', 0)
+        self.ring = TrackerRing() if getattr(args, 'transport', 'fifo') == 'shm' else None
+        self.spilldir = args.trackfile + '.spill' if getattr(args, 'transport', 'fifo') == 'spill' else None
+        self.overflow = None
+        if self.spilldir:
+            if os.path.exists(self.spilldir):
+                shutil.rmtree(self.spilldir)
+            log.info('Creating Spill Directory: %s', self.spilldir)
+            os.makedirs(self.spilldir)
+        # The native collector drains the FIFO, sharded to spread the processes across readers.
+        # A collector shared by the sessions on the host, wiskcollect -s, is asked to over its
+        # control FIFO, otherwise the session runs one of its own
+        self.collector = None
+        self.control = None
+        self.shards = 1
+        if not self.ring and not self.spilldir:
+            collector = os.path.join(os.path.dirname(env.INSTALL_LIB_DIR), 'lib64', 'wiskcollect')
+            if getattr(args, 'collector', None):
+                self.control = args.collector
+                self.shards = max(1, getattr(args, 'shards', 1))
+            elif os.path.exists(collector):
+                self.collector = collector
+                self.shards = max(1, getattr(args, 'shards', 1))
+            else:
+                log.warning('Collector %s not found, reading %s with cat', collector, WISK_TRACKER_PIPE)
+        # With a collector to merge them, processes overflow to files rather than wait on a full FIFO
+        if self.collector or self.control:
+            self.overflow = os.path.abspath(args.trackfile + '.overflow')
+            if os.path.exists(self.overflow):
+                shutil.rmtree(self.overflow)
+            os.makedirs(self.overflow)
+        self.pipes = [WISK_TRACKER_PIPE] if self.shards == 1 else ['%s.%d' % (WISK_TRACKER_PIPE, i) for i in range(self.shards)]
+        for pipe in self.pipes if self.shards > 1 else []:
+            os.mkfifo(pipe)
+        self.interval = 10 if getattr(args, 'verbose', 0) else 0
+        self.stop = os.pipe() if self.collector else None
+        self.status = self.session_open() if self.control else None
         self.thread = threading.Thread(target=self.run, args=())
         self.thread.daemon = True
         self.thread.start()
         return
     
+    def session_open(self):
+        ''' Hands the session to the shared collector, returns the status FIFO it answers on '''
+        statuspath = WISK_TRACKER_PIPE + '.status'
+        # The collector creates the trace with O_EXCL, it does not truncate one left behind
+        if os.path.lexists(self.rawfile):
+            os.unlink(self.rawfile)
+        os.mkfifo(statuspath)
+        status = os.open(statuspath, os.O_RDONLY|os.O_NONBLOCK)
+        try:
+            self.control_request(['open', WISK_SESSION, '%d' % (self.compress or -1), os.path.abspath(self.rawfile),
+                                  statuspath] + self.pipes)
+            readable, _, _ = select.select([status], [], [], WISK_COLLECTOR_TIMEOUT)
+            reply = os.read(status, 4096).decode() if readable else 'error no answer'
+            if not reply.startswith('ok'):
+                raise CmdException('Collector %s: session %s: %s' % (self.control, WISK_SESSION, reply.strip()))
+            self.control_request(['overflow', WISK_SESSION, self.overflow])
+        except CmdException:
+            os.close(status)
+            for path in [statuspath] + self.pipes:
+                os.unlink(path)
+            raise
+        log.info('Session %s collected by %s', WISK_SESSION, self.control)
+        return status
+
+    def control_request(self, request):
+        line = ('\t'.join(request) + '\n').encode('utf-8', 'surrogateescape')
+        if len(line) > select.PIPE_BUF:
+            raise CmdException('Collector request of %d bytes does not fit a single write' % len(line))
+        try:
+            fd = os.open(self.control, os.O_WRONLY|os.O_NONBLOCK)
+        except OSError as e:
+            raise CmdException('No collector on %s: %s' % (self.control, e.strerror))
+        try:
+            os.write(fd, line)
+        finally:
+            os.close(fd)
+
     def run(self):
+        if self.spilldir or self.control:
+            return None
         print('Reading RAW Dependency from: %s'  % (self.rawfile))
+        if self.ring:
+            return self.run_shm()
+        if self.collector:
+            # Closing its stdin tells the collector the command is done
+            command = [self.collector, '-o', self.rawfile, '-O', self.overflow, '-i', '%d' % self.interval] + self.pipes
+            if self.compress:
+                command[1:1] = ['-z', '%d' % self.compress]
+            return subprocess.run(command, stdin=self.stop[0])
+        if self.compress:
+            with open(WISK_TRACKER_PIPE, 'rb') as ifile, create_raw(self.rawfile, self.compress) as ofile:
+                return shutil.copyfileobj(ifile, ofile, WISK_RAWBLOCK_SIZE)
         command = '/bin/cat %s > %s' % (WISK_TRACKER_PIPE, self.rawfile)
         return subprocess.run(command, shell=True)
+
+    def run_shm(self):
+        # The FIFO carries whatever overflowed the rings, and reading EOF on it
+        # tells us every tracked process has exited
+        with create_raw(self.rawfile, self.compress) as ofile:
+            fd = os.open(WISK_TRACKER_PIPE, os.O_RDONLY)
+            try:
+                while True:
+                    if self.ring.drain(ofile):
+                        readable, _, _ = select.select([fd], [], [], 0)
+                    else:
+                        readable = self.ring.sleep([fd], ofile)
+                    if readable:
+                        data = os.read(fd, 1 << 20)
+                        if not data:
+                            break
+                        ofile.write(data)
+                # Every process is gone, what is still reserved never gets committed
+                self.ring.drain(ofile, final=True)
+            finally:
+                os.close(fd)
+                self.ring.close()
+
+    def environment(self):
+        if self.spilldir:
+            return {'WISK_TRACKER_SPILLDIR': self.spilldir}
+        if self.ring:
+            return {'WISK_TRACKER_SHM_FD': '%d' % self.ring.fd, 'WISK_TRACKER_SHM_WAKE_FD': '%d' % self.ring.wakefd}
+        cmdenv = {'WISK_TRACKER_OVERFLOW': self.overflow} if self.overflow else {}
+        if self.shards > 1:
+            cmdenv['WISK_TRACKER_PIPE_SHARDS'] = '%d' % self.shards
+        return cmdenv
+
+    def pass_fds(self):
+        return (self.ring.fd, self.ring.wakefd) if self.ring else ()
     
     def waitforcompletion(self):
+        if self.stop:
+            os.close(self.stop[1])
+        if self.status is not None:
+            # The collector closes the status FIFO once the session is written out
+            self.control_request(['close', WISK_SESSION])
+            while True:
+                select.select([self.status], [], [])
+                if not os.read(self.status, 4096):
+                    break
+            os.close(self.status)
+            os.unlink(WISK_TRACKER_PIPE + '.status')
         self.thread.join()
+        if self.stop:
+            os.close(self.stop[0])
+        if self.shards > 1:
+            for pipe in self.pipes:
+                os.unlink(pipe)
+        if self.spilldir:
+            merge_spill(self.spilldir, self.rawfile, self.compress)
+        if self.overflow and os.path.exists(self.overflow):
+            log.warning('Overflow %s was not merged into %s', self.overflow, self.rawfile)
 
 def create_reciever():
+    '''
+    Starts a session of its own, so any number of runs can be tracked on the
+    host at once: a random session id, passed in the root's WISK_TRACKER_UUID
+    and so in the uuid of every process, and a FIFO named after it that no
+    other session touches.
+    '''
     global WISK_TRACKER_PIPE
-    if WISK_TRACKER_PIPE is None:
-        WISK_TRACKER_PIPE="/tmp/wisk_tracker.pipe"
-    if os.path.exists(WISK_TRACKER_PIPE):
-        os.unlink(WISK_TRACKER_PIPE)
+    global WISK_SESSION
     log.info("WISK PID: %d", os.getpid())
-    log.info('Creating Recieving FIFO Pipe: %s', WISK_TRACKER_PIPE)
-    os.mkfifo(WISK_TRACKER_PIPE)
+    while True:
+        WISK_SESSION = '%08x' % struct.unpack('=I', os.urandom(4))
+        WISK_TRACKER_PIPE = os.path.join(WISK_SESSION_DIR or tempfile.gettempdir(), 'wisk_tracker.%s.pipe' % WISK_SESSION)
+        try:
+            os.mkfifo(WISK_TRACKER_PIPE)
+            break
+        except FileExistsError:
+            continue
+    log.info('Creating Recieving FIFO Pipe: %s, Session %s', WISK_TRACKER_PIPE, WISK_SESSION)
+
+def session_path(path):
+    '''
+    path made the session's own, <name>.<session><ext>, so the outputs of runs tracked at once from the
+    same directory do not clobber each other
+    '''
+    if WISK_SESSION is None:
+        return path
+    root, ext = os.path.splitext(path)
+    return '%s.%s%s' % (root, WISK_SESSION, ext)
+
+def session_latest(path, latest):
+    ''' Points latest at the session's path, replaced in one rename, so it is always one session's whole output '''
+    if path == latest:
+        return
+    tmp = '%s.%s.tmp' % (latest, WISK_SESSION)
+    os.symlink(os.path.basename(path), tmp)
+    os.replace(tmp, latest)
+
+def session_uuid():
+    ''' The WISK_TRACKER_UUID of the session's root, see wisk_uuid_session() in libwisktrack '''
+    if WISK_SESSION is None:
+        return WISK_TRACKER_UUID
+    return '%s-XXXXXXXX-XXXXXXXX-XXXXXXXX' % WISK_SESSION
 
 def getfiltermask(args):
     if not args.filter:
@@ -617,14 +1526,29 @@ def getfiltermask(args):
             exit(1)
     return mask
 
+def getsample(args):
+    ''' The WISK_TRACKER_SAMPLE of -sample <mode>:<rate>[:<seed>], None to track every event '''
+    if not getattr(args, 'sample', None):
+        return None
+    mode, _, rate = args.sample.partition(':')
+    rate, _, seed = rate.partition(':')
+    try:
+        if mode not in WISK_SAMPLE_MODES or not 0.0 < float(rate) <= 1.0 or (seed and int(seed, 0) < 0):
+            raise ValueError(args.sample)
+    except ValueError:
+        log.error("Unrecognized sample: %s. Supported values are %s with a rate in (0, 1], and an optional seed",
+                  args.sample, ', '.join('%s:<rate>[:<seed>]' % i for i in WISK_SAMPLE_MODES))
+        exit(1)
+    return args.sample
+
 @utils.timethis
-def tracked_run(args):
+def tracked_run(args, reciever=None):
     global WISK_DEBUGLOG
     retval = None
     log.info('WISK Verbosity: %d', args.verbose-1)
     cmdenv = {k:v for k,v in os.environ.items() if k in args.environ}
     log.debug('LATEST_LIB_DIR: %s', env.LATEST_LIB_DIR)
-    WISK_DEBUGLOG = os.path.join(args.wsroot, WISK_DEBUGLOG)
+    WISK_DEBUGLOG = os.path.join(args.wsroot, session_path(WISK_DEBUGLOG))
     open(WISK_DEBUGLOG, 'w').close()
     cmdenv.update({
         'LD_LIBRARY_PATH': ':'.join(['', os.path.join(os.path.dirname(env.INSTALL_LIB_DIR), 'lib32'),
@@ -633,10 +1557,25 @@ def tracked_run(args):
         'LD_PRELOAD': 'libwisktrack.so',
         'WISK_TRACKER_PIPE': WISK_TRACKER_PIPE,
         'WISK_TRACKER_PIPE_FD': '-1',
-        'WISK_TRACKER_UUID': WISK_TRACKER_UUID,
+        'WISK_TRACKER_UUID': session_uuid(),
 #         'WISK_TRACKER_DEBUGLOG_FD': '-1',
         'WISK_TRACKER_DEBUGLEVEL': ('%d' % (args.verbose)),
-        'WISK_TRACKER_EVENTFILTER': '%d'%(getfiltermask(args))})
+        'WISK_TRACKER_EVENTFILTER': '%d'%(getfiltermask(args)),
+        'WISK_TRACKER_FORMAT': getattr(args, 'format', 'text'),
+        'WISK_TRACKER_ENVIRONMENT': getattr(args, 'environment', 'delta')})
+    if getattr(args, 'pathfilter', None):
+        cmdenv['WISK_TRACKER_PATHFILTER'] = args.pathfilter
+    if getattr(args, 'policy', None):
+        cmdenv['WISK_TRACKER_POLICY'] = args.policy
+    if getsample(args):
+        cmdenv['WISK_TRACKER_SAMPLE'] = getsample(args)
+    command = args.command
+    if getattr(args, 'supervise', False):
+        # The supervisor is not tracked itself, it preloads the library into the command
+        cmdenv['WISK_TRACKER_PRELOAD'] = cmdenv.pop('LD_PRELOAD')
+        command = [os.path.join(os.path.dirname(env.INSTALL_LIB_DIR), 'lib64', 'wisksupervise')] + command
+    if reciever:
+        cmdenv.update(reciever.environment())
     
     if args.trace:
         cmdenv['WISK_TRACKER_DEBUGLOG'] = WISK_DEBUGLOG
@@ -649,7 +1588,7 @@ def tracked_run(args):
     log.debug('Command:%s', ' '.join(args.command))
     print('Running: %s'  % (' '.join(args.command)))
     try:
-        retval = subprocess.run(args.command, env=cmdenv)
+        retval = subprocess.run(command, env=cmdenv, pass_fds=reciever.pass_fds() if reciever else ())
 #         retval = subprocess.run(args.command, env=cmdenv, stdout=open('stdout.log', 'w'), stderr=open('stderr.log', 'w'))
     except FileNotFoundError as e:
         print(e)
@@ -661,6 +1600,103 @@ def delete_reciever(reciever):
     log.info('\nDeleting Recieving FIFO Pipe: %s', WISK_TRACKER_PIPE)
     os.unlink(WISK_TRACKER_PIPE)
 
+def compile_trie(keys, magic, filename):
+    '''
+    Write the (key, verdict) pairs as the byte trie the shim maps. Layout,
+    all little endian:
+      header: magic, version, node count, edge count     (4 x u32)
+      nodes:  first edge, edge count, verdict, pad        (u32 u16 u8 u8)
+      edges:  character, pad x 3, child node              (u8 3x u32)
+    Node 0 is the root and a node's edges are sorted by character. A later
+    key overrides the verdict of an earlier equal one.
+    '''
+    root = [{}, 0]
+    for key, verdict in keys:
+        node = root
+        for c in key.encode('utf-8', 'surrogateescape'):
+            node = node[0].setdefault(c, [{}, 0])
+        node[1] = verdict
+    nodes = [root]
+    edges = []
+    body = b''
+    for node in nodes:
+        body += struct.pack('<IHBx', len(edges), len(node[0]), node[1])
+        for c in sorted(node[0]):
+            edges.append(struct.pack('<BxxxI', c, len(nodes)))
+            nodes.append(node[0][c])
+    with open(filename, 'wb') as ofile:
+        ofile.write(struct.pack('<IIII', magic, WISK_PATHFILTER_VERSION, len(nodes), len(edges)))
+        ofile.write(body)
+        ofile.write(b''.join(edges))
+    return len(nodes)
+
+def compile_path_filter(include, exclude, filename, immutable=()):
+    '''
+    Compile the include, exclude and immutable path prefixes into the trie the
+    shim maps from WISK_TRACKER_PATHFILTER. A prefix matches whole path
+    components, the longest matching prefix decides and paths matching
+    nothing are included. What is read beneath an immutable prefix is
+    reported as a USES of the prefix.
+    '''
+    keys = [(os.path.normpath(i).rstrip('/'), WISK_PATHFILTER_EXCLUDE) for i in exclude]
+    keys += [(os.path.normpath(i).rstrip('/'), WISK_PATHFILTER_INCLUDE) for i in include]
+    keys += [(os.path.normpath(i).rstrip('/'), WISK_PATHFILTER_IMMUTABLE) for i in immutable]
+    count = compile_trie(keys, WISK_PATHFILTER_MAGIC, filename)
+    log.debug('Path filter %s: %d nodes, include %s, exclude %s, immutable %s', filename, count, include, exclude,
+              immutable)
+    return filename
+
+def fingerprint_root(root):
+    '''
+    The FINGERPRINT of an immutable root, as wiskcollect takes it: a 64 bit
+    FNV-1a hash of a line
+      <path relative to root>\t<mode, octal>\t<size>\t<mtime, seconds>[\t<link target>]\n
+    for every entry, walked depth first in byte order, without following links.
+    '''
+    fingerprint = {'hash': 14695981039346656037, 'entries': 0, 'bytes': 0}
+    def walk(rel):
+        try:
+            names = sorted(os.listdir(os.fsencode(root) + rel))
+        except OSError:
+            return
+        for name in names:
+            sub = rel + b'/' + name
+            path = os.fsencode(root) + sub
+            try:
+                st = os.lstat(path)
+            except OSError:
+                continue
+            line = b'%s\t%o\t%d\t%d' % (sub[1:], st.st_mode, st.st_size, st.st_mtime_ns // 1000000000)
+            if stat.S_ISLNK(st.st_mode):
+                line += b'\t' + os.readlink(path)
+            h = fingerprint['hash']
+            for c in line + b'\n':
+                h = ((h ^ c) * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+            fingerprint['hash'] = h
+            fingerprint['entries'] += 1
+            if stat.S_ISREG(st.st_mode):
+                fingerprint['bytes'] += st.st_size
+            elif stat.S_ISDIR(st.st_mode):
+                walk(sub)
+    walk(b'')
+    fingerprint['hash'] = '%016x' % fingerprint['hash']
+    return fingerprint
+
+def compile_command_policy(policy, filename):
+    '''
+    Compile the command_policy of the config, {<policy>_commands: [command...]},
+    into the trie the shim maps from WISK_TRACKER_POLICY and matches the
+    COMMAND_PATH of a process against at init. A command is the full path of
+    an executable or a base name, matched whole, the full path winning. The
+    most restrictive policy of a command listed twice holds.
+    '''
+    keys = []
+    for verdict, name in list(enumerate(WISK_POLICIES))[1:]:
+        keys += [(i, verdict) for i in policy.get('%s_commands' % name, [])]
+    count = compile_trie(keys, WISK_POLICY_MAGIC, filename)
+    log.debug('Command policy %s: %d nodes, %s', filename, count, policy)
+    return filename
+
 def doinit(args):
     global WSROOT
     WSROOT = args.wsroot
@@ -671,19 +1707,39 @@ def dotrack(args):
     doinit(args)
     if args.command:
         create_reciever()
+        # The default outputs are shared by every run from the directory, each session gets its own, and
+        # <trackfile>.raw points at the latest
+        default = args.trackfile
+        if os.path.basename(args.trackfile) == WISK_DEPDATA:
+            args.trackfile = session_path(args.trackfile)
+        pathfilter = CONFIG.get('path_filter', {})
+        include = pathfilter.get('include_prefixes', []) + (args.include or [])
+        exclude = pathfilter.get('exclude_prefixes', []) + (args.exclude or [])
+        immutable = pathfilter.get('immutable_prefixes', []) + (getattr(args, 'immutable', None) or [])
+        if include or exclude or immutable:
+            args.pathfilter = compile_path_filter(include, exclude, args.trackfile + '.filter', immutable)
+        policy = CONFIG.get('command_policy', {})
+        if any(policy.get('%s_commands' % i) for i in WISK_POLICIES):
+            args.policy = compile_command_policy(policy, args.trackfile + '.policy')
         reciever = TrackerReciever(args)
-        result = tracked_run(args)
+        result = tracked_run(args, reciever)
         delete_reciever(reciever)
+        session_latest(args.trackfile + '.raw', default + '.raw')
+        print('Tracking data: %s' % (args.trackfile + '.raw'))
         print(result)
-    if args.extract or args.clean:
+    elif getattr(args, 'merge', False):
+        merge_spill(args.trackfile + '.spill', args.trackfile + '.raw', args.compress)
+    if args.extract or args.clean or args.overhead:
         read_raw_data(args)
+    if args.overhead:
+        write_overhead(args)
     if args.clean:
         clean_data(args)
         extract_commands(args)
     if args.show:
         filetoshow = args.trackfile + ('.cmds' if args.clean else '.raw')
-        for line in open(filetoshow):
-            print(line, end='')
+        for line in (open(filetoshow, 'rb') if args.clean else open_raw(filetoshow)):
+            print(line.decode('utf-8', 'surrogateescape'), end='')
     configwrite(args.config)
     return (result.returncode if result else 0)
 
@@ -742,7 +1798,7 @@ def insight_init(args):
 
 def partialparse(parser):
     ''' Parse args until first unknown '''
-    global WISK_TRACKER_PIPE
+    global WISK_SESSION_DIR
     global WISK_ARGS
 
     if COMMAND_SEPARATOR in sys.argv:
@@ -752,7 +1808,7 @@ def partialparse(parser):
     args = parser.parse_args(sys.argv[1:idx])
     args.command = sys.argv[idx+1:]
     log.debug('Args & Command: %s', args)
-    WISK_TRACKER_PIPE=("%s/wisk_tracker.pipe" % args.wsroot)
+    WISK_SESSION_DIR=args.wsroot
     for k,v in vars(args).items():
         if k == 'command': continue
         if isinstance(v, list):
@@ -819,6 +1875,33 @@ Example:
                             default=['PATH', 'LOGNAME', 'LANGUAGE', 'HOME', 'USER', 'SHELL'],
                             help='Environment variables for carry forward')
         parser.add_argument('-filter', '--filter', type=str, default=None, help='Filtered list of events to track')
+        parser.add_argument('-transport', '--transport', type=str, choices=WISK_TRANSPORTS, default='fifo',
+                            help='How tracked processes send events, fifo, shm(shared memory rings) or spill(a file per process)')
+        parser.add_argument('-format', '--format', type=str, choices=WISK_FORMATS, default='text',
+                            help='Record format of the raw trace, text or binary(compact, no json escaping)')
+        parser.add_argument('-environment', '--environment', type=str, choices=WISK_ENVIRONMENT_MODES, default='delta',
+                            help='Report the environment of a process as changes to its parent\'s(delta), or in full')
+        parser.add_argument('-sample', '--sample', type=str, default=None,
+                            help='Sample the file events, of a fraction of the processes(process:<rate>) or of the paths of each(event:<rate>), '
+                                 'the same paths on every run with a seed(event:<rate>:<seed>)')
+        parser.add_argument('-collector', '--collector', type=str, default=os.environ.get('WISK_COLLECTOR'),
+                            help='Control FIFO of a wiskcollect -s shared by the sessions on the host, $WISK_COLLECTOR')
+        parser.add_argument('-shards', '--shards', type=int, default=max(1, (os.cpu_count() or 1) // 16),
+                            help='Number of FIFOs the collector drains, tracked processes spread across them by pid')
+        parser.add_argument('-compress', '--compress', type=int, choices=range(10), default=1,
+                            help='zlib level of the block compressed raw trace, 0 writes it uncompressed')
+        parser.add_argument('-overhead', '--overhead', action='store_true', default=False,
+                            help='Write the per hook and per tool cost of the tracking to <trackfile>.overhead')
+        parser.add_argument('-merge', '--merge', action='store_true', default=False,
+                            help='Merge the spill files left behind by an interrupted run into the raw trace')
+        parser.add_argument('-supervise', '--supervise', action='store_true', default=False,
+                            help='Also track statically linked programs and raw system calls, under a seccomp/ptrace supervisor')
+        parser.add_argument('-exclude', '--exclude', type=str, action='append', default=[],
+                            help='Path prefix not to track, in addition to path_filter.exclude_prefixes of the config')
+        parser.add_argument('-include', '--include', type=str, action='append', default=[],
+                            help='Path prefix to track even inside an excluded one, in addition to path_filter.include_prefixes')
+        parser.add_argument('-immutable', '--immutable', type=str, action='append', default=[],
+                            help='Toolchain or sysroot tree that does not change during the build, its reads are reported as one USES of it, in addition to path_filter.immutable_prefixes')
 
         args = partialparse(parser)
 
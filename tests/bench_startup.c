@@ -0,0 +1,109 @@
+/*
+ * Startup latency of tracked processes.
+ *
+ * Spawns a short lived program many times, with and without libwisktrack.so
+ * preloaded, and reports the wall clock cost per process of each, and the
+ * difference, the constant overhead the library adds to every process.
+ *
+ * bench_startup <libwisktrack.so> [count] [program args...]
+ *
+ * The tracker output goes to /dev/null. The program defaults to /bin/true.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static int cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double spawn(char *const argv[], char *const envp[])
+{
+	double start;
+	pid_t pid;
+	int status;
+
+	start = now_usec();
+	if (posix_spawn(&pid, argv[0], NULL, NULL, argv, envp) != 0) {
+		perror("posix_spawn");
+		exit(1);
+	}
+	waitpid(pid, &status, 0);
+	return now_usec() - start;
+}
+
+static double report(const char *label, double *samples, int count)
+{
+	double total = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		total += samples[i];
+	qsort(samples, count, sizeof(*samples), cmpdouble);
+	printf("%-10s mean %8.1f usec  median %8.1f usec  p90 %8.1f usec\n",
+	       label, total / count, samples[count / 2], samples[count * 9 / 10]);
+	return samples[count / 2];
+}
+
+int main(int argc, char *argv[])
+{
+	char *defprog[] = {"/bin/true", NULL};
+	char **prog = defprog;
+	char preload[4096];
+	char *plainenv[] = {"PATH=/usr/bin:/bin", NULL};
+	char *trackenv[] = {
+		"PATH=/usr/bin:/bin",
+		preload,
+		"WISK_TRACKER_PIPE=/dev/null",
+		"WISK_TRACKER_PIPE_FD=-1",
+		"WISK_TRACKER_UUID=XXXXXXXX-XXXXXXXX-XXXXXXXX-XXXXXXXX",
+		"WISK_TRACKER_DEBUGLOG_FD=2",
+		NULL
+	};
+	double *plain, *tracked, plainmedian, trackedmedian;
+	int count = 1000, i;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <libwisktrack.so> [count] [program args...]\n", argv[0]);
+		return 1;
+	}
+	snprintf(preload, sizeof(preload), "LD_PRELOAD=%s", argv[1]);
+	if (argc > 2)
+		count = atoi(argv[2]);
+	if (argc > 3)
+		prog = &argv[3];
+	if (count <= 0)
+		count = 1;
+	plain = malloc(count * sizeof(*plain));
+	tracked = malloc(count * sizeof(*tracked));
+
+	// Interleaved, so drift in machine load affects both the same
+	for (i = 0; i < count; i++) {
+		plain[i] = spawn(prog, plainenv);
+		tracked[i] = spawn(prog, trackenv);
+	}
+	plainmedian = report("plain", plain, count);
+	trackedmedian = report("tracked", tracked, count);
+	printf("overhead   median %8.1f usec per process\n", trackedmedian - plainmedian);
+	free(plain);
+	free(tracked);
+	return 0;
+}
@@ -0,0 +1,181 @@
+'''
+Tests of environments reported as ENVIRONMENT-DELTA: resolve_environment()
+applying a delta to the environment of the process it was taken against,
+along a chain of them, the full ENVIRONMENT a process falls back to when the
+digest it inherited no longer holds, and entries without a '=', which the
+library and the parser must hash alike.
+'''
+import os
+import sys
+import shutil
+import argparse
+import subprocess
+import unittest
+import logging
+import wisktrack
+
+log=logging.getLogger('tests.test_envdelta')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+LIBWISKTRACK = os.path.join(WSROOT, 'src/lib64/libwisktrack.so')
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+ROOT = 'XXXXXXXX-XXXXXXXX-XXXXXXXX-XXXXXXXX'
+UUIDS = ['XXXXXXXX-00000000-00000000-0000000%d' % i for i in range(4)]
+
+
+def removed(entry):
+    ''' The =<hash> an ENVIRONMENT-DELTA carries for an entry the process lacks '''
+    name, _, value = entry.partition('=')
+    return '=' + wisktrack.envhash('%s=%s' % (name, value))
+
+
+class TestParserBase(unittest.TestCase):
+
+    def setUp(self):
+        self.progtree, self.wsroot, self.config = wisktrack.ProgramNode.progtree, wisktrack.WSROOT, wisktrack.CONFIG
+        wisktrack.ProgramNode.progtree, wisktrack.WSROOT = {}, WSROOT
+        wisktrack.configparse(os.path.join(WSROOT, 'config/wisk_parser.cfg'))
+
+    def tearDown(self):
+        wisktrack.ProgramNode.progtree, wisktrack.WSROOT = self.progtree, self.wsroot
+        wisktrack.CONFIG = self.config
+
+
+class TestEnvironmentDelta(TestParserBase):
+
+    def setUp(self):
+        super().setUp()
+        wisktrack.ProgramNode(ROOT).working_directory = WSROOT
+
+    def node(self, i, parent, operation, data):
+        ''' Process i, a child of process parent, or of the session with None '''
+        node = wisktrack.ProgramNode(UUIDS[i], parent=ROOT if parent is None else UUIDS[parent])
+        node.working_directory = WSROOT
+        wisktrack.ProgramNode.apply_operation(node, 'COMMAND', ['cc', '-c', 'a.c'])
+        wisktrack.ProgramNode.apply_operation(node, operation, data)
+        return node
+
+    def environments(self):
+        wisktrack.ProgramNode.resolve_environment()
+        return [wisktrack.ProgramNode.progtree[i].environment for i in UUIDS if i in wisktrack.ProgramNode.progtree]
+
+    def test_delta(self):
+        self.node(0, None, 'ENVIRONMENT', ['PATH=/bin', 'HOME=/root', 'WISK_TRACKER_UUID=x', 'LD_PRELOAD=x'])
+        self.node(1, 0, 'ENVIRONMENT-DELTA', [UUIDS[0], 'CC=gcc', removed('HOME=/root')])
+        self.assertEqual(self.environments()[1], {'PATH': '/bin', 'CC': 'gcc'})
+
+    def test_chained(self):
+        ''' Each delta is applied to its base resolved first, whatever order the nodes are in '''
+        self.node(0, None, 'ENVIRONMENT', ['PATH=/bin', 'HOME=/root'])
+        # The grandchild's delta is read before its parent's
+        self.node(2, None, 'ENVIRONMENT-DELTA', [UUIDS[1], 'CC=clang', removed('CC=gcc'), removed('PATH=/bin')])
+        self.node(1, 0, 'ENVIRONMENT-DELTA', [UUIDS[0], 'CC=gcc', 'A=1=2'])
+        self.node(3, None, 'ENVIRONMENT-DELTA', [UUIDS[2]])
+        environments = self.environments()
+        self.assertEqual(environments[1], {'PATH': '/bin', 'HOME': '/root', 'CC': 'gcc', 'A': '1=2'})
+        self.assertEqual(environments[2], {'HOME': '/root', 'CC': 'clang', 'A': '1=2'})
+        self.assertEqual(environments[3], environments[2])
+        self.assertFalse(any(i.envdelta for i in wisktrack.ProgramNode.progtree.values()))
+
+    def test_fallback(self):
+        '''
+        A process whose environ no longer adds up to the digest it inherited
+        reports it whole, none of its parent's entries carry over, and deltas
+        taken against it resolve against that
+        '''
+        self.node(0, None, 'ENVIRONMENT', ['PATH=/bin', 'HOME=/root'])
+        self.node(1, 0, 'ENVIRONMENT', ['PATH=/usr/bin', 'CC=gcc'])
+        self.node(2, 1, 'ENVIRONMENT-DELTA', [UUIDS[1], removed('CC=gcc')])
+        environments = self.environments()
+        self.assertEqual(environments[1], {'PATH': '/usr/bin', 'CC': 'gcc'})
+        self.assertEqual(environments[2], {'PATH': '/usr/bin'})
+
+    def test_missing_base(self):
+        ''' A delta against a process not in the trace keeps what it added '''
+        self.node(1, None, 'ENVIRONMENT-DELTA', [UUIDS[0], 'CC=gcc', removed('HOME=/root')])
+        with self.assertLogs(wisktrack.log, logging.ERROR) as logs:
+            self.assertEqual(self.environments(), [{'CC': 'gcc'}])
+        self.assertTrue(any('which is not in the trace' in i for i in logs.output))
+
+    def test_no_value(self):
+        ''' An entry without a '=' is a name with an empty value, removed by the hash the library gives it '''
+        # wisk_env_hash() of the entry FLAG, as libwisktrack.so reports it
+        self.assertEqual(removed('FLAG'), '=420030167368355e')
+        self.node(0, None, 'ENVIRONMENT', ['PATH=/bin', 'FLAG'])
+        self.node(1, 0, 'ENVIRONMENT-DELTA', [UUIDS[0], 'OTHER', '=420030167368355e'])
+        environments = self.environments()
+        self.assertEqual(environments[0], {'PATH': '/bin', 'FLAG': ''})
+        self.assertEqual(environments[1], {'PATH': '/bin', 'OTHER': ''})
+
+
+@unittest.skipUnless(os.path.exists(LIBWISKTRACK), 'libwisktrack.so is not built')
+class TestEnvironmentDigest(TestParserBase):
+    ''' The environments the library reports, resolved by the parser '''
+
+    def setUp(self):
+        super().setUp()
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        os.makedirs(self.testdir)
+        self.pipe = wisktrack.WISK_TRACKER_PIPE
+
+    def tearDown(self):
+        wisktrack.WISK_TRACKER_PIPE = self.pipe
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        super().tearDown()
+
+    def track(self, code):
+        ''' The nodes of a tracked python running code, by their command, and the operations they reported '''
+        trackfile = os.path.join(self.testdir, 'trace')
+        wisktrack.create_reciever()
+        reciever = wisktrack.TrackerReciever(argparse.Namespace(trackfile=trackfile, transport='fifo', compress=0))
+        env = {'PATH': '/usr/bin:/bin', 'LD_PRELOAD': LIBWISKTRACK,
+               'WISK_TRACKER_PIPE': wisktrack.WISK_TRACKER_PIPE, 'WISK_TRACKER_PIPE_FD': '-1',
+               'WISK_TRACKER_UUID': wisktrack.session_uuid()}
+        env.update(reciever.environment())
+        subprocess.run([sys.executable, '-c', code], env=env, pass_fds=reciever.pass_fds(), check=True)
+        wisktrack.delete_reciever(reciever)
+        with wisktrack.open_raw(trackfile + '.raw') as ifile:
+            operations = {(uuid, operation) for uuid, operation, _, _, _ in wisktrack.read_raw_records(ifile)}
+        wisktrack.read_raw_data(argparse.Namespace(trackfile=trackfile, extract=[]))
+        progtree = wisktrack.ProgramNode.progtree
+        command = {uuid: os.path.basename(node.command[0]) for uuid, node in progtree.items() if node.command}
+        return ({command[uuid]: progtree[uuid] for uuid in command},
+                {(command[uuid], operation) for uuid, operation in operations if uuid in command})
+
+    def test_no_value(self):
+        ''' Entries without a '=' the program runs without are removed, in delta after delta '''
+        nodes, operations = self.track('''
+import os
+from ctypes import CDLL, c_char_p
+def strings(l):
+    a = (c_char_p * (len(l) + 1))()
+    a[:-1] = [i.encode() for i in l]
+    return a
+envp = ['%s=%s' % i for i in os.environ.items()] + ['FLAG', 'B=2']
+CDLL(None).execve(b'/bin/sh', strings(['sh', '-c', 'unset B; exec env -u FLAG /bin/true']), strings(envp))
+''')
+        self.assertIn(('sh', 'ENVIRONMENT-DELTA'), operations)
+        self.assertIn(('env', 'ENVIRONMENT-DELTA'), operations)
+        self.assertEqual(nodes['sh'].environment.get('FLAG'), '')
+        self.assertNotIn('B', nodes['env'].environment)
+        self.assertNotIn('FLAG', nodes['env'].environment)
+        self.assertEqual(nodes['true'].environment, nodes['env'].environment)
+
+    def test_fallback(self):
+        ''' The child of system() after a putenv() finds the digest it inherited does not hold '''
+        nodes, operations = self.track('''
+import os
+os.environ['CC'] = 'gcc'
+os.system('exec /bin/true')
+''')
+        self.assertIn(('sh', 'ENVIRONMENT'), operations)
+        self.assertNotIn(('sh', 'ENVIRONMENT-DELTA'), operations)
+        self.assertEqual(nodes['sh'].environment.get('CC'), 'gcc')
+        self.assertEqual(nodes['true'].environment.get('CC'), 'gcc')
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,116 @@
+'''
+Tests of the overflow path as the parser sees it: records a process could not
+write to the full FIFO spilled to its overflow file, those lost once the
+overflow could not take them either, and the spilled and dropped counts its
+COMPLETE carries, summed by ProgramNode.report_overflow().
+'''
+import os
+import sys
+import json
+import shutil
+import argparse
+import unittest
+import logging
+import wisktrack
+
+log=logging.getLogger('tests.test_overflow')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+UUIDS = {100: 'XXXXXXXX-00000000-00000000-00000100', 101: 'XXXXXXXX-00000000-00000000-00000101'}
+
+
+def text(pid, seq, operation, value):
+    ''' A text record of pid framed as the library does, its time is seq '''
+    epoch = '/1000' if seq % wisktrack.WISK_RECORD_RESYNC == 0 else ''
+    return ('%s@%d.%d~%d%s:0 %s %s\n' % (UUIDS[pid], pid, seq, seq, epoch, operation, json.dumps(value))).encode()
+
+
+def reads(pid, seqs):
+    return b''.join(text(pid, i, 'READS', '/tmp/%d/r%d' % (pid, i)) for i in seqs)
+
+
+def complete(pid, seq, overflow=None):
+    ''' COMPLETE of wisk_report_commandcomplete(), with the overflow=<spilled>,<dropped> of wisk_write_pipe() '''
+    data = [str(pid), str(pid), '1', '1', 'cc'] + (['overflow=%d,%d' % overflow] if overflow else [])
+    return text(pid, seq, 'COMPLETE', data)
+
+
+class TestOverflow(unittest.TestCase):
+
+    def setUp(self):
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        self.overflow = os.path.join(self.testdir, 'trace.overflow')
+        os.makedirs(self.overflow)
+        self.trackfile = os.path.join(self.testdir, 'trace')
+        self.progtree, self.wsroot = wisktrack.ProgramNode.progtree, wisktrack.WSROOT
+        wisktrack.ProgramNode.progtree, wisktrack.WSROOT = {}, WSROOT
+
+    def tearDown(self):
+        wisktrack.ProgramNode.progtree, wisktrack.WSROOT = self.progtree, self.wsroot
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+
+    def collect(self, fifo, overflow):
+        '''
+        The trace as wiskcollect writes it: what the FIFO had, then the
+        overflow files in name order, cut to their whole records, as
+        wisk_overflow_merge() appends them
+        '''
+        for name, data in overflow.items():
+            with open(os.path.join(self.overflow, name), 'wb') as ofile:
+                ofile.write(data)
+        with open(self.trackfile + '.raw', 'wb') as ofile:
+            ofile.write(fifo)
+            for name in sorted(os.listdir(self.overflow)):
+                ofile.write(wisktrack.read_spill(os.path.join(self.overflow, name)))
+
+    def read(self):
+        wisktrack.read_raw_data(argparse.Namespace(trackfile=self.trackfile, extract=[]))
+        return wisktrack.ProgramNode.progtree
+
+    def test_spilled(self):
+        ''' What went to the overflow file is in the trace, after what the FIFO took '''
+        fifo = text(100, 0, 'COMMAND', ['cc']) + reads(100, range(1, 10))
+        self.collect(fifo, {'100.%s' % UUIDS[100]: reads(100, range(10, 20)) + complete(100, 20, (11, 0))})
+        with self.assertLogs(wisktrack.log, logging.INFO) as logs:
+            node = self.read()[UUIDS[100]]
+        self.assertEqual(len(node.operations['READS']), 19)
+        self.assertTrue(node.complete)
+        self.assertEqual(node.overflow, {'spilled': 11, 'dropped': 0})
+        self.assertTrue(any('11 records overflowed the tracker FIFO' in i for i in logs.output))
+        self.assertFalse(any('Lost' in i or 'were lost' in i for i in logs.output))
+
+    def test_dropped(self):
+        ''' Records the full overflow could not take are a gap in the sequence, and counted in COMPLETE '''
+        fifo = text(100, 0, 'COMMAND', ['cc']) + reads(100, range(1, 10))
+        # 20 to 24 went nowhere, the COMPLETE made it to the overflow once it had room again
+        self.collect(fifo, {'100.%s' % UUIDS[100]: reads(100, range(10, 20)) + complete(100, 25, (10, 5))})
+        with self.assertLogs(wisktrack.log, logging.INFO) as logs:
+            node = self.read()[UUIDS[100]]
+        self.assertEqual(len(node.operations['READS']), 19)
+        self.assertEqual(node.overflow, {'spilled': 10, 'dropped': 5})
+        self.assertTrue(any('Lost 5 records of %s pid 100' % UUIDS[100] in i for i in logs.output))
+        self.assertTrue(any('5 records were lost, the tracker FIFO and its overflow' in i for i in logs.output))
+
+    def test_report_overflow(self):
+        ''' The counts of every process are summed, a process that never overflowed adds nothing '''
+        fifo = text(100, 0, 'COMMAND', ['cc']) + reads(100, range(1, 4))
+        fifo += text(101, 0, 'COMMAND', ['cc']) + reads(101, range(1, 4)) + complete(101, 4)
+        overflow = {'100.%s' % UUIDS[100]: reads(100, range(4, 7)) + complete(100, 9, (3, 2)),
+                    # A process killed in the middle of a write leaves a partial record, it is cut
+                    '101.%s' % UUIDS[101]: complete(101, 5, (0, 1))[:-5]}
+        with self.assertLogs(wisktrack.log, logging.INFO) as logs:
+            self.collect(fifo, overflow)
+            progtree = self.read()
+        self.assertEqual(progtree[UUIDS[100]].overflow, {'spilled': 3, 'dropped': 2})
+        self.assertIsNone(progtree[UUIDS[101]].overflow)
+        self.assertTrue(any('Dropping' in i and 'incomplete record' in i for i in logs.output))
+        self.assertTrue(any('3 records overflowed the tracker FIFO' in i for i in logs.output))
+        self.assertTrue(any('2 records were lost' in i for i in logs.output))
+
+
+if __name__ == "__main__":
+    unittest.main()
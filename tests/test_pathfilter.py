@@ -0,0 +1,127 @@
+'''
+Tests of the path filter: the trie compile_trie() writes, read back the way
+the shim maps it, and the verdicts compile_path_filter() gives paths.
+'''
+import os
+import sys
+import struct
+import shutil
+import unittest
+import logging
+import wisktrack
+
+log=logging.getLogger('tests.test_pathfilter')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+INCLUDE = wisktrack.WISK_PATHFILTER_INCLUDE
+EXCLUDE = wisktrack.WISK_PATHFILTER_EXCLUDE
+IMMUTABLE = wisktrack.WISK_PATHFILTER_IMMUTABLE
+
+
+def load(filename):
+    ''' The header, nodes and edges of a trie, checked as wisk_trie_map() does '''
+    with open(filename, 'rb') as ifile:
+        data = ifile.read()
+    header = struct.unpack_from('<IIII', data, 0)
+    _, _, nnodes, nedges = header
+    nodes = list(struct.iter_unpack('<IHBx', data[16:16 + 8 * nnodes]))
+    edges = list(struct.iter_unpack('<BxxxI', data[16 + 8 * nnodes:]))
+    assert len(data) == 16 + 8 * nnodes + 8 * nedges
+    assert all(first + count <= nedges for first, count, _ in nodes)
+    assert all(child < nnodes for _, child in edges)
+    return header, nodes, edges
+
+
+def verdict(trie, path):
+    ''' The verdict of the longest prefix of path ending on a component, as wisk_path_verdict() '''
+    _, nodes, edges = trie
+    node, result = nodes[0], 0
+    path = path.encode()
+    for i in range(len(path) + 1):
+        if node[2] and (i == len(path) or path[i:i+1] == b'/'):
+            result = node[2]
+        if i == len(path):
+            break
+        children = dict(edges[node[0]:node[0] + node[1]])
+        if path[i] not in children:
+            break
+        node = nodes[children[path[i]]]
+    return result
+
+
+class TestPathFilter(unittest.TestCase):
+
+    def setUp(self):
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        os.makedirs(self.testdir)
+        self.filename = os.path.join(self.testdir, 'pathfilter')
+
+    def tearDown(self):
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+
+    def test_layout(self):
+        count = wisktrack.compile_trie([('ab', 1), ('ac', 2), ('b', 3)], 0x1234, self.filename)
+        header, nodes, edges = load(self.filename)
+        self.assertEqual(header, (0x1234, wisktrack.WISK_PATHFILTER_VERSION, 5, 4))
+        self.assertEqual(count, 5)
+        # The edges of a node are sorted by character, the root is node 0
+        root = edges[nodes[0][0]:nodes[0][0] + nodes[0][1]]
+        self.assertEqual([c for c, _ in root], [ord('a'), ord('b')])
+        self.assertEqual(nodes[root[1][1]][2], 3)
+        a = nodes[root[0][1]]
+        self.assertEqual([(c, nodes[child][2]) for c, child in edges[a[0]:a[0] + a[1]]], [(ord('b'), 1), (ord('c'), 2)])
+
+    def test_empty(self):
+        wisktrack.compile_trie([], 0x1234, self.filename)
+        trie = load(self.filename)
+        self.assertEqual(trie[0][2:], (1, 0))
+        self.assertEqual(verdict(trie, '/usr'), 0)
+
+    def test_override(self):
+        ''' A later key overrides the verdict of an earlier equal one '''
+        wisktrack.compile_trie([('/usr', EXCLUDE), ('/usr', INCLUDE)], 0x1234, self.filename)
+        self.assertEqual(verdict(load(self.filename), '/usr/bin'), INCLUDE)
+
+    def test_non_ascii(self):
+        wisktrack.compile_trie([('/tmp/été', EXCLUDE)], 0x1234, self.filename)
+        self.assertEqual(verdict(load(self.filename), '/tmp/été/x'), EXCLUDE)
+
+    def test_verdicts(self):
+        wisktrack.compile_path_filter(include=['/usr/lib/debug'], exclude=['/usr/lib/', '/proc', '/tmp//x/../y'],
+                                      immutable=['/opt/tools'], filename=self.filename)
+        trie = load(self.filename)
+        self.assertEqual(trie[0][:2], (wisktrack.WISK_PATHFILTER_MAGIC, wisktrack.WISK_PATHFILTER_VERSION))
+        cases = [
+            ('/usr/lib', EXCLUDE),
+            ('/usr/lib/libc.so', EXCLUDE),
+            # Whole components only
+            ('/usr/lib64/libc.so', 0),
+            ('/usr/libexec', 0),
+            ('/usr', 0),
+            # The longest prefix decides
+            ('/usr/lib/debug/x.debug', INCLUDE),
+            ('/usr/lib/debugx', EXCLUDE),
+            ('/proc/self/maps', EXCLUDE),
+            # Prefixes are normalized as given
+            ('/tmp/y/z', EXCLUDE),
+            ('/tmp/x/z', 0),
+            ('/opt/tools/bin/cc', IMMUTABLE),
+            ('/opt/toolsx', 0),
+        ]
+        for path, expected in cases:
+            self.assertEqual(verdict(trie, path), expected, path)
+
+    def test_root(self):
+        ''' / excludes everything, what is included beneath it stays included '''
+        wisktrack.compile_path_filter(include=['/ws'], exclude=['/'], filename=self.filename)
+        trie = load(self.filename)
+        self.assertEqual(verdict(trie, '/usr/include/stdio.h'), EXCLUDE)
+        self.assertEqual(verdict(trie, '/ws/a.c'), INCLUDE)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,94 @@
+'''
+Tests of the command policy: the trie compile_command_policy() writes, and
+the policy wisk_policy_init() of the shim finds in it for a command.
+'''
+import os
+import sys
+import shutil
+import unittest
+import logging
+import wisktrack
+from test_pathfilter import load
+
+log=logging.getLogger('tests.test_policy')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+FULL, WRITES, LIFECYCLE, OFF = range(len(wisktrack.WISK_POLICIES))
+
+
+def lookup(trie, key):
+    ''' The policy of key matched whole, 0 when it has none, as wisk_policy_lookup() '''
+    _, nodes, edges = trie
+    node = nodes[0]
+    for c in key.encode():
+        children = dict(edges[node[0]:node[0] + node[1]])
+        if c not in children:
+            return 0
+        node = nodes[children[c]]
+    return node[2]
+
+
+def policy(trie, command_path):
+    ''' The policy of a COMMAND_PATH, by its full path, else by its base name, as wisk_policy_init() '''
+    return lookup(trie, command_path) or lookup(trie, os.path.basename(command_path))
+
+
+class TestCommandPolicy(unittest.TestCase):
+
+    def setUp(self):
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        os.makedirs(self.testdir)
+        self.filename = os.path.join(self.testdir, 'policy')
+
+    def tearDown(self):
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+
+    def compile(self, **policies):
+        wisktrack.compile_command_policy({'%s_commands' % k: v for k, v in policies.items()}, self.filename)
+        trie = load(self.filename)
+        self.assertEqual(trie[0][0], wisktrack.WISK_POLICY_MAGIC)
+        return trie
+
+    def test_policies(self):
+        trie = self.compile(off=['uname'], lifecycle=['sed', 'grep'], writes=['/usr/bin/install'])
+        self.assertEqual(policy(trie, '/bin/uname'), OFF)
+        self.assertEqual(policy(trie, '/usr/bin/sed'), LIFECYCLE)
+        self.assertEqual(policy(trie, 'grep'), LIFECYCLE)
+        self.assertEqual(policy(trie, '/usr/bin/install'), WRITES)
+
+    def test_no_match(self):
+        ''' A command no policy names is tracked in full '''
+        trie = self.compile(off=['uname'], lifecycle=['/usr/bin/sed'])
+        self.assertEqual(policy(trie, '/usr/bin/gcc'), FULL)
+        self.assertEqual(policy(trie, '/usr/local/bin/sed'), FULL)
+        self.assertEqual(policy(trie, ''), FULL)
+
+    def test_empty(self):
+        trie = self.compile()
+        self.assertEqual(len(trie[1]), 1)
+        self.assertEqual(policy(trie, '/bin/uname'), FULL)
+
+    def test_most_restrictive(self):
+        ''' A command listed under two policies gets the more restrictive, whatever the order '''
+        trie = self.compile(writes=['make', 'uname'], off=['uname'], lifecycle=['make'])
+        self.assertEqual(policy(trie, '/usr/bin/uname'), OFF)
+        self.assertEqual(policy(trie, '/usr/bin/make'), LIFECYCLE)
+
+    def test_full_path_wins(self):
+        ''' The full path decides over the base name, even a less restrictive one '''
+        trie = self.compile(off=['python3'], writes=['/opt/tools/bin/python3'])
+        self.assertEqual(policy(trie, '/opt/tools/bin/python3'), WRITES)
+        self.assertEqual(policy(trie, '/usr/bin/python3'), OFF)
+
+    def test_longest_key(self):
+        ''' Keys are matched whole: of keys that prefix one another only the one the command is counts '''
+        trie = self.compile(off=['gcc', '/usr/bin/gcc'], lifecycle=['gcc-12', '/usr/bin/gcc-12'], writes=['/usr/bin/g'])
+        self.assertEqual(policy(trie, '/usr/bin/gcc-12'), LIFECYCLE)
+        self.assertEqual(policy(trie, '/usr/bin/gcc'), OFF)
+        self.assertEqual(policy(trie, '/opt/bin/gcc-12'), LIFECYCLE)
+        self.assertEqual(policy(trie, '/usr/bin/gcc-1'), FULL)
+        self.assertEqual(policy(trie, '/usr/bin/g++'), FULL)
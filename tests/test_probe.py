@@ -0,0 +1,87 @@
+'''
+Tests of the PROBES records: the stat(), access(), listing and failed open
+lookups of a program, reported once per path and grouped by directory.
+'''
+import os
+import sys
+import stat
+import shutil
+import argparse
+import subprocess
+import unittest
+import json
+import logging
+from parameterized import parameterized_class
+import wisktrack
+from testrunner import TrackedRunner
+
+log=logging.getLogger('tests.test_probe')
+wisktrack.WISK_TRACKER_VERBOSITY=4
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+LD_PRELOAD = os.path.join(WSROOT, 'src/libwisktrack.so')
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+TEMPLATE_EXESCRIPT='#!{PYTHON}\n'.format(PYTHON=sys.executable)
+
+TEMPLATE_COMMON = TEMPLATE_EXESCRIPT + '''
+import os
+'''.format(LD_PRELOAD=LD_PRELOAD)
+
+
+# Probes are aggregated per directory, so the expectation is the set of
+# items that must show up under a directory across its PROBES records
+testcases = [
+    [0, ('/tmp/{testname}', ('+file1', '-missing1', '-missing2', '*')),
+     TEMPLATE_COMMON+     '''
+open('/tmp/{testname}/file1', 'w').close()
+os.path.exists('/tmp/{testname}/file1')
+os.path.exists('/tmp/{testname}/missing1')
+os.access('/tmp/{testname}/missing2', os.R_OK)
+os.listdir('/tmp/{testname}')
+print('Complette')
+     '''],
+]
+
+@parameterized_class(('returncode', 'tracks', 'code'), testcases)
+class TestProbe(unittest.TestCase):
+
+    def setUp(self):
+        if os.path.exists('/tmp/{}/'.format(self.id())):
+            shutil.rmtree('/tmp/{}/'.format(self.id()))
+        os.makedirs('/tmp/{}/'.format(self.id()))
+        self.code = self.code.format(testname=self.id(), wsroot=WSROOT)
+        self.tracks = (self.tracks[0].format(testname=self.id()), self.tracks[1])
+        self.testscript = '/tmp/{}/testscript'.format(self.id())
+        open(self.testscript, 'w').write(self.code)
+        print(self.testscript)
+        os.chmod(self.testscript, os.stat(self.testscript).st_mode | stat.S_IEXEC)
+
+
+    def tearDown(self):
+        if os.path.exists('/tmp/{}/'.format(self.id())):
+            shutil.rmtree('/tmp/{}/'.format(self.id()))
+
+    def test_probe(self):
+        print(self.code)
+        args = argparse.Namespace(command=[self.testscript], verbose=0, trackfile=None, test_id=self.id())
+        wisktrack.create_reciever()
+        runner = TrackedRunner(args)
+        lines = [' '.join(i.split()[1:]).strip() for i in open(wisktrack.WISK_TRACKER_PIPE).readlines()]
+        print('Tracked Operations:\n %s' % ('\n\t'.join(lines)))
+        probes = []
+        for i in lines:
+            if i.startswith('PROBES '):
+                i = json.loads(i[len('PROBES '):])
+                if i[0] == self.tracks[0]:
+                    probes.extend(i[1:])
+        print('Expected Probes:\n %s %s' % self.tracks)
+        for i in self.tracks[1]:
+            self.assertIn(i, probes)
+        wisktrack.delete_reciever(runner)
+        # runner.waitforcompletion()
+        self.assertEqual(runner.retval.returncode, self.returncode)
+
+
+if __name__ == "__main__":
+    #import sys;sys.argv = ['', 'Test.testName']
+    unittest.main()
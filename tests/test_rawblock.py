@@ -0,0 +1,116 @@
+'''
+Tests of the block compressed raw trace: RawBlockWriter and RawBlockReader
+in wisktrack.py, and the same layout written by wiskcollect -z.
+'''
+import os
+import sys
+import shutil
+import subprocess
+import unittest
+import logging
+import wisktrack
+
+log=logging.getLogger('tests.test_rawblock')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+WISKCOLLECT = os.path.join(WSROOT, 'src/lib64/wiskcollect')
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+# Small blocks, so a few KB of records span many of them
+BLOCK_SIZE = 4096
+
+
+def records(count):
+    ''' count text records of varying length, as the library frames them '''
+    return b''.join(b'XXXXXXXX-%08d@%d.%d~1:0 READS "/tmp/%s"\n' % (i, 1000 + i % 7, i, b'x' * (i % 300))
+                    for i in range(count))
+
+
+class TestRawBlock(unittest.TestCase):
+
+    def setUp(self):
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        os.makedirs(self.testdir)
+        self.rawfile = os.path.join(self.testdir, 'trace.raw')
+        self.blocksize = wisktrack.WISK_RAWBLOCK_SIZE
+        wisktrack.WISK_RAWBLOCK_SIZE = BLOCK_SIZE
+
+    def tearDown(self):
+        wisktrack.WISK_RAWBLOCK_SIZE = self.blocksize
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+
+    def write(self, data, chunk):
+        with wisktrack.create_raw(self.rawfile, 6) as ofile:
+            for i in range(0, len(data), chunk):
+                ofile.write(data[i:i+chunk])
+
+    def read(self):
+        with wisktrack.open_raw(self.rawfile) as ifile:
+            return ifile.read()
+
+    def test_roundtrip(self):
+        data = records(2000)
+        # Writes that straddle the blocks, smaller and larger than one
+        for chunk in [1, 333, BLOCK_SIZE, 3 * BLOCK_SIZE + 17]:
+            self.write(data, chunk)
+            reader = wisktrack.RawBlockReader(self.rawfile)
+            self.assertEqual(len(reader.blocks), (len(data) + BLOCK_SIZE - 1) // BLOCK_SIZE)
+            self.assertTrue(all(i[2] == BLOCK_SIZE for i in reader.blocks[:-1]))
+            reader.close()
+            self.assertEqual(self.read(), data)
+
+    def test_empty(self):
+        self.write(b'', 1)
+        self.assertEqual(self.read(), b'')
+
+    def test_no_index(self):
+        ''' A collector killed before it wrote the index leaves whole blocks and maybe part of one '''
+        data = records(2000)
+        self.write(data, 1000)
+        reader = wisktrack.RawBlockReader(self.rawfile)
+        blocks = reader.blocks
+        reader.close()
+        # Cut in the middle of the last block, the index goes with it
+        offset, clen, _ = blocks[-1]
+        with open(self.rawfile, 'r+b') as f:
+            f.truncate(offset + wisktrack.WISK_RAWBLOCK_HEADER.size + clen // 2)
+        reader = wisktrack.RawBlockReader(self.rawfile)
+        self.assertEqual(reader.blocks, blocks[:-1])
+        reader.close()
+        self.assertEqual(self.read(), data[:(len(blocks) - 1) * BLOCK_SIZE])
+        # Cut right after a block, everything is there but the index
+        with open(self.rawfile, 'r+b') as f:
+            f.truncate(offset)
+        self.assertEqual(self.read(), data[:(len(blocks) - 1) * BLOCK_SIZE])
+
+    def test_records(self):
+        ''' The records read back from a block compressed trace are those written '''
+        data = records(500)
+        self.write(data, 777)
+        with wisktrack.open_raw(self.rawfile) as ifile:
+            seqs = [int(raw.split(b'@')[1].split(b'.')[1].split(b'~')[0])
+                    for _, _, _, raw, _ in wisktrack.read_raw_records(ifile)]
+        self.assertEqual(seqs, list(range(500)))
+
+    @unittest.skipUnless(os.path.exists(WISKCOLLECT), 'wiskcollect is not built')
+    def test_wiskcollect(self):
+        ''' wiskcollect -z writes blocks of its own size, the reader takes them as they are '''
+        pipe = os.path.join(self.testdir, 'trace.pipe')
+        os.mkfifo(pipe)
+        data = records(20000)
+        collector = subprocess.Popen([WISKCOLLECT, '-z', '6', '-o', self.rawfile, pipe], stdin=subprocess.PIPE)
+        with open(pipe, 'wb') as ofile:
+            for i in range(0, len(data), 4096):
+                ofile.write(data[i:i+4096])
+        collector.stdin.close()
+        self.assertEqual(collector.wait(), 0)
+        reader = wisktrack.RawBlockReader(self.rawfile)
+        self.assertGreater(len(reader.blocks), 1)
+        reader.close()
+        self.assertEqual(self.read(), data)
+
+
+if __name__ == "__main__":
+    unittest.main()
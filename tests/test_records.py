@@ -0,0 +1,175 @@
+'''
+Tests of the record framing the parser undoes: reassemble() and
+read_raw_records() over text lines, binary records and both mixed.
+'''
+import os
+import io
+import sys
+import json
+import struct
+import unittest
+import logging
+import wisktrack
+
+log=logging.getLogger('tests.test_records')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+RAWID = bytes(range(16))
+UUID = wisktrack.uuidstr(RAWID)
+EPOCH = 1000
+
+
+def text(seq, operation, value, pid=100, frags=1):
+    ''' The lines of a framed text record, its json value split across frags fragments, its time is seq '''
+    value = json.dumps(value)
+    step = -(-len(value) // frags)
+    pieces = [value[i:i+step] for i in range(0, len(value), step)]
+    time = '%d/%d' % (seq, EPOCH) if seq % wisktrack.WISK_RECORD_RESYNC == 0 else '%d' % seq
+    return [('%s@%d.%d~%s%s%d %s %s\n' % (UUID, pid, seq, time, '+' if i < len(pieces) - 1 else ':', i, operation, p)).encode()
+            for i, p in enumerate(pieces)]
+
+
+def binary(seq, operation, values, pid=100, frags=1):
+    ''' The fragments of a binary record, its payload split across frags fragments '''
+    flags = wisktrack.WISK_RECORD_LIST if isinstance(values, list) else 0
+    payload = b''.join(i.encode() + b'\0' for i in (values if flags else [values]))
+    if seq % wisktrack.WISK_RECORD_RESYNC == 0:
+        flags |= wisktrack.WISK_RECORD_EPOCH
+        payload = struct.pack('=Q', EPOCH) + payload
+    step = -(-len(payload) // frags)
+    pieces = [payload[i:i+step] for i in range(0, len(payload), step)]
+    return [wisktrack.WISK_RECORD_HEADER.pack(wisktrack.WISK_RECORD_MAGIC, wisktrack.WISK_RECORD_VERSION,
+                                              wisktrack.WISK_OPS.index(operation),
+                                              flags | (wisktrack.WISK_RECORD_MORE if i < len(pieces) - 1 else 0),
+                                              len(p), pid, seq, i, 0, RAWID, seq) + p
+            for i, p in enumerate(pieces)]
+
+
+def read(chunks):
+    ifile = io.BufferedReader(io.BytesIO(b''.join(chunks)))
+    return [(uuid, operation, data) for uuid, operation, data, _, _ in wisktrack.read_raw_records(ifile)]
+
+
+class TestReassemble(unittest.TestCase):
+
+    def test_in_order(self):
+        fragments = {}
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k', 0, True, 'a'))
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k', 1, True, 'b'))
+        self.assertEqual(wisktrack.reassemble(fragments, 'k', 2, False, 'c'), ['a', 'b', 'c'])
+        self.assertEqual(fragments, {})
+
+    def test_out_of_order(self):
+        fragments = {}
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k', 2, False, 'c'))
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k', 0, True, 'a'))
+        self.assertEqual(wisktrack.reassemble(fragments, 'k', 1, True, 'b'), ['a', 'b', 'c'])
+        self.assertEqual(fragments, {})
+
+    def test_missing_last(self):
+        fragments = {}
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k', 0, True, 'a'))
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k', 1, True, 'b'))
+        self.assertIn('k', fragments)
+
+    def test_interleaved(self):
+        ''' Fragments of records of other keys do not get in the way '''
+        fragments = {}
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k1', 0, True, 'a'))
+        self.assertIsNone(wisktrack.reassemble(fragments, 'k2', 0, True, 'x'))
+        self.assertEqual(wisktrack.reassemble(fragments, 'k2', 1, False, 'y'), ['x', 'y'])
+        self.assertEqual(wisktrack.reassemble(fragments, 'k1', 1, False, 'b'), ['a', 'b'])
+
+
+class TestReadRawRecords(unittest.TestCase):
+
+    def test_text(self):
+        chunks = text(0, 'READS', '/tmp/a') + text(1, 'WRITES', '/tmp/' + 'b' * 100, frags=3)
+        self.assertEqual(read(chunks), [(UUID, 'READS', '/tmp/a'), (UUID, 'WRITES', '/tmp/' + 'b' * 100)])
+
+    def test_binary(self):
+        chunks = binary(0, 'COMMAND', ['cc', '-c', 'a.c'], frags=2) + binary(1, 'READS', '/tmp/a')
+        self.assertEqual(read(chunks), [(UUID, 'COMMAND', ['cc', '-c', 'a.c']), (UUID, 'READS', '/tmp/a')])
+
+    def test_out_of_order(self):
+        for make in [text, binary]:
+            frags = make(0, 'READS', '/tmp/' + 'a' * 100, frags=3)
+            self.assertEqual(read([frags[1], frags[2], frags[0]]), [(UUID, 'READS', '/tmp/' + 'a' * 100)])
+
+    def test_missing_last(self):
+        ''' The record is not passed on, and counts as lost '''
+        for make in [text, binary]:
+            chunks = make(0, 'READS', '/tmp/' + 'a' * 100, frags=3)[:-1] + make(1, 'WRITES', '/tmp/b')
+            with self.assertLogs(wisktrack.log, logging.WARNING) as logs:
+                self.assertEqual(read(chunks), [(UUID, 'WRITES', '/tmp/b')])
+            self.assertTrue(any('Incomplete record' in i for i in logs.output))
+            self.assertTrue(any('Lost 1 records' in i for i in logs.output))
+
+    def test_seq_gaps(self):
+        chunks = text(0, 'READS', '/tmp/a') + text(3, 'READS', '/tmp/b') + text(1, 'READS', '/tmp/c', pid=101)
+        with self.assertLogs(wisktrack.log, logging.WARNING) as logs:
+            self.assertEqual(len(read(chunks)), 3)
+        self.assertTrue(any('Lost 2 records of %s pid 100' % UUID in i for i in logs.output))
+        self.assertTrue(any('Lost 1 records of %s pid 101' % UUID in i for i in logs.output))
+        self.assertTrue(any('Lost 3 records from 2 processes' in i for i in logs.output))
+
+    def test_garbled(self):
+        ''' Torn or garbled lines are skipped, the records around them still come out '''
+        chunks = text(0, 'READS', '/tmp/a') + [b'mp/b"]\n', b'%s@100.x:0 READS "/tmp/c"\n' % UUID.encode(), b'\n']
+        chunks += text(1, 'READS', '/tmp/d')
+        with self.assertLogs(wisktrack.log, logging.WARNING) as logs:
+            self.assertEqual(read(chunks), [(UUID, 'READS', '/tmp/a'), (UUID, 'READS', '/tmp/d')])
+        self.assertTrue(any('Lost 3 garbled lines' in i for i in logs.output))
+
+    def test_corrupt(self):
+        ''' A record whose json does not decode counts as lost '''
+        chunks = text(0, 'READS', '/tmp/a') + [b'%s@100.1~1:0 READS ["/tmp/b\n' % UUID.encode()] + text(2, 'READS', '/tmp/c')
+        with self.assertLogs(wisktrack.log, logging.WARNING) as logs:
+            self.assertEqual(read(chunks), [(UUID, 'READS', '/tmp/a'), (UUID, 'READS', '/tmp/c')])
+        self.assertTrue(any('corrupt READS record' in i for i in logs.output))
+        self.assertTrue(any('Lost 1 records of %s pid 100' % UUID in i for i in logs.output))
+
+    def test_no_gaps(self):
+        ''' Records of a process counted across formats, in any order '''
+        chunks = binary(1, 'READS', '/tmp/b') + text(0, 'READS', '/tmp/a') + text(2, 'READS', '/tmp/c')
+        with self.assertRaises(AssertionError):
+            with self.assertLogs(wisktrack.log, logging.WARNING):
+                read(chunks)
+
+    def test_mixed(self):
+        ''' Text lines, binary records and unframed lines of an old trace, in one stream '''
+        chunks = text(0, 'READS', '/tmp/a') + binary(1, 'WRITES', '/tmp/' + 'b' * 100, frags=2)
+        chunks += [b'%s PID 42\n' % UUID.encode()]
+        chunks += text(2, 'PROBES', ['/tmp', '+a', '-b'], frags=2) + binary(3, 'COMMAND', ['ls', '-l'])
+        records = read(chunks)
+        self.assertEqual(records, [(UUID, 'READS', '/tmp/a'), (UUID, 'WRITES', '/tmp/' + 'b' * 100),
+                                   (UUID, 'PID', '42\n'), (UUID, 'PROBES', ['/tmp', '+a', '-b']),
+                                   (UUID, 'COMMAND', ['ls', '-l'])])
+
+    def test_calls(self):
+        ''' CALLS comes out tagged with the child and carrying the parent, from either format '''
+        other = 'XXXXXXXX-XXXXXXXX-XXXXXXXX-XXXXXXXX'
+        # A text line is the parent's and carries the child, a binary record the child's and carries the parent
+        self.assertEqual(read(text(0, 'CALLS', other)), [(other, 'CALLS', UUID)])
+        self.assertEqual(read(binary(0, 'CALLS', other)), [(UUID, 'CALLS', other)])
+
+    def test_times(self):
+        times = {}
+        ifile = io.BufferedReader(io.BytesIO(b''.join(text(0, 'READS', '/tmp/a') + binary(1, 'READS', '/tmp/b'))))
+        list(wisktrack.read_raw_records(ifile, times))
+        # Every record carries the ns since the epoch, the first one the epoch too
+        self.assertEqual(times, {(UUID, 100): [EPOCH, 0, 1]})
+
+    def test_times_resync(self):
+        ''' A record that carries the epoch keeps its own time, the epoch comes from whichever made it '''
+        for make in [text, binary]:
+            times = {}
+            resync = wisktrack.WISK_RECORD_RESYNC
+            ifile = io.BufferedReader(io.BytesIO(b''.join(make(5, 'READS', '/tmp/a') + make(resync, 'READS', '/tmp/b'))))
+            list(wisktrack.read_raw_records(ifile, times))
+            self.assertEqual(times, {(UUID, 100): [EPOCH, 5, resync]})
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,117 @@
+'''
+Tests of sampling: the paths an event sample of the library keeps, the same
+ones for a given seed and rate, and the counts the parser scales by the rate.
+'''
+import os
+import sys
+import shutil
+import argparse
+import subprocess
+import unittest
+import logging
+import wisktrack
+
+log=logging.getLogger('tests.test_sample')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+LIBWISKTRACK = os.path.join(WSROOT, 'src/lib64/libwisktrack.so')
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+UUID = 'XXXXXXXX-00000000-00000000-00000001'
+FILES = 200
+
+
+def complete(sample, argv=('cc', '-c', 'a.c')):
+    ''' The data of a COMPLETE with the sample= of wisk_report_commandcomplete() '''
+    return ['100', '100', '1', str(len(argv))] + list(argv) + ['sample=' + sample]
+
+
+class TestSampled(unittest.TestCase):
+    ''' The estimates of ProgramNode.sampled, from the sample= of COMPLETE '''
+
+    def setUp(self):
+        self.progtree, self.wsroot = wisktrack.ProgramNode.progtree, wisktrack.WSROOT
+        wisktrack.ProgramNode.progtree, wisktrack.WSROOT = {}, WSROOT
+        self.node = wisktrack.ProgramNode(UUID)
+
+    def tearDown(self):
+        wisktrack.ProgramNode.progtree, wisktrack.WSROOT = self.progtree, self.wsroot
+
+    def apply(self, operation, data):
+        wisktrack.ProgramNode.apply_operation(self.node, operation, data)
+
+    def test_all(self):
+        self.apply('READS', '/tmp/a')
+        self.apply('COMPLETE', complete('all,1,1,0,0')[:-1])
+        self.assertIsNone(self.node.sampled)
+
+    def test_event(self):
+        for i in range(30):
+            self.apply('READS', '/tmp/r%d' % i)
+        for i in range(5):
+            self.apply('WRITES', '/tmp/w%d' % i)
+        self.apply('COMPLETE', complete('event,0.25,1,35,105'))
+        sampled = self.node.sampled
+        self.assertEqual(sampled['mode'], 'event')
+        self.assertEqual((sampled['rate'], sampled['kept'], sampled['dropped']), (0.25, 35, 105))
+        self.assertEqual(sampled['estimate'], {'READS': 120.0, 'WRITES': 20.0})
+
+    def test_process_selected(self):
+        for i in range(3):
+            self.apply('READS', '/tmp/r%d' % i)
+        self.apply('COMPLETE', complete('process,0.5,1,3,0'))
+        self.assertEqual(self.node.sampled['estimate'], {'READS': 6.0})
+
+    def test_process_left_out(self):
+        ''' A process left out estimates 0 of every sampled operation, not nothing '''
+        self.apply('COMPLETE', complete('process,0.5,0,0,0'))
+        self.assertEqual(self.node.sampled['estimate'], {op: 0.0 for op in wisktrack.WISK_SAMPLE_OPS})
+
+
+@unittest.skipUnless(os.path.exists(LIBWISKTRACK), 'libwisktrack.so is not built')
+class TestSelection(unittest.TestCase):
+    ''' The paths the library keeps under WISK_TRACKER_SAMPLE=event:<rate>:<seed> '''
+
+    def setUp(self):
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        os.makedirs(self.testdir)
+        self.files = [os.path.join(self.testdir, 'f%03d' % i) for i in range(FILES)]
+        for i in self.files:
+            open(i, 'w').close()
+        self.pipe = wisktrack.WISK_TRACKER_PIPE
+
+    def tearDown(self):
+        wisktrack.WISK_TRACKER_PIPE = self.pipe
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+
+    def reads(self, sample):
+        ''' The paths of the test files a cat of all of them reported read '''
+        trackfile = os.path.join(self.testdir, 'trace')
+        wisktrack.create_reciever()
+        args = argparse.Namespace(trackfile=trackfile, transport='fifo', compress=0)
+        reciever = wisktrack.TrackerReciever(args)
+        env = {'PATH': os.environ.get('PATH', '/usr/bin:/bin'), 'LD_PRELOAD': LIBWISKTRACK,
+               'WISK_TRACKER_PIPE': wisktrack.WISK_TRACKER_PIPE, 'WISK_TRACKER_PIPE_FD': '-1',
+               'WISK_TRACKER_UUID': wisktrack.session_uuid(), 'WISK_TRACKER_SAMPLE': sample}
+        env.update(reciever.environment())
+        subprocess.run(['cat'] + self.files, env=env, pass_fds=reciever.pass_fds(), stdout=subprocess.DEVNULL, check=True)
+        wisktrack.delete_reciever(reciever)
+        with wisktrack.open_raw(trackfile + '.raw') as ifile:
+            return {data for _, operation, data, _, _ in wisktrack.read_raw_records(ifile)
+                    if operation == 'READS' and data in self.files}
+
+    def test_all(self):
+        self.assertEqual(self.reads(''), set(self.files))
+
+    def test_seeded(self):
+        ''' The same seed and rate keep the same paths, about rate of them, another seed others '''
+        kept = self.reads('event:0.5:1234')
+        self.assertEqual(self.reads('event:0.5:1234'), kept)
+        self.assertTrue(FILES * 0.3 < len(kept) < FILES * 0.7, len(kept))
+        self.assertNotEqual(self.reads('event:0.5:4321'), kept)
+
+    def test_rate(self):
+        ''' A seeded sample at a lower rate keeps a subset of one at a higher rate '''
+        self.assertLessEqual(self.reads('event:0.25:1234'), self.reads('event:0.75:1234'))
@@ -0,0 +1,88 @@
+'''
+Tests of the spill file merge: spill_complete() and read_spill() finding
+where the whole records of a spill file end, and merge_spill().
+'''
+import os
+import sys
+import shutil
+import unittest
+import logging
+import wisktrack
+
+log=logging.getLogger('tests.test_spill')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+TEXT = b'XXXXXXXX-00000001@100.0~0:0 READS "/tmp/a"\n'
+
+
+def binary(payload, seq=1):
+    return wisktrack.WISK_RECORD_HEADER.pack(wisktrack.WISK_RECORD_MAGIC, wisktrack.WISK_RECORD_VERSION,
+                                             wisktrack.WISK_OPS.index('READS'), 0, len(payload), 100, seq, 0, 0,
+                                             bytes(16), 1) + payload
+
+
+class TestSpillComplete(unittest.TestCase):
+
+    def test_empty(self):
+        self.assertEqual(wisktrack.spill_complete(b''), 0)
+
+    def test_whole(self):
+        data = TEXT + binary(b'/tmp/b\0') + TEXT + binary(b'')
+        self.assertEqual(wisktrack.spill_complete(data), len(data))
+
+    def test_partial_text(self):
+        self.assertEqual(wisktrack.spill_complete(TEXT + TEXT[:-1]), len(TEXT))
+        self.assertEqual(wisktrack.spill_complete(TEXT[:10]), 0)
+
+    def test_partial_header(self):
+        record = binary(b'/tmp/b\0')
+        for cut in [1, wisktrack.WISK_RECORD_HEADER.size - 1]:
+            self.assertEqual(wisktrack.spill_complete(TEXT + record[:cut]), len(TEXT))
+
+    def test_partial_payload(self):
+        record = binary(b'/tmp/b\0')
+        self.assertEqual(wisktrack.spill_complete(TEXT + record[:-1]), len(TEXT))
+        self.assertEqual(wisktrack.spill_complete(record + record[:-3]), len(record))
+
+    def test_newline_in_payload(self):
+        ''' A binary payload is skipped by its length, what it holds does not end it '''
+        record = binary(b'/tmp/a\nb\0')
+        self.assertEqual(wisktrack.spill_complete(record + TEXT), len(record) + len(TEXT))
+
+
+class TestMergeSpill(unittest.TestCase):
+
+    def setUp(self):
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        self.spilldir = os.path.join(self.testdir, 'trace.spill')
+        os.makedirs(self.spilldir)
+
+    def tearDown(self):
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+
+    def test_read_spill(self):
+        filename = os.path.join(self.spilldir, '100.uuid')
+        with open(filename, 'wb') as ofile:
+            ofile.write(TEXT + binary(b'/tmp/b\0')[:-2])
+        with self.assertLogs(wisktrack.log, logging.WARNING):
+            self.assertEqual(wisktrack.read_spill(filename), TEXT)
+
+    def test_merge(self):
+        ''' Files are merged in name order, each cut to its whole records, and removed '''
+        files = {'200.b': TEXT + binary(b'/tmp/2\0', 2), '100.a': binary(b'/tmp/1\0') + TEXT[:5], '300.c': b''}
+        for name, data in files.items():
+            with open(os.path.join(self.spilldir, name), 'wb') as ofile:
+                ofile.write(data)
+        rawfile = os.path.join(self.testdir, 'trace.raw')
+        wisktrack.merge_spill(self.spilldir, rawfile)
+        with open(rawfile, 'rb') as ifile:
+            self.assertEqual(ifile.read(), binary(b'/tmp/1\0') + TEXT + binary(b'/tmp/2\0', 2))
+        self.assertFalse(os.path.exists(self.spilldir))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,268 @@
+'''
+Tests of wiskcollect against synthetic producers: threads writing framed
+records to the FIFO shards in batches of whole fragments, as
+libwisktrack.so does, checked in the raw trace the collector writes, plain
+or block compressed, and in the traces of the sessions of a collector shared
+over its control FIFO.
+'''
+import os
+import re
+import sys
+import time
+import select
+import shutil
+import threading
+import subprocess
+import unittest
+import logging
+import wisktrack
+from test_records import text, binary
+
+log=logging.getLogger('tests.test_wiskcollect')
+WSROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.realpath(__file__)), '../'))
+WISKCOLLECT = os.path.join(WSROOT, 'src/lib64/wiskcollect')
+sys.path.insert(0, os.path.join(WSROOT, 'src/'))
+
+
+def path(pid, seq):
+    return '/tmp/%d/%d%s' % (pid, seq, 'x' * (seq % 200))
+
+
+def fragments(pid, seqs):
+    ''' The fragments of the records seqs of pid, text and binary, some in several fragments '''
+    return [i for seq in seqs for i in (text if seq % 2 else binary)(seq, 'READS', path(pid, seq), pid=pid,
+                                                                      frags=1 + seq % 3)]
+
+
+def batches(chunks):
+    ''' Whole fragments, as many as fit in one atomic write '''
+    batch = b''
+    for i in chunks:
+        if len(batch) + len(i) > select.PIPE_BUF:
+            yield batch
+            batch = b''
+        batch += i
+    if batch:
+        yield batch
+
+
+def produce(pipe, chunks, connections=1):
+    ''' A process writing chunks to pipe, connecting anew for each of connections parts of them '''
+    step = -(-len(chunks) // connections)
+    for i in range(0, len(chunks), step):
+        with open(pipe, 'wb', buffering=0) as ofile:
+            for batch in batches(chunks[i:i+step]):
+                ofile.write(batch)
+
+
+class CollectorTestCase(unittest.TestCase):
+    ''' A directory of its own for the FIFOs and traces, and checks of what the collector wrote '''
+
+    def setUp(self):
+        self.testdir = '/tmp/{}/'.format(self.id())
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+        os.makedirs(self.testdir)
+        self.rawfile = os.path.join(self.testdir, 'trace.raw')
+
+    def tearDown(self):
+        if os.path.exists(self.testdir):
+            shutil.rmtree(self.testdir)
+
+    def fifos(self, name, count):
+        pipes = [os.path.join(self.testdir, '%s.pipe.%d' % (name, i)) for i in range(count)]
+        for i in pipes:
+            os.mkfifo(i)
+        return pipes
+
+    def producers(self, pipes, pids, records, connections=1):
+        ''' Producers of records each for pids, spread across pipes, started '''
+        threads = [threading.Thread(target=produce, args=(pipes[i % len(pipes)], fragments(pid, range(records)),
+                                                          connections))
+                   for i, pid in enumerate(pids)]
+        for i in threads:
+            i.start()
+        return threads
+
+    def read(self, rawfile):
+        ''' The paths of the records in rawfile, by pid, none of them lost or garbled '''
+        paths = {}
+        with self.assertNoLogs(wisktrack.log, logging.WARNING):
+            with wisktrack.open_raw(rawfile) as ifile:
+                for _, operation, data, _, _ in wisktrack.read_raw_records(ifile):
+                    self.assertEqual(operation, 'READS')
+                    paths.setdefault(int(data.split('/')[2]), []).append(data)
+        return paths
+
+    def assertRecords(self, rawfile, pids, records):
+        ''' Every record of every pid is in rawfile, in the order it was written '''
+        self.assertEqual(self.read(rawfile), {pid: [path(pid, i) for i in range(records)] for pid in pids})
+
+
+@unittest.skipUnless(os.path.exists(WISKCOLLECT), 'wiskcollect is not built')
+class TestWiskCollect(CollectorTestCase):
+
+    def collect(self, args, pipes, pids, records, connections=1):
+        ''' Runs wiskcollect over producers of pids until they are done, returns what it reported '''
+        collector = subprocess.Popen([WISKCOLLECT] + args + pipes, stdin=subprocess.PIPE, stderr=subprocess.PIPE)
+        for i in self.producers(pipes, pids, records, connections):
+            i.join()
+        # Closing its stdin tells the collector the command is done
+        _, stderr = collector.communicate(timeout=60)
+        self.assertEqual(collector.returncode, 0, stderr)
+        return stderr.decode()
+
+    def test_framing(self):
+        ''' Batches of many writers across shards and reconnects come out whole, and are counted '''
+        pipes = self.fifos('trace', 2)
+        pids = range(100, 106)
+        stderr = self.collect(['-o', self.rawfile], pipes, pids, 300, connections=3)
+        self.assertRecords(self.rawfile, pids, 300)
+        written = sum(len(fragments(pid, range(300))) for pid in pids)
+        nbytes = sum(len(i) for pid in pids for i in fragments(pid, range(300)))
+        self.assertEqual(os.path.getsize(self.rawfile), nbytes)
+        self.assertIn('wiskcollect: %d records, %d bytes' % (written, nbytes), stderr)
+        shards = re.findall(r'\.pipe\.\d: (\d+) records, (\d+) bytes, (\d+) writer sessions', stderr)
+        self.assertEqual(sum(int(i[0]) for i in shards), written)
+        # The 3 producers of a shard connected 3 times each, some of them at once
+        self.assertTrue(all(1 <= int(i[2]) <= 9 for i in shards), shards)
+
+    def test_blocks(self):
+        ''' -z writes blocks of WISK_BLOCK_SIZE and their index, the reader takes them as they are '''
+        pipes = self.fifos('trace', 2)
+        pids = range(100, 104)
+        self.collect(['-z', '6', '-o', self.rawfile], pipes, pids, 4000)
+        reader = wisktrack.RawBlockReader(self.rawfile)
+        blocks = reader.blocks
+        reader.close()
+        self.assertGreater(len(blocks), 1)
+        self.assertTrue(all(i[2] == 1 << 20 for i in blocks[:-1]), blocks)
+        with open(self.rawfile, 'rb') as ifile:
+            ifile.seek(-wisktrack.WISK_RAWBLOCK_TRAILER.size, os.SEEK_END)
+            self.assertEqual(ifile.read(len(wisktrack.WISK_RAWINDEX_MAGIC)), wisktrack.WISK_RAWINDEX_MAGIC)
+        self.assertRecords(self.rawfile, pids, 4000)
+
+    def test_overflow(self):
+        ''' What a process wrote to its overflow file follows what the FIFO took, the files go '''
+        pipes = self.fifos('trace', 1)
+        overflow = os.path.join(self.testdir, 'trace.overflow')
+        os.makedirs(overflow)
+        pids = [100, 101]
+        for pid in pids:
+            with open(os.path.join(overflow, '%d.%s' % (pid, 'X' * 35)), 'wb') as ofile:
+                ofile.write(b''.join(fragments(pid, range(50, 100))))
+        collector = subprocess.Popen([WISKCOLLECT, '-O', overflow, '-o', self.rawfile] + pipes,
+                                     stdin=subprocess.PIPE, stderr=subprocess.PIPE)
+        for pid in pids:
+            produce(pipes[0], fragments(pid, range(50)))
+        _, stderr = collector.communicate(timeout=60)
+        self.assertEqual(collector.returncode, 0, stderr)
+        self.assertRecords(self.rawfile, pids, 100)
+        self.assertFalse(os.path.exists(overflow))
+        self.assertIn(b'%s: %d records' % (overflow.encode(), sum(len(fragments(i, range(50, 100))) for i in pids)),
+                      stderr)
+
+
+@unittest.skipUnless(os.path.exists(WISKCOLLECT), 'wiskcollect is not built')
+class TestSharedCollector(CollectorTestCase):
+    ''' Sessions of a wiskcollect -s, opened, fed and closed over its control FIFO '''
+
+    def setUp(self):
+        super().setUp()
+        self.control = os.path.join(self.testdir, 'control')
+        os.mkfifo(self.control, 0o600)
+        self.collector = subprocess.Popen([WISKCOLLECT, '-s', self.control], stdin=subprocess.PIPE,
+                                          stderr=subprocess.PIPE)
+
+    def tearDown(self):
+        if self.collector.returncode is None:
+            self.collector.kill()
+            self.collector.communicate()
+        super().tearDown()
+
+    def request(self, *request):
+        ''' A control request, in a single write, once the collector reads the FIFO '''
+        for _ in range(1000):
+            try:
+                fd = os.open(self.control, os.O_WRONLY|os.O_NONBLOCK)
+                break
+            except OSError:
+                time.sleep(0.01)
+        else:
+            self.fail('wiskcollect never opened %s' % self.control)
+        try:
+            os.write(fd, ('\t'.join(request) + '\n').encode())
+        finally:
+            os.close(fd)
+
+    def session(self, name, level, rawfile, pipes):
+        ''' Opens session name, returns its status FIFO and the collector's answer '''
+        statuspath = os.path.join(self.testdir, name + '.status')
+        os.mkfifo(statuspath)
+        status = os.open(statuspath, os.O_RDONLY|os.O_NONBLOCK)
+        self.request('open', name, '%d' % level, rawfile, statuspath, *pipes)
+        readable, _, _ = select.select([status], [], [], 10)
+        return status, os.read(status, 4096).decode() if readable else None
+
+    def close(self, name, status):
+        ''' Closes session name, returns once the collector is done with its trace '''
+        self.request('close', name)
+        while True:
+            readable, _, _ = select.select([status], [], [], 30)
+            self.assertTrue(readable, 'session %s never completed' % name)
+            if not os.read(status, 4096):
+                break
+        os.close(status)
+
+    def test_sessions(self):
+        ''' Sessions at once, one block compressed, one with overflow, each trace only its own records '''
+        sessions = {'a': (6, range(100, 103), self.fifos('a', 2)), 'b': (-1, range(200, 203), self.fifos('b', 1))}
+        overflow = os.path.join(self.testdir, 'b.overflow')
+        os.makedirs(overflow)
+        with open(os.path.join(overflow, '200.%s' % ('X' * 35)), 'wb') as ofile:
+            ofile.write(b''.join(fragments(200, range(300, 400))))
+        statuses, threads = {}, []
+        for name, (level, pids, pipes) in sessions.items():
+            statuses[name], reply = self.session(name, level, os.path.join(self.testdir, name + '.raw'), pipes)
+            self.assertEqual(reply, 'ok\n')
+        self.request('overflow', 'b', overflow)
+        for name, (level, pids, pipes) in sessions.items():
+            threads += self.producers(pipes, pids, 300, connections=2)
+        for i in threads:
+            i.join()
+        for name in sessions:
+            self.close(name, statuses[name])
+        with open(os.path.join(self.testdir, 'a.raw'), 'rb') as ifile:
+            self.assertEqual(ifile.read(len(wisktrack.WISK_RAWBLOCK_MAGIC)), wisktrack.WISK_RAWBLOCK_MAGIC)
+        self.assertRecords(os.path.join(self.testdir, 'a.raw'), range(100, 103), 300)
+        paths = self.read(os.path.join(self.testdir, 'b.raw'))
+        self.assertEqual(paths.pop(200), [path(200, i) for i in range(400)])
+        self.assertEqual(paths, {pid: [path(pid, i) for i in range(300)] for pid in range(201, 203)})
+        self.assertFalse(os.path.exists(overflow))
+        # Closing its stdin stops the collector, no sessions are left
+        _, stderr = self.collector.communicate(timeout=60)
+        self.assertEqual(self.collector.returncode, 0, stderr)
+
+    def test_existing_trace(self):
+        ''' The trace of a session is never one already there, the session is refused and the file left alone '''
+        rawfile = os.path.join(self.testdir, 'c.raw')
+        with open(rawfile, 'w') as ofile:
+            ofile.write('earlier run\n')
+        status, reply = self.session('c', -1, rawfile, self.fifos('c', 1))
+        self.assertEqual(reply, 'error %s: File exists\n' % rawfile)
+        os.close(status)
+        with open(rawfile) as ifile:
+            self.assertEqual(ifile.read(), 'earlier run\n')
+        # The refused session is gone, a new one of that name can be opened
+        os.unlink(rawfile)
+        os.unlink(os.path.join(self.testdir, 'c.status'))
+        status, reply = self.session('c', -1, rawfile, self.fifos('d', 1))
+        self.assertEqual(reply, 'ok\n')
+        self.close('c', status)
+        self.assertEqual(self.read(rawfile), {})
+        _, stderr = self.collector.communicate(timeout=60)
+        self.assertEqual(self.collector.returncode, 0, stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -27,11 +27,13 @@ tee2log program_uut.log
 # LD_LIBRARY_PATH="$WORKSPACE_DIR/src/lib64:$WORKSPACE_DIR/src/lib"
 LD_LIBRARY_PATH="$WORKSPACE_DIR/src/lib32:$WORKSPACE_DIR/src/lib64"
 LD_PRELOAD="libwisktrack.so"
-WISK_TRACKER_PIPE="/tmp/wisk_tracker.pipe"
-WISK_TRACKER_UUID="XXXXXXXX-XXXXXXXX-XXXXXXXX"
+# A session of its own, so runs on the same host do not share the pipe
+WISK_SESSION="$(od -An -N4 -tx4 /dev/urandom | tr -d ' ')"
+WISK_TRACKER_PIPE="/tmp/wisk_tracker.$WISK_SESSION.pipe"
+WISK_TRACKER_UUID="$WISK_SESSION-XXXXXXXX-XXXXXXXX-XXXXXXXX"
 
 echo "Command: $*"
-rm -f $WISK_TRACKER_PIPE
 mkfifo $WISK_TRACKER_PIPE
+trap 'rm -f $WISK_TRACKER_PIPE' EXIT
 LD_PRELOAD="$LD_PRELOAD" WISK_TRACKER_PIPE="$WISK_TRACKER_PIPE" WISK_TRACKER_UUID="$WISK_TRACKER_UUID=" $*
 